@@ -127,7 +127,8 @@ static void runCursor(RedisModuleCtx *outputCtx, Cursor *cursor, size_t num) {
   if (req->plan->outputFlags & QP_OUTPUT_FLAG_DONE) {
     goto delcursor;
   } else {
-    // Update the idle timeout
+    // Update the idle timeout, and don't hold an epoch while idle
+    QueryPlan_Pause(req->plan);
     Cursor_Pause(cursor);
     return;
   }
@@ -149,9 +150,7 @@ static void cursorRead(RedisModuleCtx *ctx, uint64_t cid, size_t count) {
     return;
   }
   AggregateRequest *req = cursor->execState;
-  if (req->plan->conc) {
-    ConcurrentSearchCtx_ReopenKeys(req->plan->conc);
-  }
+  QueryPlan_Resume(req->plan);
   runCursor(ctx, cursor, count);
 }
 
@@ -266,7 +266,13 @@ AggregateStep *newGroupStep(int idx, CmdArg *grp, char **err) {
       .properties = keys,
       .reducers = arr,
       .idx = idx,  // FIXME: Global counter
+      .phase = Reducer_Complete,
   };
+  if (CmdArg_GetFlag(grp, "PARTIAL")) {
+    ret->group.phase = Reducer_Partial;
+  } else if (CmdArg_GetFlag(grp, "FINAL")) {
+    ret->group.phase = Reducer_Final;
+  }
   // Add reducers
   CMD_FOREACH_SELECT(grp, "REDUCE", {
     AggregateGroupReduce agr;
@@ -576,6 +582,11 @@ void serializeGroup(AggregateGroupStep *g, char ***v) {
   for (int i = 0; i < g->properties->len; i++) {
     arrPushStrfmt(v, "@%s", g->properties->keys[i].key);
   }
+  if (g->phase == Reducer_Partial) {
+    arrPushStrdup(v, "PARTIAL");
+  } else if (g->phase == Reducer_Final) {
+    arrPushStrdup(v, "FINAL");
+  }
   for (int i = 0; i < AggregateGroupStep_NumReducers(g); i++) {
     arrPushStrdup(v, "REDUCE");
     arrPushStrdup(v, g->reducers[i].reducer);
@@ -720,6 +731,77 @@ AggregateStep *AggregatePlan_MoveStep(AggregatePlan *src, AggregatePlan *dist,
   return next;
 }
 
+/* Copy a group step to run in the final phase, over the partial states of the original */
+static AggregateStep *newFinalGroupStep(AggregateGroupStep *g) {
+  AggregateStep *ret = AggregatePlan_NewStep(AggregateStep_Group);
+  ret->group = (AggregateGroupStep){
+      .properties = RSMultiKey_Copy(g->properties, 1),
+      .reducers = array_new(AggregateGroupReduce, AggregateGroupStep_NumReducers(g)),
+      .idx = g->idx,
+      .phase = Reducer_Final,
+  };
+  for (int i = 0; i < AggregateGroupStep_NumReducers(g); i++) {
+    AggregateGroupReduce gr = g->reducers[i];
+    // the final reducer keeps the arguments - a quantile still needs its percentile
+    gr.args = NULL;
+    if (g->reducers[i].args) {
+      gr.args = array_newlen(RSValue *, array_len(g->reducers[i].args));
+      for (int j = 0; j < array_len(g->reducers[i].args); j++) {
+        gr.args[j] = RSValue_IncrRef(g->reducers[i].args[j]);
+      }
+    }
+    gr.alias = strdup(gr.alias);
+    ret->group.reducers = array_append(ret->group.reducers, gr);
+  }
+  return ret;
+}
+
+int AggregatePlan_MakeDistributed(AggregatePlan *plan, char **err) {
+  // find the first group step, and make sure everything before it can run on each shard
+  AggregateStep *grp = plan->head;
+  for (; grp; grp = grp->next) {
+    if (grp->type == AggregateStep_Group) break;
+    if (grp->type == AggregateStep_Limit || grp->type == AggregateStep_Sort ||
+        grp->type == AggregateStep_Distribute) {
+      SET_ERR(err, "Can't distribute a plan that sorts or limits before grouping");
+      return 0;
+    }
+  }
+  if (!grp) {
+    SET_ERR(err, "Can't distribute a plan without GROUPBY");
+    return 0;
+  }
+  for (int i = 0; i < AggregateGroupStep_NumReducers(&grp->group); i++) {
+    AggregateGroupReduce *gr = &grp->group.reducers[i];
+    if (!IsReducerMergeable(gr->reducer, gr->args, array_len(gr->args))) {
+      FMT_ERR(err, "Reducer '%s' can not be distributed", gr->reducer);
+      return 0;
+    }
+  }
+
+  AggregatePlan *sub = malloc(sizeof(*sub));
+  AggregatePlan_Init(sub);
+  sub->index = plan->index;
+  sub->verbatim = plan->verbatim;
+
+  AggregateStep *fin = newFinalGroupStep(&grp->group);
+  grp->group.phase = Reducer_Partial;
+
+  // move the steps up to and including the group to the sub plan
+  AggregateStep *current = plan->head->next;
+  for (;;) {
+    AggregateStep *next = AggregatePlan_MoveStep(plan, sub, current);
+    if (current == grp) break;
+    current = next;
+  }
+
+  AggregateStep *dist = AggregatePlan_NewStep(AggregateStep_Distribute);
+  dist->dist.plan = sub;
+  AggregateStep_AddAfter(plan->head, fin);
+  AggregateStep_AddAfter(plan->head, dist);
+  return 1;
+}
+
 void AggregatePlan_FPrint(AggregatePlan *plan, FILE *out) {
   char **args = AggregatePlan_Serialize(plan);
   for (int i = 0; i < array_len(args); i++) {
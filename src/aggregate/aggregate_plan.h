@@ -3,6 +3,7 @@
 #include <value.h>
 #include <search_options.h>
 #include <aggregate/expr/expression.h>
+#include <aggregate/reducer.h>
 
 /* A structure representing an aggregation execution plan and all its various steps.
  * This is used to safely manipulate and validate plans */
@@ -32,6 +33,8 @@ typedef struct {
   RSMultiKey *properties;
   AggregateGroupReduce *reducers;
   int idx;
+  // the phase all the reducers run in, if the step is split by AggregatePlan_MakeDistributed
+  ReducerPhase phase;
 } AggregateGroupStep;
 
 /* Apply step - evaluate an expression per record */
@@ -133,6 +136,13 @@ typedef struct AggregatePlan {
  * length can be extracted with array_len */
 char **AggregatePlan_Serialize(AggregatePlan *plan);
 
+/* Split the plan into a sub plan each shard runs and the rest, run on the merged shard results.
+ * The steps up to the first GROUPBY move into a distribute step, and the GROUPBY itself is split:
+ * the shards reply with partial reducer states, which the plan merges with a final GROUPBY before
+ * its remaining steps. Returns 0 and leaves the plan untouched if it has no GROUPBY, if a LIMIT
+ * or SORTBY comes before it, or if one of its reducers can't be merged */
+int AggregatePlan_MakeDistributed(AggregatePlan *plan, char **err);
+
 /* Build the plan from the parsed command args. Sets the error and return 0 if there's a failure */
 int AggregatePlan_Build(AggregatePlan *plan, CmdArg *cmd, char **err);
 
@@ -76,6 +76,10 @@ void Aggregate_BuildSchema() {
   CmdSchema_AddPostional(grp, "BY",
                          CmdSchema_Validate(CmdSchema_NewVector('s'), validatePropertyVector, NULL),
                          CmdSchema_Required);
+  CmdSchema_AddFlagWithHelp(grp, "PARTIAL",
+                            "Reply with the reducers' partial states, to be merged by a FINAL "
+                            "GROUPBY");
+  CmdSchema_AddFlagWithHelp(grp, "FINAL", "Merge the reducers' partial states into their results");
 
   CmdSchemaNode *red =
       CmdSchema_AddSubSchema(grp, "REDUCE", CmdSchema_Optional | CmdSchema_Repeating, NULL);
@@ -135,6 +139,10 @@ ResultProcessor *buildGroupBy(AggregateGroupStep *grp, RedisSearchCtx *sctx,
       goto fail;
     }
     Grouper_AddReducer(g, r);
+    if (!Reducer_SetPhase(r, grp->phase)) {
+      FMT_ERR(err, "Reducer '%s' can not be split into partial and final phases", red.reducer);
+      goto fail;
+    }
   });
 
   return NewGrouperProcessor(g, upstream);
@@ -179,7 +187,7 @@ ResultProcessor *buildLoader(ResultProcessor *upstream, RedisSearchCtx *ctx,
     rf->explicitReturn = 1;
   }
 
-  return NewLoader(upstream, ctx, &ls->fl);
+  return NewLoader(upstream, ctx, &ls->fl, 0);
 }
 
 ResultProcessor *AggregatePlan_BuildProcessorChain(AggregatePlan *plan, RedisSearchCtx *sctx,
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <strings.h>
 #include "expression.h"
 #include "result_processor.h"
 #include "util/arr.h"
@@ -192,6 +193,26 @@ static inline int evalFunc(RSExprEvalCtx *ctx, RSFunctionExpr *f, RSValue *resul
   return rc;
 }
 
+/* Apply an arithmetic operator to two numbers */
+static inline double exprArith(unsigned char op, double n1, double n2) {
+  switch (op) {
+    case '+':
+      return n1 + n2;
+    case '/':
+      return n1 / n2;
+    case '-':
+      return n1 - n2;
+    case '*':
+      return n1 * n2;
+    case '%':
+      return (long long)n1 % (long long)n2;
+    case '^':
+      return pow(n1, n2);
+    default:
+      return NAN;
+  }
+}
+
 static int evalOp(RSExprEvalCtx *ctx, RSExprOp *op, RSValue *result, char **err) {
 
   RSValue l = RSVALUE_STATIC, r = RSVALUE_STATIC;
@@ -211,31 +232,7 @@ static int evalOp(RSExprEvalCtx *ctx, RSExprOp *op, RSValue *result, char **err)
     goto cleanup;
   }
 
-  double res;
-  switch (op->op) {
-    case '+':
-      res = n1 + n2;
-      break;
-    case '/':
-      res = n1 / n2;
-      break;
-    case '-':
-      res = n1 - n2;
-      break;
-    case '*':
-      res = n1 * n2;
-      break;
-    case '%':
-      res = (long long)n1 % (long long)n2;
-      break;
-    case '^':
-      res = pow(n1, n2);
-      break;
-    default:
-      res = NAN;
-  }
-
-  result->numval = res;
+  result->numval = exprArith(op->op, n1, n2);
   result->t = RSValue_Number;
 
 cleanup:
@@ -244,68 +241,55 @@ cleanup:
   return rc;
 }
 
-static int evalPredicate(RSExprEvalCtx *ctx, RSPredicate *pred, RSValue *result, char **err) {
-
-  RSValue l = RSVALUE_STATIC, r = RSVALUE_STATIC;
-  if (RSExpr_Eval(ctx, pred->left, &l, err) == EXPR_EVAL_ERR) {
-    return EXPR_EVAL_ERR;
-  }
-  if (pred->right && RSExpr_Eval(ctx, pred->right, &r, err) == EXPR_EVAL_ERR) {
-    return EXPR_EVAL_ERR;
-  }
-
-  RSValue* l_ptr = RSValue_Dereference(&l);
-  RSValue* r_ptr = RSValue_Dereference(&r);
+/* Test a condition on two evaluated values. r is a static empty value for NOT */
+static int exprTestPredicate(RSCondition cond, RSValue *l, RSValue *r) {
+  RSValue *l_ptr = RSValue_Dereference(l);
+  RSValue *r_ptr = RSValue_Dereference(r);
 
-  int res;
-  if(l_ptr->t == RSValue_Null || r_ptr->t == RSValue_Null){
+  if (l_ptr->t == RSValue_Null || r_ptr->t == RSValue_Null) {
     // NULL are not comparable
-    res = 0;
-  }else switch (pred->cond) {
+    return 0;
+  }
+  switch (cond) {
     case RSCondition_Eq:
-      res = RSValue_Equal(&l, &r);
-      break;
+      return RSValue_Equal(l, r);
     case RSCondition_Lt:
-      res = RSValue_Cmp(&l, &r) < 0;
-      break;
+      return RSValue_Cmp(l, r) < 0;
     /* Less than or equal, <= */
     case RSCondition_Le:
-      res = RSValue_Cmp(&l, &r) <= 0;
-
-      break;
-      /* Greater than, > */
+      return RSValue_Cmp(l, r) <= 0;
+    /* Greater than, > */
     case RSCondition_Gt:
-      res = RSValue_Cmp(&l, &r) > 0;
-
-      break;
-
+      return RSValue_Cmp(l, r) > 0;
     /* Greater than or equal, >= */
     case RSCondition_Ge:
-      res = RSValue_Cmp(&l, &r) >= 0;
-
-      break;
-
+      return RSValue_Cmp(l, r) >= 0;
     /* Not equal, != */
     case RSCondition_Ne:
-      res = !RSValue_Equal(&l, &r);
-      break;
-      /* Logical AND of 2 expressions, && */
+      return !RSValue_Equal(l, r);
+    /* Logical AND of 2 expressions, && */
     case RSCondition_And:
-      res = RSValue_BoolTest(&l) && RSValue_BoolTest(&r);
-      break;
-
+      return RSValue_BoolTest(l) && RSValue_BoolTest(r);
     /* Logical OR of 2 expressions, || */
     case RSCondition_Or:
-      res = RSValue_BoolTest(&l) || RSValue_BoolTest(&r);
+      return RSValue_BoolTest(l) || RSValue_BoolTest(r);
+    case RSCondition_Not:
+      return RSValue_BoolTest(l) == 0;
+  }
+  return 0;
+}
 
-      break;
+static int evalPredicate(RSExprEvalCtx *ctx, RSPredicate *pred, RSValue *result, char **err) {
 
-    case RSCondition_Not:
-      res = RSValue_BoolTest(&l) == 0;
-      break;
+  RSValue l = RSVALUE_STATIC, r = RSVALUE_STATIC;
+  if (RSExpr_Eval(ctx, pred->left, &l, err) == EXPR_EVAL_ERR) {
+    return EXPR_EVAL_ERR;
+  }
+  if (pred->right && RSExpr_Eval(ctx, pred->right, &r, err) == EXPR_EVAL_ERR) {
+    return EXPR_EVAL_ERR;
   }
 
-  result->numval = res;
+  result->numval = exprTestPredicate(pred->cond, &l, &r);
   result->t = RSValue_Number;
 
   RSValue_Free(&l);
@@ -372,6 +356,26 @@ const char **Expr_GetRequiredFields(RSExpr *expr) {
   return ret;
 }
 
+/* Returns 1 if the expression reads the index result of the search result, and not just its
+ * fields */
+int Expr_ReadsIndexResult(RSExpr *expr) {
+  if (!expr) return 0;
+  switch (expr->t) {
+    case RSExpr_Function:
+      if (!strcasecmp(expr->func.name, "matched_terms")) return 1;
+      for (size_t i = 0; expr->func.args && i < expr->func.args->len; i++) {
+        if (Expr_ReadsIndexResult(expr->func.args->args[i])) return 1;
+      }
+      return 0;
+    case RSExpr_Op:
+      return Expr_ReadsIndexResult(expr->op.left) || Expr_ReadsIndexResult(expr->op.right);
+    case RSExpr_Predicate:
+      return Expr_ReadsIndexResult(expr->pred.left) || Expr_ReadsIndexResult(expr->pred.right);
+    default:
+      return 0;
+  }
+}
+
 /* Get the return type of an expression. In the case of a property we do not try to guess but
  * rather just return String */
 RSValueType GetExprType(RSExpr *expr, RSSortingTable *tbl) {
@@ -393,3 +397,336 @@ RSValueType GetExprType(RSExpr *expr, RSSortingTable *tbl) {
     }
   }
 }
+
+/*******************************************************************************************************************
+ *  Compiled expressions
+ *
+ * An expression is compiled once per query into a flat list of instructions over two register
+ * files - one of unboxed numbers and one of values. Arithmetic and predicates on numbers never box
+ * their operands, constant numeric subexpressions are folded, and property keys are resolved
+ * against the sorting table when compiling. Everything else evaluates exactly like RSExpr_Eval.
+ ********************************************************************************************************************/
+
+typedef enum {
+  // n[dst] = num
+  ExprOp_NumConst,
+  // n[dst] = the number value of the property key, or fail
+  ExprOp_NumProp,
+  // n[dst] = the number value of v[a], or fail
+  ExprOp_NumVal,
+  // n[dst] = n[a] op n[b]
+  ExprOp_NumArith,
+  // n[dst] = n[a] cond n[b]. b is unused for NOT
+  ExprOp_NumPred,
+  // n[dst] = v[a] cond v[b]. b is an empty register for NOT
+  ExprOp_ValPred,
+  // v[dst] = a reference to val
+  ExprOp_ValConst,
+  // v[dst] = a reference to the property key
+  ExprOp_ValProp,
+  // v[dst] = n[a]
+  ExprOp_ValNum,
+  // v[dst] = func(v[a] ... v[a + argc - 1])
+  ExprOp_ValCall,
+} ExprOpcode;
+
+typedef struct {
+  ExprOpcode code;
+  // the arithmetic operator or the condition
+  unsigned char op;
+  uint16_t dst;
+  uint16_t a;
+  uint16_t b;
+  union {
+    double num;
+    RSValue *val;
+    RSKey *key;
+    RSFunctionExpr *func;
+  };
+} ExprInstr;
+
+struct RSExprProgram {
+  ExprInstr *code;
+  double *nums;
+  RSValue *vals;
+  uint16_t numNums;
+  uint16_t numVals;
+  // the register holding the result, and whether it is a number register
+  uint16_t res;
+  int resIsNum;
+};
+
+/* Returns 1 if the expression always evaluates to a number */
+static int exprIsNumeric(RSExpr *e) {
+  switch (e->t) {
+    case RSExpr_Op:
+    case RSExpr_Predicate:
+      return 1;
+    case RSExpr_Literal:
+      return e->literal.t == RSValue_Number;
+    default:
+      return 0;
+  }
+}
+
+/* Returns 1 if a predicate can be tested on unboxed numbers */
+static int exprIsNumericPredicate(RSPredicate *pred) {
+  return exprIsNumeric(pred->left) && (!pred->right || exprIsNumeric(pred->right));
+}
+
+/* Test a condition on two numbers, the same way exprTestPredicate does on number values */
+static inline int exprTestNumPredicate(RSCondition cond, double l, double r) {
+  int cmp = l > r ? 1 : (l < r ? -1 : 0);
+  switch (cond) {
+    case RSCondition_Eq:
+      return cmp == 0;
+    case RSCondition_Lt:
+      return cmp < 0;
+    case RSCondition_Le:
+      return cmp <= 0;
+    case RSCondition_Gt:
+      return cmp > 0;
+    case RSCondition_Ge:
+      return cmp >= 0;
+    case RSCondition_Ne:
+      return cmp != 0;
+    case RSCondition_And:
+      return l != 0 && r != 0;
+    case RSCondition_Or:
+      return l != 0 || r != 0;
+    case RSCondition_Not:
+      return l == 0;
+  }
+  return 0;
+}
+
+/* Returns 1 and puts the value in d if the expression is a constant number */
+static int exprFoldNum(RSExpr *e, double *d) {
+  double l, r = 0;
+  switch (e->t) {
+    case RSExpr_Literal:
+      if (e->literal.t != RSValue_Number) return 0;
+      *d = e->literal.numval;
+      return 1;
+    case RSExpr_Op:
+      if (!exprFoldNum(e->op.left, &l) || !exprFoldNum(e->op.right, &r)) return 0;
+      *d = exprArith(e->op.op, l, r);
+      return 1;
+    case RSExpr_Predicate:
+      if (!exprIsNumericPredicate(&e->pred) || !exprFoldNum(e->pred.left, &l) ||
+          (e->pred.right && !exprFoldNum(e->pred.right, &r))) {
+        return 0;
+      }
+      *d = exprTestNumPredicate(e->pred.cond, l, r);
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void exprEmit(RSExprProgram *p, ExprInstr ins) {
+  p->code = array_append(p->code, ins);
+}
+
+static uint16_t exprNewNum(RSExprProgram *p) {
+  return p->numNums++;
+}
+
+static uint16_t exprNewVal(RSExprProgram *p) {
+  return p->numVals++;
+}
+
+/* Resolve a property key against the sorting table now, rather than on the first result */
+static RSKey *exprResolveKey(RSKey *k, RSSortingTable *tbl) {
+  if (tbl && k->sortableIdx == RSKEY_UNCACHED) {
+    k->sortableIdx = RSSortingTable_GetFieldIdx(tbl, RSKEY(k->key));
+  }
+  return k;
+}
+
+static void exprCompileVal(RSExprProgram *p, RSExpr *e, uint16_t dst, RSSortingTable *tbl);
+
+/* Compile an expression whose value is needed as a number into n[dst] */
+static void exprCompileNum(RSExprProgram *p, RSExpr *e, uint16_t dst, RSSortingTable *tbl) {
+  double d;
+  if (exprFoldNum(e, &d)) {
+    exprEmit(p, (ExprInstr){.code = ExprOp_NumConst, .dst = dst, .num = d});
+    return;
+  }
+
+  uint16_t a, b = 0;
+  switch (e->t) {
+    case RSExpr_Op:
+      a = exprNewNum(p);
+      b = exprNewNum(p);
+      exprCompileNum(p, e->op.left, a, tbl);
+      exprCompileNum(p, e->op.right, b, tbl);
+      exprEmit(p, (ExprInstr){.code = ExprOp_NumArith, .op = e->op.op, .dst = dst, .a = a, .b = b});
+      return;
+
+    case RSExpr_Predicate:
+      if (exprIsNumericPredicate(&e->pred)) {
+        a = exprNewNum(p);
+        exprCompileNum(p, e->pred.left, a, tbl);
+        if (e->pred.right) {
+          b = exprNewNum(p);
+          exprCompileNum(p, e->pred.right, b, tbl);
+        }
+        exprEmit(p, (ExprInstr){
+                        .code = ExprOp_NumPred, .op = e->pred.cond, .dst = dst, .a = a, .b = b});
+      } else {
+        // the right register of NOT is left empty
+        a = exprNewVal(p);
+        b = exprNewVal(p);
+        exprCompileVal(p, e->pred.left, a, tbl);
+        if (e->pred.right) {
+          exprCompileVal(p, e->pred.right, b, tbl);
+        }
+        exprEmit(p, (ExprInstr){
+                        .code = ExprOp_ValPred, .op = e->pred.cond, .dst = dst, .a = a, .b = b});
+      }
+      return;
+
+    case RSExpr_Property:
+      exprEmit(p, (ExprInstr){.code = ExprOp_NumProp,
+                              .dst = dst,
+                              .key = exprResolveKey(&e->property, tbl)});
+      return;
+
+    default:
+      a = exprNewVal(p);
+      exprCompileVal(p, e, a, tbl);
+      exprEmit(p, (ExprInstr){.code = ExprOp_NumVal, .dst = dst, .a = a});
+      return;
+  }
+}
+
+/* Compile an expression whose value is needed as a value into v[dst] */
+static void exprCompileVal(RSExprProgram *p, RSExpr *e, uint16_t dst, RSSortingTable *tbl) {
+  uint16_t a;
+  switch (e->t) {
+    case RSExpr_Literal:
+      exprEmit(p, (ExprInstr){.code = ExprOp_ValConst, .dst = dst, .val = &e->literal});
+      return;
+
+    case RSExpr_Property:
+      exprEmit(p, (ExprInstr){.code = ExprOp_ValProp,
+                              .dst = dst,
+                              .key = exprResolveKey(&e->property, tbl)});
+      return;
+
+    case RSExpr_Function: {
+      // the arguments are passed in consecutive registers
+      size_t argc = e->func.args ? e->func.args->len : 0;
+      a = p->numVals;
+      p->numVals += argc;
+      for (size_t i = 0; i < argc; i++) {
+        exprCompileVal(p, e->func.args->args[i], a + i, tbl);
+      }
+      exprEmit(p, (ExprInstr){.code = ExprOp_ValCall, .dst = dst, .a = a, .func = &e->func});
+      return;
+    }
+
+    default:
+      // arithmetic and predicates are evaluated unboxed, and boxed once
+      a = exprNewNum(p);
+      exprCompileNum(p, e, a, tbl);
+      exprEmit(p, (ExprInstr){.code = ExprOp_ValNum, .dst = dst, .a = a});
+      return;
+  }
+}
+
+RSExprProgram *RSExprProgram_Compile(RSExpr *e, RSSortingTable *tbl) {
+  RSExprProgram *p = calloc(1, sizeof(*p));
+  p->code = array_new(ExprInstr, 8);
+  p->resIsNum = exprIsNumeric(e);
+  if (p->resIsNum) {
+    p->res = exprNewNum(p);
+    exprCompileNum(p, e, p->res, tbl);
+  } else {
+    p->res = exprNewVal(p);
+    exprCompileVal(p, e, p->res, tbl);
+  }
+
+  p->nums = calloc(p->numNums, sizeof(*p->nums));
+  p->vals = malloc(p->numVals * sizeof(*p->vals));
+  for (size_t i = 0; i < p->numVals; i++) {
+    p->vals[i] = RSVALUE_STATIC;
+  }
+  return p;
+}
+
+int RSExprProgram_Eval(RSExprProgram *p, RSExprEvalCtx *ctx, RSValue *result, char **err) {
+  double *n = p->nums;
+  RSValue *v = p->vals;
+  int rc = EXPR_EVAL_OK;
+
+  for (size_t i = 0; i < array_len(p->code) && rc == EXPR_EVAL_OK; i++) {
+    const ExprInstr *ins = &p->code[i];
+    switch (ins->code) {
+      case ExprOp_NumConst:
+        n[ins->dst] = ins->num;
+        break;
+      case ExprOp_NumProp:
+        if (!RSValue_ToNumber(SearchResult_GetValue(ctx->r, ctx->sortables, ins->key),
+                              &n[ins->dst])) {
+          rc = EXPR_EVAL_ERR;
+        }
+        break;
+      case ExprOp_NumVal:
+        if (!RSValue_ToNumber(&v[ins->a], &n[ins->dst])) {
+          rc = EXPR_EVAL_ERR;
+        }
+        break;
+      case ExprOp_NumArith:
+        n[ins->dst] = exprArith(ins->op, n[ins->a], n[ins->b]);
+        break;
+      case ExprOp_NumPred:
+        n[ins->dst] = exprTestNumPredicate(ins->op, n[ins->a], n[ins->b]);
+        break;
+      case ExprOp_ValPred:
+        n[ins->dst] = exprTestPredicate(ins->op, &v[ins->a], &v[ins->b]);
+        break;
+      case ExprOp_ValConst:
+        RSValue_MakeReference(&v[ins->dst], ins->val);
+        break;
+      case ExprOp_ValProp:
+        RSValue_MakeReference(&v[ins->dst],
+                              SearchResult_GetValue(ctx->r, ctx->sortables, ins->key));
+        break;
+      case ExprOp_ValNum:
+        v[ins->dst].numval = n[ins->a];
+        v[ins->dst].t = RSValue_Number;
+        break;
+      case ExprOp_ValCall: {
+        size_t argc = ins->func->args ? ins->func->args->len : 0;
+        rc = ins->func->Call(ctx->fctx, &v[ins->dst], &v[ins->a], argc, err);
+        break;
+      }
+    }
+  }
+
+  if (rc == EXPR_EVAL_OK) {
+    if (p->resIsNum) {
+      result->numval = n[p->res];
+      result->t = RSValue_Number;
+    } else {
+      // the result is moved out of its register
+      *result = v[p->res];
+      v[p->res] = RSVALUE_STATIC;
+    }
+  }
+  for (size_t i = 0; i < p->numVals; i++) {
+    RSValue_Free(&v[i]);
+    v[i] = RSVALUE_STATIC;
+  }
+  return rc;
+}
+
+void RSExprProgram_Free(RSExprProgram *p) {
+  if (!p) return;
+  array_free(p->code);
+  free(p->nums);
+  free(p->vals);
+  free(p);
+}
@@ -126,4 +126,23 @@ RSValueType GetExprType(RSExpr *expr, RSSortingTable *tbl);
  * array_free */
 const char **Expr_GetRequiredFields(RSExpr *expr);
 
+/* An expression compiled for repeated evaluation, see RSExprProgram_Compile */
+typedef struct RSExprProgram RSExprProgram;
+
+/* Compile a parsed expression into a program of register instructions. Arithmetic and predicates on
+ * numbers are evaluated without boxing their operands, constant numeric subexpressions are folded,
+ * and properties are resolved against the sorting table tbl, which may be NULL. The program refers
+ * to the expression's literals and keys, so the expression must outlive it */
+RSExprProgram *RSExprProgram_Compile(RSExpr *e, RSSortingTable *tbl);
+
+/* Evaluate a compiled expression. The results are the same as those of RSExpr_Eval on the
+ * expression it was compiled from. A program is not reentrant - it keeps its registers */
+int RSExprProgram_Eval(RSExprProgram *p, RSExprEvalCtx *ctx, RSValue *result, char **err);
+
+void RSExprProgram_Free(RSExprProgram *p);
+
+/* Returns 1 if the expression reads the index result of the search result, and not just its
+ * fields */
+int Expr_ReadsIndexResult(RSExpr *expr);
+
 #endif
\ No newline at end of file
@@ -6,9 +6,12 @@
 
 typedef struct {
   RSExpr *exp;
+  // the expression compiled for evaluation
+  RSExprProgram *prog;
   RSSortingTable *sortables;
   RSExprEvalCtx ctx;
   RSValue val;
+  int readsIndexResult;
 } FilterCtx;
 
 static FilterCtx *NewFilterCtx() {
@@ -20,29 +23,64 @@ void Filter_Free(ResultProcessor *p) {
   FilterCtx *pc = p->ctx.privdata;
 
   RSFunctionEvalCtx_Free(pc->ctx.fctx);
+  RSExprProgram_Free(pc->prog);
   RSExpr_Free(pc->exp);
   free(pc);
   free(p);
 }
 
+/* Evaluate the filter expression on a result. Returns 1 if it passes */
+static int Filter_Match(FilterCtx *pc, SearchResult *res) {
+  char *err;
+  pc->ctx.r = res;
+  pc->ctx.fctx->res = res;
+  int rc = RSExprProgram_Eval(pc->prog, &pc->ctx, &pc->val, &err);
+  return rc == EXPR_EVAL_OK && RSValue_BoolTest(&pc->val);
+}
+
 int Filter_Next(ResultProcessorCtx *ctx, SearchResult *res) {
   FilterCtx *pc = ctx->privdata;
 
-  char *err;
   do {  // read while we either get EOF or the filter expr evaluates to true
     RESULTPROCESSOR_MAYBE_RET_EOF(ctx->upstream, res, 1);
-    pc->ctx.r = res;
-    pc->ctx.fctx->res = res;
-    int rc = RSExpr_Eval(&pc->ctx, pc->exp, &pc->val, &err);
-    if (rc == EXPR_EVAL_OK) {
-      if (RSValue_BoolTest(&pc->val)) {
-        return RS_RESULT_OK;
-      }
+    if (Filter_Match(pc, res)) {
+      return RS_RESULT_OK;
     }
   } while (1);
   return RS_RESULT_EOF;
 }
 
+/* NextBatch implementation - filters the upstream batch in place, moving the results that pass to
+ * its front */
+static int Filter_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  FilterCtx *pc = ctx->privdata;
+  if (pc->readsIndexResult) {
+    b->keepIndexResults = 1;
+  }
+  if (RS_RESULT_EOF == ResultProcessor_NextBatch(ctx->upstream, b, 1)) {
+    return RS_RESULT_EOF;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < b->len; i++) {
+    SearchResult *r = &b->rows[i];
+    if (!Filter_Match(pc, r)) {
+      // rows past the end of the batch must not hold values
+      RSFieldMap_Reset(r->fields);
+      continue;
+    }
+    if (i != n) {
+      SearchResult tmp = b->rows[n];
+      b->rows[n] = *r;
+      *r = tmp;
+    }
+    n++;
+  }
+  b->len = n;
+  // nothing passed - read another batch
+  return n ? RS_RESULT_OK : RS_RESULT_QUEUED;
+}
+
 ResultProcessor *NewFilter(RedisSearchCtx *sctx, ResultProcessor *upstream, const char *expr,
                            size_t len, char **err) {
 
@@ -55,8 +93,11 @@ ResultProcessor *NewFilter(RedisSearchCtx *sctx, ResultProcessor *upstream, cons
     free(ctx);
     return NULL;
   }
+  ctx->prog = RSExprProgram_Compile(ctx->exp, ctx->ctx.sortables);
+  ctx->readsIndexResult = Expr_ReadsIndexResult(ctx->exp);
   ResultProcessor *proc = NewResultProcessor(upstream, ctx);
   proc->Next = Filter_Next;
+  proc->NextBatch = Filter_NextBatch;
   proc->Free = Filter_Free;
   return proc;
 }
@@ -1,207 +1,519 @@
 #include <redisearch.h>
 #include <result_processor.h>
+#include <result_spill.h>
+#include <config.h>
+#include <doc_table.h>
 #include <util/block_alloc.h>
-#include <util/khash.h>
+#include <util/fnv.h>
+#include <util/arr.h>
 
 #define GROUPBY_C_
 #include "reducer.h"
 
-/* A group context is used by the reducer to manage context for a single group */
+/* A group represents a distinct combination of values of the grouper's keys. Groups are numbered
+ * in the order they are created, and the reducer instances of group n are the n-th elements of the
+ * grouper's per-reducer state arrays */
 typedef struct {
-  void *ptr;
-  void (*free)(void *);
-} GroupCtx;
-
-/* A group represents the allocated context of all reducers in a group, and the selected values of
- * that group */
-typedef struct {
-  size_t len;  // Number of contexts
-  RSFieldMap *values;
-  GroupCtx ctxs[0];
+  uint64_t hash;
+  uint32_t keyLen;
+  // the value of each of the grouper's keys, followed by the serialized key. The values are moved
+  // to the result when the group is yielded
+  RSValue *values[];
 } Group;
 
-#define kh_set(kname, hash, key, val)   \
-  ({                                    \
-    int ret;                            \
-    k = kh_put(kname, hash, key, &ret); \
-    kh_value(hash, k) = val;            \
-    ret;                                \
-  })
+#define GROUP_KEY(gr, nkeys) ((char *)((gr)->values + (nkeys)))
 
-static const int khid = 33;
-KHASH_MAP_INIT_INT64(khid, Group *);
+/* A slot of the group table. The slot keeps the high bits of the group's hash, so that probing
+ * rarely needs to look at a group that does not match */
+typedef struct {
+  // the group's id plus one, 0 if the slot is empty
+  uint32_t id;
+  uint32_t hashHi;
+} GroupSlot;
+
+#define GROUPS_BLOCK_SIZE (64 * 1024)
+#define GROUPER_MIN_CAP 64
+// The number of results we see before sizing the table for the number of groups we expect
+#define GROUPER_SAMPLE_SIZE 1024
+// We never size the table ahead of time for more groups than this. Beyond it, the table grows as
+// the groups are created, which costs a few rehashes but never makes room for groups that won't come
+#define GROUPER_MAX_PRESIZE (1 << 16)
+
+/* When the groups take more than the memory budget, results that belong to groups we don't have yet
+ * are written to one of GROUPER_SPILL_PARTITIONS files, by the top bits of their group's hash. Every
+ * group is then wholly in memory or wholly in one partition. Each partition is reduced on its own
+ * once the groups in memory are yielded, and a partition that does not fit in the budget either is
+ * partitioned again by the next bits of the hash */
+#define GROUPER_SPILL_PARTITIONS 16
+#define GROUPER_SPILL_BITS 4
+#define GROUPER_MAX_SPILL_DEPTH 8
+#define GROUPER_NO_GROUP UINT32_MAX
+
+/* A spilled partition waiting to be reduced */
+typedef struct {
+  FILE *fp;
+  int depth;
+} GrouperPartition;
 
-#define GROUP_CTX(g, i) (g->ctxs[i].ptr)
-#define GROUP_BYTESIZE(parent) (sizeof(Group) + (sizeof(GroupCtx) * (parent)->numReducers))
-#define GROUPS_PER_BLOCK 1024
 typedef struct Grouper {
-  khash_t(khid) * groups;
+  // The group table, open addressed with linear probing. Its capacity is a power of 2
+  GroupSlot *slots;
+  uint32_t cap;
+  // The groups by id, and the state of every reducer in every group - one array per reducer. The
+  // states themselves are allocated by the reducers, in order, from their own block allocators
+  Group **groups;
+  void ***states;
+  uint32_t numGroups;
+  uint32_t capGroups;
   BlkAlloc groupsAlloc;
+  // the serialized key of the current result
+  char *keyBuf;
+  size_t keyLen;
+  size_t keyCap;
+  // the number of results added so far
+  size_t numResults;
+
   RSMultiKey *keys;
   RSSortingTable *sortTable;
   Reducer **reducers;
   size_t numReducers;
   size_t capReducers;
   int accumulating;
-  int sortKeyIdx;
-  khiter_t iter;
-  int hasIter;
+  // the next group to yield
+  uint32_t yieldId;
+
+  // The memory budget of the groups, 0 if unlimited, and an estimate of what they take now
+  size_t memBudget;
+  size_t memUsed;
+  // The size of the reducer states of a group, measured on the first group. What a state
+  // allocates on its own, like the values TOLIST collects, is not accounted for
+  size_t stateSize;
+  // Set once the groups take more than the budget. Results of new groups are spilled from then on
+  int spilling;
+  // How many times the results we are reducing now were partitioned
+  int depth;
+  // The partitions we are spilling into, and those waiting to be reduced
+  FILE *parts[GROUPER_SPILL_PARTITIONS];
+  GrouperPartition *pending;
+  // the batch we read from upstream into, when we are read in batches
+  SearchResultBatch *upstreamBatch;
 
 } Grouper;
 
-static Group *GroupAlloc(void *ctx) {
-  Grouper *g = ctx;
-  size_t elemSize = sizeof(Group) + (sizeof(GroupCtx) * g->numReducers);
-  Group *group = BlkAlloc_Alloc(&g->groupsAlloc, elemSize, GROUPS_PER_BLOCK * elemSize);
-  memset(group, 0, elemSize);
+static void Grouper_KeyAppend(Grouper *g, const void *p, size_t len) {
+  if (g->keyLen + len > g->keyCap) {
+    g->keyCap = MAX(g->keyCap * 2, g->keyLen + len);
+    g->keyBuf = realloc(g->keyBuf, g->keyCap);
+  }
+  memcpy(g->keyBuf + g->keyLen, p, len);
+  g->keyLen += len;
+}
 
-  for (size_t ii = 0; ii < g->numReducers; ++ii) {
-    group->ctxs[ii].ptr = g->reducers[ii]->NewInstance(&g->reducers[ii]->ctx);
-    group->ctxs[ii].free = g->reducers[ii]->FreeInstance;
+/* Serialize a value into the current key. Values that hash the same serialize the same - strings
+ * of either kind compare by their contents, and all nulls are equal */
+static void Grouper_SerializeValue(Grouper *g, RSValue *v) {
+  while (v && v->t == RSValue_Reference) {
+    v = v->ref;
   }
-  return group;
+  const char *str = NULL;
+  size_t n = 0;
+  uint32_t len;
+  char tag;
+  switch (v ? v->t : RSValue_Null) {
+    case RSValue_Number:
+      tag = 'n';
+      Grouper_KeyAppend(g, &tag, 1);
+      Grouper_KeyAppend(g, &v->numval, sizeof(v->numval));
+      return;
+    case RSValue_String:
+      str = v->strval.str;
+      n = v->strval.len;
+      break;
+    case RSValue_RedisString:
+      str = RedisModule_StringPtrLen(v->rstrval, &n);
+      break;
+    case RSValue_Array:
+      tag = 'a';
+      len = v->arrval.len;
+      Grouper_KeyAppend(g, &tag, 1);
+      Grouper_KeyAppend(g, &len, sizeof(len));
+      for (uint32_t i = 0; i < len; i++) {
+        Grouper_SerializeValue(g, v->arrval.vals[i]);
+      }
+      return;
+    default:
+      tag = 'z';
+      Grouper_KeyAppend(g, &tag, 1);
+      return;
+  }
+  tag = 's';
+  len = n;
+  Grouper_KeyAppend(g, &tag, 1);
+  Grouper_KeyAppend(g, &len, sizeof(len));
+  Grouper_KeyAppend(g, str, n);
 }
 
-static inline void Group_Init(Group *group, Grouper *g, RSValue **arr, uint64_t hash) {
-  // Copy the group keys to the new group
-  group->len = g->numReducers;
-  group->values = RS_NewFieldMap(g->keys->len + g->numReducers + 1);
+/* Put a group in the first empty slot of its probe sequence */
+static void Grouper_InsertSlot(Grouper *g, uint32_t id) {
+  uint64_t hash = g->groups[id]->hash;
+  uint32_t pos = hash & (g->cap - 1);
+  while (g->slots[pos].id) {
+    pos = (pos + 1) & (g->cap - 1);
+  }
+  g->slots[pos] = (GroupSlot){.id = id + 1, .hashHi = hash >> 32};
+}
 
-  for (size_t i = 0; i < g->keys->len; i++) {
+/* Make room for at least n groups, without growing the table on the way */
+static void Grouper_Reserve(Grouper *g, size_t n) {
+  if (n > g->capGroups) {
+    g->capGroups = n;
+    g->groups = realloc(g->groups, n * sizeof(*g->groups));
+    if (!g->states) {
+      g->states = calloc(g->numReducers, sizeof(*g->states));
+    }
+    for (size_t i = 0; i < g->numReducers; i++) {
+      g->states[i] = realloc(g->states[i], n * sizeof(*g->states[i]));
+    }
+  }
+
+  // keep the table at most 3/4 full
+  uint32_t cap = GROUPER_MIN_CAP;
+  while (cap / 4 * 3 < n) {
+    cap *= 2;
+  }
+  if (cap <= g->cap) return;
+
+  free(g->slots);
+  g->slots = calloc(cap, sizeof(*g->slots));
+  g->cap = cap;
+  for (uint32_t id = 0; id < g->numGroups; id++) {
+    Grouper_InsertSlot(g, id);
+  }
+}
+
+/* An estimate of the memory taken by a group of sz bytes, along with its states and table slots */
+static size_t Grouper_GroupMemSize(Grouper *g, size_t sz) {
+  return sz + sizeof(Group *) + 2 * sizeof(GroupSlot) +
+         g->numReducers * sizeof(void *) + g->stateSize;
+}
 
-    // We must do a deep copy of the group values since they may be deleted during processing
-    RSFieldMap_Add(&group->values, g->keys->keys[i].key, RSValue_MakePersistent(arr[i]));
+/* Size the table once we have seen a sample of the results. If most of them started a group of
+ * their own, the number of groups grows with the number of results, and we expect the same
+ * proportion of the results the query is estimated to have. Otherwise there are few groups, and
+ * growing the table as we go costs next to nothing.
+ *
+ * The estimate of an iterator is an upper bound - a union counts the results of all its children -
+ * so it is capped by the number of documents in the index, and we never presize for more than
+ * GROUPER_MAX_PRESIZE groups */
+static void Grouper_Presize(Grouper *g, QueryProcessingCtx *qxc) {
+  if (!qxc || !qxc->rootFilter || g->numGroups * 2 < g->numResults) {
+    return;
+  }
+  size_t expected = qxc->rootFilter->NumEstimated(qxc->rootFilter->ctx);
+  if (qxc->sctx && qxc->sctx->spec) {
+    expected = MIN(expected, qxc->sctx->spec->docs.size);
+  }
+  expected = (double)expected * g->numGroups / g->numResults;
+  if (g->memBudget) {
+    // no point making room for groups we are going to spill
+    expected = MIN(expected, g->memBudget / Grouper_GroupMemSize(g, sizeof(Group)));
   }
-  // RSFieldMap_Print(group->values);
+  Grouper_Reserve(g, MIN(expected, GROUPER_MAX_PRESIZE));
 }
 
-static void gtGroupClean(Group *group, void *unused_a, void *unused_b) {
-  for (size_t i = 0; i < group->len; i++) {
-    if (group->ctxs[i].free) {
-      group->ctxs[i].free(group->ctxs[i].ptr);
+static uint32_t Grouper_NewGroup(Grouper *g, uint64_t hash, RSValue **vals) {
+  if (g->numGroups == g->capGroups) {
+    Grouper_Reserve(g, MAX(g->capGroups * 2, GROUPER_MIN_CAP));
+  }
+
+  size_t nkeys = g->keys->len;
+  size_t sz = sizeof(Group) + nkeys * sizeof(RSValue *) + g->keyLen;
+  // keep the groups aligned
+  sz = (sz + 7) & ~(size_t)7;
+  Group *gr = BlkAlloc_Alloc(&g->groupsAlloc, sz, MAX(sz, GROUPS_BLOCK_SIZE));
+  gr->hash = hash;
+  gr->keyLen = g->keyLen;
+  for (size_t i = 0; i < nkeys; i++) {
+    // We must keep our own copy of the group values since they may be deleted during processing
+    gr->values[i] = RSValue_IncrRef(RSValue_MakePersistent(vals[i]));
+  }
+  memcpy(GROUP_KEY(gr, nkeys), g->keyBuf, g->keyLen);
+
+  uint32_t id = g->numGroups++;
+  g->groups[id] = gr;
+  for (size_t i = 0; i < g->numReducers; i++) {
+    g->states[i][id] = g->reducers[i]->NewInstance(&g->reducers[i]->ctx);
+  }
+  if (id == 0) {
+    // the reducers allocate their states from their empty allocators, so we see what one takes
+    g->stateSize = 0;
+    for (size_t i = 0; i < g->numReducers; i++) {
+      BlkAlloc *ba = &g->reducers[i]->ctx.alloc;
+      g->stateSize += ba->last ? ba->last->numUsed : 0;
     }
   }
-  group->len = 0;
-  if (group->values) {
-    RSFieldMap_Free(group->values);
-    group->values = NULL;
+
+  if (g->memBudget) {
+    g->memUsed += Grouper_GroupMemSize(g, sz);
+    if (g->memUsed > g->memBudget && g->depth < GROUPER_MAX_SPILL_DEPTH) {
+      g->spilling = 1;
+    }
   }
+  return id;
 }
 
-/* Wrapper for block allocator callback */
-static void baGroupClean(void *ptr, void *arg) {
-  gtGroupClean(ptr, NULL, NULL);
+/* Get the id of the group of the current key, creating it if needed. Returns GROUPER_NO_GROUP if
+ * there is no such group and we are spilling */
+static uint32_t Grouper_GetGroup(Grouper *g, uint64_t hash, RSValue **vals) {
+  uint32_t hashHi = hash >> 32;
+  size_t nkeys = g->keys->len;
+
+  if (!g->cap) {
+    Grouper_Reserve(g, 0);
+  }
+  uint32_t mask = g->cap - 1;
+  uint32_t pos = hash & mask;
+  for (; g->slots[pos].id; pos = (pos + 1) & mask) {
+    if (g->slots[pos].hashHi != hashHi) continue;
+    Group *gr = g->groups[g->slots[pos].id - 1];
+    if (gr->hash == hash && gr->keyLen == g->keyLen &&
+        !memcmp(GROUP_KEY(gr, nkeys), g->keyBuf, g->keyLen)) {
+      return g->slots[pos].id - 1;
+    }
+  }
+  if (g->spilling) {
+    return GROUPER_NO_GROUP;
+  }
+
+  uint32_t id = Grouper_NewGroup(g, hash, vals);
+  if (g->cap - 1 == mask) {
+    g->slots[pos] = (GroupSlot){.id = id + 1, .hashHi = hashHi};
+  } else {
+    // making room for the group grew the table, so its empty slot moved
+    Grouper_InsertSlot(g, id);
+  }
+  return id;
 }
 
-/* Yield - pops the current top result from the heap */
-static int grouper_Yield(Grouper *g, SearchResult *r) {
-  if (!g->hasIter) {
-    g->iter = kh_begin(g->groups);
-    g->hasIter = 1;
+/* Write a result to the partition of its group, along with the key values it is grouped by */
+static int Grouper_Spill(Grouper *g, SearchResult *res, RSValue **vals, uint64_t hash) {
+  int shift = 64 - GROUPER_SPILL_BITS * (g->depth + 1);
+  size_t p = (hash >> shift) & (GROUPER_SPILL_PARTITIONS - 1);
+  if (!g->parts[p] && !(g->parts[p] = Spill_NewFile())) {
+    return REDISMODULE_ERR;
+  }
+
+  // the partition holds a reference to the result's document until it is read back
+  DMD_Incref(res->scorerPrivateData);
+  if (Spill_WriteValues(g->parts[p], vals, g->keys->len) != REDISMODULE_OK ||
+      Spill_WriteResult(g->parts[p], res) != REDISMODULE_OK) {
+    DMD_Decref(res->scorerPrivateData);
+    return REDISMODULE_ERR;
   }
+  return REDISMODULE_OK;
+}
 
-  char *s;
-  tm_len_t l;
-  Group *gr;
+/* Add a result to the group of the given key values */
+static void Grouper_AddToGroup(Grouper *g, SearchResult *res, RSValue **vals) {
+  g->keyLen = 0;
+  for (size_t i = 0; i < g->keys->len; i++) {
+    Grouper_SerializeValue(g, vals[i]);
+  }
+  uint64_t hash = fnv_64a_buf(g->keyBuf, g->keyLen, 0);
+  uint32_t id = Grouper_GetGroup(g, hash, vals);
+  if (id == GROUPER_NO_GROUP) {
+    if (Grouper_Spill(g, res, vals, hash) == REDISMODULE_OK) {
+      return;
+    }
+    // we can't spill, so keep all the groups in memory from now on
+    g->spilling = 0;
+    g->memBudget = 0;
+    id = Grouper_GetGroup(g, hash, vals);
+  }
 
-  for (; g->iter != kh_end(g->groups); ++g->iter) {
-    if (kh_exist(g->groups, g->iter)) {
-      gr = kh_value(g->groups, g->iter);
+  // send the result to the group's reducers
+  for (size_t i = 0; i < g->numReducers; i++) {
+    Reducer_Add(g->reducers[i], g->states[i][id], res);
+  }
+}
 
-      if (r->fields) {
-        RSFieldMap_Free(r->fields);
-        r->fields = NULL;
-      }
+/* Add a result to a group for every combination of the elements of its array values, starting at
+ * key idx */
+static void Grouper_ExtractGroups(Grouper *g, SearchResult *res, RSValue **vals, size_t idx) {
+  for (; idx < g->keys->len; idx++) {
+    RSValue *v = RSValue_Dereference(vals[idx]);
+    if (v->t != RSValue_Array) continue;
+
+    RSValue *tmp = vals[idx];
+    for (uint32_t i = 0; i < RSValue_ArrayLen(v); i++) {
+      vals[idx] = RSValue_ArrayItem(v, i);
+      Grouper_ExtractGroups(g, res, vals, idx + 1);
+    }
+    vals[idx] = tmp;
+    return;
+  }
+  Grouper_AddToGroup(g, res, vals);
+}
 
-      // We copy the group field map (containing the group keys) as is to the result as a field map!
-      r->fields = gr->values;
-      r->indexResult = NULL;
-      gr->values = NULL;
+/* Add a result to the groups its keys belong to */
+static void Grouper_AddResult(Grouper *g, SearchResult *res, QueryProcessingCtx *qxc) {
+  RSValue *vals[g->keys->len];
+  int hasArray = 0;
+  for (size_t i = 0; i < g->keys->len; i++) {
+    vals[i] = SearchResult_GetValue(res, g->sortTable, &g->keys->keys[i]);
+    hasArray |= RSValue_Dereference(vals[i])->t == RSValue_Array;
+  }
+  // array values are split into a group per element, so only they need the recursion
+  if (hasArray) {
+    Grouper_ExtractGroups(g, res, vals, 0);
+  } else {
+    Grouper_AddToGroup(g, res, vals);
+  }
+
+  if (++g->numResults == GROUPER_SAMPLE_SIZE) {
+    Grouper_Presize(g, qxc);
+  }
+}
 
-      // Copy the reducer values to the group
-      for (size_t i = 0; i < g->numReducers; i++) {
-        g->reducers[i]->Finalize(GROUP_CTX(gr, i), g->reducers[i]->alias, r);
+/* Release the groups in memory, keeping the room we made for them */
+static void Grouper_ResetGroups(Grouper *g) {
+  for (uint32_t id = 0; id < g->numGroups; id++) {
+    for (size_t i = 0; i < g->keys->len; i++) {
+      if (g->groups[id]->values[i]) RSValue_Free(g->groups[id]->values[i]);
+    }
+  }
+  for (size_t i = 0; g->states && i < g->numReducers; i++) {
+    if (g->reducers[i]->FreeInstance) {
+      for (uint32_t id = 0; id < g->numGroups; id++) {
+        g->reducers[i]->FreeInstance(g->states[i][id]);
       }
-      ++g->iter;
-      return RS_RESULT_OK;
     }
+    // the reducers allocate nothing but their states from their allocators
+    BlkAlloc_Clear(&g->reducers[i]->ctx.alloc, NULL, NULL, 0);
   }
-  return RS_RESULT_EOF;
+  BlkAlloc_Clear(&g->groupsAlloc, NULL, NULL, 0);
+  if (g->slots) {
+    memset(g->slots, 0, g->cap * sizeof(*g->slots));
+  }
+  g->numGroups = 0;
+  g->yieldId = 0;
+  g->memUsed = 0;
 }
 
-static inline void Group_HandleValues(Grouper *g, Group *gr, SearchResult *res) {
-  for (size_t i = 0; i < g->numReducers; i++) {
-    g->reducers[i]->Add(GROUP_CTX(gr, i), res);
+/* Move the partitions we spilled into to the ones waiting to be reduced */
+static void Grouper_FlushPartitions(Grouper *g) {
+  for (size_t p = 0; p < GROUPER_SPILL_PARTITIONS; p++) {
+    if (g->parts[p]) {
+      if (!g->pending) {
+        g->pending = array_new(GrouperPartition, GROUPER_SPILL_PARTITIONS);
+      }
+      g->pending = array_append(g->pending, ((GrouperPartition){g->parts[p], g->depth}));
+      g->parts[p] = NULL;
+    }
   }
+  g->spilling = 0;
 }
 
-/* Extract the group keys from the result and add to them */
-static void Grouper_ExtractGroups(Grouper *g, SearchResult *res, RSValue **arr, int idx, int arridx,
-                                  int len, uint64_t hval) {
-  // end of the line - create/add to group
-  if (idx == len) {
-    Group *group = NULL;
-
-    // Get or create the group
-    khiter_t k = kh_get(khid, g->groups, hval);  // first have to get ieter
-    if (k == kh_end(g->groups)) {                // k will be equal to kh_end if key not present
-      group = GroupAlloc(g);
-      kh_set(khid, g->groups, hval, group);
-      Group_Init(group, g, arr, hval);
-    } else {
-      group = kh_value(g->groups, k);
+/* Read the results of a partition back, and either add them to their groups, or release them */
+static void Grouper_ReadPartition(Grouper *g, FILE *fp, int reduce) {
+  size_t nkeys = g->keys->len;
+  RSValue *vals[nkeys];
+  SearchResult res = {.fields = NULL};
+
+  rewind(fp);
+  while (Spill_ReadValues(fp, vals, nkeys)) {
+    int ok = Spill_ReadResult(fp, &res);
+    if (ok && reduce) {
+      Grouper_AddToGroup(g, &res, vals);
+    }
+    DMD_Decref(res.scorerPrivateData);
+    for (size_t i = 0; i < nkeys; i++) {
+      RSValue_Free(vals[i]);
     }
+    if (!ok) break;
+  }
+  RSFieldMap_Free(res.fields);
+  fclose(fp);
+}
 
-    // send the result to the group and its reducers
-    Group_HandleValues(g, group, res);
-    return;
+/* Replace the groups in memory with those of the next partition. Returns 0 if there is none left */
+static int Grouper_LoadPartition(Grouper *g, QueryProcessingCtx *qxc) {
+  if (!g->pending || !array_len(g->pending)) {
+    return 0;
   }
+  GrouperPartition p = array_pop(g->pending);
+  Grouper_ResetGroups(g);
 
-  // get the value
-  RSValue *v = RSValue_Dereference(arr[idx]);
-  // regular value - just move one step
-  if (v->t != RSValue_Array) {
-    Grouper_ExtractGroups(g, res, arr, idx + 1, 0, len, RSValue_Hash(v, hval));
-  } else {
+  // if this partition does not fit either, it is partitioned by the next bits of the hash
+  g->depth = p.depth + 1;
+  Grouper_ReadPartition(g, p.fp, 1);
+  Grouper_FlushPartitions(g);
+
+  if (qxc) {
+    qxc->totalResults += g->numGroups;
+  }
+  return 1;
+}
 
-    // advance one in the overall array hashing current value in current array
-    RSValue *tmp = arr[idx];
-    arr[idx] = RSValue_ArrayItem(v, arridx);
-    uint64_t hh = RSValue_Hash(arr[idx], hval);
-    Grouper_ExtractGroups(g, res, arr, idx + 1, 0, len, hh);
-    arr[idx] = tmp;
-    if (arridx + 1 < RSValue_ArrayLen(v)) {
-      // advance to the next array element
-      Grouper_ExtractGroups(g, res, arr, idx, arridx + 1, len, hval);
+/* Yield - puts the next group in the result */
+static int grouper_Yield(Grouper *g, SearchResult *r, QueryProcessingCtx *qxc) {
+  while (g->yieldId >= g->numGroups) {
+    if (!Grouper_LoadPartition(g, qxc)) {
+      return RS_RESULT_EOF;
     }
   }
+  uint32_t id = g->yieldId++;
+  Group *gr = g->groups[id];
+
+  // the result may be a batch row with a field map we can reuse
+  if (r->fields) {
+    RSFieldMap_Reset(r->fields);
+  } else {
+    r->fields = RS_NewFieldMap(g->keys->len + g->numReducers + 1);
+  }
+  r->indexResult = NULL;
+  r->scorerPrivateData = NULL;
+  r->sorterPrivateData = NULL;
+
+  // Move the group keys to the result
+  for (size_t i = 0; i < g->keys->len; i++) {
+    RSFieldMap_Add(&r->fields, g->keys->keys[i].key, gr->values[i]);
+    RSValue_Free(gr->values[i]);
+    gr->values[i] = NULL;
+  }
+
+  // Copy the reducer values to the result
+  for (size_t i = 0; i < g->numReducers; i++) {
+    Reducer_Finalize(g->reducers[i], g->states[i][id], r);
+  }
+  return RS_RESULT_OK;
 }
 
-static int Grouper_Next(ResultProcessorCtx *ctx, SearchResult *res) {
-  // static SearchResult up;
+/* Stop accumulating once our upstream has finished */
+static void Grouper_EndAccumulation(Grouper *g, QueryProcessingCtx *qxc) {
+  // Set the number of results to the total number of groups we found. Groups in spilled partitions
+  // are added as they are reduced
+  if (qxc) {
+    qxc->totalResults = g->numGroups;
+  }
+  Grouper_FlushPartitions(g);
+  g->accumulating = 0;
+}
 
+static int Grouper_Next(ResultProcessorCtx *ctx, SearchResult *res) {
   Grouper *g = ctx->privdata;
   if (!g->accumulating) {
-    return grouper_Yield(g, res);
+    return grouper_Yield(g, res, ctx->qxc);
   }
 
   int rc = ResultProcessor_Next(ctx->upstream, res, 1);
   // if our upstream has finished - just change the state to not accumulating, and yield
   if (rc == RS_RESULT_EOF) {
-    // Set the number of results to the total number of groups we found
-    if (ctx->qxc) {
-      ctx->qxc->totalResults = kh_size(g->groups);
-    }
-    g->accumulating = 0;
-    return grouper_Yield(g, res);
+    Grouper_EndAccumulation(g, ctx->qxc);
+    return grouper_Yield(g, res, ctx->qxc);
   }
 
-  // Group *group;
-  RSValue *vals[g->keys->len];
-  for (size_t i = 0; i < g->keys->len; i++) {
-    vals[i] = SearchResult_GetValue(res, g->sortTable, &g->keys->keys[i]);
-  }
-  Grouper_ExtractGroups(g, res, vals, 0, 0, g->keys->len, 0);
+  Grouper_AddResult(g, res, ctx->qxc);
 
   res->indexResult = NULL;
   SearchResult_FreeInternal(res);
@@ -209,14 +521,57 @@ static int Grouper_Next(ResultProcessorCtx *ctx, SearchResult *res) {
   return RS_RESULT_QUEUED;
 }
 
+/* NextBatch implementation - groups whole batches from upstream, then yields the groups. The rows
+ * of the upstream batch keep their field maps, so accumulating does not allocate per result */
+static int Grouper_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  Grouper *g = ctx->privdata;
+
+  if (g->accumulating) {
+    if (!g->upstreamBatch) {
+      g->upstreamBatch = NewSearchResultBatch();
+    }
+    SearchResultBatch *up = g->upstreamBatch;
+    up->cap = RP_BATCH_SIZE;
+    if (ResultProcessor_NextBatch(ctx->upstream, up, 1) == RS_RESULT_OK) {
+      for (size_t i = 0; i < up->len; i++) {
+        Grouper_AddResult(g, &up->rows[i], ctx->qxc);
+      }
+      return RS_RESULT_QUEUED;
+    }
+    Grouper_EndAccumulation(g, ctx->qxc);
+  }
+
+  while (b->len < b->cap && grouper_Yield(g, &b->rows[b->len], ctx->qxc) == RS_RESULT_OK) {
+    b->len++;
+  }
+  return b->len ? RS_RESULT_OK : RS_RESULT_EOF;
+}
+
 void Grouper_Free(Grouper *g) {
-  kh_destroy(khid, g->groups);
-  BlkAlloc_FreeAll(&g->groupsAlloc, baGroupClean, g, GROUP_BYTESIZE(g));
+  Grouper_ResetGroups(g);
+  // spilled results hold document references we have to release
+  Grouper_FlushPartitions(g);
+  if (g->pending) {
+    for (size_t i = 0; i < array_len(g->pending); i++) {
+      Grouper_ReadPartition(g, g->pending[i].fp, 0);
+    }
+    array_free(g->pending);
+  }
+
+  for (size_t i = 0; g->states && i < g->numReducers; i++) {
+    free(g->states[i]);
+  }
+  free(g->states);
+  free(g->groups);
+  free(g->slots);
+  free(g->keyBuf);
+  BlkAlloc_FreeAll(&g->groupsAlloc, NULL, NULL, 0);
 
   for (size_t i = 0; i < g->numReducers; i++) {
     g->reducers[i]->Free(g->reducers[i]);
   }
   RSMultiKey_Free(g->keys);
+  SearchResultBatch_Free(g->upstreamBatch);
 
   free(g->reducers);
   free(g);
@@ -226,20 +581,18 @@ static void Grouper_FreeProcessor(struct resultProcessor *p) {
   Grouper *g = p->ctx.privdata;
   Grouper_Free(g);
   free(p);
-  // KHTable_FreeEx(&g->groups, NULL, gtGroupClean);
 }
 
 Grouper *NewGrouper(RSMultiKey *keys, RSSortingTable *tbl) {
-  Grouper *g = malloc(sizeof(*g));
+  Grouper *g = calloc(1, sizeof(*g));
   BlkAlloc_Init(&g->groupsAlloc);
-  g->groups = kh_init(khid);
   g->sortTable = tbl;
   g->keys = keys;
   g->capReducers = 2;
   g->reducers = calloc(g->capReducers, sizeof(Reducer *));
   g->numReducers = 0;
   g->accumulating = 1;
-  g->hasIter = 0;
+  g->memBudget = RSGlobalConfig.aggregateMemoryBudget;
 
   return g;
 }
@@ -247,6 +600,7 @@ ResultProcessor *NewGrouperProcessor(Grouper *g, ResultProcessor *upstream) {
 
   ResultProcessor *p = NewResultProcessor(upstream, g);
   p->Next = Grouper_Next;
+  p->NextBatch = Grouper_NextBatch;
   p->Free = Grouper_FreeProcessor;
   return p;
 }
@@ -260,4 +614,4 @@ void Grouper_AddReducer(Grouper *g, Reducer *r) {
     g->reducers = realloc(g->reducers, g->capReducers * sizeof(Reducer *));
   }
   g->reducers[g->numReducers - 1] = r;
-}
\ No newline at end of file
+}
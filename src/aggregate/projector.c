@@ -9,10 +9,13 @@
 #include <aggregate/functions/function.h>
 typedef struct {
   RSExpr *exp;
+  // the expression compiled for evaluation
+  RSExprProgram *prog;
   const char *alias;
   RSSortingTable *sortables;
   RSExprEvalCtx ctx;
   RSValue val;
+  int readsIndexResult;
 } ProjectorCtx;
 
 static ProjectorCtx *NewProjectorCtx(const char *alias) {
@@ -25,18 +28,18 @@ void Projector_Free(ResultProcessor *p) {
   ProjectorCtx *pc = p->ctx.privdata;
 
   RSFunctionEvalCtx_Free(pc->ctx.fctx);
+  RSExprProgram_Free(pc->prog);
   RSExpr_Free(pc->exp);
   free(pc);
   free(p);
 }
 
-int Projector_Next(ResultProcessorCtx *ctx, SearchResult *res) {
-  RESULTPROCESSOR_MAYBE_RET_EOF(ctx->upstream, res, 1);
-  ProjectorCtx *pc = ctx->privdata;
+/* Evaluate the expression on a result, and set its value under the alias */
+static void Projector_Project(ProjectorCtx *pc, SearchResult *res) {
   pc->ctx.r = res;
   pc->ctx.fctx->res = res;
   char *err;
-  int rc = RSExpr_Eval(&pc->ctx, pc->exp, &pc->val, &err);
+  int rc = RSExprProgram_Eval(pc->prog, &pc->ctx, &pc->val, &err);
   if (rc == EXPR_EVAL_OK) {
     RSValue *a = RS_NewValue(RSValue_Null);
     *a = pc->val;
@@ -47,6 +50,26 @@ int Projector_Next(ResultProcessorCtx *ctx, SearchResult *res) {
   } else {
     RSFieldMap_Set(&res->fields, pc->alias, RS_NullVal());
   }
+}
+
+int Projector_Next(ResultProcessorCtx *ctx, SearchResult *res) {
+  RESULTPROCESSOR_MAYBE_RET_EOF(ctx->upstream, res, 1);
+  Projector_Project(ctx->privdata, res);
+  return RS_RESULT_OK;
+}
+
+/* NextBatch implementation - projects the upstream batch in place */
+static int Projector_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  ProjectorCtx *pc = ctx->privdata;
+  if (pc->readsIndexResult) {
+    b->keepIndexResults = 1;
+  }
+  if (RS_RESULT_EOF == ResultProcessor_NextBatch(ctx->upstream, b, 1)) {
+    return RS_RESULT_EOF;
+  }
+  for (size_t i = 0; i < b->len; i++) {
+    Projector_Project(pc, &b->rows[i]);
+  }
   return RS_RESULT_OK;
 }
 
@@ -62,8 +85,11 @@ ResultProcessor *NewProjector(RedisSearchCtx *sctx, ResultProcessor *upstream, c
     free(ctx);
     return NULL;
   }
+  ctx->prog = RSExprProgram_Compile(ctx->exp, ctx->ctx.sortables);
+  ctx->readsIndexResult = Expr_ReadsIndexResult(ctx->exp);
   ResultProcessor *proc = NewResultProcessor(upstream, ctx);
   proc->Next = Projector_Next;
+  proc->NextBatch = Projector_NextBatch;
   proc->Free = Projector_Free;
   return proc;
 }
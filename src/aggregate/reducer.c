@@ -212,6 +212,18 @@ Reducer *GetReducer(RedisSearchCtx *ctx, const char *name, const char *alias, RS
   return NULL;
 }
 
+int IsReducerMergeable(const char *name, RSValue **args, size_t argc) {
+  char *err = NULL;
+  Reducer *r = GetReducer(NULL, name, NULL, args, argc, &err);
+  if (!r) {
+    free(err);
+    return 0;
+  }
+  int ret = Reducer_IsMergeable(r);
+  r->Free(r);
+  return ret;
+}
+
 RSValueType GetReducerType(const char *name) {
   for (int i = 0; reducers_g[i].k != NULL; i++) {
     if (!strcasecmp(reducers_g[i].k, name)) {
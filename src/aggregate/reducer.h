@@ -17,6 +17,16 @@ typedef struct {
   BlkAlloc alloc;
 } ReducerCtx;
 
+/* The phase a reducer runs in. A complete reducer reduces rows to its result. When the reduction
+ * is split - across shards or threads - each part runs a partial reducer over its own rows, and
+ * yields the reducer's state instead of its result. A final reducer then merges these states,
+ * read from the rows under the reducer's alias, and yields the result */
+typedef enum {
+  Reducer_Complete = 0,
+  Reducer_Partial = 1,
+  Reducer_Final = 2,
+} ReducerPhase;
+
 static inline void *ReducerCtx_Alloc(ReducerCtx *ctx, size_t sz, size_t blkSz) {
   return BlkAlloc_Alloc(&ctx->alloc, sz, blkSz);
 }
@@ -36,8 +46,48 @@ typedef struct reducer {
   void (*Free)(struct reducer *r);
 
   void (*FreeInstance)(void *ctx);
+
+  // Serialize writes the instance's partial state under key, as a value Merge can read back - even
+  // after it was sent over the network. Reducers that can't do that leave Serialize and Merge NULL
+  int (*Serialize)(void *ctx, const char *key, SearchResult *res);
+
+  // Merge a partial state written by Serialize into the instance
+  int (*Merge)(void *ctx, RSValue *state);
+
+  ReducerPhase phase;
 } Reducer;
 
+/* Return 1 if the reducer's state can be split into partial states and merged */
+static inline int Reducer_IsMergeable(const Reducer *r) {
+  return r->Serialize != NULL && r->Merge != NULL;
+}
+
+/* Set the phase the reducer runs in. Returns 0 if the reducer can not run split */
+static inline int Reducer_SetPhase(Reducer *r, ReducerPhase phase) {
+  if (phase != Reducer_Complete && !Reducer_IsMergeable(r)) {
+    return 0;
+  }
+  r->phase = phase;
+  return 1;
+}
+
+/* Add a row to a reducer instance. In the final phase the row carries a partial state */
+static inline int Reducer_Add(Reducer *r, void *ctx, SearchResult *res) {
+  if (r->phase == Reducer_Final) {
+    RSValue *state = res->fields ? RSFieldMap_Get(res->fields, r->alias) : NULL;
+    return state ? r->Merge(ctx, state) : 1;
+  }
+  return r->Add(ctx, res);
+}
+
+/* Write the result of a reducer instance - or its partial state, in the partial phase */
+static inline int Reducer_Finalize(Reducer *r, void *ctx, SearchResult *res) {
+  if (r->phase == Reducer_Partial) {
+    return r->Serialize(ctx, r->alias, res);
+  }
+  return r->Finalize(ctx, r->alias, res);
+}
+
 static inline void Reducer_GenericFree(Reducer *r) {
   BlkAlloc_FreeAll(&r->ctx.alloc, NULL, 0, 0);
   free(r->ctx.privdata);
@@ -59,6 +109,9 @@ static Reducer *NewReducer(RedisSearchCtx *ctx, void *privdata) {
   r->ctx.ctx = ctx;
   r->ctx.privdata = privdata;
   BlkAlloc_Init(&r->ctx.alloc);
+  r->Serialize = NULL;
+  r->Merge = NULL;
+  r->phase = Reducer_Complete;
   return r;
 }
 
@@ -93,6 +146,8 @@ Reducer *NewStddev(RedisSearchCtx *, const char *, const char *);
 Reducer *GetReducer(RedisSearchCtx *ctx, const char *name, const char *alias, RSValue **args,
                     size_t argc, char **err);
 RSValueType GetReducerType(const char *name);
+/* Return 1 if the reducer built from these arguments can run in partial and final phases */
+int IsReducerMergeable(const char *name, RSValue **args, size_t argc);
 Reducer *NewFirstValue(RedisSearchCtx *ctx, const char *key, const char *sortKey, int asc,
                        const char *alias);
 Reducer *NewRandomSample(RedisSearchCtx *sctx, int size, const char *property, const char *alias);
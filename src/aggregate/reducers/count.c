@@ -26,11 +26,23 @@ int counter_Finalize(void *ctx, const char *key, SearchResult *res) {
   return 1;
 }
 
+// the partial state of a counter is just its count
+int counter_Merge(void *ctx, RSValue *state) {
+  struct counter *ctr = ctx;
+  double d;
+  if (RSValue_ToNumber(state, &d)) {
+    ctr->count += (size_t)d;
+  }
+  return 1;
+}
+
 Reducer *NewCount(RedisSearchCtx *ctx, const char *alias) {
   Reducer *r = NewReducer(ctx, NULL);
 
   r->Add = counter_Add;
   r->Finalize = counter_Finalize;
+  r->Serialize = counter_Finalize;
+  r->Merge = counter_Merge;
   r->Free = Reducer_GenericFree;
   r->FreeInstance = NULL;
   r->NewInstance = counter_NewInstance;
@@ -53,6 +53,43 @@ static int countDistinct_Finalize(void *ctx, const char *key, SearchResult *res)
   return 1;
 }
 
+/* The partial state is the set of hashes seen, packed into a string */
+static int countDistinct_Serialize(void *ctx, const char *key, SearchResult *res) {
+  struct distinctCounter *ctr = ctx;
+  size_t n = kh_size(ctr->dedup);
+  uint64_t *hashes = malloc(n * sizeof(*hashes) + 1);
+  size_t i = 0;
+  for (khiter_t k = kh_begin(ctr->dedup); k != kh_end(ctr->dedup); ++k) {
+    if (kh_exist(ctr->dedup, k)) {
+      hashes[i++] = kh_key(ctr->dedup, k);
+    }
+  }
+  RSFieldMap_Set(&res->fields, key, RS_StringVal((char *)hashes, i * sizeof(*hashes)));
+  return 1;
+}
+
+static int countDistinct_Merge(void *ctx, RSValue *state) {
+  struct distinctCounter *ctr = ctx;
+  size_t len;
+  if (!RSValue_IsString(state)) {
+    return 0;
+  }
+  const char *buf = RSValue_StringPtrLen(state, &len);
+  if (len % sizeof(uint64_t)) {
+    return 0;
+  }
+  for (size_t off = 0; off < len; off += sizeof(uint64_t)) {
+    uint64_t hval;
+    memcpy(&hval, buf + off, sizeof(hval));
+    int ret;
+    kh_put(khid, ctr->dedup, hval, &ret);
+    if (ret > 0) {
+      ctr->count++;
+    }
+  }
+  return 1;
+}
+
 static void countDistinct_FreeInstance(void *p) {
   struct distinctCounter *ctr = p;
   // we only destroy the hash table. The object itself is allocated from a block and needs no
@@ -65,6 +102,8 @@ Reducer *NewCountDistinct(RedisSearchCtx *ctx, const char *alias, const char *ke
 
   r->Add = countDistinct_Add;
   r->Finalize = countDistinct_Finalize;
+  r->Serialize = countDistinct_Serialize;
+  r->Merge = countDistinct_Merge;
   r->Free = Reducer_GenericFreeWithStaticPrivdata;
   r->FreeInstance = countDistinct_FreeInstance;
   r->NewInstance = countDistinct_NewInstance;
@@ -120,53 +159,17 @@ typedef struct __attribute__((packed)) {
   // uint32_t size -- NOTE - always 1<<bits
 } HLLSerializedHeader;
 
-static int hllFinalize(void *ctx, const char *key, SearchResult *res) {
-  struct distinctishCounter *ctr = ctx;
-  // Serialize field map.
-  HLLSerializedHeader hdr = {.flags = 0, .bits = ctr->hll.bits};
-  char *str = malloc(sizeof(hdr) + ctr->hll.size);
+static RSValue *hllSerialize(const struct HLL *hll) {
+  HLLSerializedHeader hdr = {.flags = 0, .bits = hll->bits};
+  char *str = malloc(sizeof(hdr) + hll->size);
   size_t hdrsize = sizeof(hdr);
   memcpy(str, &hdr, hdrsize);
-  memcpy(str + hdrsize, ctr->hll.registers, ctr->hll.size);
-  RSFieldMap_Add(&res->fields, key, RS_StringVal(str, sizeof(hdr) + ctr->hll.size));
-  return 1;
+  memcpy(str + hdrsize, hll->registers, hll->size);
+  return RS_StringVal(str, sizeof(hdr) + hll->size);
 }
 
-static Reducer *newHllCommon(RedisSearchCtx *ctx, const char *alias, const char *key, int isRaw) {
-  Reducer *r = NewReducer(ctx, (void *)key);
-  r->Add = countDistinctish_Add;
-  r->Free = Reducer_GenericFreeWithStaticPrivdata;
-  r->FreeInstance = countDistinctish_FreeInstance;
-  r->NewInstance = countDistinctish_NewInstance;
-
-  if (isRaw) {
-    r->Finalize = hllFinalize;
-    r->alias = FormatAggAlias(alias, "hll", key);
-  } else {
-    r->Finalize = countDistinctish_Finalize;
-    r->alias = FormatAggAlias(alias, "count_distinctish", key);
-  }
-  return r;
-}
-
-Reducer *NewCountDistinctish(RedisSearchCtx *ctx, const char *alias, const char *key) {
-  return newHllCommon(ctx, alias, key, 0);
-}
-
-Reducer *NewHLL(RedisSearchCtx *ctx, const char *alias, const char *key) {
-  return newHllCommon(ctx, alias, key, 1);
-}
-
-typedef struct {
-  RSKey key;
-  RSSortingTable *sortables;
-  struct HLL hll;
-} hllSumCtx;
-
-static int hllSum_Add(void *ctx, SearchResult *res) {
-  hllSumCtx *ctr = ctx;
-  RSValue *val = SearchResult_GetValue(res, ctr->sortables, &ctr->key);
-
+/* Merge a serialized HLL into hll. If hll has no registers yet, it becomes a copy */
+static int hllMergeSerialized(struct HLL *hll, RSValue *val) {
   if (val == NULL || !RSValue_IsString(val)) {
     // Not a string!
     return 0;
@@ -196,24 +199,87 @@ static int hllSum_Add(void *ctx, SearchResult *res) {
     return 0;
   }
 
-  if (ctr->hll.bits) {
-    if (hdr->bits != ctr->hll.bits) {
+  if (hll->bits) {
+    if (hdr->bits != hll->bits) {
       return 0;
     }
     // Merge!
     struct HLL tmphll = {
         .bits = hdr->bits, .size = 1 << hdr->bits, .registers = (uint8_t *)registers};
-    if (hll_merge(&ctr->hll, &tmphll) != 0) {
+    if (hll_merge(hll, &tmphll) != 0) {
       return 0;
     }
   } else {
     // Not yet initialized - make this our first register and continue.
-    hll_init(&ctr->hll, hdr->bits);
-    memcpy(ctr->hll.registers, registers, regsz);
+    hll_init(hll, hdr->bits);
+    memcpy(hll->registers, registers, regsz);
   }
   return 1;
 }
 
+static int hllFinalize(void *ctx, const char *key, SearchResult *res) {
+  struct distinctishCounter *ctr = ctx;
+  // Serialize field map.
+  RSFieldMap_Add(&res->fields, key, hllSerialize(&ctr->hll));
+  return 1;
+}
+
+// the partial state of both HLL reducers is the serialized HLL
+static int countDistinctish_Merge(void *ctx, RSValue *state) {
+  struct distinctishCounter *ctr = ctx;
+  return hllMergeSerialized(&ctr->hll, state);
+}
+
+static Reducer *newHllCommon(RedisSearchCtx *ctx, const char *alias, const char *key, int isRaw) {
+  Reducer *r = NewReducer(ctx, (void *)key);
+  r->Add = countDistinctish_Add;
+  r->Free = Reducer_GenericFreeWithStaticPrivdata;
+  r->FreeInstance = countDistinctish_FreeInstance;
+  r->NewInstance = countDistinctish_NewInstance;
+  r->Serialize = hllFinalize;
+  r->Merge = countDistinctish_Merge;
+
+  if (isRaw) {
+    r->Finalize = hllFinalize;
+    r->alias = FormatAggAlias(alias, "hll", key);
+  } else {
+    r->Finalize = countDistinctish_Finalize;
+    r->alias = FormatAggAlias(alias, "count_distinctish", key);
+  }
+  return r;
+}
+
+Reducer *NewCountDistinctish(RedisSearchCtx *ctx, const char *alias, const char *key) {
+  return newHllCommon(ctx, alias, key, 0);
+}
+
+Reducer *NewHLL(RedisSearchCtx *ctx, const char *alias, const char *key) {
+  return newHllCommon(ctx, alias, key, 1);
+}
+
+typedef struct {
+  RSKey key;
+  RSSortingTable *sortables;
+  struct HLL hll;
+} hllSumCtx;
+
+static int hllSum_Add(void *ctx, SearchResult *res) {
+  hllSumCtx *ctr = ctx;
+  RSValue *val = SearchResult_GetValue(res, ctr->sortables, &ctr->key);
+  return hllMergeSerialized(&ctr->hll, val);
+}
+
+static int hllSum_Serialize(void *ctx, const char *key, SearchResult *res) {
+  hllSumCtx *ctr = ctx;
+  RSFieldMap_Set(&res->fields, key, ctr->hll.bits ? hllSerialize(&ctr->hll) : RS_NullVal());
+  return 1;
+}
+
+static int hllSum_Merge(void *ctx, RSValue *state) {
+  hllSumCtx *ctr = ctx;
+  return state->t == RSValue_Null ? 1 : hllMergeSerialized(&ctr->hll, state);
+}
+
 static int hllSum_Finalize(void *ctx, const char *key, SearchResult *res) {
   hllSumCtx *ctr = ctx;
   RSFieldMap_SetNumber(&res->fields, key, ctr->hll.bits ? (uint64_t)hll_count(&ctr->hll) : 0);
@@ -238,6 +304,8 @@ Reducer *NewHLLSum(RedisSearchCtx *ctx, const char *alias, const char *key) {
   Reducer *r = NewReducer(ctx, (void *)key);
   r->Add = hllSum_Add;
   r->Finalize = hllSum_Finalize;
+  r->Serialize = hllSum_Serialize;
+  r->Merge = hllSum_Merge;
   r->NewInstance = hllSum_NewInstance;
   r->FreeInstance = hllSum_FreeInstance;
   r->Free = Reducer_GenericFreeWithStaticPrivdata;
@@ -60,14 +60,54 @@ static int stddev_Finalize(void *ctx, const char *key, SearchResult *res) {
   return 1;
 }
 
+/* The partial state is the count, mean and sum of squared differences */
+static int stddev_Serialize(void *ctx, const char *key, SearchResult *res) {
+  devCtx *dctx = ctx;
+  double m = dctx->n ? dctx->newM : 0, s = dctx->n > 1 ? dctx->newS : 0;
+  RSFieldMap_Set(&res->fields, key, RS_VNumArray(3, (double)dctx->n, m, s));
+  return 1;
+}
+
+static int stddev_Merge(void *ctx, RSValue *state) {
+  devCtx *dctx = ctx;
+  double n, m, s;
+  if (state->t != RSValue_Array || RSValue_ArrayLen(state) != 3 ||
+      !RSValue_ToNumber(RSValue_ArrayItem(state, 0), &n) ||
+      !RSValue_ToNumber(RSValue_ArrayItem(state, 1), &m) ||
+      !RSValue_ToNumber(RSValue_ArrayItem(state, 2), &s)) {
+    return 0;
+  }
+  if (n < 1) {
+    return 1;
+  }
+  if (dctx->n == 0) {
+    dctx->n = n;
+    dctx->oldM = dctx->newM = m;
+    dctx->oldS = dctx->newS = s;
+    return 1;
+  }
+
+  // Chan et al. - combining the moments of two sets
+  double total = dctx->n + n;
+  double delta = m - dctx->newM;
+  dctx->newM += delta * n / total;
+  dctx->newS += s + delta * delta * dctx->n * n / total;
+  dctx->oldM = dctx->newM;
+  dctx->oldS = dctx->newS;
+  dctx->n += n;
+  return 1;
+}
+
 static void stddev_FreeInstance(void *p) {
   free(p);
 }
 
 Reducer *NewStddev(RedisSearchCtx *ctx, const char *property, const char *alias) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = stddev_Add;
   r->Finalize = stddev_Finalize;
+  r->Serialize = stddev_Serialize;
+  r->Merge = stddev_Merge;
   r->Free = Reducer_GenericFree;
   r->FreeInstance = stddev_FreeInstance;
   r->NewInstance = stddev_NewInstance;
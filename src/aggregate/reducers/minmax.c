@@ -60,12 +60,36 @@ static int minmax_Finalize(void *base, const char *key, SearchResult *res) {
   return 1;
 }
 
+/* The partial state is the value found, or null if the instance saw no numbers */
+static int minmax_Serialize(void *base, const char *key, SearchResult *res) {
+  struct minmaxCtx *ctx = base;
+  RSFieldMap_Set(&res->fields, key, ctx->numMatches ? RS_NumVal(ctx->val) : RS_NullVal());
+  return 1;
+}
+
+static int minmax_Merge(void *base, RSValue *state) {
+  struct minmaxCtx *m = base;
+  double val;
+  if (state->t == RSValue_Null || !RSValue_ToNumber(state, &val)) {
+    return 1;
+  }
+
+  if (m->mode == Minmax_Max && val > m->val) {
+    m->val = val;
+  } else if (m->mode == Minmax_Min && val < m->val) {
+    m->val = val;
+  }
+  m->numMatches++;
+  return 1;
+}
 
 static Reducer *newMinMax(RedisSearchCtx *ctx, const char *property, const char *alias,
                           MinmaxMode mode) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = minmax_Add;
   r->Finalize = minmax_Finalize;
+  r->Serialize = minmax_Serialize;
+  r->Merge = minmax_Merge;
   r->Free = Reducer_GenericFree;
   r->FreeInstance = NULL;//minmax_FreeInstance;
   r->ctx = (ReducerCtx){.ctx = ctx, .property = property};
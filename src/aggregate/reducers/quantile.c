@@ -49,6 +49,34 @@ static int quantile_Finalize(void *ctx, const char *key, SearchResult *res) {
   return 1;
 }
 
+/* The partial state is the stream's samples, flattened to value and rank width pairs */
+static int quantile_Serialize(void *ctx, const char *key, SearchResult *res) {
+  quantileCtx *qctx = ctx;
+  size_t n;
+  double *samples = QS_GetSamples(qctx->strm, &n);
+  RSFieldMap_Set(&res->fields, key, RS_NumArray(samples, n * 2));
+  free(samples);
+  return 1;
+}
+
+static int quantile_Merge(void *ctx, RSValue *state) {
+  quantileCtx *qctx = ctx;
+  uint32_t len = RSValue_ArrayLen(state);
+  if (state->t != RSValue_Array || len % 2) {
+    return 0;
+  }
+  double *samples = malloc((len + 1) * sizeof(*samples));
+  for (uint32_t i = 0; i < len; i++) {
+    if (!RSValue_ToNumber(RSValue_ArrayItem(state, i), &samples[i])) {
+      free(samples);
+      return 0;
+    }
+  }
+  QS_Merge(qctx->strm, samples, len / 2);
+  free(samples);
+  return 1;
+}
+
 static void quantile_FreeInstance(void *p) {
   quantileCtx *qctx = p;
   QS_Free(qctx->strm);
@@ -56,9 +84,11 @@ static void quantile_FreeInstance(void *p) {
 
 Reducer *NewQuantile(RedisSearchCtx *ctx, const char *property, const char *alias, double pct,
                      size_t resolution) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = quantile_Add;
   r->Finalize = quantile_Finalize;
+  r->Serialize = quantile_Serialize;
+  r->Merge = quantile_Merge;
   r->Free = Reducer_GenericFree;
   r->FreeInstance = quantile_FreeInstance;
   r->NewInstance = quantile_NewInstance;
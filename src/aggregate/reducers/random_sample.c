@@ -64,7 +64,7 @@ void sample_FreeInstance(void *p) {
 }
 
 Reducer *NewRandomSample(RedisSearchCtx *sctx, int size, const char *property, const char *alias) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = sample_Add;
   r->Finalize = sample_Finalize;
   r->Free = Reducer_GenericFree;
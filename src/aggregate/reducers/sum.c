@@ -50,6 +50,34 @@ int sum_Finalize(void *ctx, const char *key, SearchResult *res) {
   return 1;
 }
 
+/* The partial state of a sum is its total, and of an average its total and count */
+int sum_Serialize(void *ctx, const char *key, SearchResult *res) {
+  struct sumCtx *ctr = ctx;
+  if (ctr->isAvg) {
+    RSFieldMap_Set(&res->fields, key, RS_VNumArray(2, ctr->total, (double)ctr->count));
+  } else {
+    RSFieldMap_SetNumber(&res->fields, key, ctr->total);
+  }
+  return 1;
+}
+
+int sum_Merge(void *ctx, RSValue *state) {
+  struct sumCtx *ctr = ctx;
+  double total = 0, count = 0;
+  if (ctr->isAvg) {
+    if (state->t != RSValue_Array || RSValue_ArrayLen(state) != 2 ||
+        !RSValue_ToNumber(RSValue_ArrayItem(state, 0), &total) ||
+        !RSValue_ToNumber(RSValue_ArrayItem(state, 1), &count)) {
+      return 0;
+    }
+  } else if (!RSValue_ToNumber(state, &total)) {
+    return 0;
+  }
+  ctr->total += total;
+  ctr->count += (size_t)count;
+  return 1;
+}
+
 void sum_FreeInstance(void *p) {
   struct sumCtx *c = p;
   free(c);
@@ -57,9 +85,11 @@ void sum_FreeInstance(void *p) {
 
 static int sentinel =  0;
 Reducer *newSumCommon(RedisSearchCtx *ctx, const char *property, const char *alias, int isAvg) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = sum_Add;
   r->Finalize = sum_Finalize;
+  r->Serialize = sum_Serialize;
+  r->Merge = sum_Merge;
   r->Free = Reducer_GenericFreeWithStaticPrivdata;
   r->FreeInstance = NULL;
   r->NewInstance = sum_NewInstance;
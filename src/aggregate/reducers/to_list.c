@@ -14,32 +14,42 @@ void *tolist_NewInstance(ReducerCtx *rctx) {
   return ctx;
 }
 
-int tolist_Add(void *ctx, SearchResult *res) {
-  struct tolistCtx *tlc = ctx;
+static void tolist_addValue(struct tolistCtx *tlc, RSValue *v) {
+  // for non array values we simply add the value to the list */
+  if (v->t != RSValue_Array) {
+    uint64_t hval = RSValue_Hash(v, 0);
+    if (TrieMap_Find(tlc->values, (char *)&hval, sizeof(hval)) == TRIEMAP_NOTFOUND) {
 
-  RSValue *v = SearchResult_GetValue(res, tlc->sortables, &tlc->property);
-  if (v) {
-    // for non array values we simply add the value to the list */
-    if (v->t != RSValue_Array) {
-      uint64_t hval = RSValue_Hash(v, 0);
+      TrieMap_Add(tlc->values, (char *)&hval, sizeof(hval),
+                  RSValue_IncrRef(RSValue_MakePersistent(v)), NULL);
+    }
+  } else {  // For array values we add each distinct element to the list
+    uint32_t len = RSValue_ArrayLen(v);
+    for (uint32_t i = 0; i < len; i++) {
+      RSValue *av = RSValue_ArrayItem(v, i);
+      uint64_t hval = RSValue_Hash(av, 0);
       if (TrieMap_Find(tlc->values, (char *)&hval, sizeof(hval)) == TRIEMAP_NOTFOUND) {
 
         TrieMap_Add(tlc->values, (char *)&hval, sizeof(hval),
-                    RSValue_IncrRef(RSValue_MakePersistent(v)), NULL);
-      }
-    } else {  // For array values we add each distinct element to the list
-      uint32_t len = RSValue_ArrayLen(v);
-      for (uint32_t i = 0; i < len; i++) {
-        RSValue *av = RSValue_ArrayItem(v, i);
-        uint64_t hval = RSValue_Hash(av, 0);
-        if (TrieMap_Find(tlc->values, (char *)&hval, sizeof(hval)) == TRIEMAP_NOTFOUND) {
-
-          TrieMap_Add(tlc->values, (char *)&hval, sizeof(hval),
-                      RSValue_IncrRef(RSValue_MakePersistent(av)), NULL);
-        }
+                    RSValue_IncrRef(RSValue_MakePersistent(av)), NULL);
       }
     }
   }
+}
+
+int tolist_Add(void *ctx, SearchResult *res) {
+  struct tolistCtx *tlc = ctx;
+
+  RSValue *v = SearchResult_GetValue(res, tlc->sortables, &tlc->property);
+  if (v) {
+    tolist_addValue(tlc, v);
+  }
+  return 1;
+}
+
+// the partial state of a list is the list itself, and merging it adds its distinct elements
+int tolist_Merge(void *ctx, RSValue *state) {
+  tolist_addValue(ctx, state);
   return 1;
 }
 
@@ -74,9 +84,11 @@ void tolist_FreeInstance(void *p) {
 }
 
 Reducer *NewToList(RedisSearchCtx *sctx, const char *property, const char *alias) {
-  Reducer *r = malloc(sizeof(*r));
+  Reducer *r = calloc(1, sizeof(*r));
   r->Add = tolist_Add;
   r->Finalize = tolist_Finalize;
+  r->Serialize = tolist_Finalize;
+  r->Merge = tolist_Merge;
   r->Free = Reducer_GenericFree;
   r->FreeInstance = tolist_FreeInstance;
   r->NewInstance = tolist_NewInstance;
@@ -0,0 +1,202 @@
+#include "bitpack.h"
+#include <string.h>
+#include <sys/param.h>
+
+#define GROUP_HEADER_SIZE 4
+#define PACKED_BYTES(n, bits) (((n) * (bits) + 7) / 8)
+
+static inline unsigned bitWidth(uint32_t v) {
+  return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* The layout of a group of deltas: the width its deltas are packed at, and the deltas that don't
+ * fit in it */
+typedef struct {
+  unsigned bits;
+  unsigned numExceptions;
+  unsigned exceptionBits;
+} groupLayout;
+
+/* Pick the width that packs the group in the fewest bytes. A few large deltas would force all of
+ * the others to be as wide as them, so they are stored as exceptions instead - the width only
+ * holds their low bits, and their high bits are packed separately after the group */
+static groupLayout groupChooseLayout(const uint32_t *deltas, size_t len) {
+  size_t hist[33] = {0};
+  unsigned maxBits = 0;
+  for (size_t i = 0; i < len; i++) {
+    unsigned w = bitWidth(deltas[i]);
+    hist[w]++;
+    maxBits = MAX(maxBits, w);
+  }
+
+  groupLayout best = {.bits = maxBits};
+  size_t bestSize = PACKED_BYTES(len, maxBits);
+  size_t numExceptions = 0;
+  for (int b = (int)maxBits - 1; b >= 0; b--) {
+    numExceptions += hist[b + 1];
+    // every exception takes a position byte and its high bits
+    size_t sz = PACKED_BYTES(len, b) + numExceptions + PACKED_BYTES(numExceptions, maxBits - b);
+    if (sz < bestSize) {
+      bestSize = sz;
+      best = (groupLayout){
+          .bits = b, .numExceptions = numExceptions, .exceptionBits = maxBits - b};
+    }
+  }
+  return best;
+}
+
+static inline size_t groupSize(size_t len, groupLayout l) {
+  return GROUP_HEADER_SIZE + PACKED_BYTES(len, l.bits) + l.numExceptions +
+         PACKED_BYTES(l.numExceptions, l.exceptionBits);
+}
+
+/* Compute the deltas of the group starting at ids, and return its length */
+static inline size_t groupDeltas(const t_docId *ids, size_t n, t_docId base, uint32_t *deltas) {
+  size_t len = MIN(n, BITPACK_GROUP_SIZE);
+  for (size_t i = 0; i < len; i++) {
+    deltas[i] = ids[i] - base;
+    base = ids[i];
+  }
+  return len;
+}
+
+/* Pack the low bits of values[0..n) into out. Returns the number of bytes written */
+static size_t pack(const uint32_t *values, size_t n, unsigned bits, uint8_t *out) {
+  const uint64_t mask = (1ULL << bits) - 1;
+  uint8_t *p = out;
+  uint64_t acc = 0;
+  unsigned accBits = 0;
+  for (size_t i = 0; i < n; i++) {
+    acc |= (values[i] & mask) << accBits;
+    accBits += bits;
+    while (accBits >= 8) {
+      *p++ = acc;
+      acc >>= 8;
+      accBits -= 8;
+    }
+  }
+  if (accBits) {
+    *p++ = acc;
+  }
+  return p - out;
+}
+
+/* Unpack n values of the given width from [p, end) into out. Returns the number of bytes read */
+static size_t unpack(const uint8_t *p, const uint8_t *end, size_t n, unsigned bits,
+                     t_docId *out) {
+  if (!bits) {
+    memset(out, 0, n * sizeof(*out));
+    return 0;
+  }
+
+  const uint64_t mask = (1ULL << bits) - 1;
+  size_t i = 0;
+  // As long as a whole word can be loaded without reading past the buffer, every value is taken
+  // from an unaligned load at its bit offset. A value spans at most 5 bytes from there
+  for (; i < n; i++) {
+    size_t off = i * bits;
+    if ((off >> 3) + sizeof(uint64_t) > (size_t)(end - p)) break;
+    uint64_t word;
+    memcpy(&word, p + (off >> 3), sizeof(word));
+    out[i] = (word >> (off & 7)) & mask;
+  }
+
+  // The last few values of the buffer are read a byte at a time
+  if (i < n) {
+    size_t off = i * bits;
+    const uint8_t *q = p + (off >> 3);
+    uint64_t acc = *q++ >> (off & 7);
+    unsigned accBits = 8 - (off & 7);
+    for (; i < n; i++) {
+      while (accBits < bits) {
+        acc |= (uint64_t)*q++ << accBits;
+        accBits += 8;
+      }
+      out[i] = acc & mask;
+      acc >>= bits;
+      accBits -= bits;
+    }
+  }
+  return PACKED_BYTES(n, bits);
+}
+
+size_t PackedDeltasSize(const t_docId *ids, size_t n, t_docId base) {
+  uint32_t deltas[BITPACK_GROUP_SIZE];
+  size_t sz = 0;
+  for (size_t g = 0; g < n; g += BITPACK_GROUP_SIZE) {
+    size_t len = groupDeltas(ids + g, n - g, base, deltas);
+    sz += groupSize(len, groupChooseLayout(deltas, len));
+    base = ids[g + len - 1];
+  }
+  return sz;
+}
+
+size_t WritePackedDeltas(const t_docId *ids, size_t n, t_docId base, BufferWriter *w) {
+  uint32_t deltas[BITPACK_GROUP_SIZE];
+  uint32_t high[BITPACK_GROUP_SIZE];
+  uint8_t group[GROUP_HEADER_SIZE + BITPACK_GROUP_SIZE * (2 * sizeof(uint32_t) + 1)];
+  size_t sz = 0;
+  for (size_t g = 0; g < n; g += BITPACK_GROUP_SIZE) {
+    size_t len = groupDeltas(ids + g, n - g, base, deltas);
+    base = ids[g + len - 1];
+    groupLayout l = groupChooseLayout(deltas, len);
+
+    group[0] = len - 1;
+    group[1] = l.bits;
+    group[2] = l.numExceptions;
+    group[3] = l.exceptionBits;
+    size_t pos = GROUP_HEADER_SIZE;
+    pos += pack(deltas, len, l.bits, group + pos);
+    if (l.numExceptions) {
+      size_t e = 0;
+      for (size_t i = 0; i < len; i++) {
+        if (deltas[i] >> l.bits) {
+          group[pos++] = i;
+          high[e++] = deltas[i] >> l.bits;
+        }
+      }
+      pos += pack(high, e, l.exceptionBits, group + pos);
+    }
+    sz += Buffer_Write(w, group, pos);
+  }
+  return sz;
+}
+
+size_t PackedDeltasCount(const uint8_t *p, const uint8_t *end) {
+  size_t n = 0;
+  while (p < end) {
+    size_t len = (size_t)p[0] + 1;
+    groupLayout l = {.bits = p[1], .numExceptions = p[2], .exceptionBits = p[3]};
+    p += groupSize(len, l);
+    n += len;
+  }
+  return n;
+}
+
+size_t ReadPackedDeltas(const uint8_t *p, const uint8_t *end, t_docId base, t_docId *out) {
+  t_docId high[BITPACK_GROUP_SIZE];
+  size_t n = 0;
+  while (p < end) {
+    size_t len = (size_t)p[0] + 1;
+    unsigned bits = p[1], numExceptions = p[2], exceptionBits = p[3];
+    p += GROUP_HEADER_SIZE;
+    t_docId *o = out + n;
+    n += len;
+
+    p += unpack(p, end, len, bits, o);
+    if (numExceptions) {
+      const uint8_t *positions = p;
+      p += numExceptions;
+      p += unpack(p, end, numExceptions, exceptionBits, high);
+      for (unsigned e = 0; e < numExceptions; e++) {
+        o[positions[e]] |= high[e] << bits;
+      }
+    }
+
+    for (size_t i = 0; i < len; i++) {
+      base += o[i];
+      o[i] = base;
+    }
+  }
+  return n;
+}
@@ -0,0 +1,37 @@
+#ifndef __BITPACK_H__
+#define __BITPACK_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "buffer.h"
+#include "redisearch.h"
+
+/* Bit-packed runs of increasing docIds.
+ *
+ * The ids are stored as deltas, each from the one before it, in groups of up to BITPACK_GROUP_SIZE.
+ * A group starts with a 4 byte header - the number of deltas in it minus one, the width they are
+ * packed at, the number of exceptions and the width of their high bits. Then come the low bits of
+ * all of the deltas, least significant first, and for the exceptions - the few deltas that are wider
+ * than the rest - their positions in the group, one byte each, and their high bits, packed.
+ * Dense runs take a fraction of a byte per id where a varint takes at least one, and decoding a
+ * group does not branch on every byte */
+
+#define BITPACK_GROUP_SIZE 128
+
+/* The number of bytes WritePackedDeltas takes to write ids[0..n) from base. Each delta must fit
+ * in 32 bits */
+size_t PackedDeltasSize(const t_docId *ids, size_t n, t_docId base);
+
+/* Write the deltas of ids[0..n) - the first from base, and the rest from the id before them.
+ * Returns the number of bytes written */
+size_t WritePackedDeltas(const t_docId *ids, size_t n, t_docId base, BufferWriter *w);
+
+/* The number of ids packed in [p, end), without decoding them */
+size_t PackedDeltasCount(const uint8_t *p, const uint8_t *end);
+
+/* Decode the packed groups in [p, end) into absolute ids, starting from base, see
+ * ReadVarintDeltas. The output array must be able to hold PackedDeltasCount(p, end) values.
+ * Returns the number of ids decoded */
+size_t ReadPackedDeltas(const uint8_t *p, const uint8_t *end, t_docId base, t_docId *out);
+
+#endif
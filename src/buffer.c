@@ -76,7 +76,7 @@ inline size_t Buffer_ReadByte(BufferReader *br, char *c) {
   // if (BufferAtEnd(b)) {
   //     return 0;
   // }
-  *c = br->buf->data[br->pos++];
+  *c = BUFFER_READ_BYTE(br);
   //++b->buf->offset;
   return 1;
 }
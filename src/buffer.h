@@ -22,7 +22,14 @@ typedef struct {
   size_t pos;
 } BufferReader;
 
-#define BUFFER_READ_BYTE(br) br->buf->data[br->pos++]
+/* The data of the buffer a reader reads. Index block buffers are appended to while queries read them
+ * without the lock - when the writer runs out of room it copies the data to a larger allocation and
+ * publishes it, so readers load the pointer for every read, see epoch.h */
+static inline char *BufferReader_Data(const BufferReader *br) {
+  return __atomic_load_n(&br->buf->data, __ATOMIC_ACQUIRE);
+}
+
+#define BUFFER_READ_BYTE(br) BufferReader_Data(br)[br->pos++]
 //++b->buf->offset;
 
 void Buffer_Init(Buffer *b, size_t cap);
@@ -39,7 +46,7 @@ static inline size_t Buffer_Read(BufferReader *br, void *data, size_t len) {
   //   return 0;
   // }
 
-  memcpy(data, br->buf->data + br->pos, len);
+  memcpy(data, BufferReader_Data(br) + br->pos, len);
   br->pos += len;
   // b->offset += len;
 
@@ -59,8 +66,9 @@ static inline size_t Buffer_Offset(const Buffer *ctx) {
   return ctx->offset;
 }
 
+/* The offset is only moved past a record once it is fully written, see BufferReader_Data */
 static inline int BufferReader_AtEnd(const BufferReader *br) {
-  return br->pos >= br->buf->offset;
+  return br->pos >= __atomic_load_n(&br->buf->offset, __ATOMIC_ACQUIRE);
 }
 
 static inline size_t Buffer_Capacity(const Buffer *ctx) {
@@ -146,7 +154,7 @@ BufferWriter NewBufferWriter(Buffer *b);
 BufferReader NewBufferReader(Buffer *b);
 
 static inline char *BufferReader_Current(BufferReader *b) {
-  return b->buf->data + b->pos;
+  return BufferReader_Data(b) + b->pos;
 }
 
 static inline size_t BufferWriter_Offset(BufferWriter *b) {
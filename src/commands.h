@@ -9,6 +9,7 @@
 #define RS_CREATE_CMD RS_CMD_PREFIX ".CREATE"
 #define RS_ADD_CMD RS_CMD_PREFIX ".ADD"
 #define RS_SAFEADD_CMD RS_CMD_PREFIX ".SAFEADD"
+#define RS_MADD_CMD RS_CMD_PREFIX ".MADD"
 #define RS_SETPAYLOAD_CMD RS_CMD_PREFIX ".SETPAYLOAD"
 #define RS_ADDHASH_CMD RS_CMD_PREFIX ".ADDHASH"
 #define RS_SAFEADDHASH_CMD RS_CMD_PREFIX ".SAFEADDHASH"
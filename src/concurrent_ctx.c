@@ -106,7 +106,7 @@ static void ConcurrentSearch_CloseKeys(ConcurrentSearchCtx *ctx) {
   size_t sz = ctx->numOpenKeys;
   for (size_t i = 0; i < sz; i++) {
     if (ctx->openKeys[i].key &&  // if this is a shared key, don't do anything
-        !(ctx->openKeys[i].opts & ConcurrentKey_SharedKey)) {
+        !(ctx->openKeys[i].opts & (ConcurrentKey_SharedKey | ConcurrentKey_ResumeOnly))) {
       RedisModule_CloseKey(ctx->openKeys[i].key);
     }
   }
@@ -116,6 +116,7 @@ void ConcurrentSearchCtx_ReopenKeys(ConcurrentSearchCtx *ctx) {
   size_t sz = ctx->numOpenKeys;
   for (size_t i = 0; i < sz; i++) {
     ConcurrentKeyCtx *kx = &ctx->openKeys[i];
+    if (kx->opts & ConcurrentKey_ResumeOnly) continue;
     kx->key = RedisModule_OpenKey(ctx->ctx, kx->keyName, kx->keyFlags);
     // if the key is marked as shared, make sure it isn't now
     kx->opts &= ~ConcurrentKey_SharedKey;
@@ -123,25 +124,58 @@ void ConcurrentSearchCtx_ReopenKeys(ConcurrentSearchCtx *ctx) {
   }
 }
 
-/** Check the elapsed timer, and release the lock if enough time has passed */
-int ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
-  static struct timespec now;
+void ConcurrentSearchCtx_ResumeKeys(ConcurrentSearchCtx *ctx) {
+  ConcurrentSearchCtx_ReopenKeys(ctx);
+  for (size_t i = 0; i < ctx->numOpenKeys; i++) {
+    ConcurrentKeyCtx *kx = &ctx->openKeys[i];
+    if (!(kx->opts & ConcurrentKey_ResumeOnly)) continue;
+    RedisModuleKey *k = RedisModule_OpenKey(ctx->ctx, kx->keyName, kx->keyFlags);
+    kx->cb(k, kx->privdata);
+    if (k) RedisModule_CloseKey(k);
+  }
+}
+
+void ConcurrentSearchCtx_Release(ConcurrentSearchCtx *ctx) {
+  ConcurrentSearchCtx_Unlock(ctx);
+  ctx->released = 1;
+}
+
+void ConcurrentSearchCtx_Reacquire(ConcurrentSearchCtx *ctx) {
+  ctx->released = 0;
+  ConcurrentSearchCtx_Lock(ctx);
+  ConcurrentSearchCtx_ResetClock(ctx);
+}
+
+int ConcurrentSearch_TimerExpired(ConcurrentSearchCtx *ctx) {
+  // we don't hold the lock, so there is nothing to let go of
+  if (ctx->released) return 0;
+
+  struct timespec now;
   clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
   long long durationNS = (long long)1000000000 * (now.tv_sec - ctx->lastTime.tv_sec) +
                          (now.tv_nsec - ctx->lastTime.tv_nsec);
+  return durationNS > CONCURRENT_TIMEOUT_NS;
+}
+
+void ConcurrentSearch_Switch(ConcurrentSearchCtx *ctx) {
+  ConcurrentSearchCtx_Unlock(ctx);
+
+  // Right after releasing, we try to acquire the lock again.
+  // If other threads are waiting on it, the kernel will decide which one
+  // will get the chance to run again. Calling sched_yield is not necessary here.
+  // See http://blog.firetree.net/2005/06/22/thread-yield-after-mutex-unlock/
+  ConcurrentSearchCtx_Lock(ctx);
+  // Right after re-acquiring the lock, we sample the current time.
+  // This will be used to calculate the elapsed running time
+  ConcurrentSearchCtx_ResetClock(ctx);
+}
+
+/** Check the elapsed timer, and release the lock if enough time has passed */
+int ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
   // Timeout - release the thread safe context lock and let other threads run as well
-  if (durationNS > CONCURRENT_TIMEOUT_NS) {
-    ConcurrentSearchCtx_Unlock(ctx);
-
-    // Right after releasing, we try to acquire the lock again.
-    // If other threads are waiting on it, the kernel will decide which one
-    // will get the chance to run again. Calling sched_yield is not necessary here.
-    // See http://blog.firetree.net/2005/06/22/thread-yield-after-mutex-unlock/
-    ConcurrentSearchCtx_Lock(ctx);
-    // Right after re-acquiring the lock, we sample the current time.
-    // This will be used to calculate the elapsed running time
-    ConcurrentSearchCtx_ResetClock(ctx);
+  if (ConcurrentSearch_TimerExpired(ctx)) {
+    ConcurrentSearch_Switch(ctx);
     return 1;
   }
   return 0;
@@ -156,6 +190,7 @@ void ConcurrentSearchCtx_ResetClock(ConcurrentSearchCtx *ctx) {
 void ConcurrentSearchCtx_Init(RedisModuleCtx *rctx, ConcurrentSearchCtx *ctx) {
   ctx->ctx = rctx;
   ctx->isLocked = 0;
+  ctx->released = 0;
   ctx->numOpenKeys = 0;
   ctx->openKeys = NULL;
   ConcurrentSearchCtx_ResetClock(ctx);
@@ -165,6 +200,7 @@ void ConcurrentSearchCtx_InitSingle(ConcurrentSearchCtx *ctx, RedisModuleCtx *rc
                                     ConcurrentReopenCallback cb) {
   ctx->ctx = rctx;
   ctx->isLocked = 0;
+  ctx->released = 0;
   ctx->numOpenKeys = 1;
   ctx->openKeys = calloc(1, sizeof(*ctx->openKeys));
   ctx->openKeys->cb = cb;
@@ -177,7 +213,7 @@ void ConcurrentSearchCtx_Free(ConcurrentSearchCtx *ctx) {
 
     if (ctx->isLocked && ctx->openKeys[i].key &&
         // if this is a shared key, don't do anything
-        !(ctx->openKeys[i].opts & ConcurrentKey_SharedKey)) {
+        !(ctx->openKeys[i].opts & (ConcurrentKey_SharedKey | ConcurrentKey_ResumeOnly))) {
       RedisModule_CloseKey(ctx->openKeys[i].key);
     }
     // If the key name is a shared string, don't do anything
@@ -210,6 +246,13 @@ void ConcurrentSearch_AddKey(ConcurrentSearchCtx *ctx, RedisModuleKey *key, int
                              RedisModuleString *keyName, ConcurrentReopenCallback cb,
                              void *privdata, void (*freePrivDataCallback)(void *),
                              ConcurrentKeyOptions opts) {
+  // a key that is not held open is closed right away, unless it is someone else's
+  if ((opts & ConcurrentKey_ResumeOnly) && key) {
+    if (!(opts & ConcurrentKey_SharedKey)) {
+      RedisModule_CloseKey(key);
+    }
+    key = NULL;
+  }
   ctx->numOpenKeys++;
   ctx->openKeys = realloc(ctx->openKeys, ctx->numOpenKeys * sizeof(ConcurrentKeyCtx));
   ctx->openKeys[ctx->numOpenKeys - 1] = (ConcurrentKeyCtx){.key = key,
@@ -40,6 +40,11 @@ typedef enum {
   // the key itself is shared and should not be deleted.
   // this may be rewritten on reopening
   ConcurrentKey_SharedKey = 0x02,
+
+  // the key is not held open while the query runs. Its holder reads memory that is kept alive by
+  // the query's epoch pin (see epoch.h), and only needs to check the key when a paused query is
+  // resumed, see ConcurrentSearchCtx_ResumeKeys
+  ConcurrentKey_ResumeOnly = 0x04,
 } ConcurrentKeyOptions;
 /* ConcurrentKeyCtx is a reference to a key that's being held open during concurrent execution and
  * needs to be reopened after yielding and gaining back execution. See ConcurrentSearch_AddKey for
@@ -66,6 +71,8 @@ typedef struct {
   ConcurrentKeyCtx *openKeys;
   uint32_t numOpenKeys;
   uint32_t isLocked;
+  // set while the query runs without the lock, see ConcurrentSearchCtx_Release
+  uint32_t released;
 } ConcurrentSearchCtx;
 
 /** The maximal size of the concurrent query thread pool. Since only one thread is operational at a
@@ -138,6 +145,12 @@ void ConcurrentSearch_ThreadPoolRun(void (*func)(void *), void *arg, int type);
  */
 int ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx);
 
+/** Return 1 if the lock was held long enough to let other threads run */
+int ConcurrentSearch_TimerExpired(ConcurrentSearchCtx *ctx);
+
+/** Release the lock and take it again, reopening the keys */
+void ConcurrentSearch_Switch(ConcurrentSearchCtx *ctx);
+
 /** Initialize and reset a concurrent search ctx */
 void ConcurrentSearchCtx_Init(RedisModuleCtx *rctx, ConcurrentSearchCtx *ctx);
 
@@ -160,6 +173,18 @@ void ConcurrentSearchCtx_Unlock(ConcurrentSearchCtx *ctx);
 
 void ConcurrentSearchCtx_ReopenKeys(ConcurrentSearchCtx *ctx);
 
+/* Reopen the held keys, and check the keys that are not held open (ConcurrentKey_ResumeOnly) - each
+ * one is opened, its callback is called and it is closed again. Called when a paused query is
+ * resumed */
+void ConcurrentSearchCtx_ResumeKeys(ConcurrentSearchCtx *ctx);
+
+/* Close the held keys and release the lock, for a stretch of the query that only reads memory kept
+ * alive by its epoch pin. The lock is not switched while released, see ConcurrentSearch_CheckTimer */
+void ConcurrentSearchCtx_Release(ConcurrentSearchCtx *ctx);
+
+/* Take the lock back after ConcurrentSearchCtx_Release and reopen the held keys */
+void ConcurrentSearchCtx_Reacquire(ConcurrentSearchCtx *ctx);
+
 struct ConcurrentCmdCtx;
 typedef void (*ConcurrentCmdHandler)(RedisModuleCtx *, RedisModuleString **, int,
                                      struct ConcurrentCmdCtx *);
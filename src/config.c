@@ -109,6 +109,67 @@ int ReadConfig(RedisModuleString **argv, int argc, const char **err) {
     }
   }
 
+  const char *gcPolicy = NULL;
+  RMUtil_ParseArgsAfter("GC_POLICY", argv, argc, "c", &gcPolicy);
+  if (gcPolicy != NULL) {
+    if (!strcasecmp(gcPolicy, "DEFAULT")) {
+      RSGlobalConfig.gcPolicy = GCPolicy_Default;
+    } else if (!strcasecmp(gcPolicy, "FORK")) {
+      RSGlobalConfig.gcPolicy = GCPolicy_Fork;
+    } else {
+      *err = "Invalid GC_POLICY value";
+      return REDISMODULE_ERR;
+    }
+  }
+
+  if (argc >= 2 && RMUtil_ArgIndex("FORK_GC_RUN_INTERVAL", argv, argc) >= 0) {
+    RMUtil_ParseArgsAfter("FORK_GC_RUN_INTERVAL", argv, argc, "l",
+                          &RSGlobalConfig.forkGcRunIntervalSec);
+    if (RSGlobalConfig.forkGcRunIntervalSec <= 0) {
+      *err = "Invalid FORK_GC_RUN_INTERVAL value";
+      return REDISMODULE_ERR;
+    }
+  }
+
+  if (argc >= 2 && RMUtil_ArgIndex("MAXBLOCKSIZE", argv, argc) >= 0) {
+    long long blockSize = 0;
+    RMUtil_ParseArgsAfter("MAXBLOCKSIZE", argv, argc, "l", &blockSize);
+    if (blockSize < MIN_INDEX_BLOCK_SIZE || blockSize > MAX_INDEX_BLOCK_SIZE) {
+      *err = "Invalid MAXBLOCKSIZE value";
+      return REDISMODULE_ERR;
+    }
+    RSGlobalConfig.maxIndexBlockSize = blockSize;
+  }
+
+  if (argc >= 2 && RMUtil_ArgIndex("QUERY_WORKERS", argv, argc) >= 0) {
+    long long workers = 0;
+    RMUtil_ParseArgsAfter("QUERY_WORKERS", argv, argc, "l", &workers);
+    if (workers < 1 || workers > MAX_QUERY_WORKERS) {
+      *err = "Invalid QUERY_WORKERS value";
+      return REDISMODULE_ERR;
+    }
+    RSGlobalConfig.queryWorkers = workers;
+  }
+
+  if (argc >= 2 && RMUtil_ArgIndex("AGGREGATE_MEMORY_BUDGET", argv, argc) >= 0) {
+    long long budget = 0;
+    RMUtil_ParseArgsAfter("AGGREGATE_MEMORY_BUDGET", argv, argc, "l", &budget);
+    if (budget < 0) {
+      *err = "Invalid AGGREGATE_MEMORY_BUDGET value";
+      return REDISMODULE_ERR;
+    }
+    RSGlobalConfig.aggregateMemoryBudget = budget;
+  }
+
+  if (argc >= 2 && RMUtil_ArgIndex("INDEXER_LINGER", argv, argc) >= 0) {
+    RMUtil_ParseArgsAfter("INDEXER_LINGER", argv, argc, "l", &RSGlobalConfig.indexerLingerUS);
+    if (RSGlobalConfig.indexerLingerUS < 0 ||
+        RSGlobalConfig.indexerLingerUS > MAX_INDEXER_LINGER_US) {
+      *err = "Invalid INDEXER_LINGER value";
+      return REDISMODULE_ERR;
+    }
+  }
+
   return REDISMODULE_OK;
 }
 
@@ -117,6 +178,10 @@ sds RSConfig_GetInfoString(const RSConfig *config) {
 
   ss = sdscatprintf(ss, "concurrency: %s, ", config->concurrentMode ? "ON" : "OFF(SAFEMODE)");
   ss = sdscatprintf(ss, "gc: %s, ", config->enableGC ? "ON" : "OFF");
+  ss = sdscatprintf(ss, "gc policy: %s, ", GCPolicy_ToString(config->gcPolicy));
+  if (config->gcPolicy == GCPolicy_Fork) {
+    ss = sdscatprintf(ss, "fork gc run interval (s): %lld, ", config->forkGcRunIntervalSec);
+  }
   ss = sdscatprintf(ss, "prefix min length: %lld, ", config->minTermPrefix);
   ss = sdscatprintf(ss, "prefix max expansions: %lld, ", config->maxPrefixExpansions);
   ss = sdscatprintf(ss, "query timeout (ms): %lld, ", config->queryTimeoutMS);
@@ -126,6 +191,10 @@ sds RSConfig_GetInfoString(const RSConfig *config) {
   ss = sdscatprintf(ss, "max doctable size: %lu, ", config->maxDocTableSize);
   ss = sdscatprintf(ss, "search pool size: %lu, ", config->searchPoolSize);
   ss = sdscatprintf(ss, "index pool size: %lu, ", config->indexPoolSize);
+  ss = sdscatprintf(ss, "max index block size: %lu, ", config->maxIndexBlockSize);
+  ss = sdscatprintf(ss, "query workers: %lu, ", config->queryWorkers);
+  ss = sdscatprintf(ss, "aggregate memory budget: %lu, ", config->aggregateMemoryBudget);
+  ss = sdscatprintf(ss, "indexer linger (us): %lld, ", config->indexerLingerUS);
 
   if (config->extLoad) {
     ss = sdscatprintf(ss, "ext load: %s, ", config->extLoad);
@@ -21,6 +21,20 @@ static inline const char *TimeoutPolicy_ToString(RSTimeoutPolicy policy) {
   }
 }
 
+typedef enum {
+  GCPolicy_Default = 0,  // Repair a few random terms and ranges at a time, under the GIL
+  GCPolicy_Fork          // Scan all the indexes in a forked child, and apply its repairs
+} GCPolicy;
+
+static inline const char *GCPolicy_ToString(GCPolicy policy) {
+  switch (policy) {
+    case GCPolicy_Fork:
+      return "fork";
+    default:
+      return "default";
+  }
+}
+
 /* RSConfig is a global configuration struct for the module, it can be included from each file, and
  * is initialized with user config options during module statrtup */
 typedef struct {
@@ -58,6 +72,29 @@ typedef struct {
   int poolSizeNoAuto;  // Don't auto-detect pool size
 
   size_t gcScanSize;
+
+  // How the GC collects deleted documents from the indexes. Default: GCPolicy_Default
+  GCPolicy gcPolicy;
+
+  // The number of seconds between fork GC cycles, see GC_POLICY FORK. Default: 10
+  long long forkGcRunIntervalSec;
+
+  // The maximal number of entries in a single inverted index block. Frequent terms grow their
+  // blocks up to this size. Default: 4096
+  size_t maxIndexBlockSize;
+
+  // The number of threads a single large search query is split between, each scanning a range of
+  // document ids. 1 means queries always run on a single thread. Default: 1
+  size_t queryWorkers;
+
+  // The number of bytes a single aggregation may keep in memory for its GROUPBY and unbounded
+  // SORTBY steps, beyond which they spill to temporary files. 0 means unlimited. Default: 0
+  size_t aggregateMemoryBudget;
+
+  // The number of microseconds the indexer waits for more documents to be queued before it indexes
+  // a short queue, so that documents added one by one in quick succession are merged. 0 means
+  // queued documents are indexed right away. Default: 0
+  long long indexerLingerUS;
 } RSConfig;
 
 // global config extern reference
@@ -75,6 +112,12 @@ sds RSConfig_GetInfoString(const RSConfig *config);
 #define CONCURRENT_INDEX_POOL_DEFAULT_SIZE 8
 #define CONCURRENT_INDEX_MAX_POOL_SIZE 200  // Maximum number of threads to create
 #define GC_SCANSIZE 100
+#define DEFAULT_FORK_GC_RUN_INTERVAL 10
+#define DEFAULT_MAX_INDEX_BLOCK_SIZE 4096
+#define MIN_INDEX_BLOCK_SIZE 100
+#define MAX_INDEX_BLOCK_SIZE 65535  // IndexBlock.numDocs is 16 bit
+#define MAX_QUERY_WORKERS 64
+#define MAX_INDEXER_LINGER_US 1000000
 // default configuration
 #define RS_DEFAULT_CONFIG                                                                       \
   {                                                                                             \
@@ -83,7 +126,10 @@ sds RSConfig_GetInfoString(const RSConfig *config);
     .cursorReadSize = 1000, .cursorMaxIdle = 300000, .maxDocTableSize = DEFAULT_DOC_TABLE_SIZE, \
     .searchPoolSize = CONCURRENT_SEARCH_POOL_DEFAULT_SIZE,                                      \
     .indexPoolSize = CONCURRENT_INDEX_POOL_DEFAULT_SIZE, .poolSizeNoAuto = 0,                   \
-	.gcScanSize = GC_SCANSIZE                                      \
+	.gcScanSize = GC_SCANSIZE, .maxIndexBlockSize = DEFAULT_MAX_INDEX_BLOCK_SIZE,            \
+    .queryWorkers = 1, .gcPolicy = GCPolicy_Default,                                            \
+    .forkGcRunIntervalSec = DEFAULT_FORK_GC_RUN_INTERVAL, .aggregateMemoryBudget = 0,           \
+    .indexerLingerUS = 0                                                                        \
   }
 
 #endif
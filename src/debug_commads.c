@@ -150,6 +150,15 @@ static void DumpPhoneticHash(RedisModuleCtx *ctx, RedisModuleString *term) {
   free(secondary);
 }
 
+static void NumDeleted(RedisModuleCtx *ctx, RedisModuleString *indexName) {
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(indexName, NULL), 0);
+  if (!sp) {
+    RedisModule_ReplyWithError(ctx, "Unknown index name");
+    return;
+  }
+  RedisModule_ReplyWithLongLong(ctx, sp->docs.deleted.card);
+}
+
 int DebugCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
   const char *subCommand = NULL;
@@ -158,6 +167,8 @@ int DebugCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     subCommand = RedisModule_StringPtrLen(argv[1], NULL);
     if (strcmp(subCommand, DUMP_PHONETIC_HASH) == 0) {
       DumpPhoneticHash(ctx, argv[2]);
+    } else if (strcmp(subCommand, NUM_DELETED_COMMAND) == 0) {
+      NumDeleted(ctx, argv[2]);
     } else {
       RedisModule_ReplyWithError(ctx, "no such subcommand");
     }
@@ -19,6 +19,7 @@
 #define DUMP_TAGIDX_COMMAND "DUMP_TAGIDX"
 #define IDTODOCID_COMMAND "IDTODOCID"
 #define DOCIDTOID_COMMAND "DOCIDTOID"
+#define NUM_DELETED_COMMAND "NUM_DELETED"
 
 /**
  * debug command implementation
@@ -26,6 +27,7 @@
  * 1.  DUMP_INVIDX - which dump all doc ids in an inverted index
  * 2.  DUMP_NUMIDX - which dump all doc ids in a numeric index
  * 3.  DUMP_TAGIDX - which dump all doc ids in a tag index
+ * 4.  NUM_DELETED - the number of deleted documents whose postings the GC may not have collected
  *
  */
 int DebugCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
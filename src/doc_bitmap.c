@@ -0,0 +1,230 @@
+#include <string.h>
+#include "doc_bitmap.h"
+#include "index_result.h"
+#include "rmalloc.h"
+#include "epoch.h"
+
+void DocIdBitmap_Init(DocIdBitmap *b) {
+  b->table = NULL;
+  b->card = 0;
+}
+
+static void docIdBitmapTable_Free(void *p) {
+  DocIdBitmapTable *t = p;
+  for (uint32_t i = 0; i < t->numChunks; i++) {
+    rm_free(t->chunks[i]);
+  }
+  rm_free(t);
+}
+
+void DocIdBitmap_Clear(DocIdBitmap *b) {
+  if (b->table) {
+    docIdBitmapTable_Free(b->table);
+  }
+  DocIdBitmap_Init(b);
+}
+
+void DocIdBitmap_Reset(DocIdBitmap *b) {
+  DocIdBitmapTable *t = b->table;
+  Epoch_Publish(b->table, NULL);
+  b->card = 0;
+  if (t) {
+    Epoch_Retire(t, docIdBitmapTable_Free);
+  }
+}
+
+/* Only the chunk table is retired when it grows - the chunks move to the new one */
+static void retiredTable_Free(void *p) {
+  rm_free(p);
+}
+
+int DocIdBitmap_Set(DocIdBitmap *b, t_docId docId) {
+  size_t c = docId >> DOCBITMAP_CHUNK_SHIFT;
+  DocIdBitmapTable *t = b->table;
+  uint32_t numChunks = t ? t->numChunks : 0;
+  if (c >= numChunks) {
+    // grow the chunk table geometrically, new slots are empty chunks. Readers may be walking the
+    // old table, so it is copied rather than reallocated
+    uint32_t cap = numChunks ? numChunks : 1;
+    while (cap <= c) cap *= 2;
+    DocIdBitmapTable *grown = rm_calloc(1, sizeof(*grown) + cap * sizeof(*grown->chunks));
+    grown->numChunks = cap;
+    if (t) {
+      memcpy(grown->chunks, t->chunks, numChunks * sizeof(*t->chunks));
+    }
+    Epoch_Publish(b->table, grown);
+    if (t) {
+      Epoch_Retire(t, retiredTable_Free);
+    }
+    t = grown;
+  }
+  if (!t->chunks[c]) {
+    Epoch_Publish(t->chunks[c], rm_calloc(DOCBITMAP_CHUNK_WORDS, sizeof(uint64_t)));
+  }
+
+  uint32_t bit = docId & ((1 << DOCBITMAP_CHUNK_SHIFT) - 1);
+  uint64_t *w = &t->chunks[c][bit >> 6];
+  uint64_t mask = 1ULL << (bit & 63);
+  if (*w & mask) return 0;
+  __atomic_or_fetch(w, mask, __ATOMIC_RELAXED);
+  b->card++;
+  return 1;
+}
+
+int DocIdBitmap_Test(const DocIdBitmap *b, t_docId docId) {
+  size_t c = docId >> DOCBITMAP_CHUNK_SHIFT;
+  const DocIdBitmapTable *t = Epoch_Load(b->table);
+  if (!t || c >= t->numChunks) return 0;
+  const uint64_t *words = Epoch_Load(t->chunks[c]);
+  if (!words) return 0;
+  uint32_t bit = docId & ((1 << DOCBITMAP_CHUNK_SHIFT) - 1);
+  return (__atomic_load_n(&words[bit >> 6], __ATOMIC_RELAXED) >> (bit & 63)) & 1;
+}
+
+t_docId DocIdBitmap_Next(const DocIdBitmap *b, t_docId from) {
+  size_t c = from >> DOCBITMAP_CHUNK_SHIFT;
+  uint32_t bit = from & ((1 << DOCBITMAP_CHUNK_SHIFT) - 1);
+  const DocIdBitmapTable *t = Epoch_Load(b->table);
+  if (!t) return 0;
+
+  for (; c < t->numChunks; c++, bit = 0) {
+    const uint64_t *words = Epoch_Load(t->chunks[c]);
+    if (!words) continue;
+
+    uint32_t w = bit >> 6;
+    // mask out the bits below the starting position in the first word
+    uint64_t word = __atomic_load_n(&words[w], __ATOMIC_RELAXED) & (~0ULL << (bit & 63));
+    while (1) {
+      if (word) {
+        return ((t_docId)c << DOCBITMAP_CHUNK_SHIFT) | (w << 6) | __builtin_ctzll(word);
+      }
+      if (++w == DOCBITMAP_CHUNK_WORDS) break;
+      word = __atomic_load_n(&words[w], __ATOMIC_RELAXED);
+    }
+  }
+  return 0;
+}
+
+size_t DocIdBitmap_MemUsage(const DocIdBitmap *b) {
+  const DocIdBitmapTable *t = b->table;
+  size_t ret = sizeof(*b);
+  if (!t) return ret;
+  ret += sizeof(*t) + t->numChunks * sizeof(*t->chunks);
+  for (uint32_t i = 0; i < t->numChunks; i++) {
+    if (t->chunks[i]) ret += DOCBITMAP_CHUNK_WORDS * sizeof(uint64_t);
+  }
+  return ret;
+}
+
+typedef struct {
+  DocIdBitmap bm;
+  t_docId lastDocId;
+  int atEOF;
+  RSIndexResult *res;
+} BitmapIterator;
+
+static int BI_Read(void *ctx, RSIndexResult **r) {
+  BitmapIterator *it = ctx;
+  if (it->atEOF) return INDEXREAD_EOF;
+
+  t_docId next = DocIdBitmap_Next(&it->bm, it->lastDocId + 1);
+  if (!next) {
+    it->atEOF = 1;
+    return INDEXREAD_EOF;
+  }
+  it->lastDocId = it->res->docId = next;
+  *r = it->res;
+  return INDEXREAD_OK;
+}
+
+static int BI_SkipTo(void *ctx, t_docId docId, RSIndexResult **r) {
+  BitmapIterator *it = ctx;
+  if (it->atEOF) return INDEXREAD_EOF;
+
+  t_docId next = DocIdBitmap_Next(&it->bm, docId);
+  if (!next) {
+    it->atEOF = 1;
+    return INDEXREAD_EOF;
+  }
+  it->lastDocId = it->res->docId = next;
+  *r = it->res;
+  return next == docId ? INDEXREAD_OK : INDEXREAD_NOTFOUND;
+}
+
+static t_docId BI_LastDocId(void *ctx) {
+  return ((BitmapIterator *)ctx)->lastDocId;
+}
+
+static int BI_HasNext(void *ctx) {
+  return !((BitmapIterator *)ctx)->atEOF;
+}
+
+static RSIndexResult *BI_Current(void *ctx) {
+  return ((BitmapIterator *)ctx)->res;
+}
+
+static size_t BI_Len(void *ctx) {
+  return ((BitmapIterator *)ctx)->bm.card;
+}
+
+static void BI_Abort(void *ctx) {
+  ((BitmapIterator *)ctx)->atEOF = 1;
+}
+
+static void BI_Rewind(void *ctx) {
+  BitmapIterator *it = ctx;
+  it->atEOF = 0;
+  it->lastDocId = 0;
+  it->res->docId = 0;
+}
+
+static void BI_Free(struct indexIterator *self) {
+  BitmapIterator *it = self->ctx;
+  DocIdBitmap_Clear(&it->bm);
+  IndexResult_Free(it->res);
+  rm_free(it);
+  rm_free(self);
+}
+
+IndexIterator *NewBitmapIterator(DocIdBitmap *b, double weight) {
+  BitmapIterator *it = rm_new(BitmapIterator);
+  it->bm = *b;
+  DocIdBitmap_Init(b);
+  it->lastDocId = 0;
+  it->atEOF = 0;
+  it->res = NewVirtualResult(weight);
+  it->res->fieldMask = RS_FIELDMASK_ALL;
+
+  IndexIterator *ret = rm_new(IndexIterator);
+  ret->ctx = it;
+  ret->Free = BI_Free;
+  ret->HasNext = BI_HasNext;
+  ret->LastDocId = BI_LastDocId;
+  ret->Len = BI_Len;
+  ret->NumEstimated = BI_Len;
+  ret->Read = BI_Read;
+  ret->Current = BI_Current;
+  ret->SkipTo = BI_SkipTo;
+  ret->Abort = BI_Abort;
+  ret->Rewind = BI_Rewind;
+  return ret;
+}
+
+IndexIterator *NewBitmapUnionIterator(IndexIterator **its, int num, double weight) {
+  DocIdBitmap bm;
+  DocIdBitmap_Init(&bm);
+
+  for (int i = 0; i < num; i++) {
+    IndexIterator *child = its[i];
+    if (!child) continue;
+    RSIndexResult *r;
+    int rc;
+    while ((rc = child->Read(child->ctx, &r)) != INDEXREAD_EOF) {
+      if (rc == INDEXREAD_OK) DocIdBitmap_Set(&bm, r->docId);
+    }
+    child->Free(child);
+    its[i] = NULL;
+  }
+
+  return NewBitmapIterator(&bm, weight);
+}
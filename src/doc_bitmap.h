@@ -0,0 +1,60 @@
+#ifndef __DOC_BITMAP_H__
+#define __DOC_BITMAP_H__
+
+#include <stdint.h>
+#include "redisearch.h"
+#include "index_iterator.h"
+
+/* Each chunk of the bitmap covers 2^16 consecutive document ids */
+#define DOCBITMAP_CHUNK_SHIFT 16
+#define DOCBITMAP_CHUNK_WORDS ((1 << DOCBITMAP_CHUNK_SHIFT) / 64)
+
+/* The chunk table of a bitmap. It is replaced by a larger copy when the bitmap grows */
+typedef struct {
+  uint32_t numChunks;
+  uint64_t *chunks[];
+} DocIdBitmapTable;
+
+/* A set of document ids stored as a table of fixed size bitmap chunks, indexed directly by the high
+ * bits of the docId. Chunks are allocated lazily, so empty ranges of the id space cost a single
+ * NULL pointer. Membership tests and inserts are O(1), and finding the next set id only scans the
+ * words between the two ids.
+ *
+ * The doc table's bitmaps are read by queries without the lock while they are written to, see
+ * epoch.h. Readers load the table once, and the tables and chunks they may hold are retired rather
+ * than freed. A reader may miss ids that are added or see ids that are removed while it reads. */
+typedef struct {
+  DocIdBitmapTable *table;
+  size_t card;
+} DocIdBitmap;
+
+void DocIdBitmap_Init(DocIdBitmap *b);
+
+/* Release all the memory held by the bitmap, leaving it empty */
+void DocIdBitmap_Clear(DocIdBitmap *b);
+
+/* Empty a bitmap that queries may be reading. Its storage is retired rather than freed */
+void DocIdBitmap_Reset(DocIdBitmap *b);
+
+/* Add a docId to the set. Returns 1 if it was not already there */
+int DocIdBitmap_Set(DocIdBitmap *b, t_docId docId);
+
+/* Returns 1 if the docId is in the set */
+int DocIdBitmap_Test(const DocIdBitmap *b, t_docId docId);
+
+/* Return the smallest docId in the set that is >= from, or 0 if there is none */
+t_docId DocIdBitmap_Next(const DocIdBitmap *b, t_docId from);
+
+size_t DocIdBitmap_MemUsage(const DocIdBitmap *b);
+
+/* Create an iterator over the ids in a bitmap. The iterator takes ownership of the bitmap's
+ * storage, and yields virtual results with the given weight */
+IndexIterator *NewBitmapIterator(DocIdBitmap *b, double weight);
+
+/* Drain num child iterators into a bitmap and return an iterator over their union. The children
+ * are freed, but not the array holding them. The union loses the children's per-term records, so
+ * it should only be used when nothing downstream needs them (scoring, highlighting, slop checks).
+ * Children must not be registered with a concurrent search context, since they are freed here. */
+IndexIterator *NewBitmapUnionIterator(IndexIterator **its, int num, double weight);
+
+#endif
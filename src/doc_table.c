@@ -4,70 +4,35 @@
 #include <stdio.h>
 #include "redismodule.h"
 #include "util/fnv.h"
-#include "dep/triemap/triemap.h"
 #include "sortable.h"
 #include "rmalloc.h"
 #include "spec.h"
 #include "config.h"
 
+static void DocIdMap_Put(DocIdMap *m, RSDocumentKey key, t_docId docId);
+static t_docId DocIdMap_Get(const DocTable *t, RSDocumentKey key);
+static void DocIdMap_Delete(DocIdMap *m, RSDocumentKey key, t_docId docId);
+static void DocIdMap_Free(DocIdMap *m);
+
 /* Creates a new DocTable with a given capacity */
 DocTable NewDocTable(size_t cap, size_t max_size) {
-  return (DocTable){.size = 1,
-                    .cap = cap,
-                    .maxDocId = 0,
-                    .memsize = 0,
-                    .sortablesSize = 0,
-                    .maxSize = max_size,
-                    .buckets = rm_calloc(cap, sizeof(DMDChain)),
-                    .dim = NewDocIdMap()};
-}
-
-static inline uint32_t DocTable_GetBucket(const DocTable *t, t_docId docId) {
-  return docId < t->maxSize ? docId : docId % t->maxSize;
-}
-
-static inline int DocTable_ValidateDocId(const DocTable *t, t_docId docId) {
-  return docId != 0 && docId <= t->maxDocId;
-}
-
-/* Get the metadata for a doc Id from the DocTable.
- *  If docId is not inside the table, we return NULL */
-
-int DMDChain_IsEmpty(const DMDChain *dmdChain) {
-  return !dmdChain->last;
-}
-
-RSDocumentMetadata *DocTable_Get(const DocTable *t, t_docId docId) {
-  if (!DocTable_ValidateDocId(t, docId)) {
-    return NULL;
-  }
-  uint32_t bucketIndex = DocTable_GetBucket(t, docId);
-  DMDChain *dmdChain = &t->buckets[bucketIndex];
-  RSDocumentMetadata *currDmd = dmdChain->first;
-  while (currDmd) {
-    if (currDmd->id == docId) {
-      return currDmd;
-    }
-    currDmd = currDmd->next;
-  }
-  return NULL;
+  DocTable t = {.size = 1,
+                .maxDocId = 0,
+                .memsize = 0,
+                .sortablesSize = 0,
+                .maxSize = max_size,
+                .numPages = (cap >> DOCTABLE_PAGE_SHIFT) + 1,
+                .dim = {0}};
+  t.pages = rm_calloc(t.numPages, sizeof(DocTablePage));
+  DocIdBitmap_Init(&t.deleted);
+  DocIdBitmap_Init(&t.deletedSinceCollect);
+  t.collecting = 0;
+  return t;
 }
 
 int DocTable_Exists(const DocTable *t, t_docId docId) {
-  if (!docId || docId > t->maxDocId) {
-    return 0;
-  }
-  uint32_t ix = DocTable_GetBucket(t, docId);
-  const DMDChain *chain = t->buckets + ix;
-  if (chain == NULL) {
-    return 0;
-  }
-  for (const RSDocumentMetadata *md = chain->first; md; md = md->next) {
-    if (md->id == docId && !(md->flags & Document_Deleted)) {
-      return 1;
-    }
-  }
-  return 0;
+  const RSDocumentMetadata *md = DocTable_Get(t, docId);
+  return md && !(md->flags & Document_Deleted);
 }
 
 RSDocumentMetadata *DocTable_GetByKeyR(const DocTable *t, RedisModuleString *s) {
@@ -77,43 +42,83 @@ RSDocumentMetadata *DocTable_GetByKeyR(const DocTable *t, RedisModuleString *s)
   return DocTable_Get(t, id);
 }
 
+/* Free a page directory or page that was replaced, see Epoch_Retire */
+static void retiredArray_Free(void *p) {
+  rm_free(p);
+}
+
+/* Drop the table's reference to a deleted document, once no query can be looking it up */
+static void retiredDMD_Decref(void *p) {
+  DMD_Decref(p);
+}
+
+/* Queries may look documents up while we write, see DocTable_Get. Arrays are grown by copying them,
+ * publishing the copy and only then its size, so that readers that load the size first always get
+ * an array at least that large */
 static inline void DocTable_Set(DocTable *t, t_docId docId, RSDocumentMetadata *dmd) {
-  uint32_t bucket = DocTable_GetBucket(t, docId);
-  if (bucket >= t->cap && t->cap < t->maxSize) {
-    /* We have to grow the array capacity.
-     * We only grow till we reach maxSize, then we starts to add the dmds to
-     * the already existing chains.
-     */
-    size_t oldcap = t->cap;
-    // We grow by half of the current capacity with maximum of 1m
-    t->cap += 1 + (t->cap ? MIN(t->cap / 2, 1024 * 1024) : 1);
-    t->cap = MIN(t->cap, t->maxSize);  // make sure we do not excised maxSize
-    t->cap = MAX(t->cap, bucket + 1);  // docs[bucket] needs to be valid, so t->cap > bucket
-
-    t->buckets = rm_realloc(t->buckets, t->cap * sizeof(DMDChain));
-    for (; oldcap < t->cap; oldcap++) {
-      t->buckets[oldcap].first = NULL;
-      t->buckets[oldcap].last = NULL;
-    }
+  size_t page = docId >> DOCTABLE_PAGE_SHIFT;
+  if (page >= t->numPages) {
+    // ids only grow, so the directory is grown by half its size at a time
+    uint32_t oldNum = t->numPages;
+    uint32_t num = MAX(page + 1, oldNum + oldNum / 2);
+    DocTablePage *pages = rm_calloc(num, sizeof(DocTablePage));
+    DocTablePage *old = t->pages;
+    memcpy(pages, old, oldNum * sizeof(DocTablePage));
+    Epoch_Publish(t->pages, pages);
+    Epoch_Publish(t->numPages, num);
+    Epoch_Retire(old, retiredArray_Free);
   }
 
-  DMDChain *chain = &t->buckets[bucket];
+  DocTablePage *pg = &t->pages[page];
+  uint32_t slot = docId & DOCTABLE_PAGE_MASK;
+  if (slot >= pg->cap) {
+    // a page that was freed is allocated again at least as large as it was, since ids only grow.
+    // So readers that loaded its old capacity never index past the new allocation
+    uint32_t oldCap = pg->cap;
+    uint32_t cap = MAX(pg->cap, DOCTABLE_PAGE_MIN_CAP);
+    while (cap <= slot) cap *= 2;
+    RSDocumentMetadata **dmds = rm_calloc(cap, sizeof(RSDocumentMetadata *));
+    RSDocumentMetadata **old = pg->dmds;
+    if (old) {
+      memcpy(dmds, old, oldCap * sizeof(RSDocumentMetadata *));
+    }
+    Epoch_Publish(pg->dmds, dmds);
+    Epoch_Publish(pg->cap, cap);
+    if (old) {
+      Epoch_Retire(old, retiredArray_Free);
+    }
+    t->memsize += (cap - oldCap) * sizeof(RSDocumentMetadata *);
+  }
+  if (!pg->dmds[slot]) {
+    ++pg->count;
+  }
   DMD_Incref(dmd);
+  Epoch_Publish(pg->dmds[slot], dmd);
+}
 
-  // Adding the dmd to the chain
-  if (DMDChain_IsEmpty(chain)) {
-    chain->first = chain->last = dmd;
-  } else {
-    chain->last->next = dmd;
-    dmd->prev = chain->last;
-    dmd->next = NULL;
-    chain->last = dmd;
+/* Remove a document from its page, freeing the page if it was the last one in it */
+static void DocTable_Unset(DocTable *t, t_docId docId) {
+  DocTablePage *pg = &t->pages[docId >> DOCTABLE_PAGE_SHIFT];
+  Epoch_Publish(pg->dmds[docId & DOCTABLE_PAGE_MASK], NULL);
+  if (--pg->count == 0) {
+    t->memsize -= pg->cap * sizeof(RSDocumentMetadata *);
+    RSDocumentMetadata **old = pg->dmds;
+    // the capacity goes first, so readers never index past the page they load
+    Epoch_Publish(pg->cap, 0);
+    Epoch_Publish(pg->dmds, NULL);
+    Epoch_Retire(old, retiredArray_Free);
   }
 }
 
 /** Get the docId of a key if it exists in the table, or 0 if it doesnt */
 t_docId DocTable_GetId(const DocTable *dt, RSDocumentKey key) {
-  return DocIdMap_Get(&dt->dim, key);
+  return DocIdMap_Get(dt, key);
+}
+
+static void retiredPayload_Free(void *p) {
+  RSPayload *pl = p;
+  rm_free(pl->data);
+  rm_free(pl);
 }
 
 /* Set the payload for a document. Returns 1 if we set the payload, 0 if we couldn't find the
@@ -125,26 +130,28 @@ int DocTable_SetPayload(DocTable *t, t_docId docId, const char *data, size_t len
     return 0;
   }
 
-  /* If we already have metadata - clean up the old data */
-  if (dmd->payload) {
-    /* Free the old payload */
-    if (dmd->payload->data) {
-      rm_free(dmd->payload->data);
-    }
-    t->memsize -= dmd->payload->len;
-  } else {
-    dmd->payload = rm_malloc(sizeof(RSPayload));
+  /* Copy it... Queries may be reading the old payload, so it is replaced rather than rewritten */
+  RSPayload *pl = rm_malloc(sizeof(RSPayload));
+  pl->data = rm_calloc(1, len + 1);
+  pl->len = len;
+  memcpy(pl->data, data, len);
+
+  RSPayload *old = dmd->payload;
+  Epoch_Publish(dmd->payload, pl);
+  if (old) {
+    t->memsize -= old->len;
+    Epoch_Retire(old, retiredPayload_Free);
   }
-  /* Copy it... */
-  dmd->payload->data = rm_calloc(1, len + 1);
-  dmd->payload->len = len;
-  memcpy(dmd->payload->data, data, len);
 
   dmd->flags |= Document_HasPayload;
   t->memsize += len;
   return 1;
 }
 
+static void retiredSortingVector_Free(void *p) {
+  SortingVector_Free(p);
+}
+
 /* Set the sorting vector for a document. If the vector is NULL we mark the doc as not having a
  * vector. Returns 1 on success, 0 if the document does not exist. No further validation is done
  */
@@ -154,18 +161,24 @@ int DocTable_SetSortingVector(DocTable *t, t_docId docId, RSSortingVector *v) {
     return 0;
   }
 
+  // queries may be sorting by the old vector, so it is retired
+  RSSortingVector *old = dmd->sortVector;
+  if (old == v) {
+    return 1;
+  }
+  Epoch_Publish(dmd->sortVector, v);
+  if (old) {
+    t->sortablesSize -= RSSortingVector_GetMemorySize(old);
+    Epoch_Retire(old, retiredSortingVector_Free);
+  }
+
   /* Null vector means remove the current vector if it exists */
   if (!v) {
-    if (dmd->sortVector) {
-      SortingVector_Free(dmd->sortVector);
-    }
-    dmd->sortVector = NULL;
     dmd->flags &= ~Document_HasSortVector;
     return 1;
   }
 
   /* Set th new vector and the flags accordingly */
-  dmd->sortVector = v;
   dmd->flags |= Document_HasSortVector;
   t->sortablesSize += RSSortingVector_GetMemorySize(v);
 
@@ -190,7 +203,7 @@ int DocTable_SetByteOffsets(DocTable *t, t_docId docId, RSByteOffsets *v) {
 t_docId DocTable_Put(DocTable *t, RSDocumentKey key, double score, u_char flags,
                      const char *payload, size_t payloadSize) {
 
-  t_docId xid = DocIdMap_Get(&t->dim, key);
+  t_docId xid = DocIdMap_Get(t, key);
   // if the document is already in the index, return 0
   if (xid) {
     return 0;
@@ -270,42 +283,22 @@ void DMD_Free(RSDocumentMetadata *md) {
 }
 
 void DocTable_Free(DocTable *t) {
-  for (int i = 0; i < t->cap; ++i) {
-    DMDChain *chain = &t->buckets[i];
-    if (DMDChain_IsEmpty(chain)) {
+  for (uint32_t i = 0; i < t->numPages; ++i) {
+    RSDocumentMetadata **page = t->pages[i].dmds;
+    if (!page) {
       continue;
     }
-    RSDocumentMetadata *md = chain->first;
-    while (md) {
-      RSDocumentMetadata *next = md->next;
-      DMD_Free(md);
-      md = next;
+    for (uint32_t j = 0; j < t->pages[i].cap; ++j) {
+      if (page[j]) {
+        DMD_Free(page[j]);
+      }
     }
+    rm_free(page);
   }
-  rm_free(t->buckets);
+  rm_free(t->pages);
   DocIdMap_Free(&t->dim);
-}
-
-static void DocTable_DmdUnchain(DocTable *t, RSDocumentMetadata *md) {
-  uint32_t bucketIndex = DocTable_GetBucket(t, md->id);
-  DMDChain *dmdChain = &t->buckets[bucketIndex];
-
-  if (dmdChain->first == md) {
-    dmdChain->first = md->next;
-  }
-
-  if (dmdChain->last == md) {
-    dmdChain->last = md->prev;
-  }
-
-  if (md->prev) {
-    md->prev->next = md->next;
-  }
-  if (md->next) {
-    md->next->prev = md->prev;
-  }
-  md->next = NULL;
-  md->prev = NULL;
+  DocIdBitmap_Clear(&t->deleted);
+  DocIdBitmap_Clear(&t->deletedSinceCollect);
 }
 
 int DocTable_Delete(DocTable *t, RSDocumentKey key) {
@@ -318,7 +311,7 @@ int DocTable_Delete(DocTable *t, RSDocumentKey key) {
 }
 
 RSDocumentMetadata *DocTable_Pop(DocTable *t, RSDocumentKey key) {
-  t_docId docId = DocIdMap_Get(&t->dim, key);
+  t_docId docId = DocIdMap_Get(t, key);
   if (docId && docId <= t->maxDocId) {
 
     RSDocumentMetadata *md = DocTable_Get(t, docId);
@@ -327,16 +320,46 @@ RSDocumentMetadata *DocTable_Pop(DocTable *t, RSDocumentKey key) {
     }
 
     md->flags |= Document_Deleted;
+    DocIdBitmap_Set(&t->deleted, docId);
+    if (t->collecting) {
+      DocIdBitmap_Set(&t->deletedSinceCollect, docId);
+    }
 
-    DocTable_DmdUnchain(t, md);
-    DocIdMap_Delete(&t->dim, key);
+    DocTable_Unset(t, docId);
+    DocIdMap_Delete(&t->dim, key, docId);
     --t->size;
 
+    // queries may have just looked the document up and be about to take a reference to it. The
+    // caller gets a reference of its own, and the table's is only dropped once they are done
+    DMD_Incref(md);
+    Epoch_Retire(md, retiredDMD_Decref);
     return md;
   }
   return NULL;
 }
 
+void DocTable_BeginCollect(DocTable *t) {
+  DocIdBitmap_Clear(&t->deletedSinceCollect);
+  t->collecting = 1;
+}
+
+void DocTable_EndCollect(DocTable *t, int complete) {
+  if (complete) {
+    // Readers keep pointing at the table's bitmap, and the next deleted id they cached is still a
+    // deleted document, so the contents can be swapped under them. Queries reading the old chunks
+    // go on reading them until they are done
+    DocIdBitmapTable *collected = t->deleted.table;
+    Epoch_Publish(t->deleted.table, t->deletedSinceCollect.table);
+    t->deleted.card = t->deletedSinceCollect.card;
+    DocIdBitmap_Init(&t->deletedSinceCollect);
+    DocIdBitmap old = {.table = collected};
+    DocIdBitmap_Reset(&old);
+  } else {
+    DocIdBitmap_Clear(&t->deletedSinceCollect);
+  }
+  t->collecting = 0;
+}
+
 void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb) {
 
   RedisModule_SaveUnsigned(rdb, t->size);
@@ -344,13 +367,13 @@ void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb) {
   RedisModule_SaveUnsigned(rdb, t->maxSize);
 
   uint32_t elements_written = 0;
-  for (uint32_t i = 0; i < t->cap; ++i) {
-    if (DMDChain_IsEmpty(&t->buckets[i])) {
-      continue;
-    }
-    RSDocumentMetadata *dmd = t->buckets[i].first;
-    while (dmd) {
-
+  for (uint32_t i = 0; i < t->numPages; ++i) {
+    RSDocumentMetadata **page = t->pages[i].dmds;
+    for (uint32_t j = 0; j < t->pages[i].cap; ++j) {
+      RSDocumentMetadata *dmd = page[j];
+      if (!dmd) {
+        continue;
+      }
       RedisModule_SaveStringBuffer(rdb, dmd->keyPtr, sdslen(dmd->keyPtr));
       RedisModule_SaveUnsigned(rdb, dmd->id);
       RedisModule_SaveUnsigned(rdb, dmd->flags);
@@ -378,7 +401,6 @@ void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb) {
         Buffer_Free(&tmp);
       }
       ++elements_written;
-      dmd = dmd->next;
     }
   }
   assert(elements_written + 1 == t->size);
@@ -443,48 +465,118 @@ void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver) {
       rm_free(tmp);
     }
 
+    DocTable_Set(t, dmd->id, dmd);
     // We always save deleted docs to rdb, but we don't want to load them back to the id map
     if (!(dmd->flags & Document_Deleted)) {
       DocIdMap_Put(&t->dim, MakeDocKey(dmd->keyPtr, sdslen(dmd->keyPtr)), dmd->id);
     }
-    DocTable_Set(t, dmd->id, dmd);
     t->memsize += sizeof(RSDocumentMetadata) + len;
   }
+
+  // deleted documents are not saved, so every id that is not in the table was deleted
+  for (t_docId id = 1; id <= t->maxDocId; id++) {
+    if (!DocTable_Exists(t, id)) {
+      DocIdBitmap_Set(&t->deleted, id);
+    }
+  }
 }
 
-DocIdMap NewDocIdMap() {
+#define DOCIDMAP_MIN_CAP 16
 
-  TrieMap *m = NewTrieMap();
-  return (DocIdMap){m};
+static inline uint32_t docIdMap_hash(RSDocumentKey key) {
+  return rs_fnv_32a_buf((void *)key.str, key.len, 0);
 }
 
-t_docId DocIdMap_Get(const DocIdMap *m, RSDocumentKey key) {
+/* Put an id in the first free slot of its cluster. The map must have a free slot */
+static void docIdMap_insert(DocIdMapSlot *slots, uint32_t cap, t_docId docId, uint32_t hash) {
+  uint32_t mask = cap - 1;
+  uint32_t i = hash & mask;
+  while (slots[i].docId) {
+    i = (i + 1) & mask;
+  }
+  slots[i] = (DocIdMapSlot){.docId = docId, .hash = hash};
+}
 
-  void *val = TrieMap_Find(m->tm, (char *)key.str, key.len);
-  if (val && val != TRIEMAP_NOTFOUND) {
-    return *((t_docId *)val);
+/* Rehash the map into twice the slots. The hashes are kept in the slots, so the keys are not read */
+static void docIdMap_grow(DocIdMap *m) {
+  uint32_t cap = m->cap ? m->cap * 2 : DOCIDMAP_MIN_CAP;
+  DocIdMapSlot *slots = rm_calloc(cap, sizeof(*slots));
+  for (uint32_t i = 0; i < m->cap; ++i) {
+    if (m->slots[i].docId) {
+      docIdMap_insert(slots, cap, m->slots[i].docId, m->slots[i].hash);
+    }
+  }
+  rm_free(m->slots);
+  m->slots = slots;
+  m->cap = cap;
+}
+
+/* Get the id of a key. The keys of the ids in the map are compared using their metadata, so every
+ * id put in the map must be in the table */
+static t_docId DocIdMap_Get(const DocTable *t, RSDocumentKey key) {
+  const DocIdMap *m = &t->dim;
+  if (!m->size) {
+    return 0;
+  }
+  uint32_t hash = docIdMap_hash(key);
+  uint32_t mask = m->cap - 1;
+  for (uint32_t i = hash & mask; m->slots[i].docId; i = (i + 1) & mask) {
+    if (m->slots[i].hash != hash) {
+      continue;
+    }
+    const RSDocumentMetadata *dmd = DocTable_Get(t, m->slots[i].docId);
+    if (dmd && sdslen(dmd->keyPtr) == key.len && !memcmp(dmd->keyPtr, key.str, key.len)) {
+      return m->slots[i].docId;
+    }
   }
   return 0;
 }
 
-void *_docIdMap_replace(void *oldval, void *newval) {
-  if (oldval) {
-    rm_free(oldval);
+/* Put a new doc id in the map. The key must not already be in it */
+static void DocIdMap_Put(DocIdMap *m, RSDocumentKey key, t_docId docId) {
+  // keep the load factor under 3/4
+  if ((m->size + 1) * 4 > m->cap * 3) {
+    docIdMap_grow(m);
   }
-  return newval;
+  docIdMap_insert(m->slots, m->cap, docId, docIdMap_hash(key));
+  m->size++;
 }
 
-void DocIdMap_Put(DocIdMap *m, RSDocumentKey key, t_docId docId) {
+/* Remove a key's id from the map. The id is matched rather than the key, so its metadata may already
+ * be gone from the table */
+static void DocIdMap_Delete(DocIdMap *m, RSDocumentKey key, t_docId docId) {
+  if (!m->size) {
+    return;
+  }
+  uint32_t mask = m->cap - 1;
+  uint32_t i = docIdMap_hash(key) & mask;
+  while (m->slots[i].docId != docId) {
+    if (!m->slots[i].docId) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
 
-  t_docId *pd = rm_malloc(sizeof(t_docId));
-  *pd = docId;
-  TrieMap_Add(m->tm, (char *)key.str, key.len, pd, _docIdMap_replace);
+  // shift back every slot in the rest of the cluster that can't be reached without passing the hole
+  uint32_t hole = i;
+  for (uint32_t j = (i + 1) & mask; m->slots[j].docId; j = (j + 1) & mask) {
+    uint32_t home = m->slots[j].hash & mask;
+    // the slot stays if its home is cyclically in (hole, j]
+    if (((j - home) & mask) < ((j - hole) & mask)) {
+      continue;
+    }
+    m->slots[hole] = m->slots[j];
+    hole = j;
+  }
+  m->slots[hole] = (DocIdMapSlot){0};
+  m->size--;
 }
 
-void DocIdMap_Free(DocIdMap *m) {
-  TrieMap_Free(m->tm, RedisModule_Free);
+static void DocIdMap_Free(DocIdMap *m) {
+  rm_free(m->slots);
+  *m = (DocIdMap){0};
 }
 
-int DocIdMap_Delete(DocIdMap *m, RSDocumentKey key) {
-  return TrieMap_Delete(m->tm, (char *)key.str, key.len, RedisModule_Free);
+size_t DocIdMap_MemUsage(const DocIdMap *m) {
+  return sizeof(*m) + m->cap * sizeof(DocIdMapSlot);
 }
@@ -8,6 +8,8 @@
 #include "sortable.h"
 #include "byte_offsets.h"
 #include "rmutil/sds.h"
+#include "doc_bitmap.h"
+#include "epoch.h"
 
 // Simple pointer/size wrapper for a document key.
 typedef struct {
@@ -42,21 +44,26 @@ static inline RedisModuleString *DMD_CreateKeyString(const RSDocumentMetadata *d
   return RedisModule_CreateString(ctx, dmd->keyPtr, sdslen(dmd->keyPtr));
 }
 
-/* Map between external id an incremental id */
+/* Map between external id an incremental id.
+ *
+ * An open addressing hash table with linear probing. Slots only hold the docId and the hash of its
+ * key - the key itself is compared against the document's metadata in the table, so every key is
+ * stored once. Deleted slots are refilled by shifting back the slots that follow them, so there
+ * are no tombstones and lookups never probe more than the cluster their key hashes into */
 typedef struct {
-  TrieMap *tm;
-} DocIdMap;
-
-DocIdMap NewDocIdMap();
-/* Get docId from a did-map. Returns 0  if the key is not in the map */
-t_docId DocIdMap_Get(const DocIdMap *m, RSDocumentKey key);
+  t_docId docId;
+  uint32_t hash;
+} DocIdMapSlot;
 
-/* Put a new doc id in the map if it does not already exist */
-void DocIdMap_Put(DocIdMap *m, RSDocumentKey key, t_docId docId);
+typedef struct {
+  // NULL until the first key is put. The capacity is always a power of 2
+  DocIdMapSlot *slots;
+  uint32_t cap;
+  uint32_t size;
+} DocIdMap;
 
-int DocIdMap_Delete(DocIdMap *m, RSDocumentKey key);
-/* Free the doc id map */
-void DocIdMap_Free(DocIdMap *m);
+/* The memory used by the map's slots */
+size_t DocIdMap_MemUsage(const DocIdMap *m);
 
 /* The DocTable is a simple mapping between incremental ids and the original document key and
  * metadata. It is also responsible for storing the id incrementor for the index and assigning
@@ -67,40 +74,66 @@ void DocIdMap_Free(DocIdMap *m);
  * the
  * same key. This may result in document duplication in results  */
 
+/* The table is an array of pages of DOCTABLE_PAGE_SIZE metadata pointers, indexed directly by the
+ * docId. Ids are assigned incrementally, so pages fill up densely. They are allocated on their first
+ * document, grow as ids are assigned in them so that small indexes stay small, and are freed once
+ * all of their documents are deleted.
+ *
+ * Queries look documents up without the lock while the table is written to, see epoch.h. The page
+ * directory and the pages are copied rather than reallocated when they grow, and the old copies,
+ * freed pages and the metadata of deleted documents are retired. Metadata that is replaced in a
+ * document - its payload and sorting vector - is retired as well */
+#define DOCTABLE_PAGE_SHIFT 16
+#define DOCTABLE_PAGE_SIZE (1 << DOCTABLE_PAGE_SHIFT)
+#define DOCTABLE_PAGE_MASK (DOCTABLE_PAGE_SIZE - 1)
+
+#define DOCTABLE_PAGE_MIN_CAP 16
+
 typedef struct {
-  struct RSDocumentMetadata_s *first;
-  struct RSDocumentMetadata_s *last;
-} DMDChain;
+  struct RSDocumentMetadata_s **dmds;
+  // the number of documents in the page
+  uint32_t count;
+  // the number of slots allocated, from the start of the page
+  uint32_t cap;
+} DocTablePage;
 
 typedef struct {
   size_t size;
-  // the maximum size this table is allowed to grow to
+  // Kept for RDB compatibility. Older versions capped their hash table at this size
   size_t maxSize;
   t_docId maxDocId;
-  size_t cap;
   size_t memsize;
   size_t sortablesSize;
 
-  DMDChain *buckets;
+  DocTablePage *pages;
+  uint32_t numPages;
   DocIdMap dim;
 
+  // The ids of the documents deleted from the table whose postings may still be in the indexes.
+  // Readers drop their postings as they decode them, instead of leaving them for the GC, and the GC
+  // only repairs blocks that overlap them
+  DocIdBitmap deleted;
+
+  // The documents deleted since the GC cycle in progress started, see DocTable_BeginCollect
+  DocIdBitmap deletedSinceCollect;
+  int collecting;
+
 } DocTable;
 
-/* increasing the ref count of the given dmd */
+/* increasing the ref count of the given dmd. Queries take references without the lock */
 #define DMD_Incref(md) \
-  if (md) ++md->ref_count;
-
-#define DocTable_ForEach(dt, code)          \
-  for (size_t i = 1; i < dt->cap; ++i) {    \
-    DMDChain *chain = &dt->buckets[i];      \
-    if (DMDChain_IsEmpty(chain)) {          \
-      continue;                             \
-    }                                       \
-    RSDocumentMetadata *dmd = chain->first; \
-    while (dmd) {                           \
-      code;                                 \
-      dmd = dmd->next;                      \
-    }                                       \
+  if (md) __atomic_add_fetch(&md->ref_count, 1, __ATOMIC_RELAXED);
+
+#define DocTable_ForEach(dt, code)                                     \
+  for (uint32_t pageIdx_ = 0; pageIdx_ < (dt)->numPages; ++pageIdx_) { \
+    const DocTablePage *page_ = &(dt)->pages[pageIdx_];                \
+    for (uint32_t slot_ = 0; slot_ < page_->cap; ++slot_) {            \
+      RSDocumentMetadata *dmd = page_->dmds[slot_];                    \
+      if (!dmd) {                                                      \
+        continue;                                                      \
+      }                                                                \
+      code;                                                            \
+    }                                                                  \
   }
 
 /* Creates a new DocTable with a given capacity */
@@ -110,7 +143,20 @@ DocTable NewDocTable(size_t cap, size_t max_size);
 
 /* Get the metadata for a doc Id from the DocTable.
  *  If docId is not inside the table, we return NULL */
-RSDocumentMetadata *DocTable_Get(const DocTable *t, t_docId docId);
+static inline RSDocumentMetadata *DocTable_Get(const DocTable *t, t_docId docId) {
+  size_t page = docId >> DOCTABLE_PAGE_SHIFT;
+  uint32_t slot = docId & DOCTABLE_PAGE_MASK;
+  // every array loaded after a count holds at least that many entries, see DocTable_Set
+  if (!docId || page >= Epoch_Load(t->numPages)) {
+    return NULL;
+  }
+  const DocTablePage *pg = &Epoch_Load(t->pages)[page];
+  if (slot >= Epoch_Load(pg->cap)) {
+    return NULL;
+  }
+  RSDocumentMetadata **dmds = Epoch_Load(pg->dmds);
+  return dmds ? Epoch_Load(dmds[slot]) : NULL;
+}
 
 RSDocumentMetadata *DocTable_GetByKeyR(const DocTable *r, RedisModuleString *s);
 
@@ -135,11 +181,6 @@ float DocTable_GetScore(DocTable *t, t_docId docId);
  * document */
 int DocTable_SetPayload(DocTable *t, t_docId docId, const char *data, size_t len);
 
-/*
- * return true iff the given dmdChain holds no elements
- */
-int DMDChain_IsEmpty(const DMDChain *dmdChain);
-
 int DocTable_Exists(const DocTable *t, t_docId docId);
 
 /* Set the sorting vector for a document. If the vector is NULL we mark the doc as not having a
@@ -165,6 +206,15 @@ int DocTable_Delete(DocTable *t, RSDocumentKey key);
 
 RSDocumentMetadata *DocTable_Pop(DocTable *t, RSDocumentKey key);
 
+/* Called when a GC cycle that will visit every index of the table starts. Documents deleted from
+ * now on are tracked apart, since the cycle will not collect them */
+void DocTable_BeginCollect(DocTable *t);
+
+/* Called when the GC cycle ends. If it collected the postings of all the documents that were
+ * deleted before it started, their ids are dropped from the deleted set, and only the documents
+ * deleted during the cycle are left in it */
+void DocTable_EndCollect(DocTable *t, int complete);
+
 static inline RSDocumentMetadata *DocTable_GetByKey(DocTable *dt, const char *key) {
   t_docId id = DocTable_GetId(dt, (RSDocumentKey){.str = key, .len = strlen(key)});
   if (id == 0) {
@@ -178,7 +228,7 @@ void DMD_Free(RSDocumentMetadata *);
 
 /* Decrement the refcount of the DMD object, freeing it if we're the last reference */
 static inline void DMD_Decref(RSDocumentMetadata *dmd) {
-  if (dmd && !--dmd->ref_count) {
+  if (dmd && !__atomic_sub_fetch(&dmd->ref_count, 1, __ATOMIC_ACQ_REL)) {
     DMD_Free(dmd);
   }
 }
@@ -128,6 +128,7 @@ RSAddDocumentCtx *NewAddDocumentCtx(IndexSpec *sp, Document *b, const char **err
   aCtx->totalTokens = 0;
   aCtx->client.bc = NULL;
   aCtx->next = NULL;
+  aCtx->batch = NULL;
   aCtx->specFlags = sp->flags;
   aCtx->indexer = GetDocumentIndexer(sp->name);
 
@@ -179,8 +180,12 @@ static void threadCallback(void *p) {
   Document_AddToIndexes(p);
 }
 
+static void AddDocumentBatch_Finish(RSAddDocumentBatch *b);
+
 void AddDocumentCtx_Finish(RSAddDocumentCtx *aCtx) {
-  if (aCtx->stateFlags & ACTX_F_NOBLOCK) {
+  if (aCtx->batch) {
+    AddDocumentBatch_Finish(aCtx->batch);
+  } else if (aCtx->stateFlags & ACTX_F_NOBLOCK) {
     doReplyFinish(aCtx, aCtx->client.sctx->redisCtx);
   } else {
     RedisModule_UnblockClient(aCtx->client.bc, aCtx);
@@ -281,6 +286,113 @@ void AddDocumentCtx_Submit(RSAddDocumentCtx *aCtx, RedisSearchCtx *sctx, uint32_
   }
 }
 
+RSAddDocumentBatch *NewAddDocumentBatch(size_t cap) {
+  RSAddDocumentBatch *b = calloc(1, sizeof(*b));
+  b->cap = cap ? cap : 1;
+  b->ctxs = calloc(b->cap, sizeof(*b->ctxs));
+  b->errors = calloc(b->cap, sizeof(*b->errors));
+  return b;
+}
+
+void AddDocumentBatch_Add(RSAddDocumentBatch *b, RSAddDocumentCtx *aCtx, const char *err) {
+  if (b->num == b->cap) {
+    b->cap *= 2;
+    b->ctxs = realloc(b->ctxs, b->cap * sizeof(*b->ctxs));
+    b->errors = realloc(b->errors, b->cap * sizeof(*b->errors));
+  }
+  b->ctxs[b->num] = aCtx;
+  b->errors[b->num] = err;
+  b->num++;
+}
+
+static void AddDocumentBatch_Free(RSAddDocumentBatch *b) {
+  for (size_t ii = 0; ii < b->num; ++ii) {
+    if (b->ctxs[ii]) {
+      AddDocumentCtx_Free(b->ctxs[ii]);
+    }
+  }
+  free(b->ctxs);
+  free(b->errors);
+  free(b);
+}
+
+static void AddDocumentBatch_Reply(RSAddDocumentBatch *b, RedisModuleCtx *ctx) {
+  RedisModule_ReplyWithArray(ctx, b->num);
+  for (size_t ii = 0; ii < b->num; ++ii) {
+    const char *err = b->ctxs[ii] ? b->ctxs[ii]->errorString : b->errors[ii];
+    if (err) {
+      RedisModule_ReplyWithError(ctx, err);
+    } else {
+      RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+  }
+  AddDocumentBatch_Free(b);
+}
+
+static int batchReplyCallback(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  AddDocumentBatch_Reply(RedisModule_GetBlockedClientPrivateData(ctx), ctx);
+  return REDISMODULE_OK;
+}
+
+/* Called once a document of the batch is done. The last one unblocks the client */
+static void AddDocumentBatch_Finish(RSAddDocumentBatch *b) {
+  if (__sync_sub_and_fetch(&b->unfinished, 1) == 0) {
+    RedisModule_UnblockClient(b->bc, b);
+  }
+}
+
+/* Called once a document of the batch is tokenized, or has failed. The last one queues all the
+ * documents that did not fail to the indexer, in their original order */
+static void AddDocumentBatch_Tokenized(RSAddDocumentBatch *b) {
+  if (__sync_sub_and_fetch(&b->untokenized, 1) != 0) {
+    return;
+  }
+
+  RSAddDocumentCtx *head = NULL, *tail = NULL;
+  size_t n = 0;
+  for (size_t ii = 0; ii < b->num; ++ii) {
+    RSAddDocumentCtx *cur = b->ctxs[ii];
+    if (!cur || (cur->stateFlags & ACTX_F_ERRORED)) {
+      continue;
+    }
+    cur->next = NULL;
+    if (tail) {
+      tail->next = cur;
+    } else {
+      head = cur;
+    }
+    tail = cur;
+    n++;
+  }
+  if (head) {
+    Indexer_AddBatch(head->indexer, head, tail, n);
+  }
+}
+
+void AddDocumentBatch_Submit(RSAddDocumentBatch *b, RedisSearchCtx *sctx) {
+  size_t n = 0;
+  for (size_t ii = 0; ii < b->num; ++ii) {
+    if (b->ctxs[ii]) n++;
+  }
+  // nothing to index - just reply with the errors
+  if (n == 0) {
+    AddDocumentBatch_Reply(b, sctx->redisCtx);
+    return;
+  }
+
+  b->untokenized = b->unfinished = n;
+  b->bc = RedisModule_BlockClient(sctx->redisCtx, batchReplyCallback, NULL, NULL, 0);
+  for (size_t ii = 0; ii < b->num; ++ii) {
+    RSAddDocumentCtx *aCtx = b->ctxs[ii];
+    if (!aCtx) continue;
+    aCtx->batch = b;
+    aCtx->client.bc = b->bc;
+    // Unlike single documents, even small ones are tokenized in the pool, so the batch is tokenized
+    // in parallel
+    ConcurrentSearch_ThreadPoolRun(threadCallback, aCtx, CONCURRENT_POOL_INDEX);
+  }
+}
+
 void AddDocumentCtx_Free(RSAddDocumentCtx *aCtx) {
   // Destroy the common fields:
   Document_FreeDetached(&aCtx->doc, aCtx->indexer->redisCtx);
@@ -406,19 +518,25 @@ FIELD_PREPROCESSOR(geoPreprocessor) {
   }
   *pos = '\0';
   pos++;
-  fdata->geo.slon = (char *)c;
-  fdata->geo.slat = (char *)pos;
+  if (GeoIndex_ParseStrings(c, pos, &fdata->numeric) == REDISMODULE_ERR) {
+    *errorString = "Could not index geo value";
+    return -1;
+  }
   return 0;
 }
 
-FIELD_BULK_INDEXER(geoIndexer) {
+FIELD_BULK_CTOR(geoCtor) {
   GeoIndex gi = {.ctx = ctx, .sp = fs};
-  int rv = GeoIndex_AddStrings(&gi, aCtx->doc.docId, fdata->geo.slon, fdata->geo.slat);
+  bulk->indexData = GeoIndex_Open(&gi, &bulk->indexKey);
+}
 
-  if (rv == REDISMODULE_ERR) {
-    *errorString = "Could not index geo value";
+FIELD_BULK_INDEXER(geoIndexer) {
+  NumericRangeTree *rt = bulk->indexData;
+  if (!rt) {
+    *errorString = "Could not open geo index for indexing";
     return -1;
   }
+  NumericRangeTree_Add(rt, aCtx->doc.docId, fdata->numeric);
   return 0;
 }
 
@@ -471,7 +589,7 @@ PreprocessorFunc GetIndexPreprocessor(const FieldType ft) {
   }
 }
 
-static BulkIndexer geoBulkProcs = {.BulkAdd = geoIndexer};
+static BulkIndexer geoBulkProcs = {.BulkInit = geoCtor, .BulkAdd = geoIndexer};
 static BulkIndexer numBulkProcs = {.BulkInit = numericCtor, .BulkAdd = numericIndexer};
 static BulkIndexer tagBulkProcs = {.BulkInit = tagCtor, .BulkAdd = tagIndexer};
 
@@ -513,6 +631,12 @@ int Document_AddToIndexes(RSAddDocumentCtx *aCtx) {
     }
   }
 
+  if (aCtx->batch) {
+    // documents of a batch are queued to the indexer together
+    AddDocumentBatch_Tokenized(aCtx->batch);
+    return ourRv;
+  }
+
   if (Indexer_Add(aCtx->indexer, aCtx) != 0) {
     ourRv = REDISMODULE_ERR;
     goto cleanup;
@@ -523,6 +647,10 @@ cleanup:
     if (aCtx->errorString == NULL) {
       aCtx->errorString = "ERR couldn't index document";
     }
+    if (aCtx->batch) {
+      aCtx->stateFlags |= ACTX_F_ERRORED;
+      AddDocumentBatch_Tokenized(aCtx->batch);
+    }
     AddDocumentCtx_Finish(aCtx);
   }
   return ourRv;
@@ -620,6 +748,8 @@ static void AddDocumentCtx_UpdateNoIndex(RSAddDocumentCtx *aCtx, RedisSearchCtx
     goto done;             \
   } while (0);
 
+  // queries may be sorting by the document's sorting vector, so the changes are made to a copy
+  RSSortingVector *sv = NULL;
   Document *doc = &aCtx->doc;
   t_docId docId = DocTable_GetId(&sctx->spec->docs, MakeDocKeyR(doc->docKey));
   if (docId == 0) {
@@ -656,13 +786,14 @@ static void AddDocumentCtx_UpdateNoIndex(RSAddDocumentCtx *aCtx, RedisSearchCtx
       int idx = IndexSpec_GetFieldSortingIndex(sctx->spec, f->name, strlen(f->name));
       if (idx < 0) continue;
 
-      if (!md->sortVector) {
-        md->sortVector = NewSortingVector(sctx->spec->sortables->len);
+      if (!sv) {
+        sv = md->sortVector ? SortingVector_Copy(md->sortVector)
+                            : NewSortingVector(sctx->spec->sortables->len);
       }
 
       switch (fs->type) {
         case FIELD_FULLTEXT:
-          RSSortingVector_Put(md->sortVector, idx, (void *)RedisModule_StringPtrLen(f->text, NULL),
+          RSSortingVector_Put(sv, idx, (void *)RedisModule_StringPtrLen(f->text, NULL),
                               RS_SORTABLE_STR);
           break;
         case FIELD_NUMERIC: {
@@ -670,7 +801,7 @@ static void AddDocumentCtx_UpdateNoIndex(RSAddDocumentCtx *aCtx, RedisSearchCtx
           if (RedisModule_StringToDouble(f->text, &numval) == REDISMODULE_ERR) {
             BAIL("Could not parse numeric index value");
           }
-          RSSortingVector_Put(md->sortVector, idx, &numval, RS_SORTABLE_NUM);
+          RSSortingVector_Put(sv, idx, &numval, RS_SORTABLE_NUM);
           break;
         }
         default:
@@ -678,9 +809,16 @@ static void AddDocumentCtx_UpdateNoIndex(RSAddDocumentCtx *aCtx, RedisSearchCtx
           break;
       }
     }
+    if (sv) {
+      DocTable_SetSortingVector(&sctx->spec->docs, docId, sv);
+      sv = NULL;
+    }
   }
 
 done:
+  if (sv) {
+    SortingVector_Free(sv);
+  }
   if (aCtx->errorString) {
     RedisModule_ReplyWithError(sctx->redisCtx, aCtx->errorString);
   } else {
@@ -145,6 +145,7 @@ union FieldData;
 #define ACTX_F_NOBLOCK 0x20
 
 struct DocumentIndexer;
+struct RSAddDocumentBatch;
 
 /**
  * Context used when indexing documents.
@@ -162,6 +163,9 @@ typedef struct RSAddDocumentCtx {
 
   struct DocumentIndexer *indexer;
 
+  // The batch this document was added in, or NULL if it was added on its own
+  struct RSAddDocumentBatch *batch;
+
   // Sorting vector for the document. If the document has sortable fields, they
   // are added to here as well
   RSSortingVector *sv;
@@ -216,6 +220,45 @@ void AddDocumentCtx_Submit(RSAddDocumentCtx *aCtx, RedisSearchCtx *sctx, uint32_
  * Indicate that processing is finished on the current document
  */
 void AddDocumentCtx_Finish(RSAddDocumentCtx *aCtx);
+
+/**
+ * A batch of documents added by a single command (FT.MADD).
+ *
+ * The documents of a batch are tokenized in parallel on the index thread pool. Instead of being
+ * queued to the indexer one by one as they are tokenized, the last document to be tokenized queues
+ * the whole batch at once, so the indexer merges their terms and writes each term's inverted index
+ * once, under a single lock. The client is blocked until all the documents are indexed, and then
+ * gets a single reply with the status of each of them.
+ */
+typedef struct RSAddDocumentBatch {
+  // The contexts of the documents, in the order they were given. NULL for documents that could not
+  // be added, whose error is in errors
+  RSAddDocumentCtx **ctxs;
+  const char **errors;
+  size_t num;
+  size_t cap;
+
+  // Documents that are yet to be tokenized, and yet to be finished
+  volatile size_t untokenized;
+  volatile size_t unfinished;
+
+  RedisModuleBlockedClient *bc;
+} RSAddDocumentBatch;
+
+RSAddDocumentBatch *NewAddDocumentBatch(size_t cap);
+
+/**
+ * Add a document to the batch. If aCtx is NULL, the document could not be added, and err is
+ * reported for it in the reply
+ */
+void AddDocumentBatch_Add(RSAddDocumentBatch *b, RSAddDocumentCtx *aCtx, const char *err);
+
+/**
+ * Block the client and submit all the documents of the batch for indexing. The options of each
+ * context must already be set. The batch takes care of replying and of freeing itself
+ */
+void AddDocumentBatch_Submit(RSAddDocumentBatch *b, RedisSearchCtx *sctx);
+
 /**
  * This function will tokenize the document and add the resultant tokens to
  * the relevant inverted indexes. This function should be called from a
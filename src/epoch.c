@@ -0,0 +1,135 @@
+#include "epoch.h"
+#include "rmalloc.h"
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct retiredObject {
+  void *p;
+  void (*freefn)(void *);
+  // the epoch the object was retired in. Readers that pinned a later epoch can't see it
+  uint64_t epoch;
+  struct retiredObject *next;
+} retiredObject;
+
+// The current epoch. Every retire advances it, so that readers pinning after it can be told apart
+static uint64_t globalEpoch_g = 1;
+
+// The epoch pinned by each reader slot, 0 if the slot is free
+static uint64_t pins_g[EPOCH_MAX_PINS];
+
+// The epoch of the last object freed. Objects are freed in epoch order, so all the objects retired
+// up to it are gone
+static uint64_t reclaimedEpoch_g = 0;
+
+// Readers that did not get a slot. While there are any, nothing is reclaimed
+static uint32_t overflowPins_g = 0;
+
+// Retired objects, oldest first
+static struct {
+  retiredObject *head;
+  retiredObject *tail;
+  size_t len;
+  pthread_mutex_t lock;
+} limbo_g = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+EpochPin Epoch_Pin(void) {
+  for (EpochPin i = 0; i < EPOCH_MAX_PINS; i++) {
+    // the CAS is a full barrier - anything the reader loads from here on is ordered after it
+    uint64_t free = 0;
+    if (!__atomic_load_n(&pins_g[i], __ATOMIC_RELAXED) &&
+        __atomic_compare_exchange_n(&pins_g[i], &free, Epoch_Current(), 0, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_RELAXED)) {
+      return i;
+    }
+  }
+  __atomic_add_fetch(&overflowPins_g, 1, __ATOMIC_SEQ_CST);
+  return -1;
+}
+
+void Epoch_Unpin(EpochPin pin) {
+  if (pin == EPOCH_NO_PIN) {
+    return;
+  } else if (pin < 0) {
+    __atomic_sub_fetch(&overflowPins_g, 1, __ATOMIC_SEQ_CST);
+  } else {
+    __atomic_store_n(&pins_g[pin], 0, __ATOMIC_SEQ_CST);
+  }
+  if (Epoch_NumRetired()) {
+    Epoch_Reclaim();
+  }
+}
+
+/* The oldest epoch pinned by any reader, or UINT64_MAX if there are none */
+static uint64_t Epoch_MinPinned(void) {
+  if (__atomic_load_n(&overflowPins_g, __ATOMIC_SEQ_CST)) return 0;
+
+  uint64_t min = UINT64_MAX;
+  for (int i = 0; i < EPOCH_MAX_PINS; i++) {
+    uint64_t e = __atomic_load_n(&pins_g[i], __ATOMIC_SEQ_CST);
+    if (e && e < min) min = e;
+  }
+  return min;
+}
+
+void Epoch_Retire(void *p, void (*freefn)(void *)) {
+  retiredObject *obj = rm_malloc(sizeof(*obj));
+  *obj = (retiredObject){.p = p, .freefn = freefn, .next = NULL};
+
+  pthread_mutex_lock(&limbo_g.lock);
+  obj->epoch = __atomic_fetch_add(&globalEpoch_g, 1, __ATOMIC_SEQ_CST);
+  if (limbo_g.tail) {
+    limbo_g.tail->next = obj;
+  } else {
+    limbo_g.head = obj;
+  }
+  limbo_g.tail = obj;
+  __atomic_add_fetch(&limbo_g.len, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&limbo_g.lock);
+
+  Epoch_Reclaim();
+}
+
+size_t Epoch_Reclaim(void) {
+  pthread_mutex_lock(&limbo_g.lock);
+  uint64_t min = Epoch_MinPinned();
+
+  // objects are retired in epoch order, so we can stop at the first one that is still visible
+  retiredObject *freed = limbo_g.head;
+  retiredObject *last = NULL;
+  size_t n = 0;
+  for (retiredObject *obj = limbo_g.head; obj && obj->epoch < min; obj = obj->next) {
+    last = obj;
+    n++;
+  }
+  if (!last) {
+    pthread_mutex_unlock(&limbo_g.lock);
+    return 0;
+  }
+  limbo_g.head = last->next;
+  if (!limbo_g.head) limbo_g.tail = NULL;
+  __atomic_sub_fetch(&limbo_g.len, n, __ATOMIC_RELAXED);
+  last->next = NULL;
+  __atomic_store_n(&reclaimedEpoch_g, last->epoch, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&limbo_g.lock);
+
+  // free outside the lock, the free functions may be slow
+  while (freed) {
+    retiredObject *next = freed->next;
+    freed->freefn(freed->p);
+    rm_free(freed);
+    freed = next;
+  }
+  return n;
+}
+
+uint64_t Epoch_Current(void) {
+  return __atomic_load_n(&globalEpoch_g, __ATOMIC_SEQ_CST);
+}
+
+int Epoch_Reclaimed(uint64_t e) {
+  return __atomic_load_n(&reclaimedEpoch_g, __ATOMIC_ACQUIRE) >= e;
+}
+
+size_t Epoch_NumRetired(void) {
+  return __atomic_load_n(&limbo_g.len, __ATOMIC_RELAXED);
+}
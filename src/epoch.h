@@ -0,0 +1,66 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Epoch based reclamation of index memory.
+ *
+ * Queries read the index without holding the GIL - the sorter drains the iterators with the lock
+ * released, and parallel scans read from threads of their own - while the indexer and the GC go on
+ * writing to it. Writers never change memory a reader may be looking at. Structures that grow are
+ * copied and the copy is published with a single pointer store, and memory that is replaced or
+ * dropped is retired rather than freed: blocks and their buffers, skip tables, document table pages,
+ * the metadata of deleted documents, numeric tree nodes, and the indexes themselves when their keys
+ * are deleted. Every query pins the epoch it started in for as long as it runs, and retired memory
+ * is only freed once no query that was running when it was retired is left.
+ *
+ * Retiring and reclaiming are thread safe, and retired memory may be freed from any thread, so free
+ * functions must not call into redis. Readers must pin before they load any pointer into the index,
+ * and must not touch memory they loaded after unpinning. A query that goes idle for long - a cursor
+ * waiting to be read - unpins, and its readers check with Epoch_Reclaimed whether what they loaded
+ * may have been freed meanwhile when it is resumed. */
+
+/* Store a value that readers load without the lock. Everything the writer wrote before it is
+ * visible to a reader that loads the value with Epoch_Load - so a copy is filled before the pointer
+ * to it is published, and a new record is written before the length that covers it */
+#define Epoch_Publish(dst, val) __atomic_store_n(&(dst), (val), __ATOMIC_RELEASE)
+
+/* Load a value published with Epoch_Publish */
+#define Epoch_Load(src) __atomic_load_n(&(src), __ATOMIC_ACQUIRE)
+
+/* A handle to a pinned epoch */
+typedef int EpochPin;
+
+/* A handle that pins nothing */
+#define EPOCH_NO_PIN -2
+
+/* The maximal number of readers that can be tracked individually. Readers beyond that still get
+ * pinned, but hold off all reclamation until they are done */
+#define EPOCH_MAX_PINS 1024
+
+/* Pin the current epoch. Nothing retired from now on is freed before the pin is released */
+EpochPin Epoch_Pin(void);
+
+/* Release a pinned epoch (EPOCH_NO_PIN is ignored), freeing retired memory that is not visible to any reader anymore */
+void Epoch_Unpin(EpochPin pin);
+
+/* Free p with freefn once no pinned reader can possibly hold it. p must already be unreachable from
+ * the index. If there are no readers, it is freed right away */
+void Epoch_Retire(void *p, void (*freefn)(void *));
+
+/* Free all retired memory that is not visible to any reader. Returns the number of objects freed */
+size_t Epoch_Reclaim(void);
+
+/* The current epoch. Readers note it when they load a pointer into the index */
+uint64_t Epoch_Current(void);
+
+/* Return 1 if memory retired in epoch e or after it may have been freed. Memory a reader loaded in
+ * epoch e is safe to read as long as this returns 0 - which is always the case while the reader
+ * kept an epoch pinned since loading it */
+int Epoch_Reclaimed(uint64_t e);
+
+/* The number of retired objects waiting to be freed */
+size_t Epoch_NumRetired(void);
+
+#endif
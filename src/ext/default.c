@@ -65,6 +65,13 @@ double TFIDFScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetada
   return tfIdfInternal(ctx, h, dmd, minScore, NORM_MAXFREQ);
 }
 
+/* Upper bound of a term's contribution to the TFIDF score. Document scores are at most 1, a term's
+ * frequency is at most the document's max frequency and slop only divides the score, so it is just
+ * the weighted idf of the term */
+double TFIDFTermBound(double weight, double idf, uint32_t maxFreq, const RSIndexStats *stats) {
+  return weight * idf;
+}
+
 /* Identical scorer to TFIDFScorer, only the normalization is by total weighted frequency in the doc
  */
 double TFIDFNormDocLenScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetadata *dmd,
@@ -81,10 +88,13 @@ double TFIDFNormDocLenScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocu
  *
  ******************************************************************************************/
 
+#define BM25_B 0.5f
+#define BM25_K1 1.2f
+
 /* recursively calculate score for each token, summing up sub tokens */
 static double bm25Recursive(RSScoringFunctionCtx *ctx, RSIndexResult *r, RSDocumentMetadata *dmd) {
-  static const float b = 0.5;
-  static const float k1 = 1.2;
+  static const float b = BM25_B;
+  static const float k1 = BM25_K1;
   double f = (double)r->freq;
 
   if (r->type == RSResultType_Term) {
@@ -119,6 +129,13 @@ double BM25Scorer(RSScoringFunctionCtx *ctx, RSIndexResult *r, RSDocumentMetadat
   return score;
 }
 
+/* Upper bound of a term's contribution to the BM25 score. The term part grows with the frequency,
+ * so it is bounded by the highest frequency the term may have */
+double BM25TermBound(double weight, double idf, uint32_t maxFreq, const RSIndexStats *stats) {
+  double f = (double)maxFreq;
+  return idf * f / (f + BM25_K1 * (1.0f - BM25_B + BM25_B * stats->avgDocLen));
+}
+
 /******************************************************************************************
  *
  * Raw document-score scorer. Just returns the document score
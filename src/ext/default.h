@@ -15,4 +15,10 @@
 
 int DefaultExtensionInit(RSExtensionCtx *ctx);
 
+/* Upper bounds of a single term's contribution to the TFIDF and BM25 scores of a document, given
+ * the highest frequency the term may have in it. Used to skip documents that can't make it into the
+ * top results */
+double TFIDFTermBound(double weight, double idf, uint32_t maxFreq, const RSIndexStats *stats);
+double BM25TermBound(double weight, double idf, uint32_t maxFreq, const RSIndexStats *stats);
+
 #endif
\ No newline at end of file
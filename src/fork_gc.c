@@ -0,0 +1,590 @@
+#include "fork_gc.h"
+#include "redis_index.h"
+#include "numeric_index.h"
+#include "tag_index.h"
+#include "search_ctx.h"
+#include "rmalloc.h"
+#include "util/arr.h"
+#include "trie/trie_type.h"
+#include "trie/levenshtein.h"
+#include "trie/rune_util.h"
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// terminates lists of blocks, numeric ranges and messages on the pipe
+#define FGC_END UINT32_MAX
+
+typedef enum {
+  FGCMsg_Done = 0,
+  FGCMsg_Term,     // term, index repair
+  FGCMsg_Numeric,  // field, tree revision, (range ordinal, index repair)*, FGC_END
+  FGCMsg_Tag,      // field, tag value, index repair
+} FGCMessageType;
+
+static int fgc_write(int fd, const void *p, size_t len) {
+  const char *c = p;
+  while (len) {
+    ssize_t n = write(fd, c, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return REDISMODULE_ERR;
+    }
+    c += n;
+    len -= n;
+  }
+  return REDISMODULE_OK;
+}
+
+static int fgc_read(int fd, void *p, size_t len) {
+  char *c = p;
+  while (len) {
+    ssize_t n = read(fd, c, len);
+    if (n < 0 && errno == EINTR) continue;
+    // the child exits without writing a full message only if something went wrong
+    if (n <= 0) return REDISMODULE_ERR;
+    c += n;
+    len -= n;
+  }
+  return REDISMODULE_OK;
+}
+
+static int fgc_writeU32(int fd, uint32_t n) {
+  return fgc_write(fd, &n, sizeof(n));
+}
+
+static int fgc_writeString(int fd, const char *s, size_t len) {
+  if (fgc_writeU32(fd, len) != REDISMODULE_OK) return REDISMODULE_ERR;
+  return fgc_write(fd, s, len);
+}
+
+/* Read a string written by fgc_writeString. The string is NULL terminated, and must be freed with
+ * rm_free */
+static int fgc_readString(int fd, char **s, size_t *len) {
+  uint32_t n;
+  *s = NULL;
+  if (fgc_read(fd, &n, sizeof(n)) != REDISMODULE_OK) return REDISMODULE_ERR;
+  *s = rm_malloc(n + 1);
+  (*s)[n] = '\0';
+  *len = n;
+  return fgc_read(fd, *s, n);
+}
+
+size_t FGC_RepairIndex(InvertedIndex *idx, DocTable *dt, FGCIndexRepair *r) {
+  r->blocks = NULL;
+  for (uint32_t i = 0; i < idx->size; i++) {
+    const IndexBlock *blk = &idx->blocks[i];
+    FGCRepairedBlock rb = {
+        .blockNum = i,
+        .oldFirstId = blk->firstId,
+        .oldLastId = blk->lastId,
+        .oldNumDocs = blk->numDocs,
+    };
+    IndexRepairParams params = {.limit = 1, .keepReplaced = 1};
+    InvertedIndex_Repair(idx, dt, i, &params);
+    if (!params.docsCollected) continue;
+
+    // the repaired block is in a new copy of the array
+    blk = &idx->blocks[i];
+    rb.docsCollected = params.docsCollected;
+    rb.bytesCollected = params.bytesCollected;
+    rb.dataLen = blk->data->offset;
+    rb.blk = *blk;
+    if (!r->blocks) {
+      r->blocks = array_new(FGCRepairedBlock, 4);
+    }
+    r->blocks = array_append(r->blocks, rb);
+  }
+  return array_len(r->blocks);
+}
+
+int FGC_WriteIndexRepair(int fd, const FGCIndexRepair *r) {
+  for (uint32_t i = 0; i < array_len(r->blocks); i++) {
+    const FGCRepairedBlock *rb = &r->blocks[i];
+    if (fgc_write(fd, rb, sizeof(*rb)) != REDISMODULE_OK ||
+        fgc_write(fd, rb->blk.data->data, rb->dataLen) != REDISMODULE_OK ||
+        fgc_write(fd, rb->blk.skips, rb->blk.numSkips * sizeof(IndexBlockSkip)) !=
+            REDISMODULE_OK) {
+      return REDISMODULE_ERR;
+    }
+  }
+  FGCRepairedBlock end = {.blockNum = FGC_END};
+  return fgc_write(fd, &end, sizeof(end));
+}
+
+int FGC_ReadIndexRepair(int fd, FGCIndexRepair *r) {
+  r->blocks = array_new(FGCRepairedBlock, 4);
+  while (1) {
+    FGCRepairedBlock rb;
+    if (fgc_read(fd, &rb, sizeof(rb)) != REDISMODULE_OK) return REDISMODULE_ERR;
+    if (rb.blockNum == FGC_END) return REDISMODULE_OK;
+
+    // the pointers are the child's - allocate our own before reading into them
+    rb.blk.data = NewBuffer(rb.dataLen);
+    rb.blk.data->offset = rb.dataLen;
+    // the block may be appended to if it's the last one, so its skip table gets the full capacity
+    rb.blk.skips = rb.blk.numSkips
+                       ? rm_malloc(IndexArray_Cap(rb.blk.numSkips) * sizeof(IndexBlockSkip))
+                       : NULL;
+    r->blocks = array_append(r->blocks, rb);
+
+    if (fgc_read(fd, rb.blk.data->data, rb.dataLen) != REDISMODULE_OK ||
+        fgc_read(fd, rb.blk.skips, rb.blk.numSkips * sizeof(IndexBlockSkip)) != REDISMODULE_OK) {
+      return REDISMODULE_ERR;
+    }
+  }
+}
+
+size_t FGC_ApplyIndexRepair(InvertedIndex *idx, FGCIndexRepair *r, size_t *docsCollected,
+                            size_t *bytesCollected) {
+  int applied = 0;
+  size_t skipped = 0;
+  // queries may be reading the blocks, so the repairs are applied to a copy of the array
+  IndexBlock *blocks = InvertedIndex_BeginRewrite(idx);
+  for (uint32_t i = 0; i < array_len(r->blocks); i++) {
+    FGCRepairedBlock *rb = &r->blocks[i];
+    if (rb->blockNum >= idx->size) {
+      skipped++;
+      continue;
+    }
+
+    // records were written to the block after the fork. The child didn't see them, so we can't take
+    // its copy of the block without losing them
+    IndexBlock *blk = &blocks[rb->blockNum];
+    if (blk->firstId != rb->oldFirstId || blk->lastId != rb->oldLastId ||
+        blk->numDocs != rb->oldNumDocs) {
+      skipped++;
+      continue;
+    }
+
+    IndexBlock_Replace(blk, &rb->blk);
+    rb->blk.data = NULL;
+    rb->blk.skips = NULL;
+    *docsCollected += rb->docsCollected;
+    *bytesCollected += rb->bytesCollected;
+    applied = 1;
+  }
+  // this lets sleeping readers know they need to reposition themselves
+  InvertedIndex_EndRewrite(idx, blocks, applied);
+  return skipped;
+}
+
+void FGC_FreeIndexRepair(FGCIndexRepair *r) {
+  for (uint32_t i = 0; i < array_len(r->blocks); i++) {
+    FGCRepairedBlock *rb = &r->blocks[i];
+    if (rb->blk.data) {
+      Buffer_Free(rb->blk.data);
+      free(rb->blk.data);
+    }
+    rm_free(rb->blk.skips);
+  }
+  if (r->blocks) {
+    array_free(r->blocks);
+  }
+  r->blocks = NULL;
+}
+
+/********************************************************************************
+ * The child's side
+ ********************************************************************************/
+
+/* In the child, the repaired blocks belong to its copy of the index, so only the list is freed */
+static void fgc_childFreeRepair(FGCIndexRepair *r) {
+  if (r->blocks) {
+    array_free(r->blocks);
+  }
+}
+
+static int fgc_childScanTerms(RedisSearchCtx *sctx, int fd) {
+  rune *rstr = NULL;
+  t_len slen = 0;
+  float score = 0;
+  int dist = 0;
+  int rc = REDISMODULE_OK;
+
+  TrieIterator *it = Trie_Iterate(sctx->spec->terms, "", 0, 0, 1);
+  while (rc == REDISMODULE_OK && TrieIterator_Next(it, &rstr, &slen, NULL, &score, &dist)) {
+    size_t len;
+    char *term = runesToStr(rstr, slen, &len);
+    RedisModuleKey *idxKey = NULL;
+    InvertedIndex *idx = Redis_OpenInvertedIndexEx(sctx, term, len, 0, &idxKey);
+    if (idx) {
+      FGCIndexRepair r;
+      if (FGC_RepairIndex(idx, &sctx->spec->docs, &r)) {
+        if (fgc_writeU32(fd, FGCMsg_Term) != REDISMODULE_OK ||
+            fgc_writeString(fd, term, len) != REDISMODULE_OK ||
+            FGC_WriteIndexRepair(fd, &r) != REDISMODULE_OK) {
+          rc = REDISMODULE_ERR;
+        }
+      }
+      fgc_childFreeRepair(&r);
+      RedisModule_CloseKey(idxKey);
+    }
+    free(term);
+  }
+  DFAFilter_Free(it->ctx);
+  free(it->ctx);
+  TrieIterator_Free(it);
+  return rc;
+}
+
+static int fgc_childScanNumeric(RedisSearchCtx *sctx, int fd) {
+  IndexSpec *spec = sctx->spec;
+  for (int i = 0; i < spec->numFields; i++) {
+    if (!FieldSpec_HasNumericIndex(&spec->fields[i])) continue;
+
+    RedisModuleKey *idxKey = NULL;
+    RedisModuleString *keyName = IndexSpec_GetFormattedKey(spec, &spec->fields[i]);
+    NumericRangeTree *rt = OpenNumericIndex(sctx, keyName, &idxKey);
+    if (!rt) {
+      if (idxKey) RedisModule_CloseKey(idxKey);
+      continue;
+    }
+
+    int rc = REDISMODULE_OK;
+    int headerWritten = 0;
+    uint32_t ordinal = 0;
+    NumericRangeTreeIterator *it = NumericRangeTreeIterator_New(rt);
+    NumericRangeNode *node;
+    while (rc == REDISMODULE_OK && (node = NumericRangeTreeIterator_Next(it))) {
+      if (!node->range) continue;
+      FGCIndexRepair r;
+      if (FGC_RepairIndex(node->range->entries, &spec->docs, &r)) {
+        if (!headerWritten && (fgc_writeU32(fd, FGCMsg_Numeric) != REDISMODULE_OK ||
+                               fgc_writeU32(fd, i) != REDISMODULE_OK ||
+                               fgc_writeU32(fd, rt->revisionId) != REDISMODULE_OK)) {
+          rc = REDISMODULE_ERR;
+        }
+        headerWritten = 1;
+        if (rc == REDISMODULE_OK && (fgc_writeU32(fd, ordinal) != REDISMODULE_OK ||
+                                     FGC_WriteIndexRepair(fd, &r) != REDISMODULE_OK)) {
+          rc = REDISMODULE_ERR;
+        }
+      }
+      fgc_childFreeRepair(&r);
+      ordinal++;
+    }
+    NumericRangeTreeIterator_Free(it);
+    if (rc == REDISMODULE_OK && headerWritten) {
+      rc = fgc_writeU32(fd, FGC_END);
+    }
+    if (idxKey) RedisModule_CloseKey(idxKey);
+    if (rc != REDISMODULE_OK) return rc;
+  }
+  return REDISMODULE_OK;
+}
+
+static int fgc_childScanTags(RedisSearchCtx *sctx, int fd) {
+  IndexSpec *spec = sctx->spec;
+  for (int i = 0; i < spec->numFields; i++) {
+    if (spec->fields[i].type != FIELD_TAG) continue;
+
+    RedisModuleKey *idxKey = NULL;
+    RedisModuleString *keyName = IndexSpec_GetFormattedKey(spec, &spec->fields[i]);
+    TagIndex *tagIdx = TagIndex_Open(sctx->redisCtx, keyName, 0, &idxKey);
+    if (!tagIdx) {
+      if (idxKey) RedisModule_CloseKey(idxKey);
+      continue;
+    }
+
+    int rc = REDISMODULE_OK;
+    char *value;
+    tm_len_t len;
+    void *ptr;
+    TrieMapIterator *it = TrieMap_Iterate(tagIdx->values, "", 0);
+    while (rc == REDISMODULE_OK && TrieMapIterator_Next(it, &value, &len, &ptr)) {
+      FGCIndexRepair r;
+      if (FGC_RepairIndex(ptr, &spec->docs, &r)) {
+        if (fgc_writeU32(fd, FGCMsg_Tag) != REDISMODULE_OK ||
+            fgc_writeU32(fd, i) != REDISMODULE_OK ||
+            fgc_writeString(fd, value, len) != REDISMODULE_OK ||
+            FGC_WriteIndexRepair(fd, &r) != REDISMODULE_OK) {
+          rc = REDISMODULE_ERR;
+        }
+      }
+      fgc_childFreeRepair(&r);
+    }
+    TrieMapIterator_Free(it);
+    if (idxKey) RedisModule_CloseKey(idxKey);
+    if (rc != REDISMODULE_OK) return rc;
+  }
+  return REDISMODULE_OK;
+}
+
+static void fgc_childScan(RedisSearchCtx *sctx, int fd) {
+  if (fgc_childScanTerms(sctx, fd) == REDISMODULE_OK &&
+      fgc_childScanNumeric(sctx, fd) == REDISMODULE_OK &&
+      fgc_childScanTags(sctx, fd) == REDISMODULE_OK) {
+    fgc_writeU32(fd, FGCMsg_Done);
+  }
+}
+
+/********************************************************************************
+ * The parent's side
+ ********************************************************************************/
+
+typedef struct {
+  RedisModuleCtx *ctx;
+  const RedisModuleString *keyName;
+  uint64_t specUniqueId;
+  int fd;
+  size_t docsCollected;
+  size_t bytesCollected;
+  int specGone;
+  // set if some of the garbage the child found is still there - a repair was not applied, or the
+  // cycle was cut short
+  int incomplete;
+} FGCCycle;
+
+/* Take the GIL and reopen the spec. Returns NULL, with the GIL released, if it was dropped */
+static RedisSearchCtx *fgc_lockSpec(FGCCycle *c) {
+  RedisModule_ThreadSafeContextLock(c->ctx);
+  RedisSearchCtx *sctx = NewSearchCtx(c->ctx, (RedisModuleString *)c->keyName);
+  if (!sctx || sctx->spec->unique_id != c->specUniqueId) {
+    if (sctx) {
+      RedisModule_CloseKey(sctx->key);
+      SearchCtx_Free(sctx);
+    }
+    c->specGone = 1;
+    RedisModule_ThreadSafeContextUnlock(c->ctx);
+    return NULL;
+  }
+  return sctx;
+}
+
+static void fgc_unlockSpec(FGCCycle *c, RedisSearchCtx *sctx) {
+  RedisModule_CloseKey(sctx->key);
+  SearchCtx_Free(sctx);
+  RedisModule_ThreadSafeContextUnlock(c->ctx);
+}
+
+/* Apply the repair to an index of the spec, and update the stats. Returns the number of records
+ * collected */
+static size_t fgc_apply(FGCCycle *c, RedisSearchCtx *sctx, InvertedIndex *idx, FGCIndexRepair *r) {
+  size_t docs = 0, bytes = 0;
+  if (FGC_ApplyIndexRepair(idx, r, &docs, &bytes)) {
+    c->incomplete = 1;
+  }
+  sctx->spec->stats.numRecords -= docs;
+  sctx->spec->stats.invertedSize -= bytes;
+  c->docsCollected += docs;
+  c->bytesCollected += bytes;
+  return docs;
+}
+
+static int fgc_parentTerm(FGCCycle *c) {
+  char *term = NULL;
+  size_t len;
+  FGCIndexRepair r = {NULL};
+  int rc = fgc_readString(c->fd, &term, &len);
+  if (rc == REDISMODULE_OK) {
+    rc = FGC_ReadIndexRepair(c->fd, &r);
+  }
+
+  RedisSearchCtx *sctx;
+  if (rc == REDISMODULE_OK && (sctx = fgc_lockSpec(c))) {
+    RedisModuleKey *idxKey = NULL;
+    InvertedIndex *idx = Redis_OpenInvertedIndexEx(sctx, term, len, 0, &idxKey);
+    if (idx) {
+      size_t docs = fgc_apply(c, sctx, idx, &r);
+      RedisModule_CloseKey(idxKey);
+      // the term is gone from all the documents it was in
+      if (docs) Redis_DeleteEmptyTerm(sctx, term, len);
+    }
+    fgc_unlockSpec(c, sctx);
+  }
+
+  FGC_FreeIndexRepair(&r);
+  rm_free(term);
+  return rc;
+}
+
+typedef struct {
+  uint32_t ordinal;
+  FGCIndexRepair r;
+} FGCRangeRepair;
+
+static int fgc_parentNumeric(FGCCycle *c) {
+  uint32_t fieldIdx, revisionId, ordinal;
+  FGCRangeRepair *ranges = array_new(FGCRangeRepair, 8);
+  int rc = REDISMODULE_OK;
+  if (fgc_read(c->fd, &fieldIdx, sizeof(fieldIdx)) != REDISMODULE_OK ||
+      fgc_read(c->fd, &revisionId, sizeof(revisionId)) != REDISMODULE_OK) {
+    rc = REDISMODULE_ERR;
+  }
+  while (rc == REDISMODULE_OK) {
+    if (fgc_read(c->fd, &ordinal, sizeof(ordinal)) != REDISMODULE_OK) {
+      rc = REDISMODULE_ERR;
+      break;
+    }
+    if (ordinal == FGC_END) break;
+    ranges = array_append(ranges, ((FGCRangeRepair){.ordinal = ordinal}));
+    rc = FGC_ReadIndexRepair(c->fd, &array_tail(ranges).r);
+  }
+
+  RedisSearchCtx *sctx;
+  if (rc == REDISMODULE_OK && (sctx = fgc_lockSpec(c))) {
+    IndexSpec *spec = sctx->spec;
+    RedisModuleKey *idxKey = NULL;
+    NumericRangeTree *rt = NULL;
+    if (fieldIdx < spec->numFields && FieldSpec_HasNumericIndex(&spec->fields[fieldIdx])) {
+      RedisModuleString *keyName = IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]);
+      rt = OpenNumericIndex(sctx, keyName, &idxKey);
+    }
+
+    // ranges are identified by their position in the tree, which only holds if it wasn't split
+    if (rt && rt->revisionId == revisionId) {
+      NumericRangeTreeIterator *it = NumericRangeTreeIterator_New(rt);
+      NumericRangeNode *node;
+      uint32_t n = 0, next = 0;
+      while (next < array_len(ranges) && (node = NumericRangeTreeIterator_Next(it))) {
+        if (!node->range) continue;
+        if (n++ != ranges[next].ordinal) continue;
+        size_t docs = fgc_apply(c, sctx, node->range->entries, &ranges[next].r);
+        if (docs) {
+          rt->numEntries -= docs;
+          NumericRange_RecountCard(node->range);
+        }
+        next++;
+      }
+      NumericRangeTreeIterator_Free(it);
+    } else if (rt && array_len(ranges)) {
+      c->incomplete = 1;
+    }
+    if (idxKey) RedisModule_CloseKey(idxKey);
+    fgc_unlockSpec(c, sctx);
+  }
+
+  for (uint32_t i = 0; i < array_len(ranges); i++) {
+    FGC_FreeIndexRepair(&ranges[i].r);
+  }
+  array_free(ranges);
+  return rc;
+}
+
+static int fgc_parentTag(FGCCycle *c) {
+  uint32_t fieldIdx;
+  char *value = NULL;
+  size_t len;
+  FGCIndexRepair r = {NULL};
+  int rc = fgc_read(c->fd, &fieldIdx, sizeof(fieldIdx));
+  if (rc == REDISMODULE_OK) {
+    rc = fgc_readString(c->fd, &value, &len);
+  }
+  if (rc == REDISMODULE_OK) {
+    rc = FGC_ReadIndexRepair(c->fd, &r);
+  }
+
+  RedisSearchCtx *sctx;
+  if (rc == REDISMODULE_OK && (sctx = fgc_lockSpec(c))) {
+    IndexSpec *spec = sctx->spec;
+    if (fieldIdx < spec->numFields && spec->fields[fieldIdx].type == FIELD_TAG) {
+      RedisModuleKey *idxKey = NULL;
+      RedisModuleString *keyName = IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]);
+      TagIndex *tagIdx = TagIndex_Open(c->ctx, keyName, 0, &idxKey);
+      if (tagIdx) {
+        InvertedIndex *iv = TrieMap_Find(tagIdx->values, value, len);
+        if (iv && iv != TRIEMAP_NOTFOUND) {
+          fgc_apply(c, sctx, iv, &r);
+        }
+      }
+      if (idxKey) RedisModule_CloseKey(idxKey);
+    }
+    fgc_unlockSpec(c, sctx);
+  }
+
+  FGC_FreeIndexRepair(&r);
+  rm_free(value);
+  return rc;
+}
+
+size_t FGC_Collect(RedisModuleCtx *ctx, const RedisModuleString *keyName, uint64_t specUniqueId,
+                   size_t *bytesCollected, int *specGone) {
+  FGCCycle c = {.ctx = ctx, .keyName = keyName, .specUniqueId = specUniqueId, .incomplete = 1};
+
+  RedisSearchCtx *sctx = NewSearchCtx(ctx, (RedisModuleString *)keyName);
+  if (!sctx || sctx->spec->unique_id != specUniqueId) {
+    c.specGone = 1;
+    goto end;
+  }
+
+  int fds[2];
+  if (pipe(fds) == -1) {
+    RedisModule_Log(ctx, "warning", "Fork GC could not open a pipe: %s", strerror(errno));
+    goto end;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    RedisModule_Log(ctx, "warning", "Fork GC could not fork: %s", strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    goto end;
+  }
+  if (pid == 0) {
+    // the child. If the parent gives up on us, we'd rather fail the write than die of SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    close(fds[0]);
+    fgc_childScan(sctx, fds[1]);
+    _exit(0);
+  }
+
+  // the child collects the documents deleted so far, we track the ones deleted while it runs
+  DocTable_BeginCollect(&sctx->spec->docs);
+  close(fds[1]);
+  RedisModule_CloseKey(sctx->key);
+  SearchCtx_Free(sctx);
+  sctx = NULL;
+  RedisModule_ThreadSafeContextUnlock(ctx);
+
+  c.fd = fds[0];
+  c.incomplete = 0;
+  while (!c.specGone) {
+    uint32_t type;
+    if (fgc_read(c.fd, &type, sizeof(type)) != REDISMODULE_OK) {
+      // the child died before it was done
+      c.incomplete = 1;
+      break;
+    }
+    if (type == FGCMsg_Done) break;
+    int rc = REDISMODULE_ERR;
+    switch (type) {
+      case FGCMsg_Term:
+        rc = fgc_parentTerm(&c);
+        break;
+      case FGCMsg_Numeric:
+        rc = fgc_parentNumeric(&c);
+        break;
+      case FGCMsg_Tag:
+        rc = fgc_parentTag(&c);
+        break;
+    }
+    if (rc != REDISMODULE_OK) {
+      c.incomplete = 1;
+      break;
+    }
+  }
+
+  close(c.fd);
+  waitpid(pid, NULL, 0);
+  RedisModule_ThreadSafeContextLock(ctx);
+
+  sctx = NewSearchCtx(ctx, (RedisModuleString *)keyName);
+  if (sctx && sctx->spec->unique_id == specUniqueId) {
+    DocTable_EndCollect(&sctx->spec->docs, !c.incomplete && !c.specGone);
+  } else {
+    c.specGone = 1;
+  }
+
+end:
+  if (sctx) {
+    RedisModule_CloseKey(sctx->key);
+    SearchCtx_Free(sctx);
+  }
+  *specGone = c.specGone;
+  *bytesCollected = c.bytesCollected;
+  return c.docsCollected;
+}
@@ -0,0 +1,64 @@
+#ifndef RS_FORK_GC_H_
+#define RS_FORK_GC_H_
+
+#include "redismodule.h"
+#include "inverted_index.h"
+
+/* The fork GC (GC_POLICY FORK) collects the garbage of all the inverted, numeric and tag indexes of
+ * a spec in one cycle, without scanning them on the main thread.
+ *
+ * A cycle forks a child, which sees a frozen copy of the indexes and the document table. The child
+ * repairs its copy of every block that has deleted documents, and streams the repaired blocks back
+ * to the parent over a pipe, one index at a time. The parent reads each index's blocks without the
+ * GIL, then takes it just long enough to swap them in. Blocks that got new records since the fork
+ * are left alone, and repaired in the next cycle. */
+
+/* A block repaired by the child, and where it goes in the parent's index */
+typedef struct {
+  uint32_t blockNum;
+  // the block's bounds and size when the child forked. If they changed since, the block is skipped
+  t_docId oldFirstId;
+  t_docId oldLastId;
+  uint16_t oldNumDocs;
+  uint32_t docsCollected;
+  size_t bytesCollected;
+  size_t dataLen;
+  // the repaired block. On the parent's side it owns its buffer and skip table until applied
+  IndexBlock blk;
+} FGCRepairedBlock;
+
+/* The repaired blocks of a single inverted index */
+typedef struct {
+  FGCRepairedBlock *blocks;
+} FGCIndexRepair;
+
+/* Repair all the blocks of idx that point at deleted documents in place, and describe them in r.
+ * The replaced buffers are not freed, so this is only meant for the child's copy of the index.
+ * Returns the number of blocks repaired */
+size_t FGC_RepairIndex(InvertedIndex *idx, DocTable *dt, FGCIndexRepair *r);
+
+/* Write the repaired blocks to fd. Returns REDISMODULE_ERR if the pipe broke */
+int FGC_WriteIndexRepair(int fd, const FGCIndexRepair *r);
+
+/* Read repaired blocks written by FGC_WriteIndexRepair. r must be freed with FGC_FreeIndexRepair
+ * even on failure */
+int FGC_ReadIndexRepair(int fd, FGCIndexRepair *r);
+
+/* Swap the repaired blocks into the index, skipping blocks that changed since the fork. The number
+ * of records and bytes collected are added to docsCollected and bytesCollected. Returns the number
+ * of blocks skipped */
+size_t FGC_ApplyIndexRepair(InvertedIndex *idx, FGCIndexRepair *r, size_t *docsCollected,
+                            size_t *bytesCollected);
+
+/* Free the blocks that were read but not applied */
+void FGC_FreeIndexRepair(FGCIndexRepair *r);
+
+/* Run a fork GC cycle on the index named keyName. Must be called with the GIL held. The GIL is
+ * released while the child scans, and taken again to apply the repairs of each index; it is held
+ * again when this returns. Returns the number of records collected, and puts the number of bytes
+ * collected in bytesCollected. Sets specGone if the index was dropped. If all the garbage the child
+ * found was collected, the documents it collected are dropped from the doc table's deleted set */
+size_t FGC_Collect(RedisModuleCtx *ctx, const RedisModuleString *keyName, uint64_t specUniqueId,
+                   size_t *bytesCollected, int *specGone);
+
+#endif
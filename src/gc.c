@@ -13,6 +13,9 @@
 #include "numeric_index.h"
 #include "tag_index.h"
 #include "config.h"
+#include "fork_gc.h"
+#include "trie/levenshtein.h"
+#include "trie/rune_util.h"
 
 // convert a frequency to timespec
 struct timespec hzToTimeSpec(float hz) {
@@ -55,6 +58,9 @@ typedef struct GarbageCollectorCtx {
 
   uint64_t spec_unique_id;
 
+  // number of cycles since the last full sweep, see gc_Sweep
+  int cyclesSinceSweep;
+
 } GarbageCollectorCtx;
 
 /* Create a new garbage collector, with a string for the index name, and initial frequency */
@@ -149,6 +155,13 @@ size_t gc_RandomTerm(RedisModuleCtx *ctx, GarbageCollectorCtx *gc, int *status)
       // reopen the inverted index - it might have gone away
       idx = Redis_OpenInvertedIndexEx(sctx, term, strlen(term), 1, &idxKey);
     } while (idx != NULL);
+
+    // we got to the end of the index - if nothing is left in it the term is gone
+    if (idx && !blockNum && totalRemoved) {
+      RedisModule_CloseKey(idxKey);
+      idxKey = NULL;
+      Redis_DeleteEmptyTerm(sctx, term, strlen(term));
+    }
   }
   if (totalRemoved) {
     RedisModule_Log(ctx, "notice", "Garbage collected %zd bytes in %zd records for term '%s'",
@@ -216,6 +229,16 @@ static FieldSpec **getFieldsByType(IndexSpec *spec, FieldType type) {
   return fields;
 }
 
+static FieldSpec **getNumericIndexFields(IndexSpec *spec) {
+  FieldSpec **fields = array_new(FieldSpec *, FIELDS_ARRAY_CAP);
+  for (int i = 0; i < spec->numFields; ++i) {
+    if (FieldSpec_HasNumericIndex(&spec->fields[i])) {
+      fields = array_append(fields, &(spec->fields[i]));
+    }
+  }
+  return fields;
+}
+
 static RedisModuleString *getRandomFieldByType(IndexSpec *spec, FieldType type) {
   FieldSpec **tagFields = NULL;
   tagFields = getFieldsByType(spec, type);
@@ -323,8 +346,8 @@ size_t gc_NumericIndex(RedisModuleCtx *ctx, GarbageCollectorCtx *gc, int *status
     goto end;
   }
   IndexSpec *spec = sctx->spec;
-  // find all the numeric fields
-  numericFields = getFieldsByType(spec, FIELD_NUMERIC);
+  // find all the fields with numeric indexes
+  numericFields = getNumericIndexFields(spec);
 
   if (array_len(numericFields) == 0) {
     goto end;
@@ -387,6 +410,9 @@ size_t gc_NumericIndex(RedisModuleCtx *ctx, GarbageCollectorCtx *gc, int *status
       break;
     }
   } while (true);
+  if (!blockNum && totalRemoved) {
+    NumericRange_RecountCard(nextNode->range);
+  }
 
 end:
   if (numericFields) {
@@ -401,6 +427,271 @@ end:
   return totalRemoved;
 }
 
+/* State of a full sweep of the spec's indexes, see gc_Sweep */
+typedef struct {
+  RedisModuleCtx *ctx;
+  GarbageCollectorCtx *gc;
+  // NULL once the spec is gone
+  RedisSearchCtx *sctx;
+  size_t totalRemoved;
+  // set if some of the garbage that was there when we started may still be left
+  int incomplete;
+} GCSweep;
+
+/* Repair up to gcScanSize blocks of an index from blockNum on, then close the index key and yield
+ * the GIL. Returns the block to continue from, or 0 if the index is done or the spec is gone */
+static int gc_sweepStep(GCSweep *sw, InvertedIndex *idx, RedisModuleKey *idxKey, int blockNum,
+                        size_t *numEntries) {
+  IndexRepairParams params = {.limit = RSGlobalConfig.gcScanSize};
+  blockNum = InvertedIndex_Repair(idx, &sw->sctx->spec->docs, blockNum, &params);
+  sw->totalRemoved += params.docsCollected;
+  gc_updateStats(sw->sctx, sw->gc, params.docsCollected, params.bytesCollected);
+  if (numEntries) *numEntries -= params.docsCollected;
+
+  if (idxKey) RedisModule_CloseKey(idxKey);
+  sw->sctx = SearchCtx_Refresh(sw->sctx, (RedisModuleString *)sw->gc->keyName);
+  if (sw->sctx && sw->sctx->spec->unique_id != sw->gc->spec_unique_id) {
+    RedisModule_CloseKey(sw->sctx->key);
+    SearchCtx_Free(sw->sctx);
+    sw->sctx = NULL;
+  }
+  return sw->sctx ? blockNum : 0;
+}
+
+static void gc_sweepTerms(GCSweep *sw) {
+  char **terms = array_new(char *, 64);
+  rune *rstr = NULL;
+  t_len slen = 0;
+  float score = 0;
+  int dist = 0;
+  TrieIterator *it = Trie_Iterate(sw->sctx->spec->terms, "", 0, 0, 1);
+  while (TrieIterator_Next(it, &rstr, &slen, NULL, &score, &dist)) {
+    size_t len;
+    terms = array_append(terms, runesToStr(rstr, slen, &len));
+  }
+  DFAFilter_Free(it->ctx);
+  free(it->ctx);
+  TrieIterator_Free(it);
+
+  for (uint32_t i = 0; i < array_len(terms) && sw->sctx; i++) {
+    int blockNum = 0;
+    size_t removed = sw->totalRemoved;
+    do {
+      RedisModuleKey *idxKey = NULL;
+      InvertedIndex *idx = Redis_OpenInvertedIndexEx(sw->sctx, terms[i], strlen(terms[i]), 0,
+                                                     &idxKey);
+      if (!idx) {
+        // the term's index is gone, along with its garbage
+        if (idxKey) RedisModule_CloseKey(idxKey);
+        break;
+      }
+      blockNum = gc_sweepStep(sw, idx, idxKey, blockNum, NULL);
+    } while (blockNum);
+    if (sw->sctx && sw->totalRemoved != removed) {
+      Redis_DeleteEmptyTerm(sw->sctx, terms[i], strlen(terms[i]));
+    }
+  }
+
+  for (uint32_t i = 0; i < array_len(terms); i++) {
+    free(terms[i]);
+  }
+  array_free(terms);
+}
+
+static void gc_sweepNumeric(GCSweep *sw, int fieldIdx) {
+  RedisModuleKey *idxKey = NULL;
+  IndexSpec *spec = sw->sctx->spec;
+  NumericRangeTree *rt =
+      OpenNumericIndex(sw->sctx, IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]), &idxKey);
+  if (!rt) {
+    if (idxKey) RedisModule_CloseKey(idxKey);
+    return;
+  }
+  // the tree's nodes stay put as long as it isn't split, so we can go on iterating it after yielding
+  uint32_t revisionId = rt->revisionId;
+  NumericRangeTreeIterator *it = NumericRangeTreeIterator_New(rt);
+  NumericRangeNode *node;
+  while ((node = NumericRangeTreeIterator_Next(it))) {
+    if (!node->range) continue;
+    int blockNum = 0;
+    size_t removed = sw->totalRemoved;
+    do {
+      blockNum = gc_sweepStep(sw, node->range->entries, idxKey, blockNum, &rt->numEntries);
+      idxKey = NULL;
+      // the spec is gone, and the tree with it
+      if (!sw->sctx) goto end;
+
+      spec = sw->sctx->spec;
+      NumericRangeTree *cur = OpenNumericIndex(
+          sw->sctx, IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]), &idxKey);
+      if (cur != rt || rt->revisionId != revisionId) {
+        // the ranges we were going over are gone, their entries may have moved to ranges we visited
+        sw->incomplete = 1;
+        goto end;
+      }
+    } while (blockNum);
+    if (sw->totalRemoved != removed) {
+      NumericRange_RecountCard(node->range);
+    }
+  }
+
+end:
+  NumericRangeTreeIterator_Free(it);
+  if (idxKey) RedisModule_CloseKey(idxKey);
+}
+
+typedef struct {
+  char *str;
+  tm_len_t len;
+} GCTagValue;
+
+static void gc_sweepTags(GCSweep *sw, int fieldIdx) {
+  RedisModuleKey *idxKey = NULL;
+  IndexSpec *spec = sw->sctx->spec;
+  TagIndex *tagIdx = TagIndex_Open(
+      sw->ctx, IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]), 0, &idxKey);
+  if (!tagIdx) {
+    if (idxKey) RedisModule_CloseKey(idxKey);
+    return;
+  }
+
+  GCTagValue *values = array_new(GCTagValue, 16);
+  char *value;
+  tm_len_t len;
+  void *ptr;
+  TrieMapIterator *it = TrieMap_Iterate(tagIdx->values, "", 0);
+  while (TrieMapIterator_Next(it, &value, &len, &ptr)) {
+    GCTagValue v = {.str = malloc(len), .len = len};
+    memcpy(v.str, value, len);
+    values = array_append(values, v);
+  }
+  TrieMapIterator_Free(it);
+
+  for (uint32_t i = 0; i < array_len(values) && tagIdx; i++) {
+    int blockNum = 0;
+    do {
+      InvertedIndex *iv = TrieMap_Find(tagIdx->values, values[i].str, values[i].len);
+      if (!iv || iv == TRIEMAP_NOTFOUND) break;
+      blockNum = gc_sweepStep(sw, iv, idxKey, blockNum, NULL);
+      idxKey = NULL;
+      if (!sw->sctx) {
+        // the spec is gone, and the tag index with it
+        tagIdx = NULL;
+        break;
+      }
+
+      // reopen the tag index - it might have gone away
+      spec = sw->sctx->spec;
+      tagIdx = TagIndex_Open(sw->ctx, IndexSpec_GetFormattedKey(spec, &spec->fields[fieldIdx]), 0,
+                             &idxKey);
+    } while (blockNum && tagIdx);
+  }
+  if (idxKey) RedisModule_CloseKey(idxKey);
+
+  for (uint32_t i = 0; i < array_len(values); i++) {
+    free(values[i].str);
+  }
+  array_free(values);
+}
+
+/* Collect the garbage of every index of the spec, yielding the GIL every gcScanSize blocks. Random
+ * samples can never tell that all the postings of a deleted document are gone, so this is how the
+ * default GC drops collected documents from the doc table's deleted set, see DocTable_EndCollect.
+ * The indexes are listed when we start. Indexes and fields created while we sweep only hold
+ * documents added after that, so there is nothing for us in them */
+size_t gc_Sweep(RedisModuleCtx *ctx, GarbageCollectorCtx *gc, int *status) {
+  GCSweep sw = {.ctx = ctx, .gc = gc, .sctx = NewSearchCtx(ctx, (RedisModuleString *)gc->keyName)};
+  if (!sw.sctx || sw.sctx->spec->unique_id != gc->spec_unique_id) {
+    RedisModule_Log(ctx, "warning", "No index spec for GC %s",
+                    RedisModule_StringPtrLen(gc->keyName, NULL));
+    *status = SPEC_STATUS_INVALID;
+    goto end;
+  }
+  gc->cyclesSinceSweep = 0;
+  if (!sw.sctx->spec->docs.deleted.card) {
+    goto end;
+  }
+
+  DocTable_BeginCollect(&sw.sctx->spec->docs);
+  int numFields = sw.sctx->spec->numFields;
+  if (sw.sctx->spec->terms) {
+    gc_sweepTerms(&sw);
+  }
+  for (int i = 0; i < numFields && sw.sctx; i++) {
+    if (FieldSpec_HasNumericIndex(&sw.sctx->spec->fields[i])) {
+      gc_sweepNumeric(&sw, i);
+    }
+  }
+  for (int i = 0; i < numFields && sw.sctx; i++) {
+    if (sw.sctx->spec->fields[i].type == FIELD_TAG) {
+      gc_sweepTags(&sw, i);
+    }
+  }
+
+  if (!sw.sctx) {
+    *status = SPEC_STATUS_INVALID;
+    goto end;
+  }
+  DocTable_EndCollect(&sw.sctx->spec->docs, !sw.incomplete);
+  if (sw.totalRemoved) {
+    RedisModule_Log(ctx, "notice", "GC sweep collected %zd records", sw.totalRemoved);
+  }
+
+end:
+  if (sw.sctx) {
+    RedisModule_CloseKey(sw.sctx->key);
+    SearchCtx_Free(sw.sctx);
+  }
+  return sw.totalRemoved;
+}
+
+static struct timespec gc_interval(GarbageCollectorCtx *gc) {
+  if (RSGlobalConfig.gcPolicy == GCPolicy_Fork) {
+    return (struct timespec){.tv_sec = RSGlobalConfig.forkGcRunIntervalSec};
+  }
+  return hzToTimeSpec(gc->hz);
+}
+
+/* Collect the garbage of all the spec's indexes with a fork GC cycle. This releases the GIL while
+ * the child scans */
+size_t gc_Fork(RedisModuleCtx *ctx, GarbageCollectorCtx *gc, int *status) {
+  RedisSearchCtx *sctx = NewSearchCtx(ctx, (RedisModuleString *)gc->keyName);
+  if (!sctx || sctx->spec->unique_id != gc->spec_unique_id) {
+    RedisModule_Log(ctx, "warning", "No index spec for GC %s",
+                    RedisModule_StringPtrLen(gc->keyName, NULL));
+    *status = SPEC_STATUS_INVALID;
+    if (sctx) {
+      RedisModule_CloseKey(sctx->key);
+      SearchCtx_Free(sctx);
+    }
+    return 0;
+  }
+  // complete cycles drop the documents they collected from the deleted set, so cycles with no
+  // deletions left to collect are skipped, saving the fork
+  size_t deletedDocs = sctx->spec->docs.deleted.card;
+  RedisModule_CloseKey(sctx->key);
+  SearchCtx_Free(sctx);
+  if (!deletedDocs) {
+    return 0;
+  }
+
+  size_t bytesCollected = 0;
+  int specGone = 0;
+  size_t totalRemoved =
+      FGC_Collect(ctx, gc->keyName, gc->spec_unique_id, &bytesCollected, &specGone);
+  if (specGone) {
+    *status = SPEC_STATUS_INVALID;
+  }
+  // documents deleted while the child scanned, or blocks we could not repair, are left in the
+  // deleted set for the next cycle, see DocTable_EndCollect
+  gc->stats.totalCollected += bytesCollected;
+  if (totalRemoved) {
+    RedisModule_Log(ctx, "notice", "Fork GC collected %zd bytes in %zd records", bytesCollected,
+                    totalRemoved);
+  }
+  return totalRemoved;
+}
+
 /* The GC periodic callback, called in a separate thread. It selects a random term (using weighted
  * random) */
 static int gc_periodicCallback(RedisModuleCtx *ctx, void *privdata) {
@@ -423,18 +714,26 @@ static int gc_periodicCallback(RedisModuleCtx *ctx, void *privdata) {
 
   size_t totalRemoved = 0;
 
-  totalRemoved += gc_RandomTerm(ctx, gc, &status);
+  if (RSGlobalConfig.gcPolicy == GCPolicy_Fork) {
+    totalRemoved += gc_Fork(ctx, gc, &status);
+  } else {
+    totalRemoved += gc_RandomTerm(ctx, gc, &status);
 
-  totalRemoved += gc_NumericIndex(ctx, gc, &status);
+    totalRemoved += gc_NumericIndex(ctx, gc, &status);
 
-  totalRemoved += gc_TagIndex(ctx, gc, &status);
+    totalRemoved += gc_TagIndex(ctx, gc, &status);
+
+    if (status == SPEC_STATUS_OK && ++gc->cyclesSinceSweep >= GC_SWEEP_CYCLES) {
+      totalRemoved += gc_Sweep(ctx, gc, &status);
+    }
+  }
 
   gc->stats.numCycles++;
   gc->stats.effectiveCycles += totalRemoved > 0 ? 1 : 0;
 
   // if we didn't remove anything - reduce the frequency a bit.
-  // if we did  - increase the frequency a bit
-  if (gc->timer) {
+  // if we did  - increase the frequency a bit. The fork GC runs at a fixed interval
+  if (gc->timer && RSGlobalConfig.gcPolicy != GCPolicy_Fork) {
     // the timer is NULL if we've been cancelled
     if (totalRemoved > 0) {
       gc->hz = MIN(gc->hz * 1.2, GC_MAX_HZ);
@@ -469,7 +768,7 @@ static void gc_onTerm(void *privdata) {
 // Start the collector thread
 int GC_Start(GarbageCollectorCtx *ctx) {
   assert(ctx->timer == NULL);
-  ctx->timer = RMUtil_NewPeriodicTimer(gc_periodicCallback, gc_onTerm, ctx, hzToTimeSpec(ctx->hz));
+  ctx->timer = RMUtil_NewPeriodicTimer(gc_periodicCallback, gc_onTerm, ctx, gc_interval(ctx));
   return REDISMODULE_OK;
 }
 
@@ -9,6 +9,9 @@
 #define GC_MIN_HZ 1
 #define GC_DEFAULT_HZ 10
 
+// the default GC sweeps all the indexes of the spec once every this many cycles
+#define GC_SWEEP_CYCLES 10
+
 #define NUM_CYCLES_HISTORY 10
 
 typedef struct {
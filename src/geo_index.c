@@ -1,34 +1,207 @@
+#include <math.h>
+#include <sys/param.h>
 #include "index.h"
 #include "geo_index.h"
 #include "rmutil/util.h"
 #include "rmalloc.h"
+#include "redis_index.h"
+#include "util/arr.h"
 #include "id_list.h"
 
-RedisModuleString *fmtGeoIndexKey(GeoIndex *gi) {
-  return RedisModule_CreateStringPrintf(gi->ctx->redisCtx, GEOINDEX_KEY_FMT, gi->ctx->spec->name,
-                                        gi->sp->name);
+/* Spread the low 32 bits of x and y over the even and odd bits of the result, respectively */
+static inline uint64_t interleave64(uint32_t xlo, uint32_t ylo) {
+  static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+                               0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL};
+  static const unsigned int S[] = {1, 2, 4, 8, 16};
+  uint64_t x = xlo, y = ylo;
+  for (int i = 4; i >= 0; i--) {
+    x = (x | (x << S[i])) & B[i];
+    y = (y | (y << S[i])) & B[i];
+  }
+  return x | (y << 1);
 }
 
-/* Add a docId to a geoindex key. Right now we just use redis' own GEOADD */
-int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat) {
+/* The reverse of interleave64 */
+static inline void deinterleave64(uint64_t v, uint32_t *xlo, uint32_t *ylo) {
+  static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+                               0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL,
+                               0x00000000FFFFFFFFULL};
+  static const unsigned int S[] = {0, 1, 2, 4, 8, 16};
+  uint64_t x = v, y = v >> 1;
+  for (int i = 0; i < 6; i++) {
+    x = (x | (x >> S[i])) & B[i];
+    y = (y | (y >> S[i])) & B[i];
+  }
+  *xlo = (uint32_t)x;
+  *ylo = (uint32_t)y;
+}
 
-  RedisModuleString *ks = fmtGeoIndexKey(gi);
+/* The index of the cell holding v, on an axis from min to max cut into 2^step cells */
+static inline uint32_t geoCellIndex(double v, double min, double max, int step) {
+  uint32_t n = 1U << step;
+  double off = (v - min) / (max - min) * n;
+  if (off <= 0) return 0;
+  if (off >= n) return n - 1;
+  return (uint32_t)off;
+}
 
-  RedisModuleCtx *ctx = gi->ctx->redisCtx;
+#define DEG_RAD(d) ((d)*M_PI / 180.0)
+#define RAD_DEG(r) ((r)*180.0 / M_PI)
+
+int GeoHash_Encode(double lon, double lat, double *hash) {
+  if (lon < GEO_LONG_MIN || lon > GEO_LONG_MAX || lat < GEO_LAT_MIN || lat > GEO_LAT_MAX) {
+    return REDISMODULE_ERR;
+  }
+  // latitude in the even bits, like redis does
+  *hash = interleave64(geoCellIndex(lat, GEO_LAT_MIN, GEO_LAT_MAX, GEO_STEP_MAX),
+                       geoCellIndex(lon, GEO_LONG_MIN, GEO_LONG_MAX, GEO_STEP_MAX));
+  return REDISMODULE_OK;
+}
+
+void GeoHash_Decode(double hash, double *lon, double *lat) {
+  uint32_t ilat, ilon;
+  deinterleave64((uint64_t)hash, &ilat, &ilon);
+  double n = 1U << GEO_STEP_MAX;
+  *lat = GEO_LAT_MIN + (ilat + 0.5) * ((GEO_LAT_MAX - GEO_LAT_MIN) / n);
+  *lon = GEO_LONG_MIN + (ilon + 0.5) * ((GEO_LONG_MAX - GEO_LONG_MIN) / n);
+}
+
+double Geo_Distance(double lon1, double lat1, double lon2, double lat2) {
+  double lat1r = DEG_RAD(lat1), lat2r = DEG_RAD(lat2);
+  double u = sin((lat2r - lat1r) / 2);
+  double v = sin(DEG_RAD(lon2 - lon1) / 2);
+  return 2.0 * GEO_EARTH_RADIUS_M * asin(sqrt(u * u + cos(lat1r) * cos(lat2r) * v * v));
+}
 
-  /* GEOADD key longitude latitude member*/
-  RedisModuleCallReply *rep = RedisModule_Call(ctx, "GEOADD", "sccl", ks, slon, slat, docId);
-  RedisModule_FreeString(gi->ctx->redisCtx, ks);
-  if (rep == NULL) {
+int GeoIndex_ParseStrings(const char *slon, const char *slat, double *hash) {
+  char *end;
+  double lon = strtod(slon, &end);
+  if (end == slon || *end) {
     return REDISMODULE_ERR;
   }
-  int repType = RedisModule_CallReplyType(rep);
-  RedisModule_FreeCallReply(rep);
-  if (repType == REDISMODULE_REPLY_ERROR) {
+  double lat = strtod(slat, &end);
+  if (end == slat || *end) {
     return REDISMODULE_ERR;
-  } else {
-    return REDISMODULE_OK;
   }
+  return GeoHash_Encode(lon, lat, hash);
+}
+
+/* Open the sorted set an older version kept for the field. Returns NULL if there is none */
+static RedisModuleKey *geoIndex_openLegacy(GeoIndex *gi, int mode) {
+  RedisModuleCtx *ctx = gi->ctx->redisCtx;
+  RedisModuleString *ks =
+      RedisModule_CreateStringPrintf(ctx, GEOINDEX_KEY_FMT, gi->ctx->spec->name, gi->sp->name);
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, ks, mode);
+  RedisModule_FreeString(ctx, ks);
+  if (!k || RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_ZSET) {
+    if (k) RedisModule_CloseKey(k);
+    return NULL;
+  }
+  return k;
+}
+
+/* Append the entries of a legacy sorted set whose geohashes are between min and max. Their scores
+ * are our geohashes, and their members the docIds. If gf is set, only the points within its radius
+ * are added */
+static NumericRangeEntry *geoIndex_scanLegacy(GeoIndex *gi, RedisModuleKey *k, double min,
+                                              double max, const GeoFilter *gf,
+                                              NumericRangeEntry *entries) {
+  RedisModule_ZsetFirstInScoreRange(k, min, max, 0, 0);
+  while (!RedisModule_ZsetRangeEndReached(k)) {
+    double score;
+    RedisModuleString *ele = RedisModule_ZsetRangeCurrentElement(k, &score);
+    long long docId;
+    if (RedisModule_StringToLongLong(ele, &docId) == REDISMODULE_OK &&
+        DocTable_Exists(&gi->ctx->spec->docs, docId) &&
+        (!gf || GeoFilter_MatchHash(gf, score))) {
+      entries = array_append(entries, ((NumericRangeEntry){.docId = docId, .value = score}));
+    }
+    RedisModule_FreeString(gi->ctx->redisCtx, ele);
+    RedisModule_ZsetRangeNext(k);
+  }
+  RedisModule_ZsetRangeStop(k);
+  return entries;
+}
+
+/* Convert the sorted set an older version kept for the field into a range tree, deleting it */
+static NumericRangeTree *geoIndex_loadLegacy(GeoIndex *gi) {
+  RedisModuleKey *k = geoIndex_openLegacy(gi, REDISMODULE_READ | REDISMODULE_WRITE);
+  if (!k) {
+    return NULL;
+  }
+
+  NumericRangeEntry *entries = array_new(NumericRangeEntry, RedisModule_ValueLength(k));
+  entries = geoIndex_scanLegacy(gi, k, REDISMODULE_NEGATIVE_INFINITE,
+                                REDISMODULE_POSITIVE_INFINITE, NULL, entries);
+  RedisModule_DeleteKey(k);
+  RedisModule_CloseKey(k);
+
+  NumericRangeTree *t = NewNumericRangeTreeFromEntries(entries, array_len(entries));
+  array_free(entries);
+  return t;
+}
+
+static int cmpEntryIds(const void *p1, const void *p2) {
+  const NumericRangeEntry *e1 = p1, *e2 = p2;
+  return e1->docId < e2->docId ? -1 : (e1->docId > e2->docId ? 1 : 0);
+}
+
+/* Query the legacy sorted set of a field that wasn't converted yet, without touching the keyspace.
+ * Returns NULL if there is no such set */
+static IndexIterator *geoIndex_legacyIterator(GeoIndex *gi, GeoFilter *gf, double weight) {
+  RedisModuleKey *k = geoIndex_openLegacy(gi, REDISMODULE_READ);
+  if (!k) {
+    return NULL;
+  }
+  NumericRangeEntry *entries = array_new(NumericRangeEntry, 16);
+  for (size_t i = 0; i < gf->numCells; i++) {
+    const NumericFilter *c = &gf->cells[i];
+    entries = geoIndex_scanLegacy(gi, k, c->min, c->max, c->geoFilter, entries);
+  }
+  RedisModule_CloseKey(k);
+
+  qsort(entries, array_len(entries), sizeof(*entries), cmpEntryIds);
+  t_docId *ids = rm_calloc(array_len(entries) + 1, sizeof(*ids));
+  size_t n = 0;
+  for (size_t i = 0; i < array_len(entries); i++) {
+    if (!n || ids[n - 1] != entries[i].docId) {
+      ids[n++] = entries[i].docId;
+    }
+  }
+  array_free(entries);
+  IndexIterator *ret = NewIdListIterator(ids, n, weight);
+  rm_free(ids);
+  return ret;
+}
+
+/* Convert the field's legacy sorted set, if its index wasn't created yet. This deletes the set, so
+ * it is only done by the commands that write to the index, and replicated with them */
+static void geoIndex_upgrade(GeoIndex *gi, RedisModuleString *keyName) {
+  RedisModuleKey *k =
+      RedisModule_OpenKey(gi->ctx->redisCtx, keyName, REDISMODULE_READ | REDISMODULE_WRITE);
+  if (RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_EMPTY) {
+    NumericRangeTree *t = geoIndex_loadLegacy(gi);
+    if (t) {
+      RedisModule_ModuleTypeSetValue(k, NumericIndexType, t);
+    }
+  }
+  RedisModule_CloseKey(k);
+}
+
+NumericRangeTree *GeoIndex_Open(GeoIndex *gi, RedisModuleKey **idxKey) {
+  RedisModuleString *keyName = IndexSpec_GetFormattedKey(gi->ctx->spec, gi->sp);
+  geoIndex_upgrade(gi, keyName);
+  return OpenNumericIndex(gi->ctx, keyName, idxKey);
+}
+
+/* The length of a unit in meters, or 0 if the unit is not valid */
+static double geoUnitFactor(const char *unit) {
+  if (!unit) return 0;
+  if (!strcasecmp(unit, "m")) return 1;
+  if (!strcasecmp(unit, "km")) return 1000;
+  if (!strcasecmp(unit, "ft")) return 0.3048;
+  if (!strcasecmp(unit, "mi")) return 1609.34;
+  return 0;
 }
 
 /* Parse a geo filter from redis arguments. We assume the filter args start at argv[0], and FILTER
@@ -41,6 +214,9 @@ int GeoFilter_Parse(GeoFilter *gf, RedisModuleString **argv, int argc) {
   gf->lon = 0;
   gf->unit = NULL;
   gf->radius = 0;
+  gf->radiusMeters = 0;
+  gf->cells = NULL;
+  gf->numCells = 0;
 
   if (argc != 5) {
     return REDISMODULE_ERR;
@@ -63,6 +239,7 @@ int GeoFilter_Parse(GeoFilter *gf, RedisModuleString **argv, int argc) {
     // printf("wrong unit %s\n", gf->unit);
     return REDISMODULE_ERR;
   }
+  gf->radiusMeters = gf->radius * geoUnitFactor(gf->unit);
 
   return REDISMODULE_OK;
 }
@@ -70,55 +247,209 @@ int GeoFilter_Parse(GeoFilter *gf, RedisModuleString **argv, int argc) {
 void GeoFilter_Free(GeoFilter *gf) {
   if (gf->property) free((char *)gf->property);
   if (gf->unit) free((char *)gf->unit);
+  rm_free(gf->cells);
   free(gf);
 }
 
-static int cmp_docids(const void *p1, const void *p2) {
-  const t_docId *d1 = p1, *d2 = p2;
+/* Returns 1 if the whole cell is within the filter's radius. On a sphere a cap no larger than a
+ * hemisphere contains every meridian segment between two of its points, and along a parallel the
+ * distance to the center only grows away from the center's meridian. So a cell that doesn't
+ * straddle the meridian opposite the center is inside the cap if its four corners are */
+static int geoFilter_cellInside(const GeoFilter *gf, int step, uint32_t ilat, uint32_t ilon) {
+  if (gf->radiusMeters >= GEO_EARTH_RADIUS_M * M_PI / 2) {
+    return 0;
+  }
+  double n = 1U << step;
+  double latMin = GEO_LAT_MIN + ilat * ((GEO_LAT_MAX - GEO_LAT_MIN) / n);
+  double latMax = GEO_LAT_MIN + (ilat + 1) * ((GEO_LAT_MAX - GEO_LAT_MIN) / n);
+  double lonMin = GEO_LONG_MIN + ilon * ((GEO_LONG_MAX - GEO_LONG_MIN) / n);
+  double lonMax = GEO_LONG_MIN + (ilon + 1) * ((GEO_LONG_MAX - GEO_LONG_MIN) / n);
 
-  return (int)(*d1 - *d2);
+  double opposite = gf->lon > 0 ? gf->lon - 180 : gf->lon + 180;
+  if (opposite > lonMin && opposite < lonMax) {
+    return 0;
+  }
+  return Geo_Distance(gf->lon, gf->lat, lonMin, latMin) <= gf->radiusMeters &&
+         Geo_Distance(gf->lon, gf->lat, lonMin, latMax) <= gf->radiusMeters &&
+         Geo_Distance(gf->lon, gf->lat, lonMax, latMin) <= gf->radiusMeters &&
+         Geo_Distance(gf->lon, gf->lat, lonMax, latMax) <= gf->radiusMeters;
 }
 
-t_docId *__gr_load(GeoIndex *gi, GeoFilter *gf, size_t *num) {
+/* A cell of the grid at some precision */
+typedef struct {
+  int step;
+  uint32_t ilat;
+  uint32_t ilon;
+  int inside;
+} geoCell;
 
-  *num = 0;
-  /*GEORADIUS key longitude latitude radius m|km|ft|mi */
-  RedisModuleCtx *ctx = gi->ctx->redisCtx;
-  RedisModuleString *ks = fmtGeoIndexKey(gi);
-  RedisModuleCallReply *rep = RedisModule_Call(
-      gi->ctx->redisCtx, "GEORADIUS", "ssssc", ks,
-      RedisModule_CreateStringPrintf(ctx, "%f", gf->lon),
-      RedisModule_CreateStringPrintf(ctx, "%f", gf->lat),
-      RedisModule_CreateStringPrintf(ctx, "%f", gf->radius), gf->unit ? gf->unit : "km");
+/* The bounding box of a radius. If it crosses the antimeridian, lonLo > lonHi */
+typedef struct {
+  double latLo, latHi;
+  double lonLo, lonHi;
+  int allLon;
+} geoBox;
 
-  if (rep == NULL || RedisModule_CallReplyType(rep) != REDISMODULE_REPLY_ARRAY) {
+static int geoBox_Overlaps(const geoBox *box, const geoCell *c) {
+  double n = 1U << c->step;
+  double latMin = GEO_LAT_MIN + c->ilat * ((GEO_LAT_MAX - GEO_LAT_MIN) / n);
+  double latMax = GEO_LAT_MIN + (c->ilat + 1) * ((GEO_LAT_MAX - GEO_LAT_MIN) / n);
+  if (latMax < box->latLo || latMin > box->latHi) {
+    return 0;
+  }
+  if (box->allLon) {
+    return 1;
+  }
+  double lonMin = GEO_LONG_MIN + c->ilon * ((GEO_LONG_MAX - GEO_LONG_MIN) / n);
+  double lonMax = GEO_LONG_MIN + (c->ilon + 1) * ((GEO_LONG_MAX - GEO_LONG_MIN) / n);
+  if (box->lonLo <= box->lonHi) {
+    return lonMax >= box->lonLo && lonMin <= box->lonHi;
+  }
+  return lonMax >= box->lonLo || lonMin <= box->lonHi;
+}
 
-    return NULL;
+static int cmpCells(const void *p1, const void *p2) {
+  const NumericFilter *c1 = p1, *c2 = p2;
+  return c1->min < c2->min ? -1 : (c1->min > c2->min ? 1 : 0);
+}
+
+size_t GeoFilter_Cover(GeoFilter *gf) {
+  // a query plan may be evaluated more than once - e.g. once per partition of a parallel scan. The
+  // iterators of earlier evaluations read the cells, so they are built once and kept
+  if (gf->cells) {
+    return gf->numCells;
   }
 
-  size_t sz = RedisModule_CallReplyLength(rep);
-  t_docId *docIds = rm_calloc(sz, sizeof(t_docId));
-  for (size_t i = 0; i < sz; i++) {
-    const char *s = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(rep, i), NULL);
-    if (!s) continue;
+  // the bounding box of the radius
+  double angle = gf->radiusMeters / GEO_EARTH_RADIUS_M;
+  double dlat = RAD_DEG(angle);
+  geoBox box = {.latLo = MIN(MAX(gf->lat - dlat, GEO_LAT_MIN), GEO_LAT_MAX),
+                .latHi = MAX(MIN(gf->lat + dlat, GEO_LAT_MAX), GEO_LAT_MIN),
+                .lonLo = GEO_LONG_MIN,
+                .lonHi = GEO_LONG_MAX,
+                .allLon = 1};
+  // unless the radius reaches a pole, its longitudes are bounded by the meridians tangent to it
+  if (angle < M_PI / 2 && sin(angle) < cos(DEG_RAD(gf->lat))) {
+    double dlon = RAD_DEG(asin(sin(angle) / cos(DEG_RAD(gf->lat))));
+    if (dlon < 180) {
+      box.allLon = 0;
+      box.lonLo = gf->lon - dlon;
+      box.lonHi = gf->lon + dlon;
+      if (box.lonLo < GEO_LONG_MIN) box.lonLo += 360;
+      if (box.lonHi > GEO_LONG_MAX) box.lonHi -= 360;
+    }
+  }
 
-    docIds[i] = (t_docId)atol(s);
+  // find the finest precision at which the box spans few enough cells. At step 1 there are only
+  // two cells on each axis, so we always stop
+  int step;
+  uint32_t latFirst = 0, latCells = 0, lonFirst = 0, lonCells = 0;
+  for (step = GEO_STEP_MAX; step > 0; step--) {
+    uint32_t n = 1U << step;
+    latFirst = geoCellIndex(box.latLo, GEO_LAT_MIN, GEO_LAT_MAX, step);
+    latCells = geoCellIndex(box.latHi, GEO_LAT_MIN, GEO_LAT_MAX, step) - latFirst + 1;
+    if (box.allLon) {
+      lonFirst = 0;
+      lonCells = n;
+    } else {
+      lonFirst = geoCellIndex(box.lonLo, GEO_LONG_MIN, GEO_LONG_MAX, step);
+      uint32_t lonLast = geoCellIndex(box.lonHi, GEO_LONG_MIN, GEO_LONG_MAX, step);
+      // a box crossing the antimeridian wraps around
+      lonCells = ((lonLast - lonFirst) & (n - 1)) + 1;
+      if (box.lonLo > box.lonHi && lonLast == lonFirst) lonCells = n;
+    }
+    if (latCells <= GEO_COVER_AXIS_CELLS && lonCells <= GEO_COVER_AXIS_CELLS) {
+      break;
+    }
   }
 
-  *num = sz;
-  return docIds;
-}
+  geoCell *cells = array_new(geoCell, GEO_COVER_MAX_CELLS);
+  size_t numBoundary = 0;
+  for (uint32_t i = 0; i < latCells; i++) {
+    for (uint32_t j = 0; j < lonCells; j++) {
+      geoCell c = {.step = step, .ilat = latFirst + i, .ilon = (lonFirst + j) & ((1U << step) - 1)};
+      c.inside = geoFilter_cellInside(gf, c.step, c.ilat, c.ilon);
+      numBoundary += !c.inside;
+      cells = array_append(cells, c);
+    }
+  }
 
-IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf, double weight) {
-  size_t sz;
-  t_docId *docIds = __gr_load(gi, gf, &sz);
-  if (!docIds) {
-    return NULL;
+  // split the cells on the boundary into their quadrants, one precision at a time, so that only the
+  // points near the boundary are checked. Quadrants outside the bounding box are dropped
+  while (numBoundary && step < GEO_STEP_MAX &&
+         array_len(cells) + 3 * numBoundary <= GEO_COVER_MAX_CELLS) {
+    step++;
+    geoCell *next = array_new(geoCell, GEO_COVER_MAX_CELLS);
+    numBoundary = 0;
+    for (uint32_t i = 0; i < array_len(cells); i++) {
+      if (cells[i].inside) {
+        next = array_append(next, cells[i]);
+        continue;
+      }
+      for (uint32_t q = 0; q < 4; q++) {
+        geoCell c = {.step = step,
+                     .ilat = cells[i].ilat * 2 + (q >> 1),
+                     .ilon = cells[i].ilon * 2 + (q & 1)};
+        if (!geoBox_Overlaps(&box, &c)) {
+          continue;
+        }
+        c.inside = geoFilter_cellInside(gf, c.step, c.ilat, c.ilon);
+        numBoundary += !c.inside;
+        next = array_append(next, c);
+      }
+    }
+    array_free(cells);
+    cells = next;
   }
 
-  IndexIterator *ret = NewIdListIterator(docIds, (t_offset)sz, weight);
-  rm_free(docIds);
-  return ret;
+  gf->cells = rm_calloc(array_len(cells), sizeof(*gf->cells));
+  gf->numCells = array_len(cells);
+  for (uint32_t i = 0; i < array_len(cells); i++) {
+    int shift = 2 * (GEO_STEP_MAX - cells[i].step);
+    uint64_t hash = interleave64(cells[i].ilat, cells[i].ilon);
+    gf->cells[i] = (NumericFilter){
+        .min = (double)(hash << shift),
+        .max = (double)(((hash + 1) << shift) - 1),
+        .inclusiveMin = 1,
+        .inclusiveMax = 1,
+        .geoFilter = cells[i].inside ? NULL : gf,
+    };
+  }
+  array_free(cells);
+
+  // cells that follow each other on the curve are merged, as long as they are checked the same way
+  qsort(gf->cells, gf->numCells, sizeof(*gf->cells), cmpCells);
+  size_t n = 0;
+  for (size_t i = 0; i < gf->numCells; i++) {
+    if (n && gf->cells[n - 1].max + 1 == gf->cells[i].min &&
+        gf->cells[n - 1].geoFilter == gf->cells[i].geoFilter) {
+      gf->cells[n - 1].max = gf->cells[i].max;
+    } else {
+      gf->cells[n++] = gf->cells[i];
+    }
+  }
+  gf->numCells = n;
+  return n;
+}
+
+int GeoFilter_MatchHash(const GeoFilter *gf, double hash) {
+  double lon, lat;
+  GeoHash_Decode(hash, &lon, &lat);
+  return Geo_Distance(gf->lon, gf->lat, lon, lat) <= gf->radiusMeters;
+}
+
+IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf, double weight,
+                                   ConcurrentSearchCtx *csx) {
+  GeoFilter_Cover(gf);
+  RedisModuleString *keyName = fmtRedisNumericIndexKey(gi->ctx, gi->sp->name);
+  RedisModuleKey *k = RedisModule_OpenKey(gi->ctx->redisCtx, keyName, REDISMODULE_READ);
+  int converted = k && RedisModule_KeyType(k) != REDISMODULE_KEYTYPE_EMPTY;
+  if (k) RedisModule_CloseKey(k);
+  if (!converted) {
+    // no document was indexed since the upgrade, so the points are still in the legacy set
+    return geoIndex_legacyIterator(gi, gf, weight);
+  }
+  return NewNumericMultiFilterIterator(gi->ctx, keyName, gf->cells, gf->numCells, weight, csx);
 }
 
 /* Create a geo filter from parsed strings and numbers */
@@ -129,6 +460,7 @@ GeoFilter *NewGeoFilter(double lon, double lat, double radius, const char *unit)
       .lat = lat,
       .radius = radius,
       .unit = unit,
+      .radiusMeters = radius * geoUnitFactor(unit),
   };
   return gf;
 }
@@ -6,6 +6,17 @@
 #include "index_result.h"
 #include "index_iterator.h"
 #include "search_ctx.h"
+#include "concurrent_ctx.h"
+#include "numeric_index.h"
+
+/* Geo fields are indexed natively, as the geohashes of their points in a numeric range tree. A
+ * geohash interleaves the bits of the latitude and longitude cells of a point, so every cell of the
+ * grid, at any precision, is a contiguous range of geohashes. The range tree splits where the
+ * points are dense, and its ranges keep their postings in the usual numeric inverted indexes.
+ *
+ * The hashes are the same 52 bit ones redis' GEOADD uses, so the sorted sets older versions kept at
+ * GEOINDEX_KEY_FMT are converted in place the first time a document is indexed into the field.
+ * Until then queries read the sorted set as it is */
 
 typedef struct geoIndex {
   RedisSearchCtx *ctx;
@@ -14,7 +25,33 @@ typedef struct geoIndex {
 
 #define GEOINDEX_KEY_FMT "geo:%s/%s"
 
-int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat);
+#define GEO_STEP_MAX 26
+#define GEO_LAT_MIN -85.05112878
+#define GEO_LAT_MAX 85.05112878
+#define GEO_LONG_MIN -180
+#define GEO_LONG_MAX 180
+#define GEO_EARTH_RADIUS_M 6372797.560856
+
+/* Geo queries are covered by cells of the finest precision at which their bounding box spans at
+ * most this many cells on each axis. The cells on the boundary of the radius are then split into
+ * finer ones, as long as there are no more than GEO_COVER_MAX_CELLS */
+#define GEO_COVER_AXIS_CELLS 4
+#define GEO_COVER_MAX_CELLS 64
+
+/* Encode a point as a geohash at full precision. Returns REDISMODULE_ERR if it is out of range */
+int GeoHash_Encode(double lon, double lat, double *hash);
+
+/* Decode a full precision geohash to the center of its cell */
+void GeoHash_Decode(double hash, double *lon, double *lat);
+
+/* The great circle distance between two points, in meters */
+double Geo_Distance(double lon1, double lat1, double lon2, double lat2);
+
+/* Parse a "lon lat" pair into a geohash. Returns REDISMODULE_ERR if it is not a valid point */
+int GeoIndex_ParseStrings(const char *slon, const char *slat, double *hash);
+
+/* Open the index of a geo field for writing, creating it if needed */
+NumericRangeTree *GeoIndex_Open(GeoIndex *gi, RedisModuleKey **idxKey);
 
 typedef struct geoFilter {
 
@@ -23,6 +60,13 @@ typedef struct geoFilter {
   double lon;
   double radius;
   const char *unit;
+
+  // the radius in meters, computed once the unit is known
+  double radiusMeters;
+  // the ranges of geohashes covering the radius, built when the filter is evaluated. Ranges of
+  // cells wholly inside the radius don't check their points
+  NumericFilter *cells;
+  size_t numCells;
 } GeoFilter;
 
 /* Create a geo filter from parsed strings and numbers */
@@ -35,6 +79,15 @@ int GeoFilter_IsValid(GeoFilter *f, char **err);
 /* Parse a geo filter from redis arguments. We assume the filter args start at argv[0] */
 int GeoFilter_Parse(GeoFilter *gf, RedisModuleString **argv, int argc);
 void GeoFilter_Free(GeoFilter *gf);
-IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf, double weight);
 
-#endif
\ No newline at end of file
+/* Build the ranges of geohashes covering the filter into gf->cells, unless they were built already.
+ * Returns their number. Iterators read the cells, so they live as long as the filter */
+size_t GeoFilter_Cover(GeoFilter *gf);
+
+/* Returns 1 if the point at a full precision geohash is within the filter's radius */
+int GeoFilter_MatchHash(const GeoFilter *gf, double hash);
+
+IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf, double weight,
+                                   ConcurrentSearchCtx *csx);
+
+#endif
@@ -138,6 +138,7 @@ IndexIterator *NewIdListIterator(t_docId *ids, t_offset num, double weight) {
   ret->HasNext = IL_HasNext;
   ret->LastDocId = IL_LastDocId;
   ret->Len = IL_Len;
+  ret->NumEstimated = IL_Len;
   ret->Read = IL_Read;
   ret->Current = IL_Current;
   ret->SkipTo = IL_SkipTo;
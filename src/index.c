@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/param.h>
 #include "rmalloc.h"
 
@@ -16,6 +17,7 @@ static int UI_Next(void *ctx);
 static int UI_Read(void *ctx, RSIndexResult **hit);
 static int UI_HasNext(void *ctx);
 static size_t UI_Len(void *ctx);
+static size_t UI_NumEstimated(void *ctx);
 
 static int II_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit);
 static int II_Next(void *ctx);
@@ -23,6 +25,7 @@ static int II_Read(void *ctx, RSIndexResult **hit);
 static int II_HasNext(void *ctx);
 static RSIndexResult *II_Current(void *ctx);
 static size_t II_Len(void *ctx);
+static size_t II_NumEstimated(void *ctx);
 static t_docId II_LastDocId(void *ctx);
 
 static inline t_docId UI_LastDocId(void *ctx) {
@@ -39,6 +42,74 @@ static void UI_Abort(void *ctx) {
   }
 }
 
+/* Put all the existing children into the heap. Their docIds are all 0 at this point, so the heap
+ * property holds trivially */
+static void UI_HeapInit(UnionContext *ui) {
+  ui->heapSize = 0;
+  for (int i = 0; i < ui->num; i++) {
+    if (ui->its[i]) ui->heap[ui->heapSize++] = i;
+  }
+}
+
+/* Restore the heap property after the docId of the child at position pos has grown */
+static void UI_HeapSiftDown(UnionContext *ui, int pos) {
+  int *heap = ui->heap;
+  const t_docId *ids = ui->docIds;
+  const int n = ui->heapSize;
+  int item = heap[pos];
+  while (1) {
+    int child = 2 * pos + 1;
+    if (child >= n) break;
+    if (child + 1 < n && ids[heap[child + 1]] < ids[heap[child]]) child++;
+    if (ids[item] <= ids[heap[child]]) break;
+    heap[pos] = heap[child];
+    pos = child;
+  }
+  heap[pos] = item;
+}
+
+/* Restore the heap property after the child at position pos was added at the bottom */
+static void UI_HeapSiftUp(UnionContext *ui, int pos) {
+  int *heap = ui->heap;
+  const t_docId *ids = ui->docIds;
+  int item = heap[pos];
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (ids[heap[parent]] <= ids[item]) break;
+    heap[pos] = heap[parent];
+    pos = parent;
+  }
+  heap[pos] = item;
+}
+
+/* Remove the top child from the heap, once it has reached EOF */
+static void UI_HeapPop(UnionContext *ui) {
+  ui->heap[0] = ui->heap[--ui->heapSize];
+  if (ui->heapSize) UI_HeapSiftDown(ui, 0);
+}
+
+/* Add to the current result all the children positioned at docId, walking only the part of the
+ * heap that can contain them */
+static void UI_HeapCollect(UnionContext *ui, int pos, t_docId docId) {
+  if (pos >= ui->heapSize) return;
+  int i = ui->heap[pos];
+  if (ui->docIds[i] != docId) return;
+  AggregateResult_AddChild(ui->current, ui->its[i]->Current(ui->its[i]->ctx));
+  UI_HeapCollect(ui, 2 * pos + 1, docId);
+  UI_HeapCollect(ui, 2 * pos + 2, docId);
+}
+
+/* Set the union's current result to docId, which is the docId of the top child */
+static void UI_HeapSetCurrent(UnionContext *ui, t_docId docId) {
+  if (ui->quickExit) {
+    IndexIterator *it = ui->its[ui->heap[0]];
+    AggregateResult_AddChild(ui->current, it->Current(it->ctx));
+  } else {
+    UI_HeapCollect(ui, 0, docId);
+  }
+  ui->minDocId = docId;
+}
+
 static void UI_Rewind(void *ctx) {
   UnionContext *ui = ctx;
   ui->atEnd = 0;
@@ -53,6 +124,9 @@ static void UI_Rewind(void *ctx) {
       ui->its[i]->Rewind(ui->its[i]->ctx);
     }
   }
+  if (ui->heap) {
+    UI_HeapInit(ui);
+  }
 }
 
 IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int quickExit,
@@ -68,6 +142,12 @@ IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int
   ctx->current = NewUnionResult(num, weight);
   ctx->len = 0;
   ctx->quickExit = quickExit;
+  ctx->heap = NULL;
+  ctx->heapSize = 0;
+  if (num >= UNION_HEAP_THRESHOLD) {
+    ctx->heap = calloc(num, sizeof(int));
+    UI_HeapInit(ctx);
+  }
   // bind the union iterator calls
   IndexIterator *it = malloc(sizeof(IndexIterator));
   it->ctx = ctx;
@@ -78,6 +158,7 @@ IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int
   it->HasNext = UI_HasNext;
   it->Free = UnionIterator_Free;
   it->Len = UI_Len;
+  it->NumEstimated = UI_NumEstimated;
   it->Abort = UI_Abort;
   it->Rewind = UI_Rewind;
 
@@ -88,6 +169,93 @@ static RSIndexResult *UI_Current(void *ctx) {
   return ((UnionContext *)ctx)->current;
 }
 
+/* Read the next docId of a heap based union: advance the children that are still on the last
+ * docId we returned, and take the smallest docId of all */
+static int UI_ReadHeap(UnionContext *ui, RSIndexResult **hit) {
+  AggregateResult_Reset(ui->current);
+  ui->current->weight = ui->weight;
+
+  while (ui->heapSize) {
+    int i = ui->heap[0];
+    if (ui->docIds[i] > ui->minDocId) break;
+
+    IndexIterator *it = ui->its[i];
+    RSIndexResult *res = NULL;
+    int rc = INDEXREAD_NOTFOUND;
+    // read while we're not at the end and perhaps the flags do not match
+    while (rc == INDEXREAD_NOTFOUND) {
+      rc = it->Read(it->ctx, &res);
+    }
+    if (rc == INDEXREAD_EOF) {
+      UI_HeapPop(ui);
+    } else {
+      ui->docIds[i] = res->docId;
+      UI_HeapSiftDown(ui, 0);
+    }
+  }
+
+  if (!ui->heapSize) {
+    ui->atEnd = 1;
+    return INDEXREAD_EOF;
+  }
+
+  UI_HeapSetCurrent(ui, ui->docIds[ui->heap[0]]);
+  ui->len++;
+  if (hit) *hit = ui->current;
+  return INDEXREAD_OK;
+}
+
+/* SkipTo for heap based unions. Only the children behind docId are skipped, each of them once.
+ *
+ * The children behind docId are first taken out of the heap, and parked in the slots it frees right
+ * after its end. Each is then skipped and put back with the docId it reports, even if it is still
+ * behind docId - so a child that did not move can't keep us looping */
+static int UI_SkipToHeap(UnionContext *ui, t_docId docId, RSIndexResult **hit) {
+  AggregateResult_Reset(ui->current);
+  ui->current->weight = ui->weight;
+
+  int parked = 0;
+  while (ui->heapSize && ui->docIds[ui->heap[0]] < docId) {
+    int i = ui->heap[0];
+    UI_HeapPop(ui);
+    ui->heap[ui->heapSize] = i;
+    parked++;
+  }
+
+  for (; parked; parked--) {
+    int i = ui->heap[ui->heapSize];
+    IndexIterator *it = ui->its[i];
+    RSIndexResult *res = NULL;
+    if (it->SkipTo(it->ctx, docId, &res) == INDEXREAD_EOF) {
+      // drop the child, and move the last parked one into its slot
+      ui->heap[ui->heapSize] = ui->heap[ui->heapSize + parked - 1];
+      continue;
+    }
+    ui->docIds[i] = res ? res->docId : it->LastDocId(it->ctx);
+    UI_HeapSiftUp(ui, ui->heapSize++);
+  }
+
+  if (!ui->heapSize) {
+    ui->atEnd = 1;
+    return INDEXREAD_EOF;
+  }
+
+  IndexIterator *top = ui->its[ui->heap[0]];
+  t_docId topId = ui->docIds[ui->heap[0]];
+  if (topId == docId) {
+    UI_HeapSetCurrent(ui, docId);
+    if (hit) *hit = ui->current;
+    return INDEXREAD_OK;
+  }
+
+  // not found - like the linear union, we bubble up the closest result after docId
+  RSIndexResult *minResult = top->Current(top->ctx);
+  AggregateResult_AddChild(ui->current, minResult);
+  ui->minDocId = topId;
+  if (hit) *hit = minResult;
+  return INDEXREAD_NOTFOUND;
+}
+
 static inline int UI_Read(void *ctx, RSIndexResult **hit) {
   UnionContext *ui = ctx;
   // nothing to do
@@ -95,6 +263,9 @@ static inline int UI_Read(void *ctx, RSIndexResult **hit) {
     ui->atEnd = 1;
     return INDEXREAD_EOF;
   }
+  if (ui->heap) {
+    return UI_ReadHeap(ui, hit);
+  }
 
   int numActive = 0;
   AggregateResult_Reset(ui->current);
@@ -184,6 +355,9 @@ static int UI_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
   if (ui->atEnd) {
     return INDEXREAD_EOF;
   }
+  if (ui->heap) {
+    return UI_SkipToHeap(ui, docId, hit);
+  }
 
   // reset the current hitf
   AggregateResult_Reset(ui->current);
@@ -274,6 +448,7 @@ void UnionIterator_Free(IndexIterator *it) {
   }
 
   free(ui->docIds);
+  free(ui->heap);
   IndexResult_Free(ui->current);
   free(ui->its);
   free(ui);
@@ -284,6 +459,21 @@ static size_t UI_Len(void *ctx) {
   return ((UnionContext *)ctx)->len;
 }
 
+/* A union yields at most the sum of its children, and no more than the documents in the index. The
+ * children of a large union often overlap, so without the cap its estimate can be many times the
+ * size of the index */
+static size_t UI_NumEstimated(void *ctx) {
+  UnionContext *ui = ctx;
+  size_t ret = 0;
+  for (int i = 0; i < ui->num; i++) {
+    if (ui->its[i]) ret += ui->its[i]->NumEstimated(ui->its[i]->ctx);
+  }
+  if (ui->docTable && ret > ui->docTable->maxDocId) {
+    ret = ui->docTable->maxDocId;
+  }
+  return ret;
+}
+
 void IntersectIterator_Free(IndexIterator *it) {
   if (it == NULL) return;
   IntersectContext *ui = it->ctx;
@@ -294,6 +484,7 @@ void IntersectIterator_Free(IndexIterator *it) {
     // IndexResult_Free(&ui->currentHits[i]);
   }
   free(ui->docIds);
+  free(ui->origPos);
   IndexResult_Free(ui->current);
   free(ui->its);
   free(it->ctx);
@@ -324,6 +515,51 @@ static void II_Rewind(void *ctx) {
   }
 }
 
+static size_t II_ChildEstimate(IndexIterator *it) {
+  return it ? it->NumEstimated(it->ctx) : 0;
+}
+
+/* Order the children by ascending estimated cardinality, so that reads are driven by the rarest
+ * child and the others are only skipped to its ids. If the results are checked for slop or order,
+ * we remember each child's original position, so hits can be put back in query order */
+static void II_SortChildren(IntersectContext *ic) {
+  if (ic->num < 2) return;
+  size_t est[ic->num];
+  int pos[ic->num];
+  int moved = 0;
+
+  // a stable insertion sort, intersections have few children
+  for (int i = 0; i < ic->num; i++) {
+    IndexIterator *it = ic->its[i];
+    size_t e = II_ChildEstimate(it);
+    int j = i;
+    for (; j > 0 && est[j - 1] > e; j--) {
+      est[j] = est[j - 1];
+      pos[j] = pos[j - 1];
+      ic->its[j] = ic->its[j - 1];
+      moved = 1;
+    }
+    est[j] = e;
+    pos[j] = i;
+    ic->its[j] = it;
+  }
+
+  if (moved && (ic->maxSlop >= 0 || ic->inOrder)) {
+    ic->origPos = calloc(ic->num, sizeof(int));
+    memcpy(ic->origPos, pos, ic->num * sizeof(int));
+  }
+}
+
+/* Put the children of a hit back in query order */
+static void II_RestoreOrder(IntersectContext *ic) {
+  RSAggregateResult *agg = &ic->current->agg;
+  RSIndexResult *tmp[agg->numChildren];
+  for (int i = 0; i < agg->numChildren; i++) {
+    tmp[ic->origPos[i]] = agg->children[i];
+  }
+  memcpy(agg->children, tmp, agg->numChildren * sizeof(*tmp));
+}
+
 IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
                                    t_fieldMask fieldMask, int maxSlop, int inOrder, double weight) {
 
@@ -341,6 +577,8 @@ IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
   ctx->docIds = calloc(num, sizeof(t_docId));
   ctx->current = NewIntersectResult(num, weight);
   ctx->docTable = dt;
+  ctx->origPos = NULL;
+  II_SortChildren(ctx);
 
   // bind the iterator calls
   IndexIterator *it = malloc(sizeof(IndexIterator));
@@ -351,6 +589,7 @@ IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
   it->Current = II_Current;
   it->HasNext = II_HasNext;
   it->Len = II_Len;
+  it->NumEstimated = II_NumEstimated;
   it->Free = IntersectIterator_Free;
   it->Abort = II_Abort;
   it->Rewind = II_Rewind;
@@ -411,6 +650,7 @@ static int II_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
   // if the requested id was found on all children - we return OK
   if (nfound == ic->num) {
     // printf("Skipto %d hit @%d\n", docId, ic->current->docId);
+    if (ic->origPos) II_RestoreOrder(ic);
 
     // Update the last found id
     ic->lastFoundId = ic->current->docId;
@@ -496,6 +736,8 @@ static int II_Read(void *ctx, RSIndexResult **hit) {
         continue;
       }
 
+      if (ic->origPos) II_RestoreOrder(ic);
+
       // If we need to match slop and order, we do it now, and possibly skip the result
       if (ic->maxSlop >= 0) {
         if (!IndexResult_IsWithinRange(ic->current, ic->maxSlop, ic->inOrder)) {
@@ -527,6 +769,12 @@ static size_t II_Len(void *ctx) {
   return ((IntersectContext *)ctx)->len;
 }
 
+/* An intersection yields at most as many results as its rarest child, which is the first one */
+static size_t II_NumEstimated(void *ctx) {
+  IntersectContext *ic = ctx;
+  return ic->num ? II_ChildEstimate(ic->its[0]) : 0;
+}
+
 static void NI_Abort(void *ctx) {
   NotContext *nc = ctx;
   if (nc->child) {
@@ -670,6 +918,12 @@ static size_t NI_Len(void *ctx) {
   return nc->len;
 }
 
+/* A NOT iterator may match every document that is not in its child */
+static size_t NI_NumEstimated(void *ctx) {
+  NotContext *nc = ctx;
+  return nc->maxDocId;
+}
+
 /* Last docId */
 static t_docId NI_LastDocId(void *ctx) {
   NotContext *nc = ctx;
@@ -696,6 +950,7 @@ IndexIterator *NewNotIterator(IndexIterator *it, t_docId maxDocId, double weight
   ret->HasNext = NI_HasNext;
   ret->LastDocId = NI_LastDocId;
   ret->Len = NI_Len;
+  ret->NumEstimated = NI_NumEstimated;
   ret->Read = NI_Read;
   ret->SkipTo = NI_SkipTo;
   ret->Abort = NI_Abort;
@@ -794,6 +1049,12 @@ static size_t OI_Len(void *ctx) {
   return nc->child ? nc->child->Len(nc->child->ctx) : 0;
 }
 
+/* An optional iterator matches all documents */
+static size_t OI_NumEstimated(void *ctx) {
+  OptionalMatchContext *nc = ctx;
+  return nc->maxDocId;
+}
+
 /* Last docId */
 static t_docId OI_LastDocId(void *ctx) {
   OptionalMatchContext *nc = ctx;
@@ -829,6 +1090,7 @@ IndexIterator *NewOptionalIterator(IndexIterator *it, t_docId maxDocId, double w
   ret->HasNext = OI_HasNext;
   ret->LastDocId = OI_LastDocId;
   ret->Len = OI_Len;
+  ret->NumEstimated = OI_NumEstimated;
   ret->Read = OI_Read;
   ret->SkipTo = OI_SkipTo;
   ret->Abort = OI_Abort;
@@ -941,6 +1203,7 @@ IndexIterator *NewWildcardIterator(t_docId maxId) {
   ret->HasNext = WI_HasNext;
   ret->LastDocId = WI_LastDocId;
   ret->Len = WI_Len;
+  ret->NumEstimated = WI_Len;
   ret->Read = WI_Read;
   ret->SkipTo = WI_SkipTo;
   ret->Abort = WI_Abort;
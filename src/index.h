@@ -47,8 +47,15 @@ typedef struct {
 
   double weight;
 
+  // For wide unions, a min-heap of the indexes of the non-exhausted children, ordered by their
+  // current docId. NULL if the union scans its children linearly
+  int *heap;
+  int heapSize;
 } UnionContext;
 
+// Unions with at least this many children use a heap to find the next docId
+#define UNION_HEAP_THRESHOLD 16
+
 /* Create a new UnionIterator over a list of underlying child iterators.
 It will return each document of the underlying iterators, exactly once */
 IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *t, int quickExit,
@@ -75,12 +82,16 @@ typedef struct {
   t_fieldMask fieldMask;
   int atEnd;
   double weight;
+  // the original query position of each child, if the children were reordered and the hits are
+  // checked for slop/order. NULL otherwise
+  int *origPos;
 } IntersectContext;
 
 /* Create a new intersect iterator over the given list of child iterators. If maxSlop is not a
  * negative number, we will allow at most maxSlop intervening positions between the terms. If
  * maxSlop is set and inOrder is 1, we assert that the terms are in
- * order. I.e anexact match has maxSlop of 0 and inOrder 1.  */
+ * order. I.e anexact match has maxSlop of 0 and inOrder 1.
+ * The children are reordered by their estimated cardinality, but hits keep them in query order.  */
 IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *t, t_fieldMask fieldMask,
                                    int maxSlop, int inOrder, double weight);
 /* A Not iterator works by wrapping another iterator, and returning OK for misses, and NOTFOUND for
@@ -38,6 +38,10 @@ typedef struct indexIterator {
    * on the top iterator */
   size_t (*Len)(void *ctx);
 
+  /* Return an estimate of the number of results this iterator will yield, without reading it. This
+   * is used by the query planner, e.g. to drive intersections from their rarest child */
+  size_t (*NumEstimated)(void *ctx);
+
   /* Abort the execution of the iterator and mark it as EOF. This is used for early aborting in case
    * of data consistency issues due to multi threading */
   void (*Abort)(void *ctx);
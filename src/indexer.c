@@ -5,8 +5,11 @@
 #include "geo_index.h"
 #include "index.h"
 #include "redis_index.h"
+#include "config.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
 
 static void writeIndexEntry(IndexSpec *spec, InvertedIndex *idx, IndexEncoder encoder,
                             ForwardIndexEntry *entry) {
@@ -462,6 +465,27 @@ cleanup:
   }
 }
 
+/* Wait up to the configured linger time for the queue to fill up to a full merge, so that documents
+ * added one by one in quick succession - e.g. FT.ADD commands pipelined by a client - are merged and
+ * written under one lock instead of each taking the GIL. Called with the queue lock held */
+static void Indexer_Linger(DocumentIndexer *indexer) {
+  if (!RSGlobalConfig.indexerLingerUS || indexer->size >= MAX_BULK_DOCS) {
+    return;
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += (RSGlobalConfig.indexerLingerUS % 1000000) * 1000;
+  deadline.tv_sec += RSGlobalConfig.indexerLingerUS / 1000000 + deadline.tv_nsec / 1000000000;
+  deadline.tv_nsec %= 1000000000;
+
+  while (indexer->size < MAX_BULK_DOCS) {
+    if (pthread_cond_timedwait(&indexer->cond, &indexer->lock, &deadline) == ETIMEDOUT) {
+      break;
+    }
+  }
+}
+
 static void *Indexer_Run(void *p) {
   DocumentIndexer *indexer = p;
 
@@ -470,6 +494,7 @@ static void *Indexer_Run(void *p) {
     while (indexer->head == NULL) {
       pthread_cond_wait(&indexer->cond, &indexer->lock);
     }
+    Indexer_Linger(indexer);
 
     RSAddDocumentCtx *cur = indexer->head;
     indexer->size--;
@@ -490,20 +515,25 @@ int Indexer_Add(DocumentIndexer *indexer, RSAddDocumentCtx *aCtx) {
     AddDocumentCtx_Finish(aCtx);
     return 0;
   }
+  aCtx->next = NULL;
+  return Indexer_AddBatch(indexer, aCtx, aCtx, 1);
+}
 
+int Indexer_AddBatch(DocumentIndexer *indexer, RSAddDocumentCtx *head, RSAddDocumentCtx *tail,
+                     size_t n) {
   pthread_mutex_lock(&indexer->lock);
 
   if (indexer->tail) {
-    indexer->tail->next = aCtx;
-    indexer->tail = aCtx;
+    indexer->tail->next = head;
+    indexer->tail = tail;
   } else {
-    indexer->head = indexer->tail = aCtx;
+    indexer->head = head;
+    indexer->tail = tail;
   }
+  indexer->size += n;
 
   pthread_cond_signal(&indexer->cond);
   pthread_mutex_unlock(&indexer->lock);
-
-  indexer->size++;
   return 0;
 }
 
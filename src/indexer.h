@@ -8,11 +8,7 @@
 #include "util/arr.h"
 // Preprocessors can store field data to this location
 typedef union FieldData {
-  double numeric;  // i.e. the numeric value of the field
-  struct {
-    char *slon;
-    char *slat;
-  } geo;  // lon/lat pair
+  double numeric;  // i.e. the numeric value of the field, or the geohash of a geo field
   char **tags;
 } fieldData;
 
@@ -45,6 +41,14 @@ DocumentIndexer *GetDocumentIndexer(const char *specname);
  */
 int Indexer_Add(DocumentIndexer *indexer, RSAddDocumentCtx *aCtx);
 
+/**
+ * Add a chain of documents, linked through their `next` pointers, to the indexing
+ * queue at once. Documents that are queued together have their terms merged and
+ * are written to the index under a single lock.
+ */
+int Indexer_AddBatch(DocumentIndexer *indexer, RSAddDocumentCtx *head, RSAddDocumentCtx *tail,
+                     size_t n);
+
 /**
  * Function to preprocess field data. This should do as much stateless processing
  * as possible on the field - this means things like input validation and normalization.
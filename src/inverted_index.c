@@ -2,6 +2,7 @@
 #include "inverted_index.h"
 #include "math.h"
 #include "varint.h"
+#include "bitpack.h"
 #include <stdio.h>
 #include <float.h>
 #include "rmalloc.h"
@@ -9,31 +10,83 @@
 #include "qint.c"
 #include "redis_index.h"
 #include "numeric_filter.h"
+#include "geo_index.h"
 #include "redismodule.h"
-// The number of entries in each index block. A new block will be created after every N entries
+#include "config.h"
+#include "epoch.h"
+// The number of entries in the first blocks of every index. A new block will be created after every
+// N entries, where N grows for frequent terms (see InvertedIndex_BlockCapacity)
 #define INDEX_BLOCK_SIZE 100
 
+// Once an index is large enough, new blocks hold about 1/N of its entries, up to the configured
+// maximum block size
+#define INDEX_BLOCK_GROWTH_DIVISOR 16
+
 // Initial capacity (in bytes) of a new block
 #define INDEX_BLOCK_INITIAL_CAP 6
 
+// A skip entry is recorded inside each block after every N entries
+#define INDEX_BLOCK_SKIP_INTERVAL 16
+
+// The most bytes an encoder writes for a record, besides its offset vector
+#define INDEX_MAX_RECORD_HEADER 64
+
 // The last block of the index
 #define INDEX_LAST_BLOCK(idx) (idx->blocks[idx->size - 1])
 
-// pointer to the current block while reading the index
-#define IR_CURRENT_BLOCK(ir) (ir->idx->blocks[ir->currentBlock])
+// The current block while reading the index. The array may be replaced by a writer at any time, so
+// readers load it once for every access, and read the fields of a block from the same copy
+#define IR_CURRENT_BLOCK(ir) (Epoch_Load(ir->idx->blocks)[ir->currentBlock])
 
 static IndexReader *NewIndexReaderGeneric(InvertedIndex *idx, IndexDecoder decoder,
                                           IndexDecoderCtx decoderCtx, RSIndexResult *record,
                                           double weight);
 
+/* Free a block array or skip table that was replaced, see Epoch_Retire */
+static void retiredArray_Free(void *p) {
+  rm_free(p);
+}
+
+/* Returns 1 if an array allocated with IndexArray_Cap has no room for another entry after n */
+static inline int IndexArray_Full(uint32_t n) {
+  return (n & (n - 1)) == 0;
+}
+
 /* Add a new block to the index with a given document id as the initial id */
 static IndexBlock *InvertedIndex_AddBlock(InvertedIndex *idx, t_docId firstId) {
+  uint32_t n = idx->size;
+  if (IndexArray_Full(n)) {
+    IndexBlock *blocks = rm_malloc(IndexArray_Cap(n + 1) * sizeof(IndexBlock));
+    if (n) memcpy(blocks, idx->blocks, n * sizeof(IndexBlock));
+    IndexBlock *old = idx->blocks;
+    Epoch_Publish(idx->blocks, blocks);
+    if (old) Epoch_Retire(old, retiredArray_Free);
+  }
+  // the new block is written past the published size, where readers don't look
+  idx->blocks[n] = (IndexBlock){.firstId = firstId,
+                                .lastId = firstId,
+                                .numDocs = 0,
+                                .data = NewBuffer(INDEX_BLOCK_INITIAL_CAP)};
+  Epoch_Publish(idx->size, n + 1);
+  return &idx->blocks[n];
+}
+
+IndexBlock *InvertedIndex_BeginRewrite(const InvertedIndex *idx) {
+  IndexBlock *blocks = rm_malloc(IndexArray_Cap(idx->size) * sizeof(IndexBlock));
+  if (idx->size) memcpy(blocks, idx->blocks, idx->size * sizeof(IndexBlock));
+  return blocks;
+}
 
-  idx->size++;
-  idx->blocks = rm_realloc(idx->blocks, idx->size * sizeof(IndexBlock));
-  idx->blocks[idx->size - 1] = (IndexBlock){.firstId = firstId, .lastId = firstId, .numDocs = 0};
-  INDEX_LAST_BLOCK(idx).data = NewBuffer(INDEX_BLOCK_INITIAL_CAP);
-  return &INDEX_LAST_BLOCK(idx);
+void InvertedIndex_EndRewrite(InvertedIndex *idx, IndexBlock *blocks, int changed) {
+  if (!changed) {
+    rm_free(blocks);
+    return;
+  }
+  IndexBlock *old = idx->blocks;
+  Epoch_Publish(idx->blocks, blocks);
+  Epoch_Retire(old, retiredArray_Free);
+  // readers that are inside a rewritten block need to know it changed, see IndexReader_Resume
+  ++idx->gcMarker;
 }
 
 InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock) {
@@ -50,9 +103,141 @@ InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock) {
   return idx;
 }
 
+/* The number of entries a new block of the index can hold. Rare terms keep small blocks to save
+ * memory, while very frequent terms get larger blocks to cut down per block overhead */
+static inline size_t InvertedIndex_BlockCapacity(const InvertedIndex *idx) {
+  size_t cap = idx->numDocs / INDEX_BLOCK_GROWTH_DIVISOR;
+  if (cap > RSGlobalConfig.maxIndexBlockSize) cap = RSGlobalConfig.maxIndexBlockSize;
+  return MAX(cap, INDEX_BLOCK_SIZE);
+}
+
 void indexBlock_Free(IndexBlock *blk) {
   Buffer_Free(blk->data);
   free(blk->data);
+  rm_free(blk->skips);
+}
+
+/* Free a block buffer that was replaced by the GC, see Epoch_Retire */
+static void retiredBuffer_Free(void *p) {
+  Buffer_Free(p);
+  free(p);
+}
+
+/* Decode the docIds of a docId-only block buffer in [p, end) into out, starting from base. start is
+ * set if p is the beginning of the buffer. Returns the number of ids decoded */
+static size_t IndexBlock_DecodeIds(const uint8_t *p, const uint8_t *end, int packed, int start,
+                                   t_docId base, t_docId *out) {
+  if (packed) {
+    return ReadPackedDeltas(p, end, base, out);
+  }
+  size_t n = ReadVarintDeltas(p, end, base, out);
+  if (start && n && out[0] != base) {
+    // see IR_Read - old rdb versions store the first docId of the block as is and not as a delta
+    for (size_t i = 0; i < n; i++) out[i] -= base;
+  }
+  return n;
+}
+
+/* Re-encode a full block of a docId-only index as bit-packed groups, unless it is not any smaller
+ * that way. Readers that are inside the block go on reading its old buffer, which is retired.
+ * Returns 1 if the block was packed */
+static int IndexBlock_Pack(IndexBlock *blk) {
+  size_t sz = Buffer_Offset(blk->data);
+  if (blk->packed || !sz) return 0;
+
+  // every varint takes at least one byte
+  t_docId *ids = rm_malloc(sz * sizeof(*ids));
+  const uint8_t *p = (const uint8_t *)blk->data->data;
+  size_t n = IndexBlock_DecodeIds(p, p + sz, 0, 1, blk->firstId, ids);
+  size_t packedSz = PackedDeltasSize(ids, n, blk->firstId);
+  if (packedSz < sz) {
+    Buffer *packed = NewBuffer(packedSz);
+    BufferWriter bw = NewBufferWriter(packed);
+    WritePackedDeltas(ids, n, blk->firstId, &bw);
+
+    Epoch_Retire(blk->data, retiredBuffer_Free);
+    if (blk->skips) {
+      Epoch_Retire(blk->skips, retiredArray_Free);
+    }
+    // the groups are decoded whole, so a packed block needs no skip table
+    blk->data = packed;
+    blk->skips = NULL;
+    blk->numSkips = 0;
+    blk->packed = 1;
+  }
+  rm_free(ids);
+  return blk->packed;
+}
+
+/* Start a new block for docId, after the last block of the index is done with */
+static IndexBlock *InvertedIndex_NextBlock(InvertedIndex *idx, t_docId docId) {
+  if (idx->flags & Index_PackedDocIds) {
+    IndexBlock *blocks = InvertedIndex_BeginRewrite(idx);
+    InvertedIndex_EndRewrite(idx, blocks, IndexBlock_Pack(&blocks[idx->size - 1]));
+  }
+  return InvertedIndex_AddBlock(idx, docId);
+}
+
+/* Start the empty last block of the index over with docId as its first id. Readers may have loaded
+ * the block already, and would decode the new records against its old first id - so it gets a new
+ * buffer in a copy of the array. Theirs stays empty, and they load the block again when they reach
+ * its end, see IndexReader_AdvanceBlock */
+static IndexBlock *InvertedIndex_RestartBlock(InvertedIndex *idx, t_docId docId) {
+  IndexBlock *blocks = InvertedIndex_BeginRewrite(idx);
+  IndexBlock *blk = &blocks[idx->size - 1];
+  Epoch_Retire(blk->data, retiredBuffer_Free);
+  if (blk->skips) {
+    Epoch_Retire(blk->skips, retiredArray_Free);
+  }
+  *blk = (IndexBlock){.firstId = docId,
+                      .lastId = docId,
+                      .numDocs = 0,
+                      .data = NewBuffer(INDEX_BLOCK_INITIAL_CAP)};
+  IndexBlock *old = idx->blocks;
+  Epoch_Publish(idx->blocks, blocks);
+  Epoch_Retire(old, retiredArray_Free);
+  return blk;
+}
+
+/* Make room for n more bytes at the end of a block's buffer. Readers may be reading the data, so it
+ * is copied to a larger allocation and the old one is retired, rather than reallocated */
+static void IndexBlock_Reserve(IndexBlock *blk, size_t n) {
+  Buffer *b = blk->data;
+  if (b->offset + n <= b->cap) return;
+
+  size_t cap = b->cap;
+  do {
+    cap += MIN(1 + cap / 5, 1024 * 1024);
+  } while (b->offset + n > cap);
+  char *data = rm_malloc(cap);
+  if (b->offset) memcpy(data, b->data, b->offset);
+  char *old = b->data;
+  Epoch_Publish(b->data, data);
+  b->cap = cap;
+  if (old) Epoch_Retire(old, retiredArray_Free);
+}
+
+/* Append a skip entry to the block, pointing at the record written at offset. prevId is the id of
+ * the last record written before it. If the skip table is shared with readers, an outgrown table is
+ * retired rather than freed */
+static void IndexBlock_AddSkip(IndexBlock *blk, t_docId prevId, size_t offset, int shared) {
+  // skip entries store 32 bit deltas and offsets. Blocks too wide for that are read linearly
+  if (prevId - blk->firstId > UINT32_MAX || offset > UINT32_MAX) return;
+
+  uint16_t n = blk->numSkips;
+  if (IndexArray_Full(n)) {
+    IndexBlockSkip *skips = rm_malloc(IndexArray_Cap(n + 1) * sizeof(IndexBlockSkip));
+    if (n) memcpy(skips, blk->skips, n * sizeof(IndexBlockSkip));
+    IndexBlockSkip *old = blk->skips;
+    Epoch_Publish(blk->skips, skips);
+    if (old && shared) {
+      Epoch_Retire(old, retiredArray_Free);
+    } else {
+      rm_free(old);
+    }
+  }
+  blk->skips[n] = (IndexBlockSkip){.prevDelta = prevId - blk->firstId, .offset = offset};
+  Epoch_Publish(blk->numSkips, n + 1);
 }
 
 void InvertedIndex_Free(void *ctx) {
@@ -77,28 +262,42 @@ void IndexReader_OnReopen(RedisModuleKey *k, void *privdata) {
     return;
   }
 
-  // If the key is valid, we just reset the reader's buffer reader to the current block pointer
-  ir->idx = RedisModule_ModuleTypeGetValue(k);
+  // If the key now holds a different index, the one we were reading is gone
+  InvertedIndex *idx = RedisModule_ModuleTypeGetValue(k);
+  if (idx != ir->idx) {
+    ir->atEnd = 1;
+    ir->idx = NULL;
+    ir->br.buf = NULL;
+    return;
+  }
+  IndexReader_Resume(ir);
+}
 
-  // the gc marker tells us if there is a chance the keys has undergone GC while we were asleep
-  if (ir->gcMarker == ir->idx->gcMarker) {
-    // no GC - we just go to the same offset we were at
-    size_t offset = ir->br.pos;
-    ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-    ir->br.pos = offset;
-  } else {
-    // if there has been a GC cycle on this key while we were asleep, the offset might not be valid
-    // anymore. This means that we need to seek to last docId we were at
+/* Start reading the current block from its beginning */
+static void IndexReader_LoadBlock(IndexReader *ir) {
+  const IndexBlock *blk = &IR_CURRENT_BLOCK(ir);
+  ir->lastId = blk->firstId;
+  ir->br = NewBufferReader(blk->data);
+  ir->packed = blk->packed;
+  ir->epoch = Epoch_Current();
+  IndexReader_ResetBuffer(ir);
+}
 
-    // reset the state of the reader
-    t_docId lastId = ir->lastId;
-    ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-    ir->lastId = IR_CURRENT_BLOCK(ir).firstId;
+void IndexReader_Resume(IndexReader *ir) {
+  if (ir->gcMarker == ir->idx->gcMarker) return;
+  ir->gcMarker = ir->idx->gcMarker;
 
-    // seek to the previous last id
-    RSIndexResult *dummy = NULL;
-    IR_SkipTo(ir, lastId, &dummy);
-  }
+  // If the GC repaired the block while we were asleep, the repaired records were written to a new
+  // buffer, and ours was retired. As long as our query kept its epoch pinned it was not freed, and
+  // we just finish reading it - the blocks after it are read from the index as usual
+  if (!Epoch_Reclaimed(ir->epoch)) return;
+
+  // Our query went idle without a pin, and the buffer may be gone. We seek to the last docId we
+  // were at in the block's current buffer
+  t_docId lastId = ir->lastId;
+  IndexReader_LoadBlock(ir);
+  RSIndexResult *dummy = NULL;
+  IR_SkipTo(ir, lastId, &dummy);
 }
 
 /******************************************************************************
@@ -400,28 +599,42 @@ size_t InvertedIndex_WriteEntryGeneric(InvertedIndex *idx, IndexEncoder encoder,
   t_docId delta = 0;
   IndexBlock *blk = &INDEX_LAST_BLOCK(idx);
 
-  // see if we need to grow the current block
-  if (blk->numDocs >= INDEX_BLOCK_SIZE) {
-    blk = InvertedIndex_AddBlock(idx, docId);
-  } else if (blk->numDocs == 0) {
-    blk->firstId = blk->lastId = docId;
+  // see if we need to grow the current block. Packed blocks are not appended to
+  if (blk->numDocs >= InvertedIndex_BlockCapacity(idx) || blk->packed) {
+    blk = InvertedIndex_NextBlock(idx, docId);
+  } else if (blk->numDocs == 0 && blk->firstId != docId) {
+    blk = InvertedIndex_RestartBlock(idx, docId);
   }
 
   delta = docId - blk->lastId;
   if (delta > UINT32_MAX) {
-    blk = InvertedIndex_AddBlock(idx, docId);
+    blk = InvertedIndex_NextBlock(idx, docId);
     delta = 0;
   }
 
-  BufferWriter bw = NewBufferWriter(blk->data);
+  // The record is encoded past the buffer's published offset, where readers don't look, and only
+  // becomes visible when the offset is moved past it. So the buffer must not grow while we encode
+  size_t offset = Buffer_Offset(blk->data);
+  size_t offsetsLen = entry->type == RSResultType_Numeric ? 0 : entry->term.offsets.len;
+  IndexBlock_Reserve(blk, offsetsLen + INDEX_MAX_RECORD_HEADER);
+  Buffer rec = {.data = blk->data->data + offset, .cap = blk->data->cap - offset, .offset = 0};
+  BufferWriter bw = NewBufferWriter(&rec);
 
   // printf("Writing docId %llu, delta %llu, flags %x\n", docId, delta, (int)idx->flags);
   size_t ret = encoder(&bw, delta, entry);
+  Epoch_Publish(blk->data->offset, offset + rec.offset);
 
-  idx->lastId = docId;
-  blk->lastId = docId;
+  // every few records, remember where the next record starts so readers can jump straight to it
+  if (blk->numDocs && blk->numDocs % INDEX_BLOCK_SKIP_INTERVAL == 0) {
+    IndexBlock_AddSkip(blk, blk->lastId, offset, 1);
+  }
+
+  // readers bound scores by the max frequency, and estimate by the number of documents
+  __atomic_store_n(&blk->maxFreq, MAX(blk->maxFreq, entry->freq), __ATOMIC_RELAXED);
   ++blk->numDocs;
-  ++idx->numDocs;
+  __atomic_store_n(&idx->numDocs, idx->numDocs + 1, __ATOMIC_RELAXED);
+  Epoch_Publish(blk->lastId, docId);
+  Epoch_Publish(idx->lastId, docId);
 
   return ret;
 }
@@ -459,10 +672,14 @@ int IR_HasNext(void *ctx) {
   return !ir->atEnd;
 }
 
+/* Move on to the next block. A block that was empty when we loaded it may have been started over
+ * with a new buffer since (see InvertedIndex_RestartBlock), so it is loaded again rather than
+ * skipped */
 static void IndexReader_AdvanceBlock(IndexReader *ir) {
-  ir->currentBlock++;
-  ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-  ir->lastId = IR_CURRENT_BLOCK(ir).firstId;
+  if (Epoch_Load(ir->br.buf->offset) || IR_CURRENT_BLOCK(ir).data == ir->br.buf) {
+    ir->currentBlock++;
+  }
+  IndexReader_LoadBlock(ir);
 }
 
 /******************************************************************************
@@ -549,7 +766,26 @@ DECODER(readNumeric) {
 
   NumericFilter *f = ctx.ptr;
   if (f) {
-    return NumericFilter_Match(f, res->num.value);
+    return NumericFilter_Match(f, res->num.value) &&
+           (!f->geoFilter || GeoFilter_MatchHash(f->geoFilter, res->num.value));
+  }
+  return 1;
+}
+
+// numeric decoder for readers that only need the docIds - the value bytes are skipped
+DECODER(readNumericIdsOnly) {
+  EncodingHeader header;
+  Buffer_Read(br, &header, 1);
+
+  res->docId = 0;
+  Buffer_Read(br, &res->docId, header.encCommon.deltaEncoding + 1);
+
+  if (header.encCommon.isFloat) {
+    if (!header.encFloat.isInf) {
+      Buffer_Skip(br, header.encFloat.isDouble ? 8 : 4);
+    }
+  } else if (!header.encTiny.isTiny) {
+    Buffer_Skip(br, header.encInt.valueByteCount + 1);
   }
   return 1;
 }
@@ -675,18 +911,98 @@ IndexReader *NewNumericReader(InvertedIndex *idx, NumericFilter *flt) {
   return NewIndexReaderGeneric(idx, readNumeric, ctx, res, 1);
 }
 
+IndexReader *NewNumericIdsReader(InvertedIndex *idx) {
+  RSIndexResult *res = NewNumericResult();
+  res->freq = 1;
+  res->fieldMask = RS_FIELDMASK_ALL;
+  res->num.value = 0;
+
+  IndexDecoderCtx ctx = {.ptr = NULL};
+  return NewIndexReaderGeneric(idx, readNumericIdsOnly, ctx, res, 1);
+}
+
+/* Returns 1 if the document was deleted. Readers only move forward, so the bitmap is only looked up
+ * once the reader passes the next deleted id it knows of. Documents deleted behind that point while
+ * the reader slept are let through, and dropped later on by the result processors */
+static inline int IndexReader_IsDeleted(IndexReader *ir, t_docId docId) {
+  if (docId < ir->nextDeleted) return 0;
+  ir->nextDeleted = DocIdBitmap_Next(ir->deleted, docId);
+  if (!ir->nextDeleted) {
+    ir->nextDeleted = UINT64_MAX;
+    return 0;
+  }
+  return ir->nextDeleted == docId;
+}
+
+/* Decode everything from the reader's position to the end of the block into the reader's id
+ * buffer, moving on to the next non empty block if needed. Returns 0 at the end of the index */
+static int IndexReader_FillBuffer(IndexReader *ir) {
+refill:
+  // skip to the next block (skipping empty blocks that may appear here due to GC)
+  while (BufferReader_AtEnd(&ir->br)) {
+    if (ir->currentBlock + 1 == Epoch_Load(ir->idx->size)) {
+      return 0;
+    }
+    IndexReader_AdvanceBlock(ir);
+  }
+
+  // every varint takes at least one byte, so that's the most records we can decode. Packed groups
+  // tell how many ids they hold. Records appended from now on are left for the next refill
+  size_t remaining = Epoch_Load(ir->br.buf->offset) - ir->br.pos;
+  const uint8_t *p = (const uint8_t *)BufferReader_Current(&ir->br);
+  const uint8_t *end = p + remaining;
+  size_t maxIds = ir->packed ? PackedDeltasCount(p, end) : remaining;
+  if (maxIds > ir->idsBufCap) {
+    ir->idsBufCap = maxIds;
+    ir->idsBuf = rm_realloc(ir->idsBuf, ir->idsBufCap * sizeof(t_docId));
+  }
+
+  size_t n = IndexBlock_DecodeIds(p, end, ir->packed, ir->br.pos == 0, ir->lastId, ir->idsBuf);
+  ir->br.pos += remaining;
+
+  // drop the deleted ids, unless there are none in the block's range
+  if (n && ir->idsBuf[n - 1] >= ir->nextDeleted) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (!IndexReader_IsDeleted(ir, ir->idsBuf[i])) {
+        ir->idsBuf[kept++] = ir->idsBuf[i];
+      }
+    }
+    n = kept;
+    if (!n) goto refill;
+  }
+  ir->idsBufLen = n;
+  ir->idsBufPos = 0;
+  return 1;
+}
+
+/* IR_Read for readers with an id buffer. Docid-only records are never filtered */
+static int IR_ReadBuffered(IndexReader *ir, RSIndexResult **e) {
+  if (ir->idsBufPos == ir->idsBufLen && !IndexReader_FillBuffer(ir)) {
+    ir->atEnd = 1;
+    return INDEXREAD_EOF;
+  }
+  ir->lastId = ir->record->docId = ir->idsBuf[ir->idsBufPos++];
+  ++ir->len;
+  *e = ir->record;
+  return INDEXREAD_OK;
+}
+
 int IR_Read(void *ctx, RSIndexResult **e) {
 
   IndexReader *ir = ctx;
   if (ir->atEnd) {
     goto eof;
   }
+  if (ir->idsBuf) {
+    return IR_ReadBuffered(ir, e);
+  }
   do {
 
     // if needed - skip to the next block (skipping empty blocks that may appear here due to GC)
     while (BufferReader_AtEnd(&ir->br)) {
       // We're at the end of the last block...
-      if (ir->currentBlock + 1 == ir->idx->size) {
+      if (ir->currentBlock + 1 == Epoch_Load(ir->idx->size)) {
         goto eof;
       }
       IndexReader_AdvanceBlock(ir);
@@ -708,7 +1024,7 @@ int IR_Read(void *ctx, RSIndexResult **e) {
 
     // The decoder also acts as a filter. A zero return value means that the
     // current record should not be processed.
-    if (!rv) {
+    if (!rv || IndexReader_IsDeleted(ir, ir->lastId)) {
       continue;
     }
 
@@ -728,46 +1044,113 @@ RSIndexResult *IR_Current(void *ctx) {
 inline void IR_Seek(IndexReader *ir, t_offset offset, t_docId docId) {
   Buffer_Seek(&ir->br, offset);
   ir->lastId = docId;
+  IndexReader_ResetBuffer(ir);
 }
 
-#define BLOCK_MATCHES(blk, docId) (blk.firstId <= docId && docId <= blk.lastId)
+/* Find the first block at or after the from block that ends at or after docId, in the first size
+ * blocks of an array. Returns size if there is none */
+static uint32_t InvertedIndex_FindBlock(const IndexBlock *blocks, uint32_t size, uint32_t from,
+                                        t_docId docId) {
+  if (from >= size || Epoch_Load(blocks[size - 1].lastId) < docId) return size;
+  if (docId <= Epoch_Load(blocks[from].lastId)) return from;
+
+  // Gallop forward from the current block to find a range that contains docId. Skips are
+  // usually short, so this touches far fewer block headers than a full binary search
+  uint32_t bottom = from + 1;
+  uint32_t top = bottom;
+  uint32_t step = 1;
+  while (top < size - 1 && Epoch_Load(blocks[top].lastId) < docId) {
+    bottom = top + 1;
+    top = MIN(top + step, size - 1);
+    step <<= 1;
+  }
 
-static int IndexReader_SkipToBlock(IndexReader *ir, t_docId docId) {
+  // Binary search for the first block in [bottom, top] ending at or after docId
+  while (bottom < top) {
+    uint32_t i = (bottom + top) / 2;
+    if (Epoch_Load(blocks[i].lastId) < docId) {
+      bottom = i + 1;
+    } else {
+      top = i;
+    }
+  }
+  return top;
+}
 
-  InvertedIndex *idx = ir->idx;
+static int IndexReader_SkipToBlock(IndexReader *ir, t_docId docId) {
+  // the size is loaded first - the array loaded after it holds at least that many blocks
+  uint32_t size = Epoch_Load(ir->idx->size);
+  const IndexBlock *blocks = Epoch_Load(ir->idx->blocks);
 
-  if (!idx->size || docId < idx->blocks[0].firstId) {
+  if (!size || docId < blocks[0].firstId) {
     return 0;
   }
 
   // if we don't need to move beyond the current block
-  if (BLOCK_MATCHES(IR_CURRENT_BLOCK(ir), docId)) return 1;
+  if (docId <= Epoch_Load(blocks[ir->currentBlock].lastId)) return 1;
   // the current block doesn't match and it's the last one - no point in searching
-  if (ir->currentBlock + 1 == idx->size) return 0;
-
-  uint32_t top = idx->size - 1;
-  uint32_t bottom = ir->currentBlock + 1;
-  uint32_t i = bottom;  //(bottom + top) / 2;
-  while (bottom <= top) {
-    if (BLOCK_MATCHES(idx->blocks[i], docId)) {
-      ir->currentBlock = i;
-      goto found;
-    }
+  if (ir->currentBlock + 1 == size) return 0;
+
+  uint32_t blk = InvertedIndex_FindBlock(blocks, size, ir->currentBlock + 1, docId);
+  // past the last block, we leave the reader on it so the next read hits EOF
+  ir->currentBlock = MIN(blk, size - 1);
+  IndexReader_LoadBlock(ir);
+  return 1;
+}
+
+uint32_t IR_BlockMaxFreq(IndexReader *ir, t_docId docId, t_docId *lastId) {
+  // the last id is loaded before the blocks, so that the blocks we look at hold it
+  t_docId idxLastId = Epoch_Load(ir->idx->lastId);
+  uint32_t size = Epoch_Load(ir->idx->size);
+  const IndexBlock *blocks = Epoch_Load(ir->idx->blocks);
+  uint32_t blk = InvertedIndex_FindBlock(blocks, size, ir->currentBlock, docId);
+  if (blk == size) {
+    *lastId = idxLastId;
+    return 0;
+  }
+  *lastId = Epoch_Load(blocks[blk].lastId);
+  return __atomic_load_n(&blocks[blk].maxFreq, __ATOMIC_RELAXED);
+}
 
-    if (docId < idx->blocks[i].firstId) {
-      top = i - 1;
+/* Use the current block's skip table to jump to the last skip point that precedes docId, as long
+ * as it is ahead of the reader's current position. The records we jump over are all smaller than
+ * docId, so the following reads will land on docId or the first record after it */
+static void IndexReader_SkipInBlock(IndexReader *ir, t_docId docId) {
+  const IndexBlock *blk = &IR_CURRENT_BLOCK(ir);
+  // the skip table points into the block's current buffer. If the GC replaced the buffer we are
+  // reading, we read it linearly
+  if (ir->br.buf != blk->data) return;
+  // the table loaded after the count holds at least that many entries, see IndexBlock_AddSkip
+  const uint32_t numSkips = Epoch_Load(blk->numSkips);
+  if (!numSkips || docId < blk->firstId || docId - blk->firstId > UINT32_MAX) return;
+  const uint32_t delta = docId - blk->firstId;
+  const IndexBlockSkip *skips = Epoch_Load(blk->skips);
+  if (skips[0].prevDelta >= delta) return;
+
+  // gallop to find an upper bound: an entry whose previous id is not below docId
+  uint32_t lo = 0, hi = 1, step = 1;
+  while (hi < numSkips && skips[hi].prevDelta < delta) {
+    lo = hi;
+    step <<= 1;
+    hi = lo + step;
+  }
+  hi = MIN(hi, numSkips);
+
+  // binary search for the last entry in [lo, hi) whose previous id is below docId
+  while (lo + 1 < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (skips[mid].prevDelta < delta) {
+      lo = mid;
     } else {
-      bottom = i + 1;
+      hi = mid;
     }
-    i = (bottom + top) / 2;
   }
 
-  ir->currentBlock = i;
-
-found:
-  ir->lastId = IR_CURRENT_BLOCK(ir).firstId;
-  ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-  return 1;
+  // never move the reader backwards
+  if (skips[lo].offset <= ir->br.pos) return;
+  ir->br.pos = skips[lo].offset;
+  ir->lastId = blk->firstId + skips[lo].prevDelta;
+  IndexReader_ResetBuffer(ir);
 }
 
 /**
@@ -789,7 +1172,23 @@ int IR_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
     return IR_Read(ctx, hit);
   }
   if (ir->atEnd) goto eof;
-  if (docId > ir->idx->lastId) goto eof;
+  if (docId > Epoch_Load(ir->idx->lastId)) goto eof;
+
+  // if the id is within the ids we've already decoded, just search for it there
+  if (ir->idsBufPos < ir->idsBufLen && docId <= ir->idsBuf[ir->idsBufLen - 1]) {
+    uint32_t lo = ir->idsBufPos, hi = ir->idsBufLen - 1;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (ir->idsBuf[mid] < docId) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    ir->idsBufPos = lo;
+    IR_ReadBuffered(ir, hit);
+    return ir->lastId == docId ? INDEXREAD_OK : INDEXREAD_NOTFOUND;
+  }
 
   // try to skip to the current block
   if (!IndexReader_SkipToBlock(ir, docId)) {
@@ -799,6 +1198,9 @@ int IR_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
     return INDEXREAD_NOTFOUND;
   }
 
+  // avoid decoding the records we are going to throw away anyway
+  IndexReader_SkipInBlock(ir, docId);
+
   int rc;
   t_docId rid;
   while (INDEXREAD_EOF != (rc = IR_Read(ir, hit))) {
@@ -818,6 +1220,11 @@ size_t IR_NumDocs(void *ctx) {
   return ir->len;
 }
 
+size_t IR_NumEstimated(void *ctx) {
+  IndexReader *ir = ctx;
+  return __atomic_load_n(&ir->idx->numDocs, __ATOMIC_RELAXED);
+}
+
 static IndexReader *NewIndexReaderGeneric(InvertedIndex *idx, IndexDecoder decoder,
                                           IndexDecoderCtx decoderCtx, RSIndexResult *record,
                                           double weight) {
@@ -830,13 +1237,21 @@ static IndexReader *NewIndexReaderGeneric(InvertedIndex *idx, IndexDecoder decod
   ret->len = 0;
   ret->atEnd = 0;
   ret->weight = weight;
-  ret->lastId = IR_CURRENT_BLOCK(ret).firstId;
-  ret->br = NewBufferReader(IR_CURRENT_BLOCK(ret).data);
   ret->decoder = decoder;
   ret->decoderCtx = decoderCtx;
+  ret->idsBuf = NULL;
+  ret->idsBufCap = 0;
+  ret->deleted = NULL;
+  ret->nextDeleted = UINT64_MAX;
+  IndexReader_LoadBlock(ret);
   return ret;
 }
 
+void IR_SetDeleted(IndexReader *ir, const DocIdBitmap *deleted) {
+  ir->deleted = deleted;
+  ir->nextDeleted = deleted ? 0 : UINT64_MAX;
+}
+
 IndexReader *NewTermIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldMask fieldMask,
                                 RSQueryTerm *term, double weight) {
   if (term && docTable) {
@@ -856,12 +1271,22 @@ IndexReader *NewTermIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldM
 
   IndexDecoderCtx dctx = {.num = fieldMask};
 
-  return NewIndexReaderGeneric(idx, decoder, dctx, record, weight);
+  IndexReader *ir = NewIndexReaderGeneric(idx, decoder, dctx, record, weight);
+  if (docTable) {
+    IR_SetDeleted(ir, &docTable->deleted);
+  }
+  // docId-only records carry nothing but the id, so we can decode a whole block at once
+  if (decoder == readDocIdsOnly) {
+    ir->idsBufCap = INDEX_BLOCK_SIZE;
+    ir->idsBuf = rm_malloc(ir->idsBufCap * sizeof(t_docId));
+  }
+  return ir;
 }
 
 void IR_Free(IndexReader *ir) {
 
   IndexResult_Free(ir->record);
+  rm_free(ir->idsBuf);
   rm_free(ir);
 }
 
@@ -889,8 +1314,8 @@ void IR_Rewind(void *ctx) {
   ir->atEnd = 0;
   ir->currentBlock = 0;
   ir->gcMarker = ir->idx->gcMarker;
-  ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-  ir->lastId = IR_CURRENT_BLOCK(ir).firstId;
+  ir->nextDeleted = ir->deleted ? 0 : UINT64_MAX;
+  IndexReader_LoadBlock(ir);
 }
 
 IndexIterator *NewReadIterator(IndexReader *ir) {
@@ -902,6 +1327,7 @@ IndexIterator *NewReadIterator(IndexReader *ir) {
   ri->HasNext = IR_HasNext;
   ri->Free = ReadIterator_Free;
   ri->Len = IR_NumDocs;
+  ri->NumEstimated = IR_NumEstimated;
   ri->Current = IR_Current;
   ri->Abort = IR_Abort;
   ri->Rewind = IR_Rewind;
@@ -911,18 +1337,30 @@ IndexIterator *NewReadIterator(IndexReader *ir) {
 /* Repair an index block by removing garbage - records pointing at deleted documents.
  * Returns the number of records collected, and puts the number of bytes collected in the given
  * pointer. If an error occurred - returns -1
+ *
+ * Queries may be reading the block's buffer and skip table while we run, so they are never
+ * rewritten in place. Once we find the first hole, the records are written to a new buffer, and the
+ * old one is retired - the queries go on reading it until they are done. The block itself must be
+ * in an array returned by InvertedIndex_BeginRewrite.
  */
+static int IndexBlock_RepairPacked(IndexBlock *blk, DocTable *dt, IndexRepairParams *params);
+
 static int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags,
                              IndexRepairParams *params) {
+  if (blk->packed) {
+    return IndexBlock_RepairPacked(blk, dt, params);
+  }
+  const IndexBlock orig = *blk;
   t_docId lastReadId = blk->firstId;
   bool isFirstRes = true;
 
   blk->lastId = blk->firstId = 0;
-  Buffer repair = *blk->data;
-  repair.offset = 0;
+  Buffer *repair = NULL;
 
   BufferReader br = NewBufferReader(blk->data);
-  BufferWriter bw = NewBufferWriter(&repair);
+  // until we find a hole, the writer just follows the reader on the original buffer
+  size_t keptBytes = 0;
+  BufferWriter bw = {.buf = NULL};
 
   RSIndexResult *res = flags == Index_StoreNumeric ? NewNumericResult() : NewTokenRecord(NULL, 1);
   int frags = 0;
@@ -933,9 +1371,18 @@ static int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags,
 
   if (!encoder || !decoder) {
     fprintf(stderr, "Could not get decoder/encoder for index\n");
+    IndexResult_Free(res);
+    *blk = orig;
     return -1;
   }
 
+  // The skip table and max frequency are rebuilt as we go, since the offsets shift when holes are
+  // closed and the most frequent record may be gone
+  blk->skips = NULL;
+  blk->numSkips = 0;
+  blk->maxFreq = 0;
+  uint16_t numKept = 0;
+
   while (!BufferReader_AtEnd(&br)) {
     const char *bufBegin = BufferReader_Current(&br);
     decoder(&br, (IndexDecoderCtx){}, res);
@@ -959,10 +1406,24 @@ static int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags,
       if (params->RepairCallback) {
         params->RepairCallback(res, params->arg);
       }
+      if (!frags) {
+        // the first hole - copy the records we kept so far to the repaired buffer
+        repair = NewBuffer(blk->data->offset);
+        memcpy(repair->data, blk->data->data, keptBytes);
+        repair->offset = keptBytes;
+        bw = NewBufferWriter(repair);
+      }
       ++frags;
       params->bytesCollected += sz;
     } else {  // valid document
 
+      if (numKept && numKept % INDEX_BLOCK_SKIP_INTERVAL == 0) {
+        // the rebuilt skip table is not seen by readers until the block is published
+        IndexBlock_AddSkip(blk, blk->lastId, frags ? BufferWriter_Offset(&bw) : keptBytes, 0);
+      }
+      ++numKept;
+      blk->maxFreq = MAX(blk->maxFreq, res->freq);
+
       // If we're already operating in a repaired block, we do nothing if we found no holes yet, or
       // write back the record at the writer's top end if we've found a hole before
       if (frags) {
@@ -976,8 +1437,7 @@ static int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags,
 
       } else {
         // Nothing to do - this block is not fragmented as of now, so we just advance the writer
-        bw.buf->offset += sz;
-        bw.pos += sz;
+        keptBytes += sz;
       }
 
       if (blk->firstId == 0) {
@@ -990,36 +1450,156 @@ static int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags,
     // If we deleted stuff from this block, we need to change the number of docs and the data
     // pointer
     blk->numDocs -= frags;
-    *blk->data = repair;
-    Buffer_Truncate(blk->data, 0);
+    Buffer_Truncate(repair, 0);
+    if (!params->keepReplaced) {
+      Epoch_Retire(orig.data, retiredBuffer_Free);
+      if (orig.skips) {
+        Epoch_Retire(orig.skips, retiredArray_Free);
+      }
+    }
+    blk->data = repair;
+  } else {
+    // nothing changed, the block keeps its skip table
+    rm_free(blk->skips);
+    *blk = orig;
+  }
+  IndexResult_Free(res);
+  return frags;
+}
+
+/* Repair a bit-packed block. The ids we keep are packed again into a new buffer */
+static int IndexBlock_RepairPacked(IndexBlock *blk, DocTable *dt, IndexRepairParams *params) {
+  const uint8_t *p = (const uint8_t *)blk->data->data;
+  const uint8_t *end = p + Buffer_Offset(blk->data);
+  t_docId *ids = rm_malloc(PackedDeltasCount(p, end) * sizeof(*ids));
+  size_t n = ReadPackedDeltas(p, end, blk->firstId, ids);
+
+  RSIndexResult *res = NewTokenRecord(NULL, 1);
+  size_t numKept = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (DocTable_Exists(dt, ids[i])) {
+      ids[numKept++] = ids[i];
+    } else if (params->RepairCallback) {
+      res->docId = ids[i];
+      params->RepairCallback(res, params->arg);
+    }
   }
   IndexResult_Free(res);
+
+  int frags = n - numKept;
+  if (frags) {
+    blk->firstId = numKept ? ids[0] : 0;
+    blk->lastId = numKept ? ids[numKept - 1] : 0;
+    blk->numDocs = numKept;
+    blk->maxFreq = numKept ? 1 : 0;
+
+    Buffer *repair = NewBuffer(PackedDeltasSize(ids, numKept, blk->firstId));
+    BufferWriter bw = NewBufferWriter(repair);
+    WritePackedDeltas(ids, numKept, blk->firstId, &bw);
+    params->bytesCollected += Buffer_Offset(blk->data) - Buffer_Offset(repair);
+    if (!params->keepReplaced) {
+      Epoch_Retire(blk->data, retiredBuffer_Free);
+    }
+    blk->data = repair;
+    // packed blocks have no skip table, see IndexBlock_Pack
+  }
+  rm_free(ids);
   return frags;
 }
 
+void IndexBlock_Replace(IndexBlock *blk, const IndexBlock *repaired) {
+  Epoch_Retire(blk->data, retiredBuffer_Free);
+  if (blk->skips) {
+    Epoch_Retire(blk->skips, retiredArray_Free);
+  }
+  *blk = *repaired;
+}
+
+/* Decode a block from scratch and fill its skip table and max frequency */
+static void IndexBlock_BuildMeta(IndexBlock *blk, IndexDecoder decoder, RSIndexResult *res) {
+  BufferReader br = NewBufferReader(blk->data);
+  t_docId lastReadId = blk->firstId;
+  uint16_t n = 0;
+  blk->numSkips = 0;
+  blk->maxFreq = 0;
+
+  while (!BufferReader_AtEnd(&br)) {
+    size_t pos = BufferReader_Offset(&br);
+    if (n && n % INDEX_BLOCK_SKIP_INTERVAL == 0) {
+      IndexBlock_AddSkip(blk, lastReadId, pos, 0);
+    }
+    decoder(&br, (IndexDecoderCtx){}, res);
+    // see IR_Read - old rdb versions store the first docId of the block as is and not as a delta
+    uint32_t delta = *(uint32_t *)&res->docId;
+    lastReadId = (pos == 0 && delta != 0) ? delta : lastReadId + delta;
+    blk->maxFreq = MAX(blk->maxFreq, res->freq);
+    ++n;
+  }
+}
+
+void InvertedIndex_BuildBlockMeta(InvertedIndex *idx) {
+  IndexDecoder decoder = InvertedIndex_GetDecoder(idx->flags & INDEX_STORAGE_MASK);
+  if (!decoder) return;
+
+  // numeric records have no frequencies, so only blocks that need a skip table are decoded
+  int isNumeric = (idx->flags & INDEX_STORAGE_MASK) == Index_StoreNumeric;
+  RSIndexResult *res = isNumeric ? NewNumericResult() : NewTokenRecord(NULL, 1);
+  for (uint32_t i = 0; i < idx->size; i++) {
+    if (idx->blocks[i].packed) {
+      // packed blocks are docId-only, and have no skip table
+      idx->blocks[i].maxFreq = idx->blocks[i].numDocs ? 1 : 0;
+    } else if (!isNumeric || idx->blocks[i].numDocs > INDEX_BLOCK_SKIP_INTERVAL) {
+      IndexBlock_BuildMeta(&idx->blocks[i], decoder, res);
+    }
+  }
+  IndexResult_Free(res);
+}
+
+int InvertedIndex_IsEmpty(const InvertedIndex *idx) {
+  for (uint32_t i = 0; i < idx->size; i++) {
+    if (idx->blocks[i].numDocs) return 0;
+  }
+  return 1;
+}
+
 int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock,
                          IndexRepairParams *params) {
   size_t limit = params->limit ? params->limit : SIZE_MAX;
   size_t blocksProcessed = 0;
+  // blocks are repaired in a copy of the array, made once we find one with something to collect
+  IndexBlock *blocks = NULL;
+  int changed = 0;
   for (; startBlock < idx->size && blocksProcessed < limit; ++startBlock, ++blocksProcessed) {
-    IndexBlock *blk = idx->blocks + startBlock;
+    const IndexBlock *blk = idx->blocks + startBlock;
     if (blk->lastId - blk->firstId > UINT32_MAX) {
       // Skip over blocks which have a wide variation. In the future we might
       // want to split a block into two (or more) on high-delta boundaries.
       continue;
     }
-    int repaired = IndexBlock_Repair(&idx->blocks[startBlock], dt, idx->flags, params);
+    // blocks whose id range has no deleted documents in it have nothing to collect
+    t_docId nextDeleted = DocIdBitmap_Next(&dt->deleted, blk->firstId);
+    if (!nextDeleted || nextDeleted > blk->lastId) {
+      continue;
+    }
+    if (!blocks) {
+      blocks = InvertedIndex_BeginRewrite(idx);
+    }
+    int repaired = IndexBlock_Repair(&blocks[startBlock], dt, idx->flags, params);
     // We couldn't repair the block - return 0
     if (repaired == -1) {
+      InvertedIndex_EndRewrite(idx, blocks, changed);
       return 0;
     } else if (repaired > 0) {
       // Record the number of records removed for gc stats
       params->docsCollected += repaired;
-
-      // Increase the GC marker so other queries can tell that we did something
-      ++idx->gcMarker;
+      changed = 1;
     }
   }
+  // publishing the repaired blocks increases the GC marker, so other queries can tell that we did
+  // something
+  if (blocks) {
+    InvertedIndex_EndRewrite(idx, blocks, changed);
+  }
 
   return startBlock < idx->size ? startBlock : 0;
 }
@@ -9,17 +9,38 @@
 #include "index_result.h"
 #include "spec.h"
 #include "numeric_filter.h"
+#include "epoch.h"
 #include <stdint.h>
 #include <math.h>
 
+/* An entry in a block's skip table. Every INDEX_BLOCK_SKIP_INTERVAL records we remember the byte
+ * offset of the next record and the docId preceding it (as a delta from the block's firstId), so a
+ * reader can jump into the middle of a block without decoding everything before it */
+typedef struct {
+  uint32_t prevDelta;
+  uint32_t offset;
+} IndexBlockSkip;
+
 /* A single block of data in the index. The index is basically a list of blocks we iterate */
 typedef struct {
   t_docId firstId;
   t_docId lastId;
   uint16_t numDocs;
+  // readers load the count while it is written to, so it is not a bit field
+  uint16_t numSkips;
+  // the block's ids are bit-packed rather than varint encoded. Only full blocks of indexes with
+  // Index_PackedDocIds are packed, and packed blocks are not written to anymore
+  uint8_t packed;
+  // the highest term frequency of the records in the block, used to bound their scores
+  uint32_t maxFreq;
   Buffer *data;
+  IndexBlockSkip *skips;
 } IndexBlock;
 
+/* Queries read the index without the lock while it is written to, see epoch.h. Records are only
+ * appended to the last block's buffer past its published offset, and the block array, buffers and
+ * skip tables are copied rather than reallocated when they grow. Any other change to a block is made
+ * to a copy of the whole array, which is then published in place of the old one */
 typedef struct {
   IndexBlock *blocks;
   uint32_t size;
@@ -55,6 +76,9 @@ typedef struct {
   void (*RepairCallback)(const RSIndexResult *, void *);
   /** argument to pass to callback */
   void *arg;
+  /** in: leave the buffers of repaired blocks alone rather than retiring them. Used by the fork GC
+   * child, whose copy of the index is never freed */
+  int keepReplaced;
 } IndexRepairParams;
 
 /* Create a new inverted index object, with the given flag. If initBlock is 1, we create the first
@@ -64,6 +88,31 @@ void InvertedIndex_Free(void *idx);
 int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock,
                          IndexRepairParams *params);
 
+/* Swap the contents of a block for a repaired copy of it, taking ownership of its buffer and skip
+ * table. The old ones are retired, since sleeping queries may still be reading them. The block must
+ * be in an array returned by InvertedIndex_BeginRewrite */
+void IndexBlock_Replace(IndexBlock *blk, const IndexBlock *repaired);
+
+/* Block arrays and skip tables are allocated in powers of 2, so that appending to them only copies
+ * them when they are full. Returns the capacity of an array of n entries */
+static inline uint32_t IndexArray_Cap(uint32_t n) {
+  return n <= 1 ? n : 1u << (32 - __builtin_clz(n - 1));
+}
+
+/* Get a copy of the index's block array to make changes to blocks that readers may be inside */
+IndexBlock *InvertedIndex_BeginRewrite(const InvertedIndex *idx);
+
+/* Publish a block array returned by InvertedIndex_BeginRewrite if changed is set, retiring the old
+ * one. Otherwise the copy is just freed */
+void InvertedIndex_EndRewrite(InvertedIndex *idx, IndexBlock *blocks, int changed);
+
+/* Returns 1 if none of the index's blocks has records left in it, e.g. after the GC repaired them */
+int InvertedIndex_IsEmpty(const InvertedIndex *idx);
+
+/* Rebuild the in-memory metadata of all the index's blocks (skip tables and max frequencies) by
+ * decoding them. This is used when loading blocks whose metadata was not persisted (e.g. from RDB) */
+void InvertedIndex_BuildBlockMeta(InvertedIndex *idx);
+
 /**
  * Decode a single record from the buffer reader. This function is responsible for:
  * (1) Decoding the record at the given position of br
@@ -109,12 +158,43 @@ typedef struct indexReadCtx {
    */
   uint32_t gcMarker;
 
+  /* The epoch we started reading the current block's buffer in. If the GC replaced the buffer, we
+   * may keep reading it until its epoch is reclaimed */
+  uint64_t epoch;
+
   /* boosting weight */
   double weight;
+
+  /* The doc table's deleted ids, or NULL. Postings of deleted documents are dropped as they are
+   * decoded. nextDeleted is the first deleted id at or after the reader's position that we know
+   * of, so that most records are checked with a single compare */
+  const DocIdBitmap *deleted;
+  t_docId nextDeleted;
+
+  /* Whether the buffer we are reading is bit-packed. The block may have been packed since we
+   * started reading its old buffer */
+  int packed;
+
+  /* Docid-only indexes are decoded a block at a time into this buffer. It holds the ids between
+   * the reader's last returned record and its buffer reader position. NULL for other encodings */
+  t_docId *idsBuf;
+  uint32_t idsBufCap;
+  uint32_t idsBufLen;
+  uint32_t idsBufPos;
 } IndexReader;
 
+/* Discard the ids decoded ahead of the reader's position. Must be called whenever the reader's
+ * buffer reader is moved */
+static inline void IndexReader_ResetBuffer(IndexReader *ir) {
+  ir->idsBufLen = ir->idsBufPos = 0;
+}
+
 void IndexReader_OnReopen(RedisModuleKey *k, void *privdata);
 
+/* Make the reader valid again after it woke up in its index, which the GC may have visited while it
+ * was asleep */
+void IndexReader_Resume(IndexReader *ir);
+
 /* An index encoder is a callback that writes records to the index. It accepts a pre-calculated
  * delta for encoding */
 typedef size_t (*IndexEncoder)(BufferWriter *bw, uint32_t delta, RSIndexResult *record);
@@ -130,11 +210,19 @@ size_t InvertedIndex_WriteNumericEntry(InvertedIndex *idx, t_docId docId, double
 
 size_t InvertedIndex_WriteEntryGeneric(InvertedIndex *idx, IndexEncoder encoder, t_docId docId,
                                        RSIndexResult *entry);
+/* Make the reader drop the postings of the documents in the deleted set. Term readers created with a
+ * doc table do this already */
+void IR_SetDeleted(IndexReader *ir, const DocIdBitmap *deleted);
+
 /* Create a new index reader for numeric records, optionally using a given filter. If the filter
  * is
  * NULL we will return all the records in the index */
 IndexReader *NewNumericReader(InvertedIndex *idx, NumericFilter *flt);
 
+/* Create a reader over a numeric index that only decodes the docIds of the records. The values of
+ * the results it returns are left as 0 */
+IndexReader *NewNumericIdsReader(InvertedIndex *idx);
+
 /* Get the appropriate encoder for an inverted index given its flags. Returns NULL on invalid flags
  */
 IndexEncoder InvertedIndex_GetEncoder(IndexFlags flags);
@@ -172,6 +260,14 @@ RSIndexResult *IR_Current(void *ctx);
 /* The number of docs in an inverted index entry */
 size_t IR_NumDocs(void *ctx);
 
+/* Return the max frequency of the block that would hold docId, without moving the reader. The last
+ * docId covered by that block is put in *lastId. If docId is beyond the index, 0 is returned and
+ * *lastId is set to the index's last id */
+uint32_t IR_BlockMaxFreq(IndexReader *ir, t_docId docId, t_docId *lastId);
+
+/* The number of docs in the reader's inverted index, used as the reader's cardinality estimate */
+size_t IR_NumEstimated(void *ctx);
+
 /* LastDocId of an inverted index stateful reader */
 t_docId IR_LastDocId(void *ctx);
 
@@ -29,6 +29,7 @@
 #include "search_request.h"
 #include "config.h"
 #include "gc.h"
+#include "stem_cache.h"
 #include "aggregate/aggregate.h"
 #include "rmalloc.h"
 #include "cursor.h"
@@ -241,6 +242,161 @@ int SafeAddDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int ar
   return doAddDocument(ctx, argv, argc, 0);
 }
 
+/* FT.MADD {index} [NOSAVE] [REPLACE] [LANGUAGE {lang}]
+ *   DOCS {docId} {score} {nargs} {field} {value} ... [{docId} {score} {nargs} ...]
+ *
+ * Add multiple documents to the index at once. nargs is the number of field/value pairs that
+ * follow. The documents are tokenized in parallel and merged into the index under a single lock.
+ * Returns an array with the status of each document, in order.
+ */
+static int doMAddDocuments(RedisModuleCtx *ctx, RedisModuleString **argv, int argc, int canBlock) {
+  if (argc < 8) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  int nosave = 0, replace = 0;
+  const char *lang = NULL;
+  int docsIdx = 2;
+  for (; docsIdx < argc; docsIdx++) {
+    if (RMUtil_StringEqualsCaseC(argv[docsIdx], "NOSAVE")) {
+      nosave = 1;
+    } else if (RMUtil_StringEqualsCaseC(argv[docsIdx], "REPLACE")) {
+      replace = 1;
+    } else if (RMUtil_StringEqualsCaseC(argv[docsIdx], "LANGUAGE") && docsIdx + 1 < argc) {
+      lang = RedisModule_StringPtrLen(argv[++docsIdx], NULL);
+    } else {
+      break;
+    }
+  }
+  if (docsIdx >= argc || !RMUtil_StringEqualsCaseC(argv[docsIdx], "DOCS")) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModule_AutoMemory(ctx);
+
+  if (lang && !IsSupportedLanguage(lang, strlen(lang))) {
+    return RedisModule_ReplyWithError(ctx, "Unsupported Language");
+  }
+
+  // Validate the layout and the scores of all documents before touching anything
+  size_t ndocs = 0;
+  for (int i = docsIdx + 1; i < argc; ndocs++) {
+    long long nfields;
+    double ds;
+    if (argc - i < 3 || RedisModule_StringToLongLong(argv[i + 2], &nfields) != REDISMODULE_OK ||
+        nfields < 1 || argc - i - 3 < nfields * 2) {
+      return RedisModule_WrongArity(ctx);
+    }
+    if (RedisModule_StringToDouble(argv[i + 1], &ds) == REDISMODULE_ERR) {
+      return RedisModule_ReplyWithError(ctx, "Could not parse document score");
+    }
+    if (ds > 1 || ds < 0) {
+      return RedisModule_ReplyWithError(ctx, "Document scores must be normalized between 0.0 ... 1.0");
+    }
+    i += 3 + nfields * 2;
+  }
+  if (ndocs == 0) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 0);
+  if (!sp) {
+    return RedisModule_ReplyWithError(ctx, "Unknown index name");
+  }
+  RedisSearchCtx sctx = {.redisCtx = ctx, .spec = sp};
+
+  if (canBlock) {
+    canBlock = CheckConcurrentSupport(ctx);
+  }
+  // room for the replicated FT.SAFEADD arguments of the largest possible document
+  RedisModuleString **repl = malloc((argc + 6) * sizeof(*repl));
+  RSAddDocumentBatch *batch = canBlock ? NewAddDocumentBatch(ndocs) : NULL;
+  if (!batch) {
+    RedisModule_ReplyWithArray(ctx, ndocs);
+  }
+
+  for (int i = docsIdx + 1; i < argc;) {
+    long long nfields;
+    double ds;
+    RedisModule_StringToLongLong(argv[i + 2], &nfields);
+    RedisModule_StringToDouble(argv[i + 1], &ds);
+    RedisModuleString *key = argv[i];
+    int fieldsIdx = i + 3;
+    i = fieldsIdx + nfields * 2;
+
+    const char *err = NULL;
+    RSAddDocumentCtx *aCtx = NULL;
+    int exists = !!DocTable_GetId(&sp->docs, MakeDocKeyR(key));
+    if (exists && !replace) {
+      err = "Document already in index";
+      goto docDone;
+    }
+
+    // Each document is replicated on its own, as if it was added with FT.ADD
+    int nrepl = 0;
+    repl[nrepl++] = argv[1];
+    repl[nrepl++] = key;
+    repl[nrepl++] = argv[i - nfields * 2 - 2];
+    if (nosave) repl[nrepl++] = RedisModule_CreateString(ctx, "NOSAVE", 6);
+    if (replace) repl[nrepl++] = RedisModule_CreateString(ctx, "REPLACE", 7);
+    if (lang) {
+      repl[nrepl++] = RedisModule_CreateString(ctx, "LANGUAGE", 8);
+      repl[nrepl++] = RedisModule_CreateString(ctx, lang, strlen(lang));
+    }
+    repl[nrepl++] = RedisModule_CreateString(ctx, "FIELDS", 6);
+    for (int j = fieldsIdx; j < i; j++) {
+      repl[nrepl++] = argv[j];
+    }
+    RedisModule_Replicate(ctx, RS_SAFEADD_CMD, "v", repl, nrepl);
+
+    Document doc;
+    // PrepareForAdd expects the offset of the FIELDS keyword
+    Document_PrepareForAdd(&doc, key, ds, argv, fieldsIdx - 1, i, lang, NULL, ctx);
+    if (!nosave) {
+      RedisSearchCtx ssctx = SEARCH_CTX_STATIC(ctx, sp);
+      if (Redis_SaveDocument(&ssctx, &doc) != REDISMODULE_OK) {
+        Document_FreeDetached(&doc, ctx);
+        err = "ERR couldn't save document";
+        goto docDone;
+      }
+    }
+
+    aCtx = NewAddDocumentCtx(sp, &doc, &err);
+    if (aCtx == NULL) {
+      Document_FreeDetached(&doc, ctx);
+      goto docDone;
+    }
+    aCtx->options = 0;
+    if (exists && replace) {
+      aCtx->options |= DOCUMENT_ADD_REPLACE;
+    }
+    if (nosave) {
+      aCtx->options |= DOCUMENT_ADD_NOSAVE;
+    }
+
+  docDone:
+    if (batch) {
+      AddDocumentBatch_Add(batch, aCtx, err);
+    } else if (aCtx) {
+      // without blocking, documents are indexed and replied to one by one
+      aCtx->stateFlags |= ACTX_F_NOBLOCK;
+      AddDocumentCtx_Submit(aCtx, &sctx, aCtx->options);
+    } else {
+      RedisModule_ReplyWithError(ctx, err);
+    }
+  }
+
+  free(repl);
+  if (batch) {
+    AddDocumentBatch_Submit(batch, &sctx);
+  }
+  return REDISMODULE_OK;
+}
+
+int MAddDocumentsCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  return doMAddDocuments(ctx, argv, argc, 1);
+}
+
 /* FT.SETPAYLOAD {index} {docId} {payload} */
 int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
@@ -378,7 +534,9 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   REPLY_KVNUM(n, "doc_table_size_mb", sp->docs.memsize / (float)0x100000);
   REPLY_KVNUM(n, "sortable_values_size_mb", sp->docs.sortablesSize / (float)0x100000);
 
-  REPLY_KVNUM(n, "key_table_size_mb", TrieMap_MemUsage(sp->docs.dim.tm) / (float)0x100000);
+  REPLY_KVNUM(n, "key_table_size_mb", DocIdMap_MemUsage(&sp->docs.dim) / (float)0x100000);
+  REPLY_KVNUM(n, "deleted_docs_bitmap_size_mb",
+              DocIdBitmap_MemUsage(&sp->docs.deleted) / (float)0x100000);
   REPLY_KVNUM(n, "records_per_doc_avg",
               (float)sp->stats.numRecords / (float)sp->stats.numDocuments);
   REPLY_KVNUM(n, "bytes_per_record_avg",
@@ -396,6 +554,10 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   Cursors_RenderStats(&RSCursors, sp->name, ctx);
   n += 2;
 
+  RedisModule_ReplyWithSimpleString(ctx, "stem_cache_stats");
+  StemCache_RenderStats(ctx);
+  n += 2;
+
   RedisModule_ReplySetArrayLength(ctx, n);
   return REDISMODULE_OK;
 }
@@ -867,6 +1029,9 @@ field arguments
 
    - NOSTOPWORDS: If set, we do not check the query for stopwords
 
+   - PRUNE: If set, relevance sorted unions skip documents that can't make it into the results. The
+    total becomes a lower bound
+
    - SLOP slop: If set, we allow a maximal intervening number of unmatched offsets between phrase
 terms.
 
@@ -1655,6 +1820,9 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_ADD_CMD, AddDocumentCommand, "write deny-oom", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_MADD_CMD, MAddDocumentsCommand, "write deny-oom", 1,
+         1, 1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_SAFEADD_CMD, SafeAddDocumentCommand, "write deny-oom",
          1, 1, 1);
 
@@ -0,0 +1,62 @@
+#include "numeric_column.h"
+#include "epoch.h"
+#include "rmalloc.h"
+#include <string.h>
+
+NumericColumn *NewNumericColumn() {
+  NumericColumn *c = rm_calloc(1, sizeof(*c));
+  return c;
+}
+
+static void retiredDirectory_Free(void *p) {
+  rm_free(p);
+}
+
+void NumericColumn_Set(NumericColumn *c, t_docId docId, double value) {
+  size_t ci = docId >> NC_CHUNK_BITS;
+  if (ci >= c->numChunks) {
+    // grow the directory by copying it, as running queries may still be reading the old one
+    size_t n = c->numChunks ? c->numChunks : 1;
+    while (n <= ci) n *= 2;
+    NumericColumnChunk **chunks = rm_calloc(n, sizeof(*chunks));
+    NumericColumnChunk **old = c->chunks;
+    if (old) {
+      memcpy(chunks, old, c->numChunks * sizeof(*chunks));
+    }
+    Epoch_Publish(c->chunks, chunks);
+    Epoch_Publish(c->numChunks, n);
+    if (old) {
+      Epoch_Retire(old, retiredDirectory_Free);
+    }
+  }
+
+  NumericColumnChunk *ch = c->chunks[ci];
+  if (!ch) {
+    ch = rm_calloc(1, sizeof(*ch));
+    Epoch_Publish(c->chunks[ci], ch);
+  }
+  size_t off = docId & (NC_CHUNK_SIZE - 1);
+  uint64_t bit = 1ULL << (off % 64);
+  ch->values[off] = value;
+  if (!(ch->present[off / 64] & bit)) {
+    __atomic_or_fetch(&ch->present[off / 64], bit, __ATOMIC_RELEASE);
+    c->numValues++;
+  }
+}
+
+size_t NumericColumn_MemUsage(const NumericColumn *c) {
+  size_t sz = sizeof(*c) + c->numChunks * sizeof(*c->chunks);
+  for (size_t ii = 0; ii < c->numChunks; ++ii) {
+    if (c->chunks[ii]) sz += sizeof(NumericColumnChunk);
+  }
+  return sz;
+}
+
+void NumericColumn_Free(void *p) {
+  NumericColumn *c = p;
+  for (size_t ii = 0; ii < c->numChunks; ++ii) {
+    rm_free(c->chunks[ii]);
+  }
+  rm_free(c->chunks);
+  rm_free(c);
+}
@@ -0,0 +1,62 @@
+#ifndef __NUMERIC_COLUMN_H__
+#define __NUMERIC_COLUMN_H__
+
+#include "redisearch.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/* A numeric column holds the value of a numeric field for every document, addressed directly by
+ * docId. It is kept alongside the field's range tree, so that loading the value of a document does
+ * not have to go through its sorting vector or the document's hash.
+ *
+ * Values are stored in fixed size chunks, which are allocated on demand and never move. Only the
+ * chunk directory is reallocated as the column grows, and the old directory is retired through the
+ * epoch mechanism, so a query that pinned its epoch can keep reading a column without the GIL while
+ * it is written to. A value is written before its present bit is set, see epoch.h */
+
+#define NC_CHUNK_BITS 10
+#define NC_CHUNK_SIZE (1 << NC_CHUNK_BITS)
+
+typedef struct {
+  double values[NC_CHUNK_SIZE];
+  // A bit per document, set if it has a value
+  uint64_t present[NC_CHUNK_SIZE / 64];
+} NumericColumnChunk;
+
+typedef struct {
+  NumericColumnChunk **chunks;
+  size_t numChunks;
+  size_t numValues;
+} NumericColumn;
+
+NumericColumn *NewNumericColumn();
+
+/* Set the value of a document */
+void NumericColumn_Set(NumericColumn *c, t_docId docId, double value);
+
+/* Get the value of a document. Returns 0 if the document has no value in the column */
+static inline int NumericColumn_Get(const NumericColumn *c, t_docId docId, double *value) {
+  size_t ci = docId >> NC_CHUNK_BITS;
+  // the directory loaded after the count holds at least that many chunks
+  if (ci >= __atomic_load_n(&c->numChunks, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  NumericColumnChunk **chunks = __atomic_load_n(&c->chunks, __ATOMIC_ACQUIRE);
+  const NumericColumnChunk *ch = __atomic_load_n(&chunks[ci], __ATOMIC_ACQUIRE);
+  if (!ch) {
+    return 0;
+  }
+  size_t off = docId & (NC_CHUNK_SIZE - 1);
+  if (!(__atomic_load_n(&ch->present[off / 64], __ATOMIC_ACQUIRE) & (1ULL << (off % 64)))) {
+    return 0;
+  }
+  *value = ch->values[off];
+  return 1;
+}
+
+size_t NumericColumn_MemUsage(const NumericColumn *c);
+
+/* Free the column. Takes a void pointer so it can be retired */
+void NumericColumn_Free(void *p);
+
+#endif
@@ -36,6 +36,7 @@ NumericFilter *ParseNumericFilter(RedisSearchCtx *ctx, RedisModuleString **argv,
   nf->inclusiveMin = 1;
   nf->min = 0;
   nf->max = 0;
+  nf->geoFilter = NULL;
 
   // Parse the min range
 
@@ -145,5 +146,6 @@ NumericFilter *NewNumericFilter(double min, double max, int inclusiveMin, int in
   f->fieldName = NULL;
   f->inclusiveMax = inclusiveMax;
   f->inclusiveMin = inclusiveMin;
+  f->geoFilter = NULL;
   return f;
 }
@@ -7,6 +7,8 @@
 #define NF_INFINITY (1.0 / 0.0)
 #define NF_NEGATIVE_INFINITY (-1.0 / 0.0)
 
+struct geoFilter;
+
 typedef struct numericFilter {
   const char *fieldName;
   double min;
@@ -14,6 +16,9 @@ typedef struct numericFilter {
   int inclusiveMin;
   int inclusiveMax;
 
+  // If set, the values are geohashes, and only those within the geo filter's radius match. Ranges
+  // are then never considered wholly inside the filter, since their values must all be checked
+  const struct geoFilter *geoFilter;
 } NumericFilter;
 
 NumericFilter *NewNumericFilter(double min, double max, int inclusiveMin, int inclusiveMax);
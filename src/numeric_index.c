@@ -8,6 +8,8 @@
 #include <math.h>
 #include "redismodule.h"
 #include "util/misc.h"
+#include "epoch.h"
+#include "doc_bitmap.h"
 //#include "tests/time_sample.h"
 #define NR_EXPONENT 4
 #define NR_MAXRANGE_CARD 2500
@@ -16,7 +18,8 @@
 
 typedef struct {
   IndexIterator *it;
-  uint32_t lastRevId;
+  // the epoch we opened the ranges in
+  uint64_t epoch;
 } NumericUnionCtx;
 
 /* A callback called after a concurrent context regains execution context. When this happen we need
@@ -29,12 +32,12 @@ void NumericRangeIterator_OnReopen(RedisModuleKey *k, void *privdata) {
   /* If the key has been deleted we'll get a NULL heere, so we just mark ourselves as EOF
    * We simply abort the root iterator which is either a union of many ranges or a single range
    *
-   * If the numeric range tree has chained (split, nodes deleted, etc) since we last closed it,
-   * We cannot continue iterating it, since the underlying pointers might be screwed.
-   * For now we will just stop processing this query. This causes the query to return bad results,
-   * so in the future we can try an reset the state here
+   * If the numeric range tree has changed (split, ranges dropped, etc) since we last closed it, we
+   * can still continue iterating it: we only read the ranges, and ranges that are dropped from the
+   * tree are retired rather than freed, so they outlive our query. Unless our query went idle
+   * without an epoch pinned, and the ranges or their buffers may have been freed meanwhile
    */
-  if (k == NULL || t == NULL || t->revisionId != nu->lastRevId) {
+  if (k == NULL || t == NULL || Epoch_Reclaimed(nu->epoch)) {
     nu->it->Abort(nu->it->ctx);
   }
 }
@@ -64,28 +67,27 @@ int NumericRange_Overlaps(NumericRange *n, double min, double max) {
   return rc;
 }
 
-int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard) {
-
-  int add = 0;
-  if (checkCard) {
-    add = 1;
-    size_t card = n->card;
-    for (int i = 0; i < MIN(card, n->splitCard); i++) {
-
-      if (n->values[i] == value) {
-        add = 0;
-        break;
-      }
+/* Count a value in the range's cardinality if we haven't seen it yet */
+static void numericRange_AddCard(NumericRange *n, double value) {
+  size_t card = n->card;
+  for (int i = 0; i < MIN(card, n->splitCard); i++) {
+    if (n->values[i] == value) {
+      return;
     }
   }
+  if (n->card < n->splitCard) {
+    n->values[n->card] = value;
+    n->unique_sum += value;
+  }
+  ++n->card;
+}
+
+int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard) {
+
   if (n->minVal == NF_NEGATIVE_INFINITY || value < n->minVal) n->minVal = value;
   if (n->maxVal == NF_INFINITY || value > n->maxVal) n->maxVal = value;
-  if (add) {
-    if (n->card < n->splitCard) {
-      n->values[n->card] = value;
-      n->unique_sum += value;
-    }
-    ++n->card;
+  if (checkCard) {
+    numericRange_AddCard(n, value);
   }
 
   InvertedIndex_WriteNumericEntry(n->entries, docId, value);
@@ -93,6 +95,17 @@ int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard
   return n->card;
 }
 
+void NumericRange_RecountCard(NumericRange *n) {
+  n->card = 0;
+  n->unique_sum = 0;
+  RSIndexResult *res = NULL;
+  IndexReader *ir = NewNumericReader(n->entries, NULL);
+  while (INDEXREAD_OK == IR_Read(ir, &res)) {
+    numericRange_AddCard(n, res->num.value);
+  }
+  IR_Free(ir);
+}
+
 double NumericRange_Split(NumericRange *n, NumericRangeNode **lp, NumericRangeNode **rp) {
 
   double split = (n->unique_sum) / (double)n->card;
@@ -138,6 +151,28 @@ NumericRangeNode *NewLeafNode(size_t cap, double min, double max, size_t splitCa
   return n;
 }
 
+/* Copy a node for a rotation. The copy shares the node's range */
+static NumericRangeNode *numericRangeNode_Copy(const NumericRangeNode *n) {
+  NumericRangeNode *c = RedisModule_Alloc(sizeof(*c));
+  *c = *n;
+  return c;
+}
+
+/* Free a node replaced by a copy, but not its range or children, see Epoch_Retire */
+static void retiredNode_Free(void *p) {
+  RedisModule_Free(p);
+}
+
+/* Publish a rotated subtree in place of the node at *childP, retiring that node and the child it was
+ * rotated with. Their other children are shared with the new subtree */
+static void numericRangeNode_Replace(NumericRangeNode **childP, NumericRangeNode *sub,
+                                     NumericRangeNode *rotated) {
+  NumericRangeNode *old = *childP;
+  Epoch_Publish(*childP, sub);
+  Epoch_Retire(rotated, retiredNode_Free);
+  Epoch_Retire(old, retiredNode_Free);
+}
+
 int NumericRangeNode_Add(NumericRangeNode *n, t_docId docId, double value) {
 
   if (!NumericRangeNode_IsLeaf(n)) {
@@ -157,28 +192,33 @@ int NumericRangeNode_Add(NumericRangeNode *n, t_docId docId, double value) {
       // we are too deep - we don't retain this node's range anymore.
       // this keeps memory footprint in check
       if (++n->maxDepth > NR_MAX_DEPTH && n->range) {
-        InvertedIndex_Free(n->range->entries);
-        RedisModule_Free(n->range->values);
-        RedisModule_Free(n->range);
+        // running queries may be reading the range
+        Epoch_Retire(n->range, NumericRange_Free);
         n->range = NULL;
       }
 
       // check if we need to rebalance the child.
       // To ease the rebalance we don't rebalance the root
       // nor do we rebalance nodes that are with ranges (n->maxDepth > NR_MAX_DEPTH)
+      // Queries may be walking the tree, so the rotated nodes are replaced by copies rather than
+      // relinked in place
       if ((child->right->maxDepth - child->left->maxDepth) > NR_MAX_DEPTH) {  // role to the left
-        NumericRangeNode *right = child->right;
-        child->right = right->left;
-        right->left = child;
-        --child->maxDepth;
-        *childP = right;  // replace the child with the new child
+        NumericRangeNode *right = numericRangeNode_Copy(child->right);
+        NumericRangeNode *c = numericRangeNode_Copy(child);
+        c->right = right->left;
+        right->left = c;
+        --c->maxDepth;
+        // replace the child with the new child
+        numericRangeNode_Replace(childP, right, child->right);
       } else if ((child->left->maxDepth - child->right->maxDepth) >
                  NR_MAX_DEPTH) {  // role to the right
-        NumericRangeNode *left = child->left;
-        child->left = left->right;
-        left->right = child;
-        --child->maxDepth;
-        *childP = left;  // replace the child with the new child
+        NumericRangeNode *left = numericRangeNode_Copy(child->left);
+        NumericRangeNode *c = numericRangeNode_Copy(child);
+        c->left = left->right;
+        left->right = c;
+        --c->maxDepth;
+        // replace the child with the new child
+        numericRangeNode_Replace(childP, left, child->left);
       }
     }
     // return 1 or 0 to our called, so this is done recursively
@@ -194,12 +234,13 @@ int NumericRangeNode_Add(NumericRangeNode *n, t_docId docId, double value) {
   if (card >= n->range->splitCard ||
       (n->range->entries->numDocs > NR_MAXRANGE_SIZE && n->range->card > 1)) {
 
-    // split this node but don't delete its range
-    double split = NumericRange_Split(n->range, &n->left, &n->right);
-
-    n->value = split;
-
+    // split this node but don't delete its range. The children are built before they are
+    // published, and the right one goes first - a node with a left child is not a leaf
+    NumericRangeNode *left, *right;
+    n->value = NumericRange_Split(n->range, &left, &right);
     n->maxDepth = 1;
+    Epoch_Publish(n->right, right);
+    Epoch_Publish(n->left, left);
     return 1;
   }
 
@@ -253,12 +294,17 @@ Vector *NumericRangeNode_FindRange(NumericRangeNode *n, double min, double max)
   return leaves;
 }
 
+void NumericRange_Free(void *p) {
+  NumericRange *r = p;
+  InvertedIndex_Free(r->entries);
+  RedisModule_Free(r->values);
+  RedisModule_Free(r);
+}
+
 void NumericRangeNode_Free(NumericRangeNode *n) {
   if (!n) return;
   if (n->range) {
-    InvertedIndex_Free(n->range->entries);
-    RedisModule_Free(n->range->values);
-    RedisModule_Free(n->range);
+    NumericRange_Free(n->range);
     n->range = NULL;
   }
 
@@ -278,6 +324,7 @@ NumericRangeTree *NewNumericRangeTree() {
   ret->numRanges = 1;
   ret->revisionId = 0;
   ret->lastDocId = 0;
+  ret->column = NewNumericColumn();
   return ret;
 }
 
@@ -289,6 +336,7 @@ int NumericRangeTree_Add(NumericRangeTree *t, t_docId docId, double value) {
     return 0;
   }
   t->lastDocId = docId;
+  NumericColumn_Set(t->column, docId, value);
 
   int rc = NumericRangeNode_Add(t->root, docId, value);
   // rc != 0 means the tree nodes have changed, and concurrent iteration is not allowed now
@@ -322,28 +370,74 @@ void NumericRangeNode_Traverse(NumericRangeNode *n,
 
 void NumericRangeTree_Free(NumericRangeTree *t) {
   NumericRangeNode_Free(t->root);
+  // running queries may be loading values from the column
+  Epoch_Retire(t->column, NumericColumn_Free);
   RedisModule_Free(t);
 }
 
-IndexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f) {
+/* Returns 1 if all the values of a range match the filter, so they don't need to be checked */
+static inline int numericFilter_ContainsRange(NumericFilter *f, NumericRange *nr) {
+  return !f->geoFilter && NumericFilter_Match(f, nr->minVal) && NumericFilter_Match(f, nr->maxVal);
+}
+
+static IndexIterator *newNumericRangeIterator(NumericRange *nr, NumericFilter *f,
+                                              const DocIdBitmap *deleted) {
 
   // if this range is at either end of the filter, we need to check each record
-  if (NumericFilter_Match(f, nr->minVal) && NumericFilter_Match(f, nr->maxVal)) {
+  if (numericFilter_ContainsRange(f, nr)) {
     // make the filter NULL so the reader will ignore it
     f = NULL;
   }
   IndexReader *ir = NewNumericReader(nr->entries, f);
+  if (deleted) {
+    IR_SetDeleted(ir, deleted);
+  }
 
   return NewReadIterator(ir);
 }
 
+IndexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f) {
+  return newNumericRangeIterator(nr, f, NULL);
+}
+
+/* Filters covering at least this many whole ranges are considered for merging them into a bitmap */
+#define NR_BITMAP_MIN_RANGES 8
+/* ... and are only merged if the ranges hold at least 1/N of the docId space, so that the bitmap
+ * chunks are dense enough to pay for themselves */
+#define NR_BITMAP_DENSITY_RATIO 64
+
+/* Merge the docIds of the given ranges into a single bitmap iterator. Since the ranges are wholly
+ * inside the filter, their values don't need to be decoded */
+static IndexIterator *mergeContainedRanges(NumericRange **rngs, size_t n,
+                                           const DocIdBitmap *deleted) {
+  DocIdBitmap b;
+  DocIdBitmap_Init(&b);
+  for (size_t i = 0; i < n; i++) {
+    IndexReader *ir = NewNumericIdsReader(rngs[i]->entries);
+    if (deleted) {
+      IR_SetDeleted(ir, deleted);
+    }
+    RSIndexResult *res = NULL;
+    while (INDEXREAD_OK == IR_Read(ir, &res)) {
+      DocIdBitmap_Set(&b, res->docId);
+    }
+    IR_Free(ir);
+  }
+  return NewBitmapIterator(&b, 1);
+}
+
 /* Create a union iterator from the numeric filter, over all the sub-ranges in the tree that fit
- * the filter */
-IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
+ * the filter. Ranges whose values all match the filter are read without checking them. If
+ * mergeContained is set and the filter covers many whole ranges, those are merged upfront into a
+ * bitmap, so that only the ranges at the edges of the filter are left to union. If deleted is not
+ * NULL, the postings of the documents in it are dropped */
+IndexIterator *createNumericIteratorEx(NumericRangeTree *t, NumericFilter *f,
+                                       const DocIdBitmap *deleted, int mergeContained) {
 
   Vector *v = NumericRangeTree_Find(t, f->min, f->max);
   if (!v || Vector_Size(v) == 0) {
     // printf("Got no filter vector\n");
+    if (v) Vector_Free(v);
     return NULL;
   }
 
@@ -352,7 +446,7 @@ IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
   if (n == 1) {
     NumericRange *rng;
     Vector_Get(v, 0, &rng);
-    IndexIterator *it = NewNumericRangeIterator(rng, f);
+    IndexIterator *it = newNumericRangeIterator(rng, f, deleted);
     Vector_Free(v);
     return it;
   }
@@ -360,6 +454,9 @@ IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
   // We create a  union iterator, advancing a union on all the selected range,
   // treating them as one consecutive range
   IndexIterator **its = calloc(n, sizeof(IndexIterator *));
+  NumericRange **contained = calloc(n, sizeof(*contained));
+  size_t numContained = 0, containedEntries = 0;
+  int numIts = 0;
 
   for (size_t i = 0; i < n; i++) {
     NumericRange *rng;
@@ -367,14 +464,35 @@ IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
     if (!rng) {
       continue;
     }
-
-    its[i] = NewNumericRangeIterator(rng, f);
+    if (numericFilter_ContainsRange(f, rng)) {
+      contained[numContained++] = rng;
+      containedEntries += rng->entries->numDocs;
+    } else {
+      its[numIts++] = newNumericRangeIterator(rng, f, deleted);
+    }
   }
   Vector_Free(v);
 
-  IndexIterator *it = NewUnionIterator(its, n, NULL, 1, 1);
+  if (mergeContained && numContained >= NR_BITMAP_MIN_RANGES &&
+      containedEntries * NR_BITMAP_DENSITY_RATIO >= t->lastDocId) {
+    its[numIts++] = mergeContainedRanges(contained, numContained, deleted);
+  } else {
+    for (size_t i = 0; i < numContained; i++) {
+      its[numIts++] = newNumericRangeIterator(contained[i], f, deleted);
+    }
+  }
+  free(contained);
 
-  return it;
+  if (numIts == 1) {
+    IndexIterator *it = its[0];
+    free(its);
+    return it;
+  }
+  return NewUnionIterator(its, numIts, NULL, 1, 1);
+}
+
+IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
+  return createNumericIteratorEx(t, f, NULL, 0);
 }
 
 RedisModuleType *NumericIndexType = NULL;
@@ -385,30 +503,51 @@ RedisModuleString *fmtRedisNumericIndexKey(RedisSearchCtx *ctx, const char *fiel
                                         field);
 }
 
-struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilter *flt,
-                                               ConcurrentSearchCtx *csx) {
-  RedisModuleString *s = fmtRedisNumericIndexKey(ctx, flt->fieldName);
-  RedisModuleKey *key = RedisModule_OpenKey(ctx->redisCtx, s, REDISMODULE_READ);
+IndexIterator *NewNumericMultiFilterIterator(RedisSearchCtx *ctx, RedisModuleString *keyName,
+                                             NumericFilter *flts, size_t n, double weight,
+                                             ConcurrentSearchCtx *csx) {
+  RedisModuleKey *key = RedisModule_OpenKey(ctx->redisCtx, keyName, REDISMODULE_READ);
   if (!key || RedisModule_ModuleTypeGetType(key) != NumericIndexType) {
     return NULL;
   }
   NumericRangeTree *t = RedisModule_ModuleTypeGetValue(key);
 
-  IndexIterator *it = createNumericIterator(t, flt);
-  if (!it) {
+  IndexIterator **its = calloc(n, sizeof(*its));
+  int numIts = 0;
+  for (size_t i = 0; i < n; i++) {
+    IndexIterator *it = createNumericIteratorEx(t, &flts[i], &ctx->spec->docs.deleted, 1);
+    if (it) {
+      its[numIts++] = it;
+    }
+  }
+
+  IndexIterator *it = NULL;
+  if (numIts == 1) {
+    it = its[0];
+    free(its);
+  } else if (numIts > 1) {
+    it = NewUnionIterator(its, numIts, NULL, 1, weight);
+  } else {
+    free(its);
     return NULL;
   }
 
   NumericUnionCtx *uc = malloc(sizeof(*uc));
-  uc->lastRevId = t->revisionId;
+  uc->epoch = Epoch_Current();
   uc->it = it;
   if (csx) {
-    ConcurrentSearch_AddKey(csx, key, REDISMODULE_READ, s, NumericRangeIterator_OnReopen, uc, free,
-                            ConcurrentKey_SharedNothing);
+    ConcurrentSearch_AddKey(csx, key, REDISMODULE_READ, keyName, NumericRangeIterator_OnReopen, uc,
+                            free, ConcurrentKey_ResumeOnly);
   }
   return it;
 }
 
+struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilter *flt,
+                                               ConcurrentSearchCtx *csx) {
+  RedisModuleString *s = fmtRedisNumericIndexKey(ctx, flt->fieldName);
+  return NewNumericMultiFilterIterator(ctx, s, flt, 1, 1, csx);
+}
+
 NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, RedisModuleString *keyName,
                                    RedisModuleKey **idxKey) {
 
@@ -437,6 +576,21 @@ NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, RedisModuleString *keyNa
   return t;
 }
 
+NumericColumn *NumericIndex_GetColumn(RedisSearchCtx *ctx, const char *field) {
+  RedisModuleString *s = fmtRedisNumericIndexKey(ctx, field);
+  RedisModuleKey *key = RedisModule_OpenKey(ctx->redisCtx, s, REDISMODULE_READ);
+  NumericColumn *c = NULL;
+  if (key && RedisModule_ModuleTypeGetType(key) == NumericIndexType) {
+    NumericRangeTree *t = RedisModule_ModuleTypeGetValue(key);
+    c = t->column;
+  }
+  if (key) {
+    RedisModule_CloseKey(key);
+  }
+  RedisModule_FreeString(ctx->redisCtx, s);
+  return c;
+}
+
 void __numericIndex_memUsageCallback(NumericRangeNode *n, void *ctx) {
   unsigned long *sz = ctx;
   *sz += sizeof(NumericRangeNode);
@@ -452,7 +606,7 @@ void __numericIndex_memUsageCallback(NumericRangeNode *n, void *ctx) {
 
 unsigned long NumericIndexType_MemUsage(const void *value) {
   const NumericRangeTree *t = value;
-  unsigned long ret = sizeof(NumericRangeTree);
+  unsigned long ret = sizeof(NumericRangeTree) + NumericColumn_MemUsage(t->column);
   NumericRangeNode_Traverse(t->root, __numericIndex_memUsageCallback, &ret);
   return ret;
 }
@@ -476,18 +630,132 @@ int NumericIndexType_Register(RedisModuleCtx *ctx) {
   return REDISMODULE_OK;
 }
 
-/* A single entry in a numeric index's single range. Since entries are binned together, each needs
- * to have the exact value */
-typedef struct {
-  t_docId docId;
-  double value;
-} NumericRangeEntry;
+/* Bulk loading: rather than growing the tree by splits, sort the entries by value and cut them
+ * into leaves of a fixed size, then build a balanced tree over the leaves bottom up. Leaves are
+ * only filled halfway, so that they can take new values before having to split */
+#define NR_BULK_LEAF_CARD (NR_MAXRANGE_CARD / 2)
+#define NR_BULK_LEAF_SIZE (NR_MAXRANGE_SIZE / 2)
 
 static int cmpdocId(const void *p1, const void *p2) {
-  NumericRangeEntry *e1 = (NumericRangeEntry *)p1;
-  NumericRangeEntry *e2 = (NumericRangeEntry *)p2;
+  const NumericRangeEntry *e1 = p1, *e2 = p2;
+  return e1->docId < e2->docId ? -1 : (e1->docId > e2->docId ? 1 : 0);
+}
+
+static int cmpValue(const void *p1, const void *p2) {
+  const NumericRangeEntry *e1 = p1, *e2 = p2;
+  if (e1->value != e2->value) {
+    return e1->value < e2->value ? -1 : 1;
+  }
+  return cmpdocId(p1, p2);
+}
+
+/* Create a range holding the given entries, which are sorted by value. If isLeaf is set, the
+ * distinct values are tracked as they would have been by NumericRange_Add */
+static NumericRange *bulkRange(const NumericRangeEntry *entries, size_t n, int isLeaf) {
+  size_t splitCard = isLeaf ? NR_MAXRANGE_CARD : 1;
+  NumericRange *r = RedisModule_Alloc(sizeof(*r));
+  *r = (NumericRange){.minVal = entries[0].value,
+                      .maxVal = entries[n - 1].value,
+                      .unique_sum = 0,
+                      .card = 0,
+                      .splitCard = splitCard,
+                      .values = RedisModule_Calloc(splitCard, sizeof(double)),
+                      .entries = NewInvertedIndex(Index_StoreNumeric, 1)};
+
+  if (isLeaf) {
+    for (size_t ii = 0; ii < n; ++ii) {
+      if (ii == 0 || entries[ii].value != entries[ii - 1].value) {
+        r->values[r->card++] = entries[ii].value;
+        r->unique_sum += entries[ii].value;
+      }
+    }
+  }
+
+  // the inverted index must be written in docId order
+  NumericRangeEntry *byId = array_newlen(NumericRangeEntry, n);
+  memcpy(byId, entries, n * sizeof(*entries));
+  qsort(byId, n, sizeof(*byId), cmpdocId);
+  for (size_t ii = 0; ii < n; ++ii) {
+    InvertedIndex_WriteNumericEntry(r->entries, byId[ii].docId, byId[ii].value);
+  }
+  array_free(byId);
+  return r;
+}
 
-  return (int)e1->docId - (int)e2->docId;
+/* Build a subtree over leaves [lo, hi). bounds[i] is the offset of the first entry of leaf i */
+static NumericRangeNode *bulkBuild(NumericRangeNode **leaves, size_t *bounds,
+                                   const NumericRangeEntry *entries, size_t lo, size_t hi) {
+  if (hi - lo == 1) {
+    return leaves[lo];
+  }
+  size_t mid = lo + (hi - lo) / 2;
+  NumericRangeNode *n = RedisModule_Alloc(sizeof(*n));
+  n->left = bulkBuild(leaves, bounds, entries, lo, mid);
+  n->right = bulkBuild(leaves, bounds, entries, mid, hi);
+  // values lower than the split go left. Equal values never span two leaves
+  n->value = entries[bounds[mid]].value;
+  n->maxDepth = 1 + MAX(n->left->maxDepth, n->right->maxDepth);
+  n->range = NULL;
+  // like splitting nodes, nodes close enough to the leaves keep a range of their own
+  if (n->maxDepth <= NR_MAX_DEPTH) {
+    n->range = bulkRange(entries + bounds[lo], bounds[hi] - bounds[lo], 0);
+  }
+  return n;
+}
+
+NumericRangeTree *NewNumericRangeTreeFromEntries(NumericRangeEntry *entries, size_t n) {
+  NumericRangeTree *t = NewNumericRangeTree();
+  if (!n) {
+    return t;
+  }
+
+  // keep one entry per document, as adding them in order would
+  qsort(entries, n, sizeof(*entries), cmpdocId);
+  size_t numUnique = 1;
+  for (size_t ii = 1; ii < n; ++ii) {
+    if (entries[ii].docId != entries[numUnique - 1].docId) {
+      entries[numUnique++] = entries[ii];
+    }
+  }
+  n = numUnique;
+  t->lastDocId = entries[n - 1].docId;
+  t->numEntries = n;
+  for (size_t ii = 0; ii < n; ++ii) {
+    NumericColumn_Set(t->column, entries[ii].docId, entries[ii].value);
+  }
+
+  // Cut the entries, sorted by value, into leaves. A leaf ends once it has enough distinct values
+  // or entries, but never in the middle of a run of equal values
+  qsort(entries, n, sizeof(*entries), cmpValue);
+  size_t *bounds = array_new(size_t, 16);
+  bounds = array_append(bounds, 0);
+  size_t card = 1;
+  for (size_t ii = 1; ii < n; ++ii) {
+    if (entries[ii].value == entries[ii - 1].value) continue;
+    size_t start = bounds[array_len(bounds) - 1];
+    if (card >= NR_BULK_LEAF_CARD || ii - start >= NR_BULK_LEAF_SIZE) {
+      bounds = array_append(bounds, ii);
+      card = 0;
+    }
+    card++;
+  }
+  size_t numLeaves = array_len(bounds);
+  bounds = array_append(bounds, n);
+
+  NumericRangeNode **leaves = array_newlen(NumericRangeNode *, numLeaves);
+  for (size_t ii = 0; ii < numLeaves; ++ii) {
+    NumericRangeNode *leaf = RedisModule_Alloc(sizeof(*leaf));
+    *leaf = (NumericRangeNode){.value = 0, .maxDepth = 0, .left = NULL, .right = NULL};
+    leaf->range = bulkRange(entries + bounds[ii], bounds[ii + 1] - bounds[ii], 1);
+    leaves[ii] = leaf;
+  }
+
+  NumericRangeNode_Free(t->root);
+  t->root = bulkBuild(leaves, bounds, entries, 0, numLeaves);
+  t->numRanges = numLeaves;
+  array_free(leaves);
+  array_free(bounds);
+  return t;
 }
 
 /** Version 0 stores the number of entries beforehand, and then loads them */
@@ -538,14 +806,7 @@ void *NumericIndexType_RdbLoad(RedisModuleIO *rdb, int encver) {
     return NULL;  // Unknown version
   }
 
-  // sort the entries by doc id, as they were not saved in this order
-  qsort(entries, numEntries, sizeof(NumericRangeEntry), cmpdocId);
-  NumericRangeTree *t = NewNumericRangeTree();
-
-  // now push them in order into the tree
-  for (size_t i = 0; i < numEntries; i++) {
-    NumericRangeTree_Add(t, entries[i].docId, entries[i].value);
-  }
+  NumericRangeTree *t = NewNumericRangeTreeFromEntries(entries, numEntries);
   array_free(entries);
   return t;
 }
@@ -582,9 +843,14 @@ void NumericIndexType_RdbSave(RedisModuleIO *rdb, void *value) {
 void NumericIndexType_Digest(RedisModuleDigest *digest, void *value) {
 }
 
+static void numericIndex_retiredFree(void *p) {
+  NumericRangeTree_Free(p);
+}
+
+/* Queries may still be reading the ranges of a tree whose key was deleted, so it is retired rather
+ * than freed */
 void NumericIndexType_Free(void *value) {
-  NumericRangeTree *t = value;
-  NumericRangeTree_Free(t);
+  Epoch_Retire(value, numericIndex_retiredFree);
 }
 
 NumericRangeTreeIterator *NumericRangeTreeIterator_New(NumericRangeTree *t) {
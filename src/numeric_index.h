@@ -11,6 +11,7 @@
 #include "concurrent_ctx.h"
 #include "inverted_index.h"
 #include "numeric_filter.h"
+#include "numeric_column.h"
 
 #define RT_LEAF_CARDINALITY_MAX 500
 
@@ -57,6 +58,8 @@ typedef struct {
 
   uint32_t revisionId;
 
+  // The value of every document in the tree, by docId
+  NumericColumn *column;
 } NumericRangeTree;
 
 #define NumericRangeNode_IsLeaf(n) (n->left == NULL && n->right == NULL)
@@ -66,14 +69,27 @@ struct indexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f
 struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilter *flt,
                                                ConcurrentSearchCtx *csx);
 
+/* Create an iterator over the union of several filters on the numeric index at keyName, such as the
+ * geohash ranges covering a geo query. Returns NULL if no value in the index matches */
+struct indexIterator *NewNumericMultiFilterIterator(RedisSearchCtx *ctx, RedisModuleString *keyName,
+                                                    NumericFilter *flts, size_t n, double weight,
+                                                    ConcurrentSearchCtx *csx);
+
 /* Add an entry to a numeric range node. Returns the cardinality of the range after the
  * inserstion.
  * No deduplication is done */
 int NumericRange_Add(NumericRange *r, t_docId docId, double value, int checkCard);
 
+/* Recount the cardinality and unique values of a range from its entries, after the GC removed some
+ * of them */
+void NumericRange_RecountCard(NumericRange *n);
+
 /* Split n into two ranges, lp for left, and rp for right. We split by the median score */
 double NumericRange_Split(NumericRange *n, NumericRangeNode **lp, NumericRangeNode **rp);
 
+/* Free a range along with its entries */
+void NumericRange_Free(void *p);
+
 /* Create a new range node with the given capacity, minimum and maximum values */
 NumericRangeNode *NewLeafNode(size_t cap, double min, double max, size_t splitCard);
 
@@ -91,6 +107,18 @@ void NumericRangeNode_Free(NumericRangeNode *n);
 /* Create a new tree */
 NumericRangeTree *NewNumericRangeTree();
 
+/* A single entry in a numeric index's single range. Since entries are binned together, each needs
+ * to have the exact value */
+typedef struct {
+  t_docId docId;
+  double value;
+} NumericRangeEntry;
+
+/* Build a balanced tree out of a set of entries at once, instead of adding them one by one. The
+ * entries may come in any order, and are sorted in place. As when adding, a document only gets one
+ * entry, even if it appears more than once */
+NumericRangeTree *NewNumericRangeTreeFromEntries(NumericRangeEntry *entries, size_t n);
+
 /* Add a value to a tree. Returns 0 if no nodes were split, 1 if we splitted nodes */
 int NumericRangeTree_Add(NumericRangeTree *t, t_docId docId, double value);
 
@@ -106,6 +134,10 @@ extern RedisModuleType *NumericIndexType;
 NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, RedisModuleString *keyName,
                                    RedisModuleKey **idxKey);
 
+/* Get the value column of a numeric field, or NULL if the field has no index yet. The column must
+ * only be read by queries that have pinned their epoch */
+NumericColumn *NumericIndex_GetColumn(RedisSearchCtx *ctx, const char *field);
+
 int NumericIndexType_Register(RedisModuleCtx *ctx);
 void *NumericIndexType_RdbLoad(RedisModuleIO *rdb, int encver);
 void NumericIndexType_RdbSave(RedisModuleIO *rdb, void *value);
@@ -27,6 +27,37 @@ class SearchTestCase(BaseSearchTestCase):
             self.assertExists(r, prefix + ':idx/world')
             self.assertExists(r, prefix + ':idx/lorem')
 
+    def testMAdd(self):
+        self.assertOk(self.cmd(
+            'ft.create', 'idx', 'schema', 'title', 'text', 'n', 'numeric'))
+        self.assertOk(self.cmd('ft.add', 'idx', 'doc2', 1.0,
+                               'fields', 'title', 'old title'))
+        res = self.cmd('ft.madd', 'idx', 'docs',
+                       'doc1', 1.0, 2, 'title', 'hello world', 'n', 1,
+                       'doc2', 0.5, 1, 'title', 'hello kitty',
+                       'doc3', 1.0, 1, 'title', 'hello there')
+        self.assertEqual('OK', res[0])
+        self.assertIsInstance(res[1], Exception)
+        self.assertEqual('OK', res[2])
+
+        res = self.cmd('ft.madd', 'idx', 'replace', 'docs',
+                       'doc2', 0.5, 1, 'title', 'hello kitty')
+        self.assertEqual(['OK'], res)
+
+        for _ in self.retry_with_rdb_reload():
+            res = self.cmd('ft.search', 'idx', 'hello', 'nocontent')
+            self.assertEqual(3, res[0])
+            res = self.cmd('ft.search', 'idx', 'kitty', 'nocontent')
+            self.assertEqual([1, 'doc2'], res)
+
+        # nothing is added if any of the documents is malformed
+        with self.assertResponseError():
+            self.cmd('ft.madd', 'idx', 'docs', 'doc4', 1.0, 1, 'title', 'foo',
+                     'doc5', 2.0, 1, 'title', 'bar')
+        with self.assertResponseError():
+            self.cmd('ft.madd', 'idx', 'docs', 'doc4', 1.0, 2, 'title', 'foo')
+        self.assertEqual(3, self.cmd('ft.search', 'idx', '*', 'nocontent')[0])
+
     def testConditionalUpdate(self):
         self.assertOk(self.cmd(
             'ft.create', 'idx', 'schema', 'foo', 'text', 'bar', 'numeric', 'sortable'))
@@ -1353,6 +1384,17 @@ class SearchTestCase(BaseSearchTestCase):
         with self.assertResponseError():
             res = self.cmd('ft.search', 'idx', 'val*', 'return', 700, 'nonexist')
 
+    def testReturnNumericAsIs(self):
+        self.assertCmdOk('ft.create', 'idx', 'schema', 't', 'text', 'n', 'numeric')
+        self.assertCmdOk('ft.add', 'idx', 'doc1', 1.0, 'fields', 't', 'hello', 'n', '1.50')
+        self.assertCmdOk('ft.add', 'idx', 'doc2', 1.0, 'fields', 't', 'hello', 'n', '007')
+
+        # numeric fields are returned the way they are in the document, not as their parsed value
+        res = self.cmd('ft.search', 'idx', 'hello', 'return', 1, 'n')
+        self.assertEqual(2, res[0])
+        self.assertEqual({'doc1': ['n', '1.50'], 'doc2': ['n', '007']},
+                         dict(grouper(res[1:], 2)))
+
     def _test_create_options_real(self, *options):
         options = [x for x in options if x]
         has_offsets = 'NOOFFSETS' not in options
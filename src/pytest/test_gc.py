@@ -66,3 +66,48 @@ class SearchGCTestCase(BaseSearchTestCase):
         for r1 in res:
             for r2 in r1[1]:
                 self.assertEqual(r2 % 2, 0)
+
+    def testDeletedSetShrinks(self):
+        NumberOfDocs = 100
+        self.assertOk(self.cmd('ft.create', 'idx', 'schema', 'title', 'text', 'id', 'numeric', 't', 'tag'))
+
+        for i in range(NumberOfDocs):
+            self.assertOk(self.cmd('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                   'title', 'hello world %d' % i, 'id', str(i), 't', 'tag%d' % (i % 10)))
+
+        for i in range(0, NumberOfDocs, 2):
+            self.assertEqual(self.cmd('ft.del', 'idx', 'doc%d' % i), 1)
+        self.assertEqual(self.cmd('ft.debug', 'NUM_DELETED', 'idx'), NumberOfDocs / 2)
+
+        # the default GC sweeps every index once in a few cycles, and forgets the documents it collected
+        for _ in range(50):
+            if self.cmd('ft.debug', 'NUM_DELETED', 'idx') == 0:
+                break
+            time.sleep(0.1)
+        self.assertEqual(self.cmd('ft.debug', 'NUM_DELETED', 'idx'), 0)
+
+        res = self.cmd('ft.debug', 'DUMP_INVIDX', 'idx', 'hello')
+        self.assertEqual(len(res), NumberOfDocs / 2)
+        for docId in res:
+            self.assertEqual(docId % 2, 0)
+
+    def testEmptyTermDeleted(self):
+        self.assertOk(self.cmd('ft.create', 'idx', 'schema', 'title', 'text'))
+        self.assertOk(self.cmd('ft.add', 'idx', 'doc1', 1.0, 'fields', 'title', 'hello world'))
+        self.assertOk(self.cmd('ft.add', 'idx', 'doc2', 1.0, 'fields', 'title', 'hello unique'))
+
+        def numTerms():
+            info = self.cmd('ft.info', 'idx')
+            return int(info[info.index('num_terms') + 1])
+        self.assertEqual(numTerms(), 3)
+
+        self.assertEqual(self.cmd('ft.del', 'idx', 'doc2'), 1)
+        # once the gc collects the only record of a term, its index is deleted along with it
+        for _ in range(50):
+            if numTerms() == 2:
+                break
+            time.sleep(0.1)
+        self.assertEqual(numTerms(), 2)
+        self.assertEqual(self.cmd('exists', 'ft:idx/unique'), 0)
+        self.assertEqual(self.cmd('ft.search', 'idx', 'unique'), [0])
+        self.assertEqual(self.cmd('ft.search', 'idx', 'hello', 'nocontent'), [1, 'doc1'])
@@ -19,6 +19,7 @@
 #include "err.h"
 #include "concurrent_ctx.h"
 #include "util/strconv.h"
+#include "doc_bitmap.h"
 
 static void QueryTokenNode_Free(QueryTokenNode *tn) {
 
@@ -310,11 +311,39 @@ IndexIterator *Query_EvalTokenNode(QueryEvalCtx *q, QueryNode *qn) {
   return NewReadIterator(ir);
 }
 
-static IndexIterator *iterateExpandedTerms(QueryEvalCtx *q, Trie *terms, const char *str,
-                                           size_t len, int maxDist, int prefixMode,
-                                           QueryNodeOptions *opts) {
+/* Prefix/fuzzy/tag expansions with at least this many terms are considered for materialization */
+#define BITMAP_UNION_MIN_CHILDREN 32
+/* ... and are only materialized if their combined postings cover at least 1/N of the docId space,
+ * otherwise the bitmap chunks would be too sparse to pay for themselves */
+#define BITMAP_UNION_DENSITY_RATIO 64
+
+/* Can the expansions of a term be evaluated as a plain set of docIds? This is the case only if
+ * nothing down the chain looks at the per-term records: no scorer (sorted or aggregate queries),
+ * no highlighter, and not inside a phrase where offsets are checked */
+static int Query_CanMaterializeExpansions(QueryEvalCtx *q) {
+  if (q->phraseDepth > 0 || !q->docTable) return 0;
+  if (!(q->opts->flags & Search_AggregationQuery) && !q->opts->sortBy) return 0;
+  return !q->opts->fields.wantSummaries;
+}
+
+/* Decide by the estimated cardinality whether a union of expansions should be materialized into a
+ * bitmap. If so, the children are consumed and the bitmap iterator is returned */
+static IndexIterator *Query_MaterializeUnion(QueryEvalCtx *q, IndexIterator **its, size_t num,
+                                             size_t estimate, double weight) {
+  if (num < BITMAP_UNION_MIN_CHILDREN ||
+      estimate * BITMAP_UNION_DENSITY_RATIO < q->docTable->maxDocId) {
+    return NULL;
+  }
+  return NewBitmapUnionIterator(its, num, weight);
+}
+
+/* Open a reader for every expansion of str in the terms trie. Returns the number of readers opened
+ * into *itsp, and their total number of postings into *estimate */
+static size_t expandTerms(QueryEvalCtx *q, Trie *terms, const char *str, size_t len, int maxDist,
+                          int prefixMode, QueryNodeOptions *opts, ConcurrentSearchCtx *conc,
+                          IndexIterator ***itsp, size_t *estimate) {
   TrieIterator *it = Trie_Iterate(terms, str, len, maxDist, prefixMode);
-  if (!it) return NULL;
+  if (!it) return 0;
 
   size_t itsSz = 0, itsCap = 8;
   IndexIterator **its = calloc(itsCap, sizeof(*its));
@@ -323,6 +352,7 @@ static IndexIterator *iterateExpandedTerms(QueryEvalCtx *q, Trie *terms, const c
   t_len slen = 0;
   float score = 0;
   int dist = 0;
+  *estimate = 0;
 
   // an upper limit on the number of expansions is enforced to avoid stuff like "*"
 
@@ -342,13 +372,14 @@ static IndexIterator *iterateExpandedTerms(QueryEvalCtx *q, Trie *terms, const c
 
     // Open an index reader
     IndexReader *ir = Redis_OpenReader(q->sctx, term, &q->sctx->spec->docs, 0,
-                                       q->opts->fieldMask & opts->fieldMask, q->conc, 1);
+                                       q->opts->fieldMask & opts->fieldMask, conc, 1);
 
     free(tok.str);
     if (!ir) {
       Term_Free(term);
       continue;
     }
+    *estimate += ir->idx->numDocs;
 
     // Add the reader to the iterator array
     its[itsSz++] = NewReadIterator(ir);
@@ -361,6 +392,36 @@ static IndexIterator *iterateExpandedTerms(QueryEvalCtx *q, Trie *terms, const c
   DFAFilter_Free(it->ctx);
   free(it->ctx);
   TrieIterator_Free(it);
+
+  *itsp = its;
+  return itsSz;
+}
+
+static IndexIterator *iterateExpandedTerms(QueryEvalCtx *q, Trie *terms, const char *str,
+                                           size_t len, int maxDist, int prefixMode,
+                                           QueryNodeOptions *opts) {
+  IndexIterator **its = NULL;
+  size_t estimate = 0;
+
+  // Readers that may be materialized and freed during evaluation can't be registered for reopening,
+  // so we open them without the concurrent context, and register them with it if we end up not
+  // materializing
+  int materialize = Query_CanMaterializeExpansions(q);
+  size_t itsSz = expandTerms(q, terms, str, len, maxDist, prefixMode, opts,
+                             materialize ? NULL : q->conc, &its, &estimate);
+  if (materialize && itsSz) {
+    IndexIterator *ret = Query_MaterializeUnion(q, its, itsSz, estimate, opts->weight);
+    if (ret) {
+      free(its);
+      return ret;
+    }
+    if (q->conc) {
+      for (size_t i = 0; i < itsSz; i++) {
+        Redis_RegisterReader(q->sctx, its[i]->ctx, q->conc);
+      }
+    }
+  }
+
   // printf("Expanded %d terms!\n", itsSz);
   if (itsSz == 0) {
     free(its);
@@ -408,10 +469,12 @@ static IndexIterator *Query_EvalPhraseNode(QueryEvalCtx *q, QueryNode *qn) {
 
   // recursively eval the children
   IndexIterator **iters = calloc(node->numChildren, sizeof(IndexIterator *));
+  q->phraseDepth++;
   for (int i = 0; i < node->numChildren; i++) {
     node->children[i]->opts.fieldMask &= qn->opts.fieldMask;
     iters[i] = Query_EvalNode(q, node->children[i]);
   }
+  q->phraseDepth--;
   IndexIterator *ret;
 
   if (node->exact) {
@@ -487,7 +550,7 @@ static IndexIterator *Query_EvalGeofilterNode(QueryEvalCtx *q, QueryGeofilterNod
   }
 
   GeoIndex gi = {.ctx = q->sctx, .sp = fs};
-  return NewGeoRangeIterator(&gi, node->gf, weight);
+  return NewGeoRangeIterator(&gi, node->gf, weight, q->conc);
 }
 
 static IndexIterator *Query_EvalIdFilterNode(QueryEvalCtx *q, QueryIdFilterNode *node) {
@@ -501,6 +564,12 @@ static IndexIterator *Query_EvalUnionNode(QueryEvalCtx *q, QueryNode *qn) {
   }
   QueryUnionNode *node = &qn->un;
 
+  // only the root union may prune by score, the children's scores are not the whole score
+  const ScoreBound *sb = q->scoreBound;
+  const double *threshold = q->topkThreshold;
+  q->scoreBound = NULL;
+  q->topkThreshold = NULL;
+
   // a union stage with one child is the same as the child, so we just return it
   if (node->numChildren == 1) {
     node->children[0]->opts.fieldMask &= qn->opts.fieldMask;
@@ -528,29 +597,27 @@ static IndexIterator *Query_EvalUnionNode(QueryEvalCtx *q, QueryNode *qn) {
     return ret;
   }
 
+  if (sb) {
+    IndexIterator *ret = NewWandIterator(iters, n, sb, threshold, qn->opts.weight);
+    if (ret) return ret;
+  }
+
   IndexIterator *ret = NewUnionIterator(iters, n, q->docTable, 0, qn->opts.weight);
   return ret;
 }
 
 /* Evaluate a tag prefix by expanding it with a lookup on the tag index */
-static IndexIterator *Query_EvalTagPrefixNode(QueryEvalCtx *q, TagIndex *idx, QueryNode *qn,
-                                              RedisModuleKey *k, RedisModuleString *kn,
-                                              double weight) {
-  if (qn->type != QN_PREFX) {
-    return NULL;
-  }
-
-  // we allow a minimum of 2 letters in the prefx by default (configurable)
-  if (qn->pfx.len < RSGlobalConfig.minTermPrefix) {
-    return NULL;
-  }
-  if (!idx || !idx->values) return NULL;
-
+/* Open a reader for every tag value starting with the node's prefix. Returns the number of readers
+ * opened into *itsp, and their total number of postings into *estimate */
+static size_t expandTagPrefix(QueryEvalCtx *q, TagIndex *idx, QueryNode *qn,
+                              ConcurrentSearchCtx *conc, RedisModuleKey *k, RedisModuleString *kn,
+                              IndexIterator ***itsp, size_t *estimate) {
   TrieMapIterator *it = TrieMap_Iterate(idx->values, qn->pfx.str, qn->pfx.len);
-  if (!it) return NULL;
+  if (!it) return 0;
 
   size_t itsSz = 0, itsCap = 8;
   IndexIterator **its = calloc(itsCap, sizeof(*its));
+  *estimate = 0;
 
   // an upper limit on the number of expansions is enforced to avoid stuff like "*"
   char *s;
@@ -559,8 +626,9 @@ static IndexIterator *Query_EvalTagPrefixNode(QueryEvalCtx *q, TagIndex *idx, Qu
 
   // Find all completions of the prefix
   while (TrieMapIterator_Next(it, &s, &sl, &ptr) && itsSz < RSGlobalConfig.maxPrefixExpansions) {
-    IndexIterator *ret = TagIndex_OpenReader(idx, q->docTable, s, sl, q->conc, k, kn, 1);
+    IndexIterator *ret = TagIndex_OpenReader(idx, q->docTable, s, sl, conc, k, kn, 1);
     if (!ret) continue;
+    *estimate += ((InvertedIndex *)ptr)->numDocs;
 
     // Add the reader to the iterator array
     its[itsSz++] = ret;
@@ -572,6 +640,42 @@ static IndexIterator *Query_EvalTagPrefixNode(QueryEvalCtx *q, TagIndex *idx, Qu
 
   TrieMapIterator_Free(it);
 
+  *itsp = its;
+  return itsSz;
+}
+
+static IndexIterator *Query_EvalTagPrefixNode(QueryEvalCtx *q, TagIndex *idx, QueryNode *qn,
+                                              RedisModuleKey *k, RedisModuleString *kn,
+                                              double weight) {
+  if (qn->type != QN_PREFX) {
+    return NULL;
+  }
+
+  // we allow a minimum of 2 letters in the prefx by default (configurable)
+  if (qn->pfx.len < RSGlobalConfig.minTermPrefix) {
+    return NULL;
+  }
+  if (!idx || !idx->values) return NULL;
+
+  IndexIterator **its = NULL;
+  size_t estimate = 0;
+
+  // see iterateExpandedTerms for why materialized readers are opened without the concurrent context
+  int materialize = Query_CanMaterializeExpansions(q);
+  size_t itsSz = expandTagPrefix(q, idx, qn, materialize ? NULL : q->conc, k, kn, &its, &estimate);
+  if (materialize && itsSz) {
+    IndexIterator *ret = Query_MaterializeUnion(q, its, itsSz, estimate, weight);
+    if (ret) {
+      free(its);
+      return ret;
+    }
+    if (q->conc) {
+      for (size_t i = 0; i < itsSz; i++) {
+        TagIndex_RegisterReader(idx, its[i], q->conc, k, kn);
+      }
+    }
+  }
+
   // printf("Expanded %d terms!\n", itsSz);
   if (itsSz == 0) {
     free(its);
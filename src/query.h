@@ -18,6 +18,7 @@
 #include "rmutil/sds.h"
 #include "concurrent_ctx.h"
 #include "search_options.h"
+#include "wand_iterator.h"
 
 /* A QueryParseCtx represents the parse tree and execution plan for a single
  * search QueryParseCtx */
@@ -55,6 +56,13 @@ typedef struct {
   int tokenId;
   DocTable *docTable;
   RSSearchOptions *opts;
+  /* Nesting depth of phrase nodes being evaluated. Iterators under a phrase must keep their
+   * per-term records for slop and order checks */
+  int phraseDepth;
+  /* If set, the root union may skip documents whose score bound is below *topkThreshold. Cleared
+   * once the root is evaluated, since pruning is only valid where the whole score is known */
+  const ScoreBound *scoreBound;
+  const double *topkThreshold;
 } QueryEvalCtx;
 
 /* Evaluate a QueryParseCtx stage and prepare it for execution. As execution is lazy
@@ -2,6 +2,9 @@
 #include "config.h"
 #include "value.h"
 #include "aggregate/aggregate.h"
+#include "ext/default.h"
+#include "extension.h"
+#include <string.h>
 
 /******************************************************************************************************
  *   Query Plan - the actual binding context of the whole execution plan - from filters to
@@ -115,9 +118,31 @@ static void Query_SerializeResults(QueryPlan *qex, RedisModuleCtx *output) {
     qex->outputFlags = 0;
   }
 
+  // read in batches if the last processor supports it. The results of a batch are all sent, so we
+  // only stop for a paused cursor at the end of one
+  SearchResultBatch *b = NULL;
+  size_t bi = 0;
+  if (qex->rootProcessor->NextBatch) {
+    if (!qex->batch) {
+      qex->batch = NewSearchResultBatch();
+    }
+    b = qex->batch;
+    bi = b->len;
+  }
+
   do {
-    SearchResult r = SEARCH_RESULT_INIT;
-    rc = ResultProcessor_Next(qex->rootProcessor, &r, 1);
+    SearchResult row = SEARCH_RESULT_INIT;
+    SearchResult *r = &row;
+    if (b) {
+      if (bi == b->len) {
+        b->cap = limit ? MIN(RP_BATCH_SIZE, limit - nrows) : RP_BATCH_SIZE;
+        rc = ResultProcessor_NextBatch(qex->rootProcessor, b, 1);
+        bi = 0;
+      }
+      r = &b->rows[bi++];
+    } else {
+      rc = ResultProcessor_Next(qex->rootProcessor, r, 1);
+    }
 
     if (rc == RS_RESULT_EOF) {
       qex->outputFlags |= QP_OUTPUT_FLAG_DONE;
@@ -125,7 +150,7 @@ static void Query_SerializeResults(QueryPlan *qex, RedisModuleCtx *output) {
     }
 
     if (HAS_TIMEOUT_FAILURE(qex)) {
-      RSFieldMap_Free(r.fields);
+      if (!b) RSFieldMap_Free(r->fields);
       qex->outputFlags |= QP_OUTPUT_FLAG_DONE;
       break;
     }
@@ -140,14 +165,16 @@ static void Query_SerializeResults(QueryPlan *qex, RedisModuleCtx *output) {
       RedisModule_ReplyWithLongLong(output, ResultProcessor_Total(qex->rootProcessor));
       count++;
     }
-    count += serializeResult(qex, &r, qex->opts.flags, output);
+    count += serializeResult(qex, r, qex->opts.flags, output);
 
-    // IndexResult_Free(r.indexResult);
-    RSFieldMap_Free(r.fields);
-    r.fields = NULL;
+    // batch rows are released by the next batch
+    if (!b) {
+      RSFieldMap_Free(r->fields);
+      r->fields = NULL;
+    }
 
     if (limit) {
-      if (++nrows >= limit || qex->pause) {
+      if (++nrows >= limit || (qex->pause && (!b || bi == b->len))) {
         break;
       }
     }
@@ -190,38 +217,49 @@ void Query_OnReopen(RedisModuleKey *k, void *privdata) {
   // The spec might have changed while we were sleeping - for example a realloc of the doc table
   q->ctx->spec = sp;
 
-  // FIXME: Per-query!!
-  if (RSGlobalConfig.queryTimeoutMS > 0) {
-    // Check the elapsed processing time
-    static struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
-
-    long long durationNS = (long long)1000000000 * (now.tv_sec - q->execCtx.startTime.tv_sec) +
-                           (now.tv_nsec - q->execCtx.startTime.tv_nsec);
-    // printf("Elapsed: %zdms\n", durationNS / 1000000);
-    // Abort on timeout
-    if (durationNS > q->opts.timeoutMS * 1000000) {
-      if (q->opts.flags & Search_IsCursor) {
-        q->pause = 1;
-      } else {
-        q->execCtx.state = QPState_TimedOut;
-      }
+  // Abort on timeout
+  if (QueryProcessingCtx_TimeoutExpired(&q->execCtx)) {
+    if (q->opts.flags & Search_IsCursor) {
+      q->pause = 1;
+    } else {
+      q->execCtx.state = QPState_TimedOut;
     }
   }
   // q->docTable = &sp->docs;
 }
 
+void QueryPlan_Pause(QueryPlan *plan) {
+  Epoch_Unpin(plan->epoch);
+  plan->epoch = EPOCH_NO_PIN;
+}
+
+void QueryPlan_Resume(QueryPlan *plan) {
+  if (plan->epoch == EPOCH_NO_PIN) {
+    plan->epoch = Epoch_Pin();
+  }
+  // Readers check whether what they were reading was reclaimed while we were paused
+  if (plan->conc) {
+    ConcurrentSearchCtx_ResumeKeys(plan->conc);
+  }
+}
+
 void QueryPlan_Free(QueryPlan *plan) {
+  SearchResultBatch_Free(plan->batch);
   if (plan->rootProcessor) {
     ResultProcessor_Free(plan->rootProcessor);
   }
   if (plan->rootFilter) {
     plan->rootFilter->Free(plan->rootFilter);
   }
+  for (int i = 0; i < plan->numPartitions; i++) {
+    if (plan->partitions[i]) plan->partitions[i]->Free(plan->partitions[i]);
+  }
+  free(plan->partitions);
   if (plan->conc) {
     ConcurrentSearchCtx_Free(plan->conc);
     free(plan->conc);
   }
+  Epoch_Unpin(plan->epoch);
   if (plan->preHook.privdata) {
     if (plan->preHook.free) plan->preHook.free(plan->preHook.privdata);
   }
@@ -256,6 +294,112 @@ static int queryPlan_ValidateQuery(QueryParseCtx *parsedQuery, void *ctx) {
   return Query_NodeForEach(parsedQuery, queryPlan_ValidateNode, ctx);
 }
 
+/* Can a relevance sorted query skip documents by bounding their scores? Only if it asked to with
+ * PRUNE, since skipped documents are not counted, and results are ranked by one of the scorers we
+ * know how to bound */
+static int queryPlan_GetScoreBound(QueryPlan *plan, RSSearchOptions *opts, ScoreBound *sb) {
+  if (!(opts->flags & Search_Prune) || opts->sortBy || (opts->flags & Search_AggregationQuery) ||
+      !plan->ctx || !plan->ctx->spec) {
+    return 0;
+  }
+
+  // unknown scorers fall back to the default one, see NewScorer
+  const char *scorer = opts->scorer ? opts->scorer : DEFAULT_SCORER_NAME;
+  if (!Extensions_GetScoringFunction(NULL, scorer)) scorer = DEFAULT_SCORER_NAME;
+
+  if (!strcmp(scorer, DEFAULT_SCORER_NAME)) {
+    sb->termBound = TFIDFTermBound;
+  } else if (!strcmp(scorer, BM25_SCORER_NAME)) {
+    sb->termBound = BM25TermBound;
+  } else {
+    return 0;
+  }
+  IndexSpec_GetStats(plan->ctx->spec, &sb->stats);
+  return 1;
+}
+
+/* Is the query ranked by one of the built-in scorers, or by a sorting key? Extension scorers may
+ * not be thread safe, so they are only run with the lock held */
+static int queryPlan_ThreadSafeScorer(const RSSearchOptions *opts) {
+  if (opts->sortBy) return 1;
+  static const char *threadSafeScorers[] = {
+      DEFAULT_SCORER_NAME, TFIDF_DOCNORM_SCORER_NAME, BM25_SCORER_NAME,
+      DISMAX_SCORER_NAME,  DOCSCORE_SCORER,           HAMMINGDISTANCE_SCORER};
+  const char *scorer = opts->scorer ? opts->scorer : DEFAULT_SCORER_NAME;
+  if (!Extensions_GetScoringFunction(NULL, scorer)) scorer = DEFAULT_SCORER_NAME;
+  for (int i = 0; i < sizeof(threadSafeScorers) / sizeof(*threadSafeScorers); i++) {
+    if (!strcmp(scorer, threadSafeScorers[i])) return 1;
+  }
+  return 0;
+}
+
+int QueryPlan_CanScanUnlocked(const QueryPlan *plan) {
+  return plan->conc && !(plan->opts.flags & Search_AggregationQuery) &&
+         queryPlan_ThreadSafeScorer(&plan->opts);
+}
+
+/* The minimal number of results we expect each worker of a parallel query to scan. Below that, the
+ * cost of evaluating the query again and of starting a thread outweighs the parallel scan */
+#define PARALLEL_MIN_RESULTS_PER_WORKER 20000
+
+/* Is the node evaluated without walking the terms trie to expand it? */
+static int queryPlan_IsPlainNode(QueryNode *node, QueryParseCtx *q, void *ctx) {
+  return node->type != QN_PREFX && node->type != QN_FUZZY;
+}
+
+/* How many threads should the query be split between? Only search queries ranked by one of the
+ * built-in scorers, or by a sorting key, are split - extension scorers may not be thread safe.
+ * Every range is evaluated again, so queries with prefixes or fuzzy terms, which would walk the
+ * terms trie for each range, are not split either */
+static int queryPlan_NumWorkers(QueryPlan *plan, QueryParseCtx *parsedQuery,
+                                RSSearchOptions *opts) {
+  if (RSGlobalConfig.queryWorkers <= 1 || !plan->rootFilter || !plan->ctx || !plan->ctx->spec) {
+    return 1;
+  }
+  if (opts->flags & (Search_AggregationQuery | Search_IsCursor) || opts->fields.wantSummaries) {
+    return 1;
+  }
+  if (!queryPlan_ThreadSafeScorer(opts)) {
+    return 1;
+  }
+  if (!Query_NodeForEach(parsedQuery, queryPlan_IsPlainNode, NULL)) {
+    return 1;
+  }
+
+  size_t workers = plan->rootFilter->NumEstimated(plan->rootFilter->ctx) /
+                   PARALLEL_MIN_RESULTS_PER_WORKER;
+  if (workers < 1) return 1;
+  return workers < RSGlobalConfig.queryWorkers ? workers : RSGlobalConfig.queryWorkers;
+}
+
+/* Evaluate the query again for each docId range but the first one. Iterators keep their read
+ * position, so every range needs a tree of its own. The tree only opens the readers of terms the
+ * query already expanded */
+static void queryPlan_EvalPartitions(QueryPlan *plan, QueryParseCtx *parsedQuery,
+                                     RSSearchOptions *opts, int numWorkers) {
+  plan->partitions = calloc(numWorkers - 1, sizeof(*plan->partitions));
+  for (int i = 0; i < numWorkers - 1; i++) {
+    QueryEvalCtx ev = {.docTable = &plan->ctx->spec->docs,
+                       .conc = plan->conc,
+                       .numTokens = parsedQuery->numTokens,
+                       .tokenId = 1,
+                       .sctx = plan->ctx,
+                       .opts = opts};
+    IndexIterator *it = Query_EvalNode(&ev, parsedQuery->root);
+    if (!it) break;
+    plan->partitions[plan->numPartitions++] = it;
+  }
+  // we need all the ranges covered, or none of them
+  if (plan->numPartitions != numWorkers - 1) {
+    for (int i = 0; i < plan->numPartitions; i++) {
+      plan->partitions[i]->Free(plan->partitions[i]);
+    }
+    free(plan->partitions);
+    plan->partitions = NULL;
+    plan->numPartitions = 0;
+  }
+}
+
 static int queryPlan_EvalQuery(QueryPlan *plan, QueryParseCtx *parsedQuery, RSSearchOptions *opts) {
   QueryEvalCtx ev = {.docTable = plan->ctx && plan->ctx->spec ? &plan->ctx->spec->docs : NULL,
                      .conc = plan->conc,
@@ -264,13 +408,30 @@ static int queryPlan_EvalQuery(QueryPlan *plan, QueryParseCtx *parsedQuery, RSSe
                      .sctx = plan->ctx,
                      .opts = opts};
 
+  // a root union of terms can skip documents that can't make it into the top results
+  ScoreBound sb;
+  int bounded = 0;
+  if (parsedQuery->root->type == QN_UNION && queryPlan_GetScoreBound(plan, opts, &sb)) {
+    bounded = 1;
+    ev.scoreBound = &sb;
+    ev.topkThreshold = &plan->execCtx.minScore;
+  }
+
   plan->rootFilter = Query_EvalNode(&ev, parsedQuery->root);
-  return plan->rootFilter ? 1 : 0;
+  if (!plan->rootFilter) return 0;
+
+  // partitions are ranked by a scan of their own, they can't share a top-k threshold
+  int numWorkers = bounded ? 1 : queryPlan_NumWorkers(plan, parsedQuery, opts);
+  if (numWorkers > 1) {
+    queryPlan_EvalPartitions(plan, parsedQuery, opts, numWorkers);
+  }
+  return 1;
 }
 
 QueryPlan *Query_BuildPlan(RedisSearchCtx *ctx, QueryParseCtx *parsedQuery, RSSearchOptions *opts,
                            ProcessorChainBuilder pcb, void *chainBuilderContext, char **err) {
   QueryPlan *plan = calloc(1, sizeof(*plan));
+  plan->epoch = Epoch_Pin();
   plan->ctx = ctx;
   plan->conc = opts->concurrentMode ? malloc(sizeof(*plan->conc)) : NULL;
   plan->opts = opts ? *opts : RS_DEFAULT_SEARCHOPTS;
@@ -288,6 +449,7 @@ QueryPlan *Query_BuildPlan(RedisSearchCtx *ctx, QueryParseCtx *parsedQuery, RSSe
       .state = QPState_Running,
       .sctx = plan->ctx,
       .conc = plan->conc,
+      .timeoutNS = RSGlobalConfig.queryTimeoutMS > 0 ? plan->opts.timeoutMS * 1000000LL : 0,
   };
   clock_gettime(CLOCK_MONOTONIC_RAW, &plan->execCtx.startTime);
   if (plan->conc) {
@@ -6,6 +6,7 @@
 #include "index_iterator.h"
 #include "result_processor.h"
 #include "query.h"
+#include "epoch.h"
 
 /******************************************************************************************************
  *   Query Plan - the actual binding context of the whole execution plan - from filters to
@@ -37,12 +38,26 @@ typedef struct QueryPlan {
 
   IndexIterator *rootFilter;
 
+  // Copies of the root filter for scanning the query in parallel. The root filter scans the first
+  // range of document ids, and each partition scans one of the following ranges. NULL if the query
+  // runs on a single thread
+  IndexIterator **partitions;
+  int numPartitions;
+
   ResultProcessor *rootProcessor;
 
+  // the batch results are read into, if the root processor supports batches. Kept across cursor
+  // reads so its rows' field maps are reused
+  SearchResultBatch *batch;
+
   QueryProcessingCtx execCtx;
 
   ConcurrentSearchCtx *conc;
 
+  // The epoch pinned while the query runs. Index memory we may be reading while asleep is not freed
+  // before we release it. A paused query (an idle cursor) holds no pin
+  EpochPin epoch;
+
   RSSearchOptions opts;
 
   // right now we allow a single pre and post hook
@@ -80,6 +95,17 @@ void QueryPlan_Run(QueryPlan *plan, RedisModuleCtx *outputCtx);
 
 void QueryPlan_Free(QueryPlan *plan);
 
+/* Release the plan's epoch while it is idle between cursor reads, so it does not hold off the
+ * reclamation of index memory for as long as the cursor lives */
+void QueryPlan_Pause(QueryPlan *plan);
+
+/* Pin an epoch again and reopen the plan's keys before resuming a paused plan */
+void QueryPlan_Resume(QueryPlan *plan);
+
+/* Can a search query read its results off the index without the lock? Only concurrent queries,
+ * which pin an epoch and don't hold their readers' keys open, ranked by a thread safe scorer */
+int QueryPlan_CanScanUnlocked(const QueryPlan *plan);
+
 #define QueryPlan_HasError(plan) ((plan)->execCtx.state != QueryState_OK)
 
 #endif
\ No newline at end of file
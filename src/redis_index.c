@@ -26,13 +26,16 @@ void *InvertedIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
   idx->lastId = RedisModule_LoadUnsigned(rdb);
   idx->numDocs = RedisModule_LoadUnsigned(rdb);
   idx->size = RedisModule_LoadUnsigned(rdb);
-  idx->blocks = rm_calloc(idx->size, sizeof(IndexBlock));
+  idx->blocks = rm_calloc(IndexArray_Cap(idx->size), sizeof(IndexBlock));
 
   for (uint32_t i = 0; i < idx->size; i++) {
     IndexBlock *blk = &idx->blocks[i];
     blk->firstId = RedisModule_LoadUnsigned(rdb);
     blk->lastId = RedisModule_LoadUnsigned(rdb);
     blk->numDocs = RedisModule_LoadUnsigned(rdb);
+    if (encver >= INVERTED_INDEX_MIN_PACKED_VER && (idx->flags & Index_PackedDocIds)) {
+      blk->packed = RedisModule_LoadUnsigned(rdb);
+    }
 
     size_t cap;
     char *data = RedisModule_LoadStringBuffer(rdb, &cap);
@@ -42,6 +45,8 @@ void *InvertedIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
     // if we read a buffer of 0 bytes we still read 1 byte from the RDB that needs to be freed
     if (!cap && data) RedisModule_Free(data);
   }
+  // block metadata is not persisted, we rebuild it from the block data
+  InvertedIndex_BuildBlockMeta(idx);
   return idx;
 }
 void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value) {
@@ -57,12 +62,20 @@ void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value) {
     RedisModule_SaveUnsigned(rdb, blk->firstId);
     RedisModule_SaveUnsigned(rdb, blk->lastId);
     RedisModule_SaveUnsigned(rdb, blk->numDocs);
+    if (idx->flags & Index_PackedDocIds) {
+      RedisModule_SaveUnsigned(rdb, blk->packed);
+    }
     RedisModule_SaveStringBuffer(rdb, blk->data->data ? blk->data->data : "", blk->data->offset);
   }
 }
 void InvertedIndex_Digest(RedisModuleDigest *digest, void *value) {
 }
 
+/* Queries may still be reading an index whose key was deleted, so it is retired rather than freed */
+static void InvertedIndex_RetireFree(void *value) {
+  Epoch_Retire(value, InvertedIndex_Free);
+}
+
 unsigned long InvertedIndex_MemUsage(const void *value) {
   const InvertedIndex *idx = value;
   unsigned long ret = sizeof(InvertedIndex);
@@ -70,6 +83,7 @@ unsigned long InvertedIndex_MemUsage(const void *value) {
     ret += sizeof(IndexBlock);
     ret += sizeof(Buffer);
     ret += Buffer_Offset(idx->blocks[i].data);
+    ret += idx->blocks[i].numSkips * sizeof(IndexBlockSkip);
   }
   return ret;
 }
@@ -80,7 +94,7 @@ int InvertedIndex_RegisterType(RedisModuleCtx *ctx) {
                                .rdb_save = InvertedIndex_RdbSave,
                                .aof_rewrite = GenericAofRewrite_DisabledHandler,
                                .mem_usage = InvertedIndex_MemUsage,
-                               .free = InvertedIndex_Free};
+                               .free = InvertedIndex_RetireFree};
 
   InvertedIndexType = RedisModule_CreateDataType(ctx, "ft_invidx", INVERTED_INDEX_ENCVER, &tm);
   if (InvertedIndexType == NULL) {
@@ -269,7 +283,10 @@ InvertedIndex *Redis_OpenInvertedIndexEx(RedisSearchCtx *ctx, const char *term,
 
   if (kType == REDISMODULE_KEYTYPE_EMPTY) {
     if (write) {
-      idx = NewInvertedIndex(ctx->spec->flags, 1);
+      // docId-only indexes pack their full blocks
+      IndexFlags flags = ctx->spec->flags;
+      if (!(flags & INDEX_STORAGE_MASK)) flags |= Index_PackedDocIds;
+      idx = NewInvertedIndex(flags, 1);
       RedisModule_ModuleTypeSetValue(k, InvertedIndexType, idx);
     }
   } else if (kType == REDISMODULE_KEYTYPE_MODULE &&
@@ -287,6 +304,28 @@ InvertedIndex *Redis_OpenInvertedIndexEx(RedisSearchCtx *ctx, const char *term,
   }
 }
 
+int Redis_DeleteEmptyTerm(RedisSearchCtx *ctx, const char *term, size_t len) {
+  RedisModuleString *termKey = fmtRedisTermKey(ctx, term, len);
+  RedisModuleKey *k = RedisModule_OpenKey(ctx->redisCtx, termKey, REDISMODULE_WRITE);
+  RedisModule_FreeString(ctx->redisCtx, termKey);
+  if (k == NULL) {
+    return 0;
+  }
+
+  int deleted = 0;
+  if (RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_MODULE &&
+      RedisModule_ModuleTypeGetType(k) == InvertedIndexType &&
+      InvertedIndex_IsEmpty(RedisModule_ModuleTypeGetValue(k))) {
+    // queries reading the index still see it until they leave the epoch, see
+    // InvertedIndex_RetireFree. Those that sleep will find the key gone when they resume
+    RedisModule_DeleteKey(k);
+    IndexSpec_DeleteTerm(ctx->spec, term, len);
+    deleted = 1;
+  }
+  RedisModule_CloseKey(k);
+  return deleted;
+}
+
 IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSQueryTerm *term, DocTable *dt,
                               int singleWordMode, t_fieldMask fieldMask, ConcurrentSearchCtx *csx,
                               double weight) {
@@ -305,12 +344,20 @@ IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSQueryTerm *term, DocTable *
 
   IndexReader *ret = NewTermIndexReader(idx, dt, fieldMask, term, weight);
   if (csx) {
+    // the reader is kept alive by the query's epoch pin, so the key is only checked on resume
     ConcurrentSearch_AddKey(csx, k, REDISMODULE_READ, termKey, IndexReader_OnReopen, ret, NULL,
-                            ConcurrentKey_SharedNothing);
+                            ConcurrentKey_ResumeOnly);
   }
   return ret;
 }
 
+void Redis_RegisterReader(RedisSearchCtx *ctx, IndexReader *ir, ConcurrentSearchCtx *csx) {
+  RSQueryTerm *term = ir->record->term.term;
+  RedisModuleString *termKey = fmtRedisTermKey(ctx, term->str, term->len);
+  ConcurrentSearch_AddKey(csx, NULL, REDISMODULE_READ, termKey, IndexReader_OnReopen, ir, NULL,
+                          ConcurrentKey_ResumeOnly);
+}
+
 int Redis_LoadDocument(RedisSearchCtx *ctx, RedisModuleString *key, Document *doc) {
   doc->numFields = 0;
   doc->fields = NULL;
@@ -469,7 +516,7 @@ int Redis_DropIndex(RedisSearchCtx *ctx, int deleteDocuments) {
   const char *prefix = RedisModule_StringPtrLen(pf, NULL);
   Redis_ScanKeys(ctx->redisCtx, prefix, Redis_DropScanHandler, ctx);
 
-  // Do the same with geo keys
+  // Do the same with the geo keys of older versions
   pf = RedisModule_CreateStringPrintf(ctx->redisCtx, GEOINDEX_KEY_FMT, ctx->spec->name, "*");
   prefix = RedisModule_StringPtrLen(pf, NULL);
   Redis_ScanKeys(ctx->redisCtx, prefix, Redis_DropScanHandler, ctx);
@@ -477,7 +524,7 @@ int Redis_DropIndex(RedisSearchCtx *ctx, int deleteDocuments) {
   // Delete the numeric and tag indexes which reside on separate keys
   for (size_t i = 0; i < ctx->spec->numFields; i++) {
     const FieldSpec *spec = ctx->spec->fields + i;
-    if (spec->type == FIELD_NUMERIC) {
+    if (FieldSpec_HasNumericIndex(spec)) {
       Redis_DeleteKey(ctx->redisCtx, fmtRedisNumericIndexKey(ctx, spec->name));
     } else if (spec->type == FIELD_TAG) {
       Redis_DeleteKey(ctx->redisCtx, TagIndex_FormatName(ctx, spec->name));
@@ -15,12 +15,20 @@ IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSQueryTerm *term, DocTable *
                               int singleWordMode, t_fieldMask fieldMask, ConcurrentSearchCtx *csx,
                               double weight);
 
+/* Register a reader opened by Redis_OpenReader without a concurrent context, so that its term key
+ * is checked when the query resumes, as if it had been opened with csx */
+void Redis_RegisterReader(RedisSearchCtx *ctx, IndexReader *ir, ConcurrentSearchCtx *csx);
+
 InvertedIndex *Redis_OpenInvertedIndexEx(RedisSearchCtx *ctx, const char *term, size_t len,
                                          int write, RedisModuleKey **keyp);
 #define Redis_OpenInvertedIndex(ctx, term, len, isWrite) \
   Redis_OpenInvertedIndexEx(ctx, term, len, isWrite, NULL)
 void Redis_CloseReader(IndexReader *r);
 
+/* Delete the inverted index of a term if the GC left no records in it, and remove the term from the
+ * spec. The term's index key must not be open. Returns 1 if the term was deleted */
+int Redis_DeleteEmptyTerm(RedisSearchCtx *ctx, const char *term, size_t len);
+
 /*
  * Select a random term from the index that matches the index prefix and inveted key format.
  * It tries RANDOMKEY 10 times and returns NULL if it can't find anything.
@@ -32,8 +40,11 @@ const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen);
 #define SKIPINDEX_KEY_FORMAT "si:%s/%.*s"
 #define SCOREINDEX_KEY_FORMAT "ss:%s/%.*s"
 
-#define INVERTED_INDEX_ENCVER 1
+#define INVERTED_INDEX_ENCVER 2
 #define INVERTED_INDEX_NOFREQFLAG_VER 0
+// Versions below this don't know bit-packed blocks. Indexes with Index_PackedDocIds save whether
+// each of their blocks is packed
+#define INVERTED_INDEX_MIN_PACKED_VER 2
 
 typedef int (*ScanFunc)(RedisModuleCtx *ctx, RedisModuleString *keyName, void *opaque);
 
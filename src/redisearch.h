@@ -78,9 +78,6 @@ typedef struct RSDocumentMetadata_s {
   struct RSByteOffsets *byteOffsets;
 
   uint32_t ref_count;
-
-  struct RSDocumentMetadata_s *next;
-  struct RSDocumentMetadata_s *prev;
 } RSDocumentMetadata;
 
 /* Forward declaration of the opaque query object */
@@ -5,6 +5,12 @@
 #include "ext/default.h"
 #include "query_plan.h"
 #include "highlight.h"
+#include "config.h"
+#include "numeric_index.h"
+#include "result_spill.h"
+#include "util/arr.h"
+#include <pthread.h>
+#include <time.h>
 
 /*******************************************************************************************************************
  *  General Result Processor Helper functions
@@ -83,6 +89,66 @@ void ResultProcessor_GenericFree(ResultProcessor *rp) {
   free(rp);
 }
 
+SearchResultBatch *NewSearchResultBatch() {
+  SearchResultBatch *b = calloc(1, sizeof(*b));
+  b->cap = RP_BATCH_SIZE;
+  return b;
+}
+
+void SearchResultBatch_Free(SearchResultBatch *b) {
+  if (!b) return;
+  for (size_t i = 0; i < RP_BATCH_SIZE; i++) {
+    SearchResult_FreeInternal(&b->rows[i]);
+  }
+  free(b);
+}
+
+/* Release the values of the rows of the last batch, keeping their field maps for the next one. A
+ * row filled by a failed read right past the end may have values as well */
+static void searchResultBatch_Reset(SearchResultBatch *b) {
+  size_t n = MIN(b->len + 1, RP_BATCH_SIZE);
+  for (size_t i = 0; i < n; i++) {
+    RSFieldMap *fields = b->rows[i].fields;
+    RSFieldMap_Reset(fields);
+    b->rows[i] = SEARCH_RESULT_INIT;
+    b->rows[i].fields = fields;
+  }
+  b->len = 0;
+}
+
+/* Fill a batch from a processor that only implements Next */
+static int resultProcessor_FillBatch(ResultProcessor *rp, SearchResultBatch *b) {
+  QueryProcessingCtx *qxc = rp->ctx.qxc;
+  if (qxc) qxc->inBatch++;
+  while (b->len < b->cap) {
+    SearchResult *r = &b->rows[b->len];
+    if (ResultProcessor_Next(rp, r, 1) == RS_RESULT_EOF) break;
+    b->len++;
+    if (b->keepIndexResults && r->indexResult) break;
+  }
+  if (qxc) qxc->inBatch--;
+  return b->len ? RS_RESULT_OK : RS_RESULT_EOF;
+}
+
+int ResultProcessor_NextBatch(ResultProcessor *rp, SearchResultBatch *b, int allowSwitching) {
+  QueryProcessingCtx *qxc = rp->ctx.qxc;
+  ConcurrentSearchCtx *cxc = qxc ? qxc->conc : NULL;
+  int rc;
+
+  do {
+    searchResultBatch_Reset(b);
+    // a batch is long enough to be worth a look at the clock every time
+    if (allowSwitching && cxc && !qxc->inBatch) {
+      ConcurrentSearch_CheckTimer(cxc);
+      if (qxc->state == QPState_Aborted) {
+        return RS_RESULT_EOF;
+      }
+    }
+    rc = rp->NextBatch ? rp->NextBatch(&rp->ctx, b) : resultProcessor_FillBatch(rp, b);
+  } while (rc == RS_RESULT_QUEUED);
+  return rc;
+}
+
 /*******************************************************************************************************************
  *  Base Result Processor - this processor is the topmost processor of every processing chain.
  *
@@ -149,11 +215,22 @@ int baseResultProcessor_Next(ResultProcessorCtx *ctx, SearchResult *res) {
   return RS_RESULT_OK;
 }
 
+/* NextBatch implementation - reads the root filter straight into the rows of the batch. All of our
+ * rows have index results, so if the batch keeps them we can only put one in it */
+static int baseResultProcessor_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  size_t cap = b->keepIndexResults ? 1 : b->cap;
+  while (b->len < cap && baseResultProcessor_Next(ctx, &b->rows[b->len]) == RS_RESULT_OK) {
+    b->len++;
+  }
+  return b->len ? RS_RESULT_OK : RS_RESULT_EOF;
+}
+
 /* Createa a new base processor */
 ResultProcessor *NewBaseProcessor(QueryPlan *q, QueryProcessingCtx *xc) {
   ResultProcessor *rp = NewResultProcessor(NULL, q);
   rp->ctx.qxc = xc;
   rp->Next = baseResultProcessor_Next;
+  rp->NextBatch = baseResultProcessor_NextBatch;
   return rp;
 }
 
@@ -172,28 +249,38 @@ struct scorerCtx {
   RSScoringFunctionCtx scorerCtx;
 };
 
-int scorerProcessor_Next(ResultProcessorCtx *ctx, SearchResult *res) {
-  struct scorerCtx *sc = ctx->privdata;
-  int rc;
-
-  do {
+/* Apply the scoring function to a result while its index result is still valid */
+static inline void scorer_Score(struct scorerCtx *sc, QueryProcessingCtx *qxc, SearchResult *res) {
+  res->score = sc->scorer(&sc->scorerCtx, res->indexResult, res->scorerPrivateData, qxc->minScore);
 
-    if (RS_RESULT_EOF == (rc = ResultProcessor_Next(ctx->upstream, res, 0))) return rc;
-
-    // Apply the scoring function
-    res->score =
-        sc->scorer(&sc->scorerCtx, res->indexResult, res->scorerPrivateData, ctx->qxc->minScore);
-
-    // If we got the special score RS_SCORE_FILTEROUT - disregard the result and decrease the total
-    // number of results (it's been increased by the upstream processor)
-    if (res->score == RS_SCORE_FILTEROUT) ctx->qxc->totalResults--;
+  // If we got the special score RS_SCORE_FILTEROUT - disregard the result and decrease the total
+  // number of results (it's been increased by the upstream processor)
+  if (res->score == RS_SCORE_FILTEROUT) qxc->totalResults--;
+}
 
-    break;
-  } while (1);
+int scorerProcessor_Next(ResultProcessorCtx *ctx, SearchResult *res) {
+  int rc;
+  if (RS_RESULT_EOF == (rc = ResultProcessor_Next(ctx->upstream, res, 0))) return rc;
 
+  scorer_Score(ctx->privdata, ctx->qxc, res);
   return rc;
 }
 
+/* NextBatch implementation. The scores are computed from the index results, which are only valid
+ * until the next one is read, so we can't take a whole batch from upstream and score it. Instead
+ * we read the upstream rows straight into the batch and score each one as it arrives - the timer
+ * is checked once for the batch, not on every row */
+static int scorerProcessor_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  while (b->len < b->cap) {
+    SearchResult *res = &b->rows[b->len];
+    if (ResultProcessor_Next(ctx->upstream, res, 0) == RS_RESULT_EOF) break;
+    scorer_Score(ctx->privdata, ctx->qxc, res);
+    b->len++;
+    if (b->keepIndexResults) break;
+  }
+  return b->len ? RS_RESULT_OK : RS_RESULT_EOF;
+}
+
 /* Free impl. for scorer - frees up the scorer privdata if needed */
 static void scorer_Free(ResultProcessor *rp) {
   struct scorerCtx *sc = rp->ctx.privdata;
@@ -203,10 +290,10 @@ static void scorer_Free(ResultProcessor *rp) {
   ResultProcessor_GenericFree(rp);
 }
 
-/* Create a new scorer by name. If the name is not found in the scorer registry, we use the defalt
- * scorer */
-ResultProcessor *NewScorer(const char *scorer, ResultProcessor *upstream, RSSearchRequest *req) {
-  struct scorerCtx *sc = malloc(sizeof(*sc));
+/* Set up the scoring function by name. If the name is not found in the scorer registry, we use the
+ * defalt scorer */
+static void scorerCtx_Init(struct scorerCtx *sc, const char *scorer, QueryProcessingCtx *qxc,
+                           RSSearchRequest *req) {
   ExtScoringFunctionCtx *scx =
       Extensions_GetScoringFunction(&sc->scorerCtx, scorer ? scorer : DEFAULT_SCORER_NAME);
   if (!scx) {
@@ -217,10 +304,18 @@ ResultProcessor *NewScorer(const char *scorer, ResultProcessor *upstream, RSSear
   sc->scorerFree = scx->ff;
   sc->scorerCtx.payload = req->payload;
   // Initialize scorer stats
-  IndexSpec_GetStats(upstream->ctx.qxc->sctx->spec, &sc->scorerCtx.indexStats);
+  IndexSpec_GetStats(qxc->sctx->spec, &sc->scorerCtx.indexStats);
+}
+
+/* Create a new scorer by name. If the name is not found in the scorer registry, we use the defalt
+ * scorer */
+ResultProcessor *NewScorer(const char *scorer, ResultProcessor *upstream, RSSearchRequest *req) {
+  struct scorerCtx *sc = malloc(sizeof(*sc));
+  scorerCtx_Init(sc, scorer, upstream->ctx.qxc, req);
 
   ResultProcessor *rp = NewResultProcessor(upstream, sc);
   rp->Next = scorerProcessor_Next;
+  rp->NextBatch = scorerProcessor_NextBatch;
   rp->Free = scorer_Free;
   return rp;
 }
@@ -245,6 +340,10 @@ ResultProcessor *NewScorer(const char *scorer, ResultProcessor *upstream, RSSear
  * Note: We use a min-max heap to simplify maintaining a max heap where we can pop from the bottom
  * while
  * finding the top N results
+ *
+ * A growing heap of an aggregation (SORTBY without MAX) is limited by the aggregation memory budget.
+ * Once the heap takes more than the budget, it is written to a temporary file as a sorted run and
+ * emptied. When the upstream is done, the runs are merged along with what is left in the heap.
  ********************************************************************************************************************/
 
 typedef enum {
@@ -252,6 +351,16 @@ typedef enum {
   Sort_BySortKey,
   Sort_ByFields,
 } SortMode;
+// The number of sorted runs of the same size we merge into a larger one
+#define SORTER_MERGE_FANIN 16
+
+/* A sorted run spilled by the sorter. Runs of level n are merged from SORTER_MERGE_FANIN runs of
+ * level n-1, and runs of level 0 are written from the heap */
+typedef struct {
+  FILE *fp;
+  int level;
+} sorterRun;
+
 /* Sorter's private context */
 struct sorterCtx {
 
@@ -273,11 +382,26 @@ struct sorterCtx {
   // pooled result - we recycle it to avoid allocations
   SearchResult *pooledResult;
 
+  // the batch we read from upstream into, when we are read in batches
+  SearchResultBatch *upstreamBatch;
+
+  // The memory budget of a growing heap, 0 if it is unlimited, and an estimate of what the heap
+  // takes now
+  size_t memBudget;
+  size_t memUsed;
+  // The sorted runs spilled so far, by descending level, and their merge once we are done
+  // accumulating
+  sorterRun *runs;
+  SpillMerger *merger;
+
   // accumulation state - while this is true, any call to next() will yield QUEUED
   int accumulating;
 
   int saveIndexResults;
 
+  // accumulate with the lock released, see sorter_AccumulateUnlocked
+  int unlocked;
+
   SortMode sortMode;
 };
 
@@ -289,12 +413,23 @@ struct fieldCmpCtx {
   uint64_t ascendMap;
 };
 
-/* Yield - pops the current top result from the heap */
+/* Yield - pops the current top result from the heap, or from the spilled runs if their top is
+ * greater */
 int sorter_Yield(struct sorterCtx *sc, SearchResult *r) {
+  if (sc->merger) {
+    const SearchResult *top = SpillMerger_Peek(sc->merger);
+    if (top && (!sc->pq->count || sc->cmp(top, mmh_peek_max(sc->pq), sc->cmpCtx) > 0)) {
+      SpillMerger_Next(sc->merger, r);
+      DMD_Decref(r->scorerPrivateData);
+      return RS_RESULT_OK;
+    }
+  }
 
   // make sure we don't overshoot the heap size, unless the heap size is dynamic
   if (sc->pq->count > 0 && (!sc->size || sc->offset++ < sc->size)) {
     SearchResult *sr = mmh_pop_max(sc->pq);
+    // the result may be a batch row with a field map of its own
+    RSFieldMap_Free(r->fields);
     *r = *sr;
     DMD_Decref(r->scorerPrivateData);
     free(sr);
@@ -303,11 +438,23 @@ int sorter_Yield(struct sorterCtx *sc, SearchResult *r) {
   return RS_RESULT_EOF;
 }
 
+/* Merge the last n runs. The merger takes their files */
+static SpillMerger *sorter_NewMerger(struct sorterCtx *sc, size_t n) {
+  size_t first = array_len(sc->runs) - n;
+  FILE *files[n ? n : 1];
+  for (size_t i = 0; i < n; i++) {
+    files[i] = sc->runs[first + i].fp;
+  }
+  sc->runs = array_trimm_len(sc->runs, first);
+  return NewSpillMerger(files, n, sc->cmp, sc->cmpCtx);
+}
+
 void sorter_Free(ResultProcessor *rp) {
   struct sorterCtx *sc = rp->ctx.privdata;
   if (sc->pooledResult) {
     SearchResult_Free(sc->pooledResult);
   }
+  SearchResultBatch_Free(sc->upstreamBatch);
   if (sc->cmpCtx) {
     if (sc->sortMode == Sort_ByFields) {
       struct fieldCmpCtx *fcc = sc->cmpCtx;
@@ -316,6 +463,15 @@ void sorter_Free(ResultProcessor *rp) {
     }
   }
 
+  if (sc->merger) {
+    SpillMerger_Free(sc->merger);
+  }
+  if (sc->runs) {
+    // we stopped before merging, the merger would have taken the files
+    SpillMerger_Free(sorter_NewMerger(sc, array_len(sc->runs)));
+    array_free(sc->runs);
+  }
+
   // calling mmh_free will free all the remaining results in the heap, if any
   mmh_free(sc->pq);
   free(sc);
@@ -333,8 +489,162 @@ static void keepResult(struct sorterCtx *sctx, SearchResult *r) {
   }
 }
 
+/* Write the heap to a new sorted run, and empty it. Runs are merged as soon as there are
+ * SORTER_MERGE_FANIN of the same level, so a result is written once per level, and the final merge
+ * reads from a few files per level */
+static void sorter_SpillRun(struct sorterCtx *sc) {
+  if (!sc->runs) {
+    sc->runs = array_new(sorterRun, SORTER_MERGE_FANIN);
+  }
+
+  FILE *fp = Spill_NewFile();
+  if (!fp) goto fail;
+  while (sc->pq->count) {
+    SearchResult *h = mmh_pop_max(sc->pq);
+    if (Spill_WriteResult(fp, h) != REDISMODULE_OK) {
+      // keep what we could not write in memory
+      mmh_insert(sc->pq, h);
+      sc->runs = array_append(sc->runs, ((sorterRun){fp, 0}));
+      goto fail;
+    }
+    // the run holds the result's document reference now
+    h->scorerPrivateData = NULL;
+    SearchResult_Free(h);
+  }
+  sc->runs = array_append(sc->runs, ((sorterRun){fp, 0}));
+  sc->memUsed = 0;
+
+  size_t n;
+  while ((n = array_len(sc->runs)) >= SORTER_MERGE_FANIN &&
+         sc->runs[n - SORTER_MERGE_FANIN].level == sc->runs[n - 1].level) {
+    int level = sc->runs[n - 1].level + 1;
+    if (!(fp = Spill_NewFile())) goto fail;
+
+    SpillMerger *m = sorter_NewMerger(sc, SORTER_MERGE_FANIN);
+    SearchResult res = {.fields = NULL};
+    int ok = 1;
+    while (ok && SpillMerger_Next(m, &res) == RS_RESULT_OK) {
+      ok = Spill_WriteResult(fp, &res) == REDISMODULE_OK;
+    }
+    // what we merged so far is a run of its own
+    sc->runs = array_append(sc->runs, ((sorterRun){fp, level}));
+    if (!ok) {
+      // and the rest of the merge, starting with the result we failed to write, goes back to the
+      // heap
+      do {
+        SearchResult *h = malloc(sizeof(*h));
+        *h = res;
+        res.fields = NULL;
+        mmh_insert(sc->pq, h);
+      } while (SpillMerger_Next(m, &res) == RS_RESULT_OK);
+    }
+    RSFieldMap_Free(res.fields);
+    SpillMerger_Free(m);
+    if (!ok) goto fail;
+  }
+  return;
+
+fail:
+  // we can't spill, so just keep growing the heap
+  sc->memBudget = 0;
+}
+
+/* Push a result into the heap if it makes the top N. The result is moved into a heap entry, and
+ * gets the field map of the entry it evicted, if any, so the caller can read into it again. Its
+ * index result is not kept, since it is only valid until the next read */
+static void sorter_Accumulate(struct sorterCtx *sc, QueryProcessingCtx *qxc, SearchResult *r) {
+  SearchResult *h;
+  r->indexResult = NULL;
+
+  // If the queue is not full - we just push the result into it
+  // If the pool size is 0 we always do that, letting the heap grow dynamically
+  if (!sc->size || sc->pq->count + 1 < sc->pq->size) {
+    h = malloc(sizeof(*h));
+    *h = *r;
+    r->fields = NULL;
+    if (h->score < qxc->minScore) {
+      qxc->minScore = h->score;
+    }
+
+  } else {
+    // find the min result
+    SearchResult *minh = mmh_peek_min(sc->pq);
+
+    // update the min score. Irrelevant to SORTBY mode but hardly costs anything...
+    if (minh->score > qxc->minScore) {
+      qxc->minScore = minh->score;
+    }
+
+    // The current should not enter the pool, so just leave it as is
+    if (sc->cmp(r, minh, sc->cmpCtx) <= 0) {
+      return;
+    }
+
+    // pop the min result, and reuse its entry for the new one
+    h = mmh_pop_min(sc->pq);
+    DMD_Decref(h->scorerPrivateData);
+    RSFieldMap *fields = h->fields;
+    RSFieldMap_Reset(fields);
+    *h = *r;
+    r->fields = fields;
+  }
+
+  keepResult(sc, h);
+  mmh_insert(sc->pq, h);
+
+  if (sc->memBudget) {
+    sc->memUsed += Spill_ResultSize(h);
+    if (sc->memUsed > sc->memBudget) {
+      sorter_SpillRun(sc);
+    }
+  }
+}
+
+/* Stop accumulating once our upstream has finished. If we have spilled runs, we start merging
+ * them, along with what is left in the heap */
+static void sorter_EndAccumulation(struct sorterCtx *sc) {
+  sc->accumulating = 0;
+  if (!sc->runs) return;
+  sc->merger = sorter_NewMerger(sc, array_len(sc->runs));
+  array_free(sc->runs);
+  sc->runs = NULL;
+}
+
+/* Accumulate all of our upstream with the lock released. Everything upstream of us only reads the
+ * index, the document table and the sorting vectors, which writers change by copy and retire while
+ * our epoch is pinned (see epoch.h) - so the scan runs in parallel with indexing and with other
+ * queries. The lock is not switched while released, and switching is where the query timeout is
+ * checked, so we check it once per batch instead */
+static int sorter_AccumulateUnlocked(ResultProcessorCtx *ctx) {
+  struct sorterCtx *sc = ctx->privdata;
+  QueryProcessingCtx *qxc = ctx->qxc;
+  if (!sc->upstreamBatch) {
+    sc->upstreamBatch = NewSearchResultBatch();
+  }
+  SearchResultBatch *up = sc->upstreamBatch;
+  up->cap = RP_BATCH_SIZE;
+
+  ConcurrentSearchCtx_Release(qxc->conc);
+  while (ResultProcessor_NextBatch(ctx->upstream, up, 1) == RS_RESULT_OK) {
+    for (size_t i = 0; i < up->len; i++) {
+      sorter_Accumulate(sc, qxc, &up->rows[i]);
+    }
+    if (QueryProcessingCtx_TimeoutExpired(qxc)) {
+      qxc->state = QPState_TimedOut;
+      break;
+    }
+  }
+  // reopening the spec key aborts the query if the index was dropped meanwhile
+  ConcurrentSearchCtx_Reacquire(qxc->conc);
+  sorter_EndAccumulation(sc);
+  return qxc->state == QPState_Aborted ? RS_RESULT_EOF : RS_RESULT_OK;
+}
+
 int sorter_Next(ResultProcessorCtx *ctx, SearchResult *r) {
   struct sorterCtx *sc = ctx->privdata;
+  if (sc->accumulating && sc->unlocked && sorter_AccumulateUnlocked(ctx) == RS_RESULT_EOF) {
+    return RS_RESULT_EOF;
+  }
   // if we're not accumulating anymore - yield the top result
   if (!sc->accumulating) {
     return sorter_Yield(sc, r);
@@ -342,60 +652,48 @@ int sorter_Next(ResultProcessorCtx *ctx, SearchResult *r) {
 
   if (sc->pooledResult == NULL) {
     sc->pooledResult = NewSearchResult();
-  } else if (sc->pooledResult->fields) {
-    sc->pooledResult->fields->len = 0;
+  } else {
+    RSFieldMap_Reset(sc->pooledResult->fields);
   }
   SearchResult *h = sc->pooledResult;
 
   int rc = ResultProcessor_Next(ctx->upstream, h, 0);
   // if our upstream has finished - just change the state to not accumulating, and yield
   if (rc == RS_RESULT_EOF) {
-    sc->accumulating = 0;
+    sorter_EndAccumulation(sc);
     return sorter_Yield(sc, r);
   }
 
-  // If the queue is not full - we just push the result into it
-  // If the pool size is 0 we always do that, letting the heap grow dynamically
-  if (!sc->size || sc->pq->count + 1 < sc->pq->size) {
-
-    // copy the index result to make it thread safe - but only if it is pushed to the heap
-    h->indexResult = NULL;
-
-    keepResult(sc, h);
-    mmh_insert(sc->pq, h);
-    sc->pooledResult = NULL;
-    if (h->score < ctx->qxc->minScore) {
-      ctx->qxc->minScore = h->score;
-    }
+  sorter_Accumulate(sc, ctx->qxc, h);
+  return RS_RESULT_QUEUED;
+}
 
-  } else {
-    // find the min result
-    SearchResult *minh = mmh_peek_min(sc->pq);
+/* NextBatch implementation - accumulates whole batches from upstream, then yields the heap */
+static int sorter_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  struct sorterCtx *sc = ctx->privdata;
 
-    // update the min score. Irrelevant to SORTBY mode but hardly costs anything...
-    if (minh->score > ctx->qxc->minScore) {
-      ctx->qxc->minScore = minh->score;
+  if (sc->accumulating && sc->unlocked && sorter_AccumulateUnlocked(ctx) == RS_RESULT_EOF) {
+    return RS_RESULT_EOF;
+  }
+  if (sc->accumulating) {
+    if (!sc->upstreamBatch) {
+      sc->upstreamBatch = NewSearchResultBatch();
     }
-
-    // if needed - pop it and insert a new result
-    if (sc->cmp(h, minh, sc->cmpCtx) > 0) {
-      // copy the index result to make it thread safe - but only if it is pushed to the heap
-      h->indexResult = NULL;
-      sc->pooledResult = mmh_pop_min(sc->pq);
-      SearchResult_FreeInternal(sc->pooledResult);
-
-      keepResult(sc, h);
-      mmh_insert(sc->pq, h);
-    } else {
-      // The current should not enter the pool, so just leave it as is
-      h->indexResult = NULL;
-      sc->pooledResult = h;
-      // make sure we will not try to free the index result of the pooled result at the end
-      SearchResult_FreeInternal(sc->pooledResult);
+    SearchResultBatch *up = sc->upstreamBatch;
+    up->cap = RP_BATCH_SIZE;
+    if (ResultProcessor_NextBatch(ctx->upstream, up, 1) == RS_RESULT_OK) {
+      for (size_t i = 0; i < up->len; i++) {
+        sorter_Accumulate(sc, ctx->qxc, &up->rows[i]);
+      }
+      return RS_RESULT_QUEUED;
     }
+    sorter_EndAccumulation(sc);
   }
 
-  return RS_RESULT_QUEUED;
+  while (b->len < b->cap && sorter_Yield(sc, &b->rows[b->len]) == RS_RESULT_OK) {
+    b->len++;
+  }
+  return b->len ? RS_RESULT_OK : RS_RESULT_EOF;
 }
 
 /* Compare results for the heap by score */
@@ -466,12 +764,19 @@ ResultProcessor *NewSorter(SortMode sortMode, void *sortCtx, uint32_t size,
   sc->size = size;
   sc->offset = 0;
   sc->pooledResult = NULL;
+  sc->upstreamBatch = NULL;
+  sc->memBudget = 0;
+  sc->memUsed = 0;
+  sc->runs = NULL;
+  sc->merger = NULL;
   sc->accumulating = 1;
   sc->saveIndexResults = copyIndexResults;
+  sc->unlocked = 0;
   sc->sortMode = sortMode;
 
   ResultProcessor *rp = NewResultProcessor(upstream, sc);
   rp->Next = sorter_Next;
+  rp->NextBatch = sorter_NextBatch;
   rp->Free = sorter_Free;
   return rp;
 }
@@ -482,7 +787,410 @@ ResultProcessor *NewSorterByFields(RSMultiKey *mk, uint64_t ascendingMap, uint32
   c->ascendMap = ascendingMap;
   c->keys = mk;
 
-  return NewSorter(Sort_ByFields, c, size, upstream, 0);
+  ResultProcessor *rp = NewSorter(Sort_ByFields, c, size, upstream, 0);
+  // only a growing heap needs a budget, the top N results are bounded by N
+  if (!size) {
+    struct sorterCtx *sc = rp->ctx.privdata;
+    sc->memBudget = RSGlobalConfig.aggregateMemoryBudget;
+  }
+  return rp;
+}
+
+/*******************************************************************************************************************
+ *  Parallel Scan Processor
+ *
+ * For queries that match many documents, this processor replaces the base processor and the
+ * scorer. The query plan holds a copy of the root filter per range of document ids (see
+ * QueryPlan.partitions), and each range is read, scored and reduced to its own top N results on a
+ * thread of its own. The candidates of all the ranges are then passed down to the sorter, which
+ * merges them into the final top N.
+ *
+ * The workers only read the index, the document table and the sorting vectors. A concurrent search
+ * is scanned with the lock released (see sorter_AccumulateUnlocked), and the writers publish their
+ * changes through the query's epoch pin. Otherwise the scanning thread holds the lock for them, and
+ * when it has held it for long enough, it asks the workers to pause between two reads, releases the
+ * lock and takes it again, and lets them go on.
+ ********************************************************************************************************************/
+
+// How many results a worker reads between checks of the query timeout
+#define PARALLEL_TIMEOUT_CHECK_INTERVAL 1000
+
+struct parallelScanCtx;
+
+/* A single range of document ids and the top N results found in it */
+struct parallelPartition {
+  struct parallelScanCtx *ps;
+  IndexIterator *it;
+  // the range of document ids scanned by this partition: [start, end)
+  t_docId start, end;
+  heap_t *pq;
+  SearchResult *pooledResult;
+  // the lowest score in the partition's heap, once it is full
+  double minScore;
+  size_t totalResults;
+  RSScoringFunctionCtx scorerCtx;
+  pthread_t thread;
+  int threaded;
+};
+
+struct parallelScanCtx {
+  QueryPlan *q;
+  struct parallelPartition *parts;
+  int numParts;
+
+  // NULL in SORTBY mode
+  struct scorerCtx *sc;
+  int (*cmp)(const void *e1, const void *e2, const void *udata);
+  void *cmpCtx;
+  // the size of the heaps - top N results. 0 means a growing heap
+  uint32_t size;
+
+  // set by the first worker to see the timeout expire, and read by all of them without the lock
+  int timedOut;
+
+  // The workers pause between reads when the scanning thread wants to release the lock. It waits
+  // until all the running workers are paused, and bumps resumes to let them go on. pauseRequested is
+  // only written under the lock, but the workers poll it without the lock between reads
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int pauseRequested;
+  int numThreads;
+  int numPaused;
+  int numDone;
+  uint32_t resumes;
+
+  // whether the scan is over and we are passing its results down
+  int scanned;
+  // the partition whose results we are currently passing down
+  int cur;
+  // the document of the last result we passed down. We release it on the next call, after the
+  // sorter has taken its own reference if it needed it
+  RSDocumentMetadata *yielded;
+};
+
+/* Free a result held in a partition heap, along with its document reference */
+static void parallelScan_FreeResult(void *p) {
+  SearchResult *r = p;
+  // mmh_free passes the heap's unused first slot as well
+  if (!r) return;
+  DMD_Decref(r->scorerPrivateData);
+  free(r);
+}
+
+static int parallelScan_TimedOut(struct parallelScanCtx *ps) {
+  if (!__atomic_load_n(&ps->timedOut, __ATOMIC_RELAXED) &&
+      QueryProcessingCtx_TimeoutExpired(&ps->q->execCtx)) {
+    __atomic_store_n(&ps->timedOut, 1, __ATOMIC_RELAXED);
+  }
+  return __atomic_load_n(&ps->timedOut, __ATOMIC_RELAXED);
+}
+
+/* Release the lock and take it again, once all the workers are paused. Called by the scanning
+ * thread */
+static void parallelScan_Switch(struct parallelScanCtx *ps) {
+  pthread_mutex_lock(&ps->lock);
+  __atomic_store_n(&ps->pauseRequested, 1, __ATOMIC_RELAXED);
+  while (ps->numPaused + ps->numDone < ps->numThreads) {
+    pthread_cond_wait(&ps->cond, &ps->lock);
+  }
+  pthread_mutex_unlock(&ps->lock);
+
+  ConcurrentSearch_Switch(ps->q->conc);
+
+  pthread_mutex_lock(&ps->lock);
+  __atomic_store_n(&ps->pauseRequested, 0, __ATOMIC_RELAXED);
+  ps->numPaused = 0;
+  ps->resumes++;
+  pthread_cond_broadcast(&ps->cond);
+  pthread_mutex_unlock(&ps->lock);
+}
+
+/* Wait while the scanning thread has released the lock. Called by the workers */
+static void parallelScan_Pause(struct parallelScanCtx *ps) {
+  pthread_mutex_lock(&ps->lock);
+  if (ps->pauseRequested) {
+    uint32_t resumes = ps->resumes;
+    ps->numPaused++;
+    pthread_cond_broadcast(&ps->cond);
+    while (ps->resumes == resumes) {
+      pthread_cond_wait(&ps->cond, &ps->lock);
+    }
+  }
+  pthread_mutex_unlock(&ps->lock);
+}
+
+/* Read the next result of a partition. Between two reads - when no result is held - the scanning
+ * thread may release the lock, and the workers pause for it */
+static int parallelScan_Read(struct parallelPartition *p, RSIndexResult **r) {
+  struct parallelScanCtx *ps = p->ps;
+  ConcurrentSearchCtx *conc = ps->q->conc;
+  if (conc) {
+    if (!p->threaded) {
+      if (++conc->ticker % CONCURRENT_TICK_CHECK == 0 && ConcurrentSearch_TimerExpired(conc)) {
+        parallelScan_Switch(ps);
+      }
+    } else if (__atomic_load_n(&ps->pauseRequested, __ATOMIC_RELAXED)) {
+      parallelScan_Pause(ps);
+    }
+    // the index was dropped while the lock was released
+    if (ps->q->execCtx.state == QPState_Aborted) {
+      return INDEXREAD_EOF;
+    }
+  }
+  return p->it->Read(p->it->ctx, r);
+}
+
+/* Push a result into the partition heap if it makes it into the partition's top N - just like the
+ * sorter does */
+static void parallelScan_Collect(struct parallelPartition *p, t_docId docId, double score,
+                                 RSDocumentMetadata *dmd) {
+  struct parallelScanCtx *ps = p->ps;
+  if (p->pooledResult == NULL) {
+    p->pooledResult = calloc(1, sizeof(*p->pooledResult));
+  }
+  SearchResult *h = p->pooledResult;
+  h->docId = docId;
+  h->score = score;
+  h->scorerPrivateData = dmd;
+  h->sorterPrivateData = dmd->sortVector;
+
+  if (!ps->size || p->pq->count + 1 < p->pq->size) {
+    DMD_Incref(dmd);
+    mmh_insert(p->pq, h);
+    p->pooledResult = NULL;
+    return;
+  }
+
+  SearchResult *minh = mmh_peek_min(p->pq);
+  if (minh->score > p->minScore) {
+    p->minScore = minh->score;
+  }
+  if (ps->cmp(h, minh, ps->cmpCtx) > 0) {
+    p->pooledResult = mmh_pop_min(p->pq);
+    DMD_Decref(p->pooledResult->scorerPrivateData);
+    DMD_Incref(dmd);
+    mmh_insert(p->pq, h);
+  }
+}
+
+/* Scan a single range of document ids */
+static void *parallelScan_Run(void *arg) {
+  struct parallelPartition *p = arg;
+  struct parallelScanCtx *ps = p->ps;
+  DocTable *dt = &ps->q->ctx->spec->docs;
+  IndexIterator *it = p->it;
+  RSIndexResult *r = NULL;
+  size_t n = 0;
+  int rc;
+
+  if (p->start > 1) {
+    // Whatever is at start - 1 belongs to the previous range. If we land after it, the iterator has
+    // already read the first match of our range
+    rc = it->SkipTo(it->ctx, p->start - 1, &r);
+    if (rc != INDEXREAD_EOF) {
+      if (!r || r->docId < p->start) {
+        rc = parallelScan_Read(p, &r);
+      } else {
+        rc = INDEXREAD_OK;
+      }
+    }
+  } else {
+    rc = parallelScan_Read(p, &r);
+  }
+
+  for (; rc != INDEXREAD_EOF; rc = parallelScan_Read(p, &r)) {
+    if (!r || rc == INDEXREAD_NOTFOUND) continue;
+    if (r->docId >= p->end) break;
+    if (++n % PARALLEL_TIMEOUT_CHECK_INTERVAL == 0 && parallelScan_TimedOut(ps)) break;
+
+    RSDocumentMetadata *dmd = DocTable_Get(dt, r->docId);
+    // skip deleted documents
+    if (!dmd || (dmd->flags & Document_Deleted)) {
+      continue;
+    }
+    ++p->totalResults;
+
+    double score = 0;
+    if (ps->sc) {
+      score = ps->sc->scorer(&p->scorerCtx, r, dmd, p->minScore);
+      if (score == RS_SCORE_FILTEROUT) p->totalResults--;
+    }
+    parallelScan_Collect(p, r->docId, score, dmd);
+  }
+
+  if (p->threaded) {
+    pthread_mutex_lock(&ps->lock);
+    ps->numDone++;
+    pthread_cond_broadcast(&ps->cond);
+    pthread_mutex_unlock(&ps->lock);
+  }
+  return NULL;
+}
+
+/* Wait for the workers to finish, releasing the lock for them when it was held long enough */
+static void parallelScan_Wait(struct parallelScanCtx *ps) {
+  ConcurrentSearchCtx *conc = ps->q->conc;
+  pthread_mutex_lock(&ps->lock);
+  while (ps->numDone < ps->numThreads) {
+    if (conc && ConcurrentSearch_TimerExpired(conc)) {
+      pthread_mutex_unlock(&ps->lock);
+      parallelScan_Switch(ps);
+      pthread_mutex_lock(&ps->lock);
+      continue;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += CONCURRENT_TIMEOUT_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ps->cond, &ps->lock, &deadline);
+  }
+  pthread_mutex_unlock(&ps->lock);
+}
+
+/* Split the document ids between the partitions and scan them all */
+static void parallelScan_Scan(struct parallelScanCtx *ps) {
+  QueryPlan *q = ps->q;
+  t_docId maxDocId = q->ctx->spec->docs.maxDocId;
+  t_docId step = maxDocId / ps->numParts + 1;
+
+  for (int i = 0; i < ps->numParts; i++) {
+    struct parallelPartition *p = &ps->parts[i];
+    p->start = i * step + 1;
+    p->end = i == ps->numParts - 1 ? maxDocId + 1 : p->start + step;
+  }
+
+  // the first range is scanned by the calling thread, the rest by threads of their own. A worker
+  // counts as running before it starts, so the lock is never released under it
+  for (int i = 1; i < ps->numParts; i++) {
+    struct parallelPartition *p = &ps->parts[i];
+    p->threaded = 1;
+    ps->numThreads++;
+    if (pthread_create(&p->thread, NULL, parallelScan_Run, p) != 0) {
+      p->threaded = 0;
+      ps->numThreads--;
+    }
+  }
+  // ranges we could not start a thread for are scanned by the calling thread as well
+  for (int i = 0; i < ps->numParts; i++) {
+    if (!ps->parts[i].threaded) {
+      parallelScan_Run(&ps->parts[i]);
+    }
+  }
+  parallelScan_Wait(ps);
+  for (int i = 1; i < ps->numParts; i++) {
+    if (ps->parts[i].threaded) {
+      pthread_join(ps->parts[i].thread, NULL);
+    }
+  }
+
+  for (int i = 0; i < ps->numParts; i++) {
+    q->execCtx.totalResults += ps->parts[i].totalResults;
+    if (ps->parts[i].minScore > q->execCtx.minScore) {
+      q->execCtx.minScore = ps->parts[i].minScore;
+    }
+  }
+  if (ps->timedOut) {
+    q->execCtx.state = QPState_TimedOut;
+  }
+}
+
+int parallelScan_Next(ResultProcessorCtx *ctx, SearchResult *res) {
+  struct parallelScanCtx *ps = ctx->privdata;
+
+  if (ps->yielded) {
+    DMD_Decref(ps->yielded);
+    ps->yielded = NULL;
+  }
+  if (!ps->scanned) {
+    if (ctx->qxc->state != QPState_TimedOut) {
+      parallelScan_Scan(ps);
+    }
+    ps->scanned = 1;
+  }
+
+  while (ps->cur < ps->numParts && ps->parts[ps->cur].pq->count == 0) {
+    ps->cur++;
+  }
+  if (ps->cur == ps->numParts) {
+    return RS_RESULT_EOF;
+  }
+
+  SearchResult *sr = mmh_pop_max(ps->parts[ps->cur].pq);
+  res->docId = sr->docId;
+  res->score = sr->score;
+  res->indexResult = NULL;
+  res->sorterPrivateData = sr->sorterPrivateData;
+  res->scorerPrivateData = sr->scorerPrivateData;
+  if (res->fields != NULL) {
+    res->fields->len = 0;
+  }
+  ps->yielded = sr->scorerPrivateData;
+  free(sr);
+  return RS_RESULT_OK;
+}
+
+static void parallelScan_Free(ResultProcessor *rp) {
+  struct parallelScanCtx *ps = rp->ctx.privdata;
+  if (ps->yielded) {
+    DMD_Decref(ps->yielded);
+  }
+  for (int i = 0; i < ps->numParts; i++) {
+    // calling mmh_free will free all the remaining results in the heap, if any
+    mmh_free(ps->parts[i].pq);
+    free(ps->parts[i].pooledResult);
+  }
+  pthread_mutex_destroy(&ps->lock);
+  pthread_cond_destroy(&ps->cond);
+  if (ps->sc) {
+    if (ps->sc->scorerFree) {
+      ps->sc->scorerFree(ps->sc->scorerCtx.privdata);
+    }
+    free(ps->sc);
+  }
+  free(ps->parts);
+  free(ps);
+  free(rp);
+}
+
+/* Create a processor that scans the root filter and its partitions in parallel. The results are
+ * scored by the given scorer, or left unscored in SORTBY mode. Each partition keeps its top N
+ * results */
+static ResultProcessor *NewParallelScan(QueryPlan *q, const char *scorer, RSSearchRequest *req,
+                                        uint32_t size) {
+  struct parallelScanCtx *ps = calloc(1, sizeof(*ps));
+  ps->q = q;
+  ps->size = size;
+  if (q->opts.sortBy) {
+    ps->cmp = cmpBySortKey;
+    ps->cmpCtx = q->opts.sortBy;
+  } else {
+    ps->cmp = cmpByScore;
+    ps->sc = malloc(sizeof(*ps->sc));
+    scorerCtx_Init(ps->sc, scorer, &q->execCtx, req);
+  }
+  pthread_mutex_init(&ps->lock, NULL);
+  pthread_cond_init(&ps->cond, NULL);
+
+  ps->numParts = q->numPartitions + 1;
+  ps->parts = calloc(ps->numParts, sizeof(*ps->parts));
+  for (int i = 0; i < ps->numParts; i++) {
+    struct parallelPartition *p = &ps->parts[i];
+    p->ps = ps;
+    p->it = i == 0 ? q->rootFilter : q->partitions[i - 1];
+    p->pq = mmh_init_with_size(size + 1, ps->cmp, ps->cmpCtx, parallelScan_FreeResult);
+    if (ps->sc) {
+      p->scorerCtx = ps->sc->scorerCtx;
+    }
+  }
+
+  ResultProcessor *rp = NewResultProcessor(NULL, ps);
+  rp->ctx.qxc = &q->execCtx;
+  rp->Next = parallelScan_Next;
+  rp->Free = parallelScan_Free;
+  return rp;
 }
 
 /*******************************************************************************************************************
@@ -534,6 +1242,28 @@ int pager_Next(ResultProcessorCtx *ctx, SearchResult *r) {
   return RS_RESULT_OK;
 }
 
+/* NextBatch implementation. The results before the offset are read in batches of their own, and
+ * dropped */
+static int pager_NextBatch(ResultProcessorCtx *ctx, SearchResultBatch *b) {
+  struct pagerCtx *pc = ctx->privdata;
+  uint32_t end = pc->offset + pc->limit;
+  if (pc->count >= end) {
+    return RS_RESULT_EOF;
+  }
+
+  int skipping = pc->count < pc->offset;
+  size_t cap = b->cap;
+  b->cap = skipping ? MIN(RP_BATCH_SIZE, pc->offset - pc->count) : MIN(cap, end - pc->count);
+  int rc = ResultProcessor_NextBatch(ctx->upstream, b, 1);
+  b->cap = cap;
+  if (rc == RS_RESULT_EOF) {
+    return rc;
+  }
+
+  pc->count += b->len;
+  return skipping ? RS_RESULT_QUEUED : RS_RESULT_OK;
+}
+
 /* Create a new pager. The offset and limit are taken from the user request */
 ResultProcessor *NewPager(ResultProcessor *upstream, uint32_t offset, uint32_t limit) {
   struct pagerCtx *pc = malloc(sizeof(*pc));
@@ -544,6 +1274,7 @@ ResultProcessor *NewPager(ResultProcessor *upstream, uint32_t offset, uint32_t l
   ResultProcessor *rp = NewResultProcessor(upstream, pc);
 
   rp->Next = pager_Next;
+  rp->NextBatch = pager_NextBatch;
   // no need for a special free function
   rp->Free = ResultProcessor_GenericFree;
   return rp;
@@ -562,6 +1293,7 @@ typedef struct {
   const char *name;  // Key to use on output
   int sortIndex;     // If sortable, sort index; otherwise -1
   int type;          // Type, if in field spec, otherwise -1
+  NumericColumn *column;  // Values of numeric fields, if indexed
 } LoadedField;
 
 struct loaderCtx {
@@ -569,6 +1301,7 @@ struct loaderCtx {
   LoadedField *fields;
   size_t numFields;
   int explicitReturn;
+  int rawStrings;
 };
 
 static RSValue *getValueFromField(RedisModuleString *origval, int typeCode) {
@@ -607,6 +1340,11 @@ static void loadExplicitFields(struct loaderCtx *lc, RedisSearchCtx *sctx, Redis
         continue;
       }
     }
+    double d;
+    if (field->column && NumericColumn_Get(field->column, dmd->id, &d)) {
+      RSFieldMap_Set(&r->fields, field->name, RS_NumVal(d));
+      continue;
+    }
     // Otherwise, we need to load from the fieldspec
     if (triedOpen && !k) {
       continue;  // not gonna open the key
@@ -621,7 +1359,8 @@ static void loadExplicitFields(struct loaderCtx *lc, RedisSearchCtx *sctx, Redis
     RedisModuleString *v = NULL;
     int rv = RedisModule_HashGet(k, REDISMODULE_HASH_CFIELDS, field->name, &v, NULL);
     if (rv == REDISMODULE_OK && v) {
-      RSFieldMap_Set(&r->fields, field->name, getValueFromField(v, field->type));
+      RSFieldMap_Set(&r->fields, field->name,
+                     lc->rawStrings ? RS_RedisStringVal(v) : getValueFromField(v, field->type));
     } else {
       RSFieldMap_Set(&r->fields, field->name, RS_NullVal());
     }
@@ -679,7 +1418,8 @@ void loader_Free(ResultProcessor *rp) {
   free(lc);
   free(rp);
 }
-ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, FieldList *fields) {
+ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, FieldList *fields,
+                           int rawStrings) {
   struct loaderCtx *sc = malloc(sizeof(*sc));
 
   sc->ctx = sctx;
@@ -692,8 +1432,13 @@ ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, Fiel
     lf->name = name;
     // Find the fieldspec
     const FieldSpec *fs = IndexSpec_GetField(sctx->spec, name, strlen(name));
+    lf->column = NULL;
     if (fs) {
       lf->type = fs->type;
+      // the column holds the parsed value, not the string the document was indexed with
+      if (fs->type == FIELD_NUMERIC && !rawStrings) {
+        lf->column = NumericIndex_GetColumn(sctx, fs->name);
+      }
       if (FieldSpec_IsSortable(fs)) {
         lf->sortIndex = fs->sortIdx;
       } else {
@@ -705,6 +1450,7 @@ ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, Fiel
     }
   }
   sc->explicitReturn = fields->explicitReturn;
+  sc->rawStrings = rawStrings;
 
   ResultProcessor *rp = NewResultProcessor(upstream, sc);
 
@@ -719,11 +1465,18 @@ ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, Fiel
 ResultProcessor *Query_BuildProcessorChain(QueryPlan *q, void *privdata, char **err) {
   *err = NULL;
   RSSearchRequest *req = privdata;
-  // The base processor translates index results into search results
-  ResultProcessor *next = NewBaseProcessor(q, &q->execCtx);
+  ResultProcessor *next;
+  int parallel = q->numPartitions > 0 && !req->opts.fields.wantSummaries;
+  if (parallel) {
+    // Large queries are scanned and scored in parallel, the sorter merges the partial results
+    next = NewParallelScan(q, q->opts.scorer, req, q->opts.offset + q->opts.num);
+  } else {
+    // The base processor translates index results into search results
+    next = NewBaseProcessor(q, &q->execCtx);
+  }
 
   // If we are not in SORTBY mode - add a scorer to the chain
-  if (q->opts.sortBy == NULL) {
+  if (q->opts.sortBy == NULL && !parallel) {
     next = NewScorer(q->opts.scorer, next, req);
     // Scorers usually need the index results, let's tell the query plan that
     q->opts.needIndexResult = 1;
@@ -732,6 +1485,8 @@ ResultProcessor *Query_BuildProcessorChain(QueryPlan *q, void *privdata, char **
   // The sorter sorts the top-N results
   next = NewSorter(q->opts.sortBy ? Sort_BySortKey : Sort_ByScore, q->opts.sortBy,
                    q->opts.offset + q->opts.num, next, req->opts.fields.wantSummaries);
+  // The results are read off the index and ranked without the lock, when the query can
+  ((struct sorterCtx *)next->ctx.privdata)->unlocked = QueryPlan_CanScanUnlocked(q);
 
   // The pager pages over the results of the sorter
   next = NewPager(next, q->opts.offset, q->opts.num);
@@ -739,7 +1494,8 @@ ResultProcessor *Query_BuildProcessorChain(QueryPlan *q, void *privdata, char **
   // The loader loads the documents from redis
   // If we do not need to return any fields - we do not need the loader in the loop
   if (!(q->opts.flags & Search_NoContent)) {
-    next = NewLoader(next, q->ctx, &req->opts.fields);
+    // search results return the documents' fields as they were given to us
+    next = NewLoader(next, q->ctx, &req->opts.fields, 1);
     if (req->opts.fields.wantSummaries && (q->ctx->spec->flags & Index_StoreTermOffsets) != 0) {
       next = NewHighlightProcessor(next, req);
     }
@@ -55,9 +55,25 @@ typedef struct {
   IndexIterator *rootFilter;
 
   struct timespec startTime;
+  // how long the query may run since startTime, 0 if it has no timeout
+  long long timeoutNS;
+
+  // set while a batch is filled row by row. The rows of a batch may point into the index and the
+  // document table, so switching threads is deferred to the next batch
+  int inBatch;
 
 } QueryProcessingCtx;
 
+/* Returns 1 if the query has run for longer than its timeout */
+static inline int QueryProcessingCtx_TimeoutExpired(const QueryProcessingCtx *c) {
+  if (!c->timeoutNS) return 0;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  long long durationNS = (long long)1000000000 * (now.tv_sec - c->startTime.tv_sec) +
+                         (now.tv_nsec - c->startTime.tv_nsec);
+  return durationNS > c->timeoutNS;
+}
+
 static inline RSSortingTable *QueryProcessingCtx_GetSortingTable(QueryProcessingCtx *c) {
   if (c->sctx && c->sctx->spec) return c->sctx->spec->sortables;
   return NULL;
@@ -141,6 +157,26 @@ noret:
 // EOF - no results from this processor
 #define RS_RESULT_EOF 2
 
+/* The maximal number of results passed down the chain in a single batch */
+#define RP_BATCH_SIZE 1024
+
+/* A batch of results, passed down the chain at once by processors that implement NextBatch. The
+ * batch owns the field maps of its rows, and keeps them from one batch to the next, so that reading
+ * a result does not allocate a map of its own. Rows past len hold no values */
+typedef struct {
+  // the number of results in the batch
+  size_t len;
+  // the maximal number of results the consumer wants from this call, at most RP_BATCH_SIZE
+  size_t cap;
+  // set by processors that read the index results of their upstream rows. Index results are only
+  // valid until the next one is read, so batches filled row by row end at a row that has one
+  int keepIndexResults;
+  SearchResult rows[RP_BATCH_SIZE];
+} SearchResultBatch;
+
+SearchResultBatch *NewSearchResultBatch();
+void SearchResultBatch_Free(SearchResultBatch *b);
+
 /* Context for a single result processor, including global shared state, upstream processor and
  * private data */
 typedef struct {
@@ -166,6 +202,11 @@ typedef struct resultProcessor {
   // * RS_RESULT_EOF -> finished, nothing more from this processor
   int (*Next)(ResultProcessorCtx *ctx, SearchResult *res);
 
+  // NextBatch is optional, and puts up to batch->cap results in the batch. It returns OK if it put
+  // at least one, and QUEUED or EOF like Next. Processors that don't implement it are read one
+  // result at a time by ResultProcessor_NextBatch
+  int (*NextBatch)(ResultProcessorCtx *ctx, SearchResultBatch *batch);
+
   // Free just frees up the processor. If left as NULL we simply use free()
   void (*Free)(struct resultProcessor *p);
 } ResultProcessor;
@@ -196,7 +237,7 @@ static inline int ResultProcessor_Next(ResultProcessor *rp, SearchResult *res, i
   do {
 
     // If we can switch - we check the concurrent context switch BEFORE calling the upstream
-    if (allowSwitching && cxc) {
+    if (allowSwitching && cxc && !rp->ctx.qxc->inBatch) {
       CONCURRENT_CTX_TICK(cxc);
       // need to abort - return EOF
       if (rp->ctx.qxc->state == QPState_Aborted) {
@@ -209,6 +250,12 @@ static inline int ResultProcessor_Next(ResultProcessor *rp, SearchResult *res, i
   return rc;
 }
 
+/* Read the next batch of results from a processor, up to batch->cap of them. The rows of the
+ * previous batch are released first. Like ResultProcessor_Next, this returns only OK or EOF, and
+ * if allowSwitching is 1 the concurrent context is checked - but once per batch rather than once
+ * per result */
+int ResultProcessor_NextBatch(ResultProcessor *rp, SearchResultBatch *batch, int allowSwitching);
+
 /* Shortcut macro - call ResultProcessor_Next and return EOF if it returned EOF - otherwise it has
  * to return OK */
 #define RESULTPROCESSOR_MAYBE_RET_EOF(proc, res, allowSwitch)                     \
@@ -246,7 +293,12 @@ struct QueryPlan;
 ResultProcessor *NewSorterByFields(RSMultiKey *mk, uint64_t ascendingMap, uint32_t size,
                                    ResultProcessor *upstream);
 
-ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, FieldList *fields);
+/* Create a loader of the fields of the results' documents. If rawStrings is set, fields are returned
+ * as they are in the document's hash, except for sortable numeric fields which are read off the
+ * sorting vector. Otherwise numeric fields are loaded as numbers, read off the field's numeric index
+ * when it has one */
+ResultProcessor *NewLoader(ResultProcessor *upstream, RedisSearchCtx *sctx, FieldList *fields,
+                           int rawStrings);
 
 ResultProcessor *NewBaseProcessor(struct QueryPlan *q, QueryProcessingCtx *xc);
 ResultProcessor *NewPager(ResultProcessor *upstream, uint32_t offset, uint32_t limit);
@@ -0,0 +1,280 @@
+#include "result_spill.h"
+#include "doc_table.h"
+#include "util/minmax_heap.h"
+
+#define SPILL_WRITE(fp, p, sz) \
+  if (fwrite(p, sz, 1, fp) != 1) return REDISMODULE_ERR;
+#define SPILL_READ(fp, p, sz) \
+  if (fread(p, sz, 1, fp) != 1) return 0;
+
+FILE *Spill_NewFile() {
+  return tmpfile();
+}
+
+static int spillWriteValue(FILE *fp, RSValue *v) {
+  v = RSValue_Dereference(v);
+  const char *str;
+  size_t n;
+  uint32_t len;
+  uint8_t t = v ? v->t : RSValue_Null;
+  switch (t) {
+    case RSValue_Number:
+      SPILL_WRITE(fp, &t, 1);
+      SPILL_WRITE(fp, &v->numval, sizeof(v->numval));
+      return REDISMODULE_OK;
+
+    case RSValue_String:
+    case RSValue_RedisString:
+      // redis strings are read back as plain strings
+      str = RSValue_StringPtrLen(v, &n);
+      t = RSValue_String;
+      len = n;
+      SPILL_WRITE(fp, &t, 1);
+      SPILL_WRITE(fp, &len, sizeof(len));
+      if (len) SPILL_WRITE(fp, str, len);
+      return REDISMODULE_OK;
+
+    case RSValue_Array:
+      len = v->arrval.len;
+      SPILL_WRITE(fp, &t, 1);
+      SPILL_WRITE(fp, &len, sizeof(len));
+      for (uint32_t i = 0; i < len; i++) {
+        if (spillWriteValue(fp, v->arrval.vals[i]) != REDISMODULE_OK) return REDISMODULE_ERR;
+      }
+      return REDISMODULE_OK;
+
+    default:
+      t = RSValue_Null;
+      SPILL_WRITE(fp, &t, 1);
+      return REDISMODULE_OK;
+  }
+}
+
+/* Read a value, with no reference held. Returns NULL on failure */
+static RSValue *spillReadValue(FILE *fp) {
+  uint8_t t;
+  uint32_t len;
+  double d;
+  if (fread(&t, 1, 1, fp) != 1) return NULL;
+
+  switch (t) {
+    case RSValue_Number:
+      if (fread(&d, sizeof(d), 1, fp) != 1) return NULL;
+      return RS_NumVal(d);
+
+    case RSValue_String: {
+      if (fread(&len, sizeof(len), 1, fp) != 1) return NULL;
+      char *str = malloc(len + 1);
+      if (len && fread(str, len, 1, fp) != 1) {
+        free(str);
+        return NULL;
+      }
+      str[len] = '\0';
+      return RS_StringVal(str, len);
+    }
+
+    case RSValue_Array: {
+      if (fread(&len, sizeof(len), 1, fp) != 1) return NULL;
+      RSValue **vals = calloc(len ? len : 1, sizeof(*vals));
+      for (uint32_t i = 0; i < len; i++) {
+        if (!(vals[i] = spillReadValue(fp))) {
+          while (i--) {
+            RSValue_Free(RSValue_IncrRef(vals[i]));
+          }
+          free(vals);
+          return NULL;
+        }
+      }
+      return RS_ArrVal(vals, len);
+    }
+
+    default:
+      return RS_NullVal();
+  }
+}
+
+int Spill_WriteValues(FILE *fp, RSValue **vals, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (spillWriteValue(fp, vals[i]) != REDISMODULE_OK) return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+int Spill_ReadValues(FILE *fp, RSValue **vals, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (!(vals[i] = spillReadValue(fp))) {
+      while (i--) {
+        RSValue_Free(vals[i]);
+      }
+      return 0;
+    }
+    RSValue_IncrRef(vals[i]);
+  }
+  return 1;
+}
+
+int Spill_WriteResult(FILE *fp, SearchResult *r) {
+  uint16_t nfields = r->fields ? r->fields->len : 0;
+  SPILL_WRITE(fp, &r->docId, sizeof(r->docId));
+  SPILL_WRITE(fp, &r->score, sizeof(r->score));
+  // the metadata stays in memory, and the file holds the result's reference to it
+  SPILL_WRITE(fp, &r->scorerPrivateData, sizeof(r->scorerPrivateData));
+  SPILL_WRITE(fp, &nfields, sizeof(nfields));
+  for (uint16_t i = 0; i < nfields; i++) {
+    const char *key = r->fields->fields[i].key;
+    uint32_t len = strlen(key);
+    SPILL_WRITE(fp, &len, sizeof(len));
+    if (len) SPILL_WRITE(fp, key, len);
+    if (spillWriteValue(fp, r->fields->fields[i].val) != REDISMODULE_OK) return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+int Spill_ReadResult(FILE *fp, SearchResult *r) {
+  uint16_t nfields;
+  if (r->fields) {
+    RSFieldMap_Reset(r->fields);
+  }
+  r->indexResult = NULL;
+  r->scorerPrivateData = NULL;
+  r->sorterPrivateData = NULL;
+
+  SPILL_READ(fp, &r->docId, sizeof(r->docId));
+  SPILL_READ(fp, &r->score, sizeof(r->score));
+  SPILL_READ(fp, &r->scorerPrivateData, sizeof(r->scorerPrivateData));
+  if (fread(&nfields, sizeof(nfields), 1, fp) != 1) goto truncated;
+
+  for (uint16_t i = 0; i < nfields; i++) {
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, fp) != 1) goto truncated;
+    char *key = malloc(len + 1);
+    RSValue *v = NULL;
+    if ((len && fread(key, len, 1, fp) != 1) || !(v = spillReadValue(fp))) {
+      free(key);
+      goto truncated;
+    }
+    key[len] = '\0';
+    // keys are owned by the map, like the keys of results kept by the sorter
+    RSFieldMap_Add(&r->fields, key, v);
+    r->fields->isKeyAlloc = 1;
+  }
+  if (r->scorerPrivateData) {
+    r->sorterPrivateData = r->scorerPrivateData->sortVector;
+  }
+  return 1;
+
+truncated:
+  // a result we failed to write whole. Its document reference was never given to the file
+  r->scorerPrivateData = NULL;
+  return 0;
+}
+
+static size_t spillValueSize(const RSValue *v) {
+  size_t sz = sizeof(RSValue);
+  v = RSValue_Dereference((RSValue *)v);
+  if (!v) return sz;
+  switch (v->t) {
+    case RSValue_String:
+      return sz + v->strval.len;
+    case RSValue_Array:
+      sz += v->arrval.len * sizeof(RSValue *);
+      for (uint32_t i = 0; i < v->arrval.len; i++) {
+        sz += spillValueSize(v->arrval.vals[i]);
+      }
+      return sz;
+    default:
+      return sz;
+  }
+}
+
+size_t Spill_ResultSize(const SearchResult *r) {
+  size_t sz = sizeof(*r);
+  if (r->fields) {
+    sz += sizeof(RSFieldMap) + r->fields->cap * sizeof(RSField);
+    for (uint16_t i = 0; i < r->fields->len; i++) {
+      sz += spillValueSize(r->fields->fields[i].val);
+      if (r->fields->isKeyAlloc) {
+        sz += strlen(r->fields->fields[i].key) + 1;
+      }
+    }
+  }
+  return sz;
+}
+
+/* The head of a run in the merge. The result comes first, so the heap compares entries as
+ * results */
+typedef struct {
+  SearchResult res;
+  FILE *fp;
+} spillRunHead;
+
+struct spillMerger {
+  heap_t *heap;
+  spillRunHead *heads;
+  size_t numRuns;
+};
+
+static void spillRunHead_Release(spillRunHead *h) {
+  DMD_Decref(h->res.scorerPrivateData);
+  h->res.scorerPrivateData = NULL;
+  RSFieldMap_Free(h->res.fields);
+  h->res.fields = NULL;
+}
+
+SpillMerger *NewSpillMerger(FILE **runs, size_t numRuns,
+                            int (*cmp)(const void *, const void *, const void *), void *cmpCtx) {
+  SpillMerger *m = malloc(sizeof(*m));
+  m->numRuns = numRuns;
+  m->heads = calloc(numRuns ? numRuns : 1, sizeof(*m->heads));
+  m->heap = mmh_init_with_size(numRuns + 1, cmp, cmpCtx, NULL);
+  for (size_t i = 0; i < numRuns; i++) {
+    m->heads[i].fp = runs[i];
+    rewind(runs[i]);
+    if (Spill_ReadResult(runs[i], &m->heads[i].res)) {
+      mmh_insert(m->heap, &m->heads[i]);
+    }
+  }
+  return m;
+}
+
+int SpillMerger_Next(SpillMerger *m, SearchResult *r) {
+  if (!m->heap->count) {
+    return RS_RESULT_EOF;
+  }
+  spillRunHead *h = mmh_pop_max(m->heap);
+
+  // the result may be a batch row with a field map of its own
+  RSFieldMap_Free(r->fields);
+  *r = h->res;
+  h->res.fields = NULL;
+  h->res.scorerPrivateData = NULL;
+
+  if (Spill_ReadResult(h->fp, &h->res)) {
+    mmh_insert(m->heap, h);
+  } else {
+    spillRunHead_Release(h);
+  }
+  return RS_RESULT_OK;
+}
+
+const SearchResult *SpillMerger_Peek(SpillMerger *m) {
+  if (!m->heap->count) {
+    return NULL;
+  }
+  spillRunHead *h = mmh_peek_max(m->heap);
+  return &h->res;
+}
+
+void SpillMerger_Free(SpillMerger *m) {
+  for (size_t i = 0; i < m->numRuns; i++) {
+    // the results we did not get to hold document references
+    spillRunHead *h = &m->heads[i];
+    do {
+      spillRunHead_Release(h);
+    } while (Spill_ReadResult(h->fp, &h->res));
+    fclose(h->fp);
+  }
+  mmh_free(m->heap);
+  free(m->heads);
+  free(m);
+}
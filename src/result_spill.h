@@ -0,0 +1,54 @@
+#ifndef RS_RESULT_SPILL_H_
+#define RS_RESULT_SPILL_H_
+
+#include <stdio.h>
+#include "result_processor.h"
+
+/* Aggregations that do not fit in their memory budget (see AGGREGATE_MEMORY_BUDGET) spill results
+ * to anonymous temporary files: the sorter writes sorted runs and merges them, and the grouper
+ * partitions the results it has no room for by their group's hash.
+ *
+ * A spilled result keeps its id, score, field map and a reference to its document metadata, so
+ * values read from the sorting vector are still there when it is read back. The files are only
+ * ever read by the process that wrote them */
+
+/* Open a new spill file. It is deleted when closed. Returns NULL on failure */
+FILE *Spill_NewFile();
+
+/* Write a result to a spill file. The reference to the result's document metadata is taken by
+ * the file, and given back to the result when it is read. Returns REDISMODULE_ERR on failure */
+int Spill_WriteResult(FILE *fp, SearchResult *r);
+
+/* Write the values the result is grouped by, before the result itself */
+int Spill_WriteValues(FILE *fp, RSValue **vals, size_t n);
+
+/* Read the next result of a spill file into r, reusing its field map. The result owns the values
+ * and keys of the fields, and a reference to its document metadata. Returns 0 at the end of the
+ * file */
+int Spill_ReadResult(FILE *fp, SearchResult *r);
+
+/* Read values written by Spill_WriteValues. Each value is returned with a reference held */
+int Spill_ReadValues(FILE *fp, RSValue **vals, size_t n);
+
+/* An estimate of the memory a result kept by a processor takes, including its field map */
+size_t Spill_ResultSize(const SearchResult *r);
+
+/* Merges sorted runs into a single sorted stream, by the same compare function that sorted them.
+ * Runs are sorted from the greatest result to the smallest, like a sorter yields them */
+typedef struct spillMerger SpillMerger;
+
+/* Create a merger over the runs. The merger takes ownership of the files */
+SpillMerger *NewSpillMerger(FILE **runs, size_t numRuns,
+                            int (*cmp)(const void *, const void *, const void *), void *cmpCtx);
+
+/* Move the next result of the merge into r, along with its document reference. Returns
+ * RS_RESULT_EOF when all runs are exhausted */
+int SpillMerger_Next(SpillMerger *m, SearchResult *r);
+
+/* The result SpillMerger_Next would return next, or NULL if all runs are exhausted */
+const SearchResult *SpillMerger_Peek(SpillMerger *m);
+
+/* Free the merger, closing its files and releasing the results it still holds */
+void SpillMerger_Free(SpillMerger *m);
+
+#endif
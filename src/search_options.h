@@ -66,7 +66,11 @@ typedef enum {
 
   Search_WithSortKeys = 0x40,
   Search_AggregationQuery = 0x80,
-  Search_IsCursor = 0x100
+  Search_IsCursor = 0x100,
+
+  // Relevance sorted unions may skip documents that can't make it into the top results, leaving
+  // them out of the total
+  Search_Prune = 0x200
 } RSSearchFlags;
 
 #define RS_DEFAULT_QUERY_FLAGS 0x00
@@ -22,6 +22,29 @@ RSSortingVector *NewSortingVector(int len) {
   return ret;
 }
 
+RSSortingVector *SortingVector_Copy(const RSSortingVector *v) {
+  RSSortingVector *ret = NewSortingVector(v->len);
+  for (int i = 0; i < v->len; i++) {
+    const RSValue *val = v->values[i];
+    if (!val) continue;
+    switch (val->t) {
+      case RSValue_Number:
+        RSValue_Free(ret->values[i]);
+        ret->values[i] = RSValue_IncrRef(RS_NumVal(val->numval));
+        break;
+      case RSValue_String:
+        RSValue_Free(ret->values[i]);
+        ret->values[i] = RSValue_IncrRef(RS_StringValT(
+            rm_strndup(val->strval.str, val->strval.len), val->strval.len, RSString_RMAlloc));
+        break;
+      default:
+        // left as NIL
+        break;
+    }
+  }
+  return ret;
+}
+
 /* Internal compare function between members of the sorting vectors, sorted by sk */
 inline int RSSortingVector_Cmp(RSSortingVector *self, RSSortingVector *other, RSSortingKey *sk) {
 
@@ -65,6 +88,8 @@ char *normalizeStr(const char *str) {
 /* Put a value in the sorting vector */
 void RSSortingVector_Put(RSSortingVector *tbl, int idx, void *p, int type) {
   if (idx <= RS_SORTABLES_MAX) {
+    // the value we replace, released once the new one is in
+    RSValue *old = tbl->values[idx];
     switch (type) {
       case RS_SORTABLE_NUM:
         tbl->values[idx] = RSValue_IncrRef(RS_NumVal(*(double *)p));
@@ -80,6 +105,7 @@ void RSSortingVector_Put(RSSortingVector *tbl, int idx, void *p, int type) {
         tbl->values[idx] = RSValue_IncrRef(RS_NullVal());
         break;
     }
+    RSValue_Free(old);
   }
 }
 RSValue *RSSortingVector_Get(RSSortingVector *v, RSSortingKey *k) {
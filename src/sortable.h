@@ -81,6 +81,10 @@ size_t RSSortingVector_GetMemorySize(RSSortingVector *v);
 /* Create a sorting vector of a given length for a document */
 RSSortingVector *NewSortingVector(int len);
 
+/* Copy a sorting vector. The copy shares no values with it, so the two can be freed separately on
+ * different threads */
+RSSortingVector *SortingVector_Copy(const RSSortingVector *v);
+
 /* Free a sorting vector */
 void SortingVector_Free(RSSortingVector *v);
 
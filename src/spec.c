@@ -453,6 +453,15 @@ int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len) {
   return isNew;
 }
 
+int IndexSpec_DeleteTerm(IndexSpec *sp, const char *term, size_t len) {
+  int deleted = Trie_Delete(sp->terms, (char *)term, len);
+  if (deleted) {
+    sp->stats.numTerms--;
+    sp->stats.termsSize -= len;
+  }
+  return deleted;
+}
+
 /// given an array of random weights, return the a weighted random selection, as the index in the
 /// array
 size_t weightedRandom(double weights[], size_t len) {
@@ -507,13 +516,10 @@ char *IndexSpec_GetRandomTerm(IndexSpec *sp, size_t sampleSize) {
   return samples[selection];
 }
 
-void IndexSpec_Free(void *ctx) {
+/* Free the memory queries read the spec through - the terms trie, the document table, and the
+ * field and sorting tables */
+static void indexSpec_FreeData(void *ctx) {
   IndexSpec *spec = ctx;
-
-  if (spec->gc) {
-    GC_Stop(spec->gc);
-  }
-
   if (spec->terms) {
     TrieType_Free(spec->terms);
   }
@@ -524,14 +530,22 @@ void IndexSpec_Free(void *ctx) {
     }
     rm_free(spec->fields);
   }
-
-  Cursors_PurgeWithName(&RSCursors, spec->name);
-
   rm_free(spec->name);
   if (spec->sortables) {
     SortingTable_Free(spec->sortables);
     spec->sortables = NULL;
   }
+  rm_free(spec);
+}
+
+/* Stop the GC and release everything that needs the lock to be released */
+static void indexSpec_Unlink(IndexSpec *spec) {
+  if (spec->gc) {
+    GC_Stop(spec->gc);
+  }
+
+  Cursors_PurgeWithName(&RSCursors, spec->name);
+
   if (spec->stopwords) {
     StopWordList_Unref(spec->stopwords);
     spec->stopwords = NULL;
@@ -539,6 +553,7 @@ void IndexSpec_Free(void *ctx) {
 
   if (spec->smap) {
     SynonymMap_Free(spec->smap);
+    spec->smap = NULL;
   }
 
   if (spec->indexStrs) {
@@ -548,9 +563,23 @@ void IndexSpec_Free(void *ctx) {
       }
     }
     rm_free(spec->indexStrs);
+    spec->indexStrs = NULL;
     RedisModule_FreeThreadSafeContext(spec->strCtx);
   }
-  rm_free(spec);
+}
+
+void IndexSpec_Free(void *ctx) {
+  IndexSpec *spec = ctx;
+  indexSpec_Unlink(spec);
+  indexSpec_FreeData(spec);
+}
+
+/* Queries running without the lock may still be reading the document table of a dropped index, so
+ * its data is retired rather than freed */
+static void IndexSpec_RetireFree(void *ctx) {
+  IndexSpec *spec = ctx;
+  indexSpec_Unlink(spec);
+  Epoch_Retire(spec, indexSpec_FreeData);
 }
 
 IndexSpec *IndexSpec_LoadEx(RedisModuleCtx *ctx, RedisModuleString *formattedKey, int openWrite,
@@ -587,7 +616,7 @@ RedisModuleString *IndexSpec_GetFormattedKey(IndexSpec *sp, const FieldSpec *fs)
   RedisModuleString *ret = sp->indexStrs[fs->index];
   if (!ret) {
     RedisSearchCtx sctx = {.redisCtx = sp->strCtx, .spec = sp};
-    if (fs->type == FIELD_NUMERIC) {
+    if (FieldSpec_HasNumericIndex(fs)) {
       ret = fmtRedisNumericIndexKey(&sctx, fs->name);
     } else if (fs->type == FIELD_TAG) {
       ret = TagIndex_FormatName(&sctx, fs->name);
@@ -877,7 +906,7 @@ int IndexSpec_RegisterType(RedisModuleCtx *ctx) {
                                .rdb_load = IndexSpec_RdbLoad,
                                .rdb_save = IndexSpec_RdbSave,
                                .aof_rewrite = GenericAofRewrite_DisabledHandler,
-                               .free = IndexSpec_Free};
+                               .free = IndexSpec_RetireFree};
 
   IndexSpecType = RedisModule_CreateDataType(ctx, "ft_index0", INDEX_CURRENT_VERSION, &tm);
   if (IndexSpecType == NULL) {
@@ -102,6 +102,8 @@ typedef struct fieldSpec {
 #define FieldSpec_IsNoStem(fs) ((fs)->options & FieldSpec_NoStemming)
 #define FieldSpec_IsPhonetics(fs) ((fs)->options & FieldSpec_Phonetics)
 #define FieldSpec_IsIndexable(fs) (0 == ((fs)->options & FieldSpec_NotIndexable))
+// Geo fields are kept in numeric indexes too, of the geohashes of their points
+#define FieldSpec_HasNumericIndex(fs) ((fs)->type == FIELD_NUMERIC || (fs)->type == FIELD_GEO)
 
 typedef struct {
   size_t numDocuments;
@@ -128,6 +130,8 @@ typedef enum {
   Index_StoreByteOffsets = 0x40,
   Index_WideSchema = 0x080,
   Index_HasSmap = 0x100,
+  // Full blocks of docId-only inverted indexes are bit-packed, see bitpack.h
+  Index_PackedDocIds = 0x200,
   Index_DocIdsOnly = 0x00,
 } IndexFlags;
 
@@ -249,6 +253,9 @@ extern void (*IndexSpec_OnCreate)(const IndexSpec *sp);
 
 int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len);
 
+/* Remove a term whose inverted index is gone from the spec's terms and stats */
+int IndexSpec_DeleteTerm(IndexSpec *sp, const char *term, size_t len);
+
 /* Get a random term from the index spec using weighted random. Weighted random is done by sampling
  * N terms from the index and then doing weighted random on them. A sample size of 10-20 should be
  * enough */
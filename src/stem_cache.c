@@ -0,0 +1,230 @@
+#include "stem_cache.h"
+#include "phonetic_manager.h"
+#include "rmalloc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// The cache is split into sets of a few entries each, and a token can only live in its own set
+#define STEM_CACHE_SETS 1024
+#define STEM_CACHE_WAYS 4
+
+// Longest token that can be cached, and room for its expansions
+#define STEM_CACHE_MAX_TOKEN 24
+#define STEM_CACHE_MAX_STEM (STEM_CACHE_MAX_TOKEN + 8)
+#define STEM_CACHE_MAX_PHONETIC 16
+
+#define SC_F_USED 0x01
+// Set on every hit, cleared as the CLOCK hand passes over the entry
+#define SC_F_REF 0x02
+#define SC_F_STEM 0x04
+#define SC_F_PHONETIC 0x08
+
+typedef struct {
+  // The stemmer language. Languages come from a static table, so comparing pointers is enough
+  const char *lang;
+  uint32_t hash;
+  uint8_t len;
+  uint8_t stemLen;  // 0 if the token is its own stem
+  uint8_t flags;
+  char tok[STEM_CACHE_MAX_TOKEN];
+  char stem[STEM_CACHE_MAX_STEM];
+  char phonetic[STEM_CACHE_MAX_PHONETIC];
+} stemCacheEntry;
+
+typedef struct stemCache {
+  stemCacheEntry entries[STEM_CACHE_SETS][STEM_CACHE_WAYS];
+  uint8_t hands[STEM_CACHE_SETS];
+
+  // Phonetic code of the last token that could not be cached. Allocated by the phonetic library
+  // with the libc allocator
+  char *scratch;
+
+  size_t hits;
+  size_t misses;
+  struct stemCache *prev, *next;
+} stemCache;
+
+// All the live caches, for the stats. Counters of exited threads are folded into retiredStats_g
+static struct {
+  stemCache *head;
+  StemCacheStats retiredStats;
+  pthread_mutex_t lock;
+} caches_g = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_key_t cacheKey_g;
+
+static void stemCache_Free(void *p) {
+  stemCache *c = p;
+  pthread_mutex_lock(&caches_g.lock);
+  if (c->prev) {
+    c->prev->next = c->next;
+  } else {
+    caches_g.head = c->next;
+  }
+  if (c->next) c->next->prev = c->prev;
+  caches_g.retiredStats.hits += c->hits;
+  caches_g.retiredStats.misses += c->misses;
+  pthread_mutex_unlock(&caches_g.lock);
+
+  free(c->scratch);
+  rm_free(c);
+}
+
+static void __attribute__((constructor)) initKey() {
+  pthread_key_create(&cacheKey_g, stemCache_Free);
+}
+
+static stemCache *getCache() {
+  stemCache *c = pthread_getspecific(cacheKey_g);
+  if (c == NULL) {
+    c = rm_calloc(1, sizeof(*c));
+    pthread_mutex_lock(&caches_g.lock);
+    c->next = caches_g.head;
+    if (c->next) c->next->prev = c;
+    caches_g.head = c;
+    pthread_mutex_unlock(&caches_g.lock);
+    pthread_setspecific(cacheKey_g, c);
+  }
+  return c;
+}
+
+static uint32_t stemCache_Hash(const char *lang, const char *s, size_t len) {
+  // FNV-1a, seeded with the language
+  uint32_t h = 2166136261u ^ (uint32_t)(uintptr_t)lang;
+  for (size_t ii = 0; ii < len; ++ii) {
+    h = (h ^ (uint8_t)s[ii]) * 16777619u;
+  }
+  return h;
+}
+
+/* Find the entry of the token, or evict one for it */
+static stemCacheEntry *stemCache_Get(stemCache *c, const char *lang, const char *tok, size_t len) {
+  uint32_t h = stemCache_Hash(lang, tok, len);
+  size_t set = h % STEM_CACHE_SETS;
+  stemCacheEntry *ents = c->entries[set];
+
+  for (int i = 0; i < STEM_CACHE_WAYS; i++) {
+    stemCacheEntry *e = ents + i;
+    if ((e->flags & SC_F_USED) && e->hash == h && e->len == len && e->lang == lang &&
+        !memcmp(e->tok, tok, len)) {
+      e->flags |= SC_F_REF;
+      return e;
+    }
+  }
+
+  // Give every recently used entry a second chance before evicting it
+  uint8_t hand = c->hands[set];
+  while (ents[hand].flags & SC_F_REF) {
+    ents[hand].flags &= ~SC_F_REF;
+    hand = (hand + 1) % STEM_CACHE_WAYS;
+  }
+  c->hands[set] = (hand + 1) % STEM_CACHE_WAYS;
+
+  stemCacheEntry *e = ents + hand;
+  e->lang = lang;
+  e->hash = h;
+  e->len = len;
+  e->flags = SC_F_USED | SC_F_REF;
+  memcpy(e->tok, tok, len);
+  return e;
+}
+
+/* Compute the phonetic code of a token into a newly allocated string */
+static char *expandPhonetic(const char *tok, size_t len) {
+  char *primary = NULL;
+  PhoneticManager_ExpandPhonerics(NULL, tok, len, &primary, NULL);
+  return primary;
+}
+
+void StemCache_Expand(Stemmer *stemmer, int wantPhonetic, const char *tok, size_t len,
+                      StemCacheEntry *out) {
+  *out = (StemCacheEntry){.stem = NULL, .stemLen = 0, .phonetic = NULL};
+  stemCache *c = getCache();
+  const char *lang = stemmer ? stemmer->language : NULL;
+
+  // Stemmers of languages that are not in the static table can't be told apart
+  if (len > STEM_CACHE_MAX_TOKEN || (stemmer && !lang)) {
+    c->misses++;
+    if (stemmer) {
+      out->stem = stemmer->Stem(stemmer->ctx, tok, len, &out->stemLen);
+    }
+    if (wantPhonetic) {
+      free(c->scratch);
+      c->scratch = expandPhonetic(tok, len);
+      out->phonetic = c->scratch;
+    }
+    return;
+  }
+
+  stemCacheEntry *e = stemCache_Get(c, lang, tok, len);
+  int hit = 1;
+
+  if (stemmer) {
+    if (!(e->flags & SC_F_STEM)) {
+      hit = 0;
+      size_t sl = 0;
+      const char *stem = stemmer->Stem(stemmer->ctx, tok, len, &sl);
+      if (stem && sl > STEM_CACHE_MAX_STEM) {
+        // doesn't fit, so it's not cached and will be stemmed again next time
+        out->stem = stem;
+        out->stemLen = sl;
+      } else {
+        e->stemLen = stem ? sl : 0;
+        if (stem) memcpy(e->stem, stem, sl);
+        e->flags |= SC_F_STEM;
+      }
+    }
+    if (e->flags & SC_F_STEM && e->stemLen) {
+      out->stem = e->stem;
+      out->stemLen = e->stemLen;
+    }
+  }
+
+  if (wantPhonetic) {
+    if (!(e->flags & SC_F_PHONETIC)) {
+      hit = 0;
+      char *primary = expandPhonetic(tok, len);
+      size_t pl = strlen(primary);
+      if (pl < STEM_CACHE_MAX_PHONETIC) {
+        memcpy(e->phonetic, primary, pl + 1);
+        e->flags |= SC_F_PHONETIC;
+        free(primary);
+      } else {
+        free(c->scratch);
+        c->scratch = primary;
+      }
+    }
+    out->phonetic = (e->flags & SC_F_PHONETIC) ? e->phonetic : c->scratch;
+  }
+
+  if (hit) {
+    c->hits++;
+  } else {
+    c->misses++;
+  }
+}
+
+StemCacheStats StemCache_GetStats(void) {
+  pthread_mutex_lock(&caches_g.lock);
+  StemCacheStats st = caches_g.retiredStats;
+  // The counters of other threads are read without synchronization, so they may lag a little
+  for (stemCache *c = caches_g.head; c; c = c->next) {
+    st.hits += c->hits;
+    st.misses += c->misses;
+  }
+  pthread_mutex_unlock(&caches_g.lock);
+  return st;
+}
+
+void StemCache_RenderStats(RedisModuleCtx *ctx) {
+  StemCacheStats st = StemCache_GetStats();
+  size_t total = st.hits + st.misses;
+  RedisModule_ReplyWithArray(ctx, 6);
+  RedisModule_ReplyWithSimpleString(ctx, "hits");
+  RedisModule_ReplyWithDouble(ctx, (double)st.hits);
+  RedisModule_ReplyWithSimpleString(ctx, "misses");
+  RedisModule_ReplyWithDouble(ctx, (double)st.misses);
+  RedisModule_ReplyWithSimpleString(ctx, "hit_rate");
+  RedisModule_ReplyWithDouble(ctx, total ? (double)st.hits / (double)total : 0);
+}
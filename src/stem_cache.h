@@ -0,0 +1,40 @@
+#ifndef __RS_STEM_CACHE_H__
+#define __RS_STEM_CACHE_H__
+
+#include "stemmer.h"
+#include "redismodule.h"
+#include <stddef.h>
+
+/* A per-thread cache of the stems and phonetic codes of tokens.
+ *
+ * Word frequencies in natural language are heavily skewed, so most of the tokens the indexing
+ * threads see are the same few thousand words over and over. Every thread keeps a small, fixed
+ * size cache keyed by the stemmer language and the normalized token, and evicts with the CLOCK
+ * algorithm. Tokens too long to fit in an entry are always expanded directly. */
+
+/* The expansions of a token. The strings belong to the calling thread's cache, and are only valid
+ * until its next call to StemCache_Expand */
+typedef struct {
+  // The stem, with its STEM_PREFIX, or NULL if the token is its own stem
+  const char *stem;
+  size_t stemLen;
+  // The primary phonetic code, with its PHONETIC_PREFIX, or NULL if there is none
+  const char *phonetic;
+} StemCacheEntry;
+
+/* Expand a normalized token. The stem is computed only if stemmer is not NULL, and the phonetic
+ * code only if wantPhonetic is set */
+void StemCache_Expand(Stemmer *stemmer, int wantPhonetic, const char *tok, size_t len,
+                      StemCacheEntry *out);
+
+/* Reply with the hit and miss counters of all the threads' caches */
+void StemCache_RenderStats(RedisModuleCtx *ctx);
+
+typedef struct {
+  size_t hits;
+  size_t misses;
+} StemCacheStats;
+
+StemCacheStats StemCache_GetStats(void);
+
+#endif
@@ -87,7 +87,7 @@ static inline size_t tagIndex_Put(TagIndex *idx, char *value, size_t len, t_docI
 
   InvertedIndex *iv = TrieMap_Find(idx->values, value, len);
   if (iv == TRIEMAP_NOTFOUND) {
-    iv = NewInvertedIndex(Index_DocIdsOnly, 1);
+    iv = NewInvertedIndex(Index_DocIdsOnly | Index_PackedDocIds, 1);
     TrieMap_Add(idx->values, value, len, iv, NULL);
   }
 
@@ -125,30 +125,9 @@ static void TagReader_OnReopen(RedisModuleKey *k, void *privdata) {
     return;
   }
 
-  // If the key is valid, we just reset the reader's buffer reader to the current block pointer
+  // If the key is valid, we just keep reading, see IndexReader_Resume
   ctx->idx = RedisModule_ModuleTypeGetValue(k);
-  IndexReader *ir = ctx->it->ctx;
-  ir->idx = ir->idx;
-
-  // the gc marker tells us if there is a chance the keys has undergone GC while we were asleep
-  if (ir->gcMarker == ir->idx->gcMarker) {
-    // no GC - we just go to the same offset we were at
-    size_t offset = ir->br.pos;
-    ir->br = NewBufferReader(ir->idx->blocks[ir->currentBlock].data);
-    ir->br.pos = offset;
-  } else {
-    // if there has been a GC cycle on this key while we were asleep, the offset might not be valid
-    // anymore. This means that we need to seek to last docId we were at
-
-    // reset the state of the reader
-    t_docId lastId = ir->lastId;
-    ir->br = NewBufferReader(ir->idx->blocks[ir->currentBlock].data);
-    ir->lastId = 0;
-
-    // seek to the previous last id
-    RSIndexResult *dummy = NULL;
-    IR_SkipTo(ir, lastId, &dummy);
-  }
+  IndexReader_Resume(ctx->it->ctx);
 }
 
 /* Open an index reader to iterate a tag index for a specific tag. Used at query evaluation time.
@@ -174,16 +153,22 @@ IndexIterator *TagIndex_OpenReader(TagIndex *idx, DocTable *dt, const char *valu
 
   // register the on reopen function
   if (csx) {
-    struct TagReaderCtx *tc = malloc(sizeof(*tc));
-    tc->idx = idx;
-    tc->it = it;
-    ConcurrentSearch_AddKey(csx, k, REDISMODULE_READ, keyName, TagReader_OnReopen, tc, free,
-                            ConcurrentKey_SharedKey | ConcurrentKey_SharedKeyString);
+    TagIndex_RegisterReader(idx, it, csx, k, keyName);
   }
 
   return it;
 }
 
+void TagIndex_RegisterReader(TagIndex *idx, IndexIterator *it, ConcurrentSearchCtx *csx,
+                             RedisModuleKey *k, RedisModuleString *keyName) {
+  struct TagReaderCtx *tc = malloc(sizeof(*tc));
+  tc->idx = idx;
+  tc->it = it;
+  ConcurrentSearch_AddKey(csx, k, REDISMODULE_READ, keyName, TagReader_OnReopen, tc, free,
+                          ConcurrentKey_SharedKey | ConcurrentKey_SharedKeyString |
+                              ConcurrentKey_ResumeOnly);
+}
+
 /* Format the key name for a tag index */
 RedisModuleString *TagIndex_FormatName(RedisSearchCtx *sctx, const char *field) {
   return RedisModule_CreateStringPrintf(sctx->redisCtx, TAG_INDEX_KEY_FMT, sctx->spec->name, field);
@@ -241,6 +226,9 @@ void TagIndex_SerializeValues(TagIndex *idx, RedisModuleCtx *ctx) {
 RedisModuleType *TagIndexType;
 
 void *TagIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
+  if (encver > TAGIDX_CURRENT_VERSION) {
+    return NULL;
+  }
   unsigned long long elems = RedisModule_LoadUnsigned(rdb);
   TagIndex *idx = NewTagIndex();
 
@@ -281,6 +269,12 @@ void TagIndex_Free(void *p) {
   rm_free(idx);
 }
 
+/* Queries may still be reading the values of a tag index whose key was deleted, so it is retired
+ * rather than freed */
+static void TagIndex_RetireFree(void *p) {
+  Epoch_Retire(p, TagIndex_Free);
+}
+
 size_t TagIndex_MemUsage(const void *value) {
   const TagIndex *idx = value;
   size_t sz = sizeof(*idx);
@@ -302,7 +296,7 @@ int TagIndex_RegisterType(RedisModuleCtx *ctx) {
                                .rdb_load = TagIndex_RdbLoad,
                                .rdb_save = TagIndex_RdbSave,
                                .aof_rewrite = GenericAofRewrite_DisabledHandler,
-                               .free = TagIndex_Free,
+                               .free = TagIndex_RetireFree,
                                .mem_usage = TagIndex_MemUsage};
 
   TagIndexType = RedisModule_CreateDataType(ctx, "ft_tagidx", TAGIDX_CURRENT_VERSION, &tm);
@@ -114,6 +114,11 @@ IndexIterator *TagIndex_OpenReader(TagIndex *idx, DocTable *dt, const char *valu
                                    ConcurrentSearchCtx *csx, RedisModuleKey *k,
                                    RedisModuleString *keyName, double weight);
 
+/* Register an iterator opened by TagIndex_OpenReader without a concurrent context, so that the
+ * tag index key is checked when the query resumes, as if it had been opened with csx */
+void TagIndex_RegisterReader(TagIndex *idx, IndexIterator *it, ConcurrentSearchCtx *csx,
+                             RedisModuleKey *k, RedisModuleString *keyName);
+
 /* Open the tag index key in redis */
 TagIndex *TagIndex_Open(RedisModuleCtx *ctx, RedisModuleString *formattedKey, int openWrite,
                         RedisModuleKey **keyp);
@@ -121,7 +126,8 @@ TagIndex *TagIndex_Open(RedisModuleCtx *ctx, RedisModuleString *formattedKey, in
 /* Serialize all the tags in the index to the redis client */
 void TagIndex_SerializeValues(TagIndex *idx, RedisModuleCtx *ctx);
 
-#define TAGIDX_CURRENT_VERSION 1
+// Version 2 saves tag values with bit-packed blocks, see INVERTED_INDEX_MIN_PACKED_VER
+#define TAGIDX_CURRENT_VERSION 2
 extern RedisModuleType *TagIndexType;
 /* Register the tag index type in redis */
 int TagIndex_RegisterType(RedisModuleCtx *ctx);
@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
 #include <aggregate/aggregate.h>
 #include <aggregate/reducer.h>
 #include "test_util.h"
 #include "time_sample.h"
 #include <util/arr.h>
 #include <rmutil/alloc.h>
+#include <config.h>
 
 struct mockProcessorCtx {
   int counter;
@@ -176,6 +178,260 @@ int testGroupSplit() {
   RETURN_TEST_SUCCESS;
 }
 
+#define NUM_DISTINCT 50000
+
+int mock_Next_Distinct(ResultProcessorCtx *ctx, SearchResult *res) {
+
+  struct mockProcessorCtx *p = ctx->privdata;
+  if (p->counter >= NUM_RESULTS) return RS_RESULT_EOF;
+
+  res->docId = ++p->counter;
+  RSFieldMap_Set(&res->fields, "value", RS_NumVal((double)(p->counter % NUM_DISTINCT)));
+  return RS_RESULT_OK;
+}
+
+/* Group NUM_DISTINCT groups under the given memory budget, 0 for unlimited */
+static int groupDistinct(size_t memBudget) {
+  struct mockProcessorCtx ctx = {0};
+  RSGlobalConfig.aggregateMemoryBudget = memBudget;
+
+  ResultProcessor *mp = NewResultProcessor(NULL, &ctx);
+  mp->Next = mock_Next_Distinct;
+  mp->Free = NULL;
+  RSMultiKey *keys = RS_NewMultiKeyVariadic(1, "value");
+
+  Grouper *gr = NewGrouper(keys, NULL);
+  Grouper_AddReducer(gr, NewCount(NULL, "countie"));
+
+  ResultProcessor *gp = NewGrouperProcessor(gr, mp);
+  SearchResult *res = NewSearchResult();
+  res->fields = NULL;
+  char *seen = calloc(NUM_DISTINCT, 1);
+  int n = 0;
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  while (ResultProcessor_Next(gp, res, 0) != RS_RESULT_EOF) {
+    RSValue *rv = RSValue_Dereference(RSFieldMap_Get(res->fields, "value"));
+    ASSERT(rv->t == RSValue_Number);
+    int v = rv->numval;
+    ASSERT(v >= 0 && v < NUM_DISTINCT);
+    ASSERT(!seen[v]);
+    seen[v] = 1;
+    ASSERT_EQUAL((NUM_RESULTS / NUM_DISTINCT), RSFieldMap_Get(res->fields, "countie")->numval);
+    RSFieldMap_Reset(res->fields);
+    n++;
+  }
+  TimeSampler_End(&ts);
+  ASSERT_EQUAL(NUM_DISTINCT, n);
+  printf("%d groups in %fms, %fns/iter", NUM_DISTINCT, TimeSampler_DurationSec(&ts) * 1000,
+         (double)(TimeSampler_DurationNS(&ts)) / (double)NUM_RESULTS);
+  free(seen);
+  SearchResult_Free(res);
+  gp->Free(gp);
+  RSGlobalConfig.aggregateMemoryBudget = 0;
+  RETURN_TEST_SUCCESS;
+}
+
+int testGroupDistinct() {
+  return groupDistinct(0);
+}
+
+int testGroupSpill() {
+  // small enough for the partitions to be partitioned again
+  return groupDistinct(16 * 1024);
+}
+
+int testSortSpill() {
+  char *values[] = {"foo", "bar", "baz"};
+  // only the last NUM_DISTINCT results of the mock
+  struct mockProcessorCtx ctx = {NUM_RESULTS - NUM_DISTINCT, values, 3};
+  QueryProcessingCtx pc = {};
+  RSGlobalConfig.aggregateMemoryBudget = 64 * 1024;
+
+  ResultProcessor *mp = NewResultProcessor(NULL, &ctx);
+  mp->Next = mock_Next;
+  mp->Free = NULL;
+  mp->ctx.qxc = &pc;
+  // sort by value, then by descending score
+  ResultProcessor *sp =
+      NewSorterByFields(RS_NewMultiKeyVariadic(2, "value", "score"), 0x1, 0, mp);
+
+  SearchResult *res = NewSearchResult();
+  res->fields = NULL;
+  int n = 0;
+  char *last = NULL;
+  double lastScore = 0;
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  while (ResultProcessor_Next(sp, res, 0) != RS_RESULT_EOF) {
+    RSValue *v = RSValue_Dereference(RSFieldMap_Get(res->fields, "value"));
+    double score = RSFieldMap_Get(res->fields, "score")->numval;
+    ASSERT(RSValue_IsString(v));
+    if (last) {
+      int rc = strcmp(last, v->strval.str);
+      ASSERT(rc <= 0);
+      ASSERT(rc < 0 || lastScore > score);
+      free(last);
+    }
+    last = strdup(v->strval.str);
+    lastScore = score;
+    RSFieldMap_Free(res->fields);
+    res->fields = NULL;
+    n++;
+  }
+  TimeSampler_End(&ts);
+  ASSERT_EQUAL(NUM_DISTINCT, n);
+  printf("%d spilled results sorted in %fms", n, TimeSampler_DurationSec(&ts) * 1000);
+  free(last);
+  SearchResult_Free(res);
+  sp->Free(sp);
+  RSGlobalConfig.aggregateMemoryBudget = 0;
+  RETURN_TEST_SUCCESS;
+}
+
+#define MERGE_RESULTS 30000
+
+struct mockRangeCtx {
+  int counter;
+  int end;
+};
+
+int mock_Next_Range(ResultProcessorCtx *ctx, SearchResult *res) {
+  static char *values[] = {"foo", "bar", "baz"};
+  struct mockRangeCtx *p = ctx->privdata;
+  if (p->counter >= p->end) return RS_RESULT_EOF;
+
+  res->docId = ++p->counter;
+  RSFieldMap_Set(&res->fields, "value", RS_ConstStringValC(values[p->counter % 3]));
+  RSFieldMap_Set(&res->fields, "score", RS_NumVal((double)p->counter));
+  return RS_RESULT_OK;
+}
+
+struct mockRowsCtx {
+  RSFieldMap **rows;
+  size_t pos;
+};
+
+/* Replay rows yielded by another processor */
+int mock_Next_Rows(ResultProcessorCtx *ctx, SearchResult *res) {
+  struct mockRowsCtx *p = ctx->privdata;
+  if (p->pos >= array_len(p->rows)) return RS_RESULT_EOF;
+
+  RSFieldMap *row = p->rows[p->pos++];
+  res->docId = p->pos;
+  for (uint16_t i = 0; i < row->len; i++) {
+    RSFieldMap_Set(&res->fields, row->fields[i].key, row->fields[i].val);
+  }
+  return RS_RESULT_OK;
+}
+
+ResultProcessor *newMergeGrouper(ResultProcessor *upstream, ReducerPhase phase) {
+  Grouper *gr = NewGrouper(RS_NewMultiKeyVariadic(1, "value"), NULL);
+  Reducer *reducers[] = {
+      NewCount(NULL, "count"),
+      NewSum(NULL, "score", "sum"),
+      NewAvg(NULL, "score", "avg"),
+      NewMin(NULL, "score", "min"),
+      NewMax(NULL, "score", "max"),
+      NewStddev(NULL, "score", "stddev"),
+      NewQuantile(NULL, "score", "median", 0.5, 500),
+      NewCountDistinct(NULL, "distinct", "score"),
+      NewCountDistinctish(NULL, "distinctish", "score"),
+      NewToList(NULL, "value", "list"),
+  };
+  for (size_t i = 0; i < sizeof(reducers) / sizeof(*reducers); i++) {
+    int rc = Reducer_SetPhase(reducers[i], phase);
+    assert(rc);
+    Grouper_AddReducer(gr, reducers[i]);
+  }
+  return NewGrouperProcessor(gr, upstream);
+}
+
+/* Run a processor to its end, keeping the field maps of its results */
+RSFieldMap **collectRows(ResultProcessor *rp, RSFieldMap **rows) {
+  SearchResult *res = NewSearchResult();
+  res->fields = NULL;
+  while (ResultProcessor_Next(rp, res, 0) != RS_RESULT_EOF) {
+    rows = array_append(rows, res->fields);
+    res->fields = NULL;
+  }
+  SearchResult_Free(res);
+  return rows;
+}
+
+RSFieldMap *findRow(RSFieldMap **rows, const char *value) {
+  for (size_t i = 0; i < array_len(rows); i++) {
+    RSValue *v = RSFieldMap_Get(rows[i], "value");
+    if (v && RSValue_IsString(v) && !strcmp(RSValue_StringPtrLen(v, NULL), value)) {
+      return rows[i];
+    }
+  }
+  return NULL;
+}
+
+double rowNumber(RSFieldMap *row, const char *key) {
+  double d = -1;
+  RSValue_ToNumber(RSFieldMap_Get(row, key), &d);
+  return d;
+}
+
+int testGroupMerge() {
+  // reduce all the results at once
+  struct mockRangeCtx all = {0, MERGE_RESULTS};
+  ResultProcessor *mp = NewResultProcessor(NULL, &all);
+  mp->Next = mock_Next_Range;
+  mp->Free = NULL;
+  ResultProcessor *complete = newMergeGrouper(mp, Reducer_Complete);
+  RSFieldMap **expected = collectRows(complete, array_new(RSFieldMap *, 3));
+
+  // reduce each half to partial states, and merge them
+  struct mockRangeCtx halves[] = {{0, MERGE_RESULTS / 2}, {MERGE_RESULTS / 2, MERGE_RESULTS}};
+  ResultProcessor *partial[2];
+  RSFieldMap **states = array_new(RSFieldMap *, 6);
+  for (int i = 0; i < 2; i++) {
+    mp = NewResultProcessor(NULL, &halves[i]);
+    mp->Next = mock_Next_Range;
+    mp->Free = NULL;
+    partial[i] = newMergeGrouper(mp, Reducer_Partial);
+    states = collectRows(partial[i], states);
+  }
+  ASSERT_EQUAL(6, array_len(states));
+
+  struct mockRowsCtx replay = {states, 0};
+  mp = NewResultProcessor(NULL, &replay);
+  mp->Next = mock_Next_Rows;
+  mp->Free = NULL;
+  ResultProcessor *final = newMergeGrouper(mp, Reducer_Final);
+  RSFieldMap **merged = collectRows(final, array_new(RSFieldMap *, 3));
+
+  ASSERT_EQUAL(3, array_len(expected));
+  ASSERT_EQUAL(3, array_len(merged));
+  const char *exact[] = {"count", "sum", "min", "max", "distinct", "distinctish"};
+  for (int i = 0; i < 3; i++) {
+    const char *value = RSValue_StringPtrLen(RSFieldMap_Get(expected[i], "value"), NULL);
+    RSFieldMap *row = findRow(merged, value);
+    ASSERT(row != NULL);
+    for (int j = 0; j < sizeof(exact) / sizeof(*exact); j++) {
+      ASSERT_EQUAL(rowNumber(expected[i], exact[j]), rowNumber(row, exact[j]));
+    }
+    ASSERT(fabs(rowNumber(expected[i], "avg") - rowNumber(row, "avg")) < 1e-6);
+    ASSERT(fabs(rowNumber(expected[i], "stddev") - rowNumber(row, "stddev")) < 1e-6);
+    // both are estimates, within a fraction of the range
+    ASSERT(fabs(rowNumber(expected[i], "median") - rowNumber(row, "median")) <
+           MERGE_RESULTS * 0.02);
+    ASSERT_EQUAL(1, RSValue_ArrayLen(RSFieldMap_Get(row, "list")));
+  }
+
+  array_free_ex(merged, RSFieldMap_Free(*(RSFieldMap **)ptr));
+  array_free_ex(states, RSFieldMap_Free(*(RSFieldMap **)ptr));
+  array_free_ex(expected, RSFieldMap_Free(*(RSFieldMap **)ptr));
+  final->Free(final);
+  partial[0]->Free(partial[0]);
+  partial[1]->Free(partial[1]);
+  complete->Free(complete);
+  RETURN_TEST_SUCCESS;
+}
+
 int testAggregatePlan() {
   CmdString *argv = CmdParser_NewArgListV(
       39, "FT.AGGREGATE", "idx", "foo bar", "APPLY", "@foo", "AS", "@bar", "GROUPBY", "2", "@foo",
@@ -209,95 +465,86 @@ int testAggregatePlan() {
   RETURN_TEST_SUCCESS
 }
 
-/*
 int testDistribute() {
-  CmdString *argv = CmdParser_NewArgListV(
-      22, "FT.AGGREGATE", "idx", "foo", "GROUPBY", "1", "@bar", "REDUCE", "AVG", "1", "@foo",
-"AS", "num", "REDUCE", "MAX", "1", "@bar", "AS", "sum_bar", "SORTBY", "2", "@num", "DESC");
-
+  const char *args[] = {"FT.AGGREGATE", "idx",    "foo",      "APPLY",   "@foo*2", "AS",
+                        "foo2",         "GROUPBY", "1",       "@bar",    "REDUCE", "AVG",
+                        "1",            "@foo2",   "AS",      "num",     "REDUCE", "QUANTILE",
+                        "2",            "@foo",    "0.5",     "AS",      "q",      "SORTBY",
+                        "2",            "@num",    "DESC"};
+  int len = sizeof(args) / sizeof(char *);
+  CmdString *argv = CmdParser_NewArgListC(args, len);
   CmdArg *cmd = NULL;
-  char *err;
+  char *err = NULL;
   Aggregate_BuildSchema();
-  CmdParser_ParseCmd(GetAggregateRequestSchema(), &cmd, argv, 22, &err, 1);
-  printf("%s\n", err);
+  CmdParser_ParseCmd(GetAggregateRequestSchema(), &cmd, argv, len, &err, 1);
   ASSERT(!err);
-  ASSERT(cmd);
-
-  CmdArg_Print(cmd, 0);
 
   AggregatePlan plan;
-  int rc = AggregatePlan_Build(&plan, cmd, &err);
-  if (err) printf("%s\n", err);
-  ASSERT(rc);
-
+  ASSERT(AggregatePlan_Build(&plan, cmd, &err));
+  ASSERT(AggregatePlan_MakeDistributed(&plan, &err));
   ASSERT(!err);
 
-  AggregatePlan_Print(&plan);
-
-  printf("----------------\n");
-  printf("----------------\n");
-
-  AggregatePlan distro;
-  rc = AggregatePlan_MakeDistributed(&plan, &distro);
-  ASSERT(rc);
-  printf("----------------\n");
-  AggregatePlan_Print(&plan);
-  printf("----------------\n");
-
-  AggregatePlan_Print(&distro);
-  AggregatePlan_Free(&plan);
-
-  RETURN_TEST_SUCCESS;
-}
-
-int testRevertToBasic() {
-  CmdString *argv =
-      CmdParser_NewArgListV(22, "FT.AGGREGATE", "idx", "foo", "GROUPBY", "1", "@bar", "REDUCE",
-                            "COUNT_DISTINCT", "1", "@foo", "AS", "num", "REDUCE", "MAX", "1",
-                            "@bar", "AS", "sum_bar", "SORTBY", "2", "@num", "DESC");
-
-  CmdArg *cmd = NULL;
-  char *err;
-  Aggregate_BuildSchema();
-  CmdParser_ParseCmd(GetAggregateRequestSchema(), &cmd, argv, 22, &err, 1);
-  printf("%s\n", err);
+  // the shards group into partial states, which the plan merges before sorting
+  const char *expected[] = {
+      "FT.AGGREGATE", "idx",   "{{",    "FT.AGGREGATE", "idx",   "foo",      "APPLY", "@foo*2",
+      "AS",           "foo2",  "GROUPBY", "1",          "@bar",  "PARTIAL",  "REDUCE", "AVG",
+      "1",            "@foo2", "AS",    "num",          "REDUCE", "QUANTILE", "2",     "@foo",
+      "0.5",          "AS",    "q",     "}}",           "GROUPBY", "1",       "@bar",  "FINAL",
+      "REDUCE",       "AVG",   "1",     "@foo2",        "AS",    "num",      "REDUCE", "QUANTILE",
+      "2",            "@foo",  "0.5",   "AS",           "q",     "SORTBY",   "2",     "@num",
+      "DESC"};
+  char **ser = AggregatePlan_Serialize(&plan);
+  ASSERT_EQUAL(sizeof(expected) / sizeof(*expected), array_len(ser));
+  for (int i = 0; i < array_len(ser); i++) {
+    ASSERT_STRING_EQ(expected[i], ser[i]);
+  }
+  array_free_ex(ser, free(*(void **)ptr));
+
+  // the shard's command parses back into a partial group
+  AggregateStep *dist = plan.head->next;
+  ASSERT_EQUAL(AggregateStep_Distribute, dist->type);
+  ser = AggregatePlan_Serialize(dist->dist.plan);
+  CmdArg *shardCmd = NULL;
+  CmdParser_ParseCmd(GetAggregateRequestSchema(), &shardCmd,
+                     CmdParser_NewArgListC((const char **)ser, array_len(ser)), array_len(ser),
+                     &err, 1);
   ASSERT(!err);
-  ASSERT(cmd);
-
-  CmdArg_Print(cmd, 0);
-
-  AggregatePlan plan;
-  int rc = AggregatePlan_Build(&plan, cmd, &err);
-  if (err) printf("%s\n", err);
-  ASSERT(rc);
+  AggregatePlan shardPlan;
+  ASSERT(AggregatePlan_Build(&shardPlan, shardCmd, &err));
+  AggregateStep *grp = shardPlan.head;
+  while (grp && grp->type != AggregateStep_Group) grp = grp->next;
+  ASSERT(grp != NULL);
+  ASSERT_EQUAL(Reducer_Partial, grp->group.phase);
+  AggregatePlan_Free(&shardPlan);
+  array_free_ex(ser, free(*(void **)ptr));
+  AggregatePlan_Free(&plan);
 
+  // random samples can't be merged, so this plan stays as it is
+  const char *sampleArgs[] = {"FT.AGGREGATE", "idx", "foo",           "GROUPBY", "1",    "@bar",
+                              "REDUCE",       "RANDOM_SAMPLE", "2", "@foo",    "10"};
+  len = sizeof(sampleArgs) / sizeof(char *);
+  cmd = NULL;
+  CmdParser_ParseCmd(GetAggregateRequestSchema(), &cmd, CmdParser_NewArgListC(sampleArgs, len),
+                     len, &err, 1);
   ASSERT(!err);
-
-  AggregatePlan_Print(&plan);
-
-  printf("----------------\n");
-  printf("----------------\n");
-
-  AggregatePlan distro;
-  rc = AggregatePlan_MakeDistributed(&plan, &distro);
-  ASSERT(rc);
-  printf("----------------\n");
-  AggregatePlan_Print(&plan);
-  printf("----------------\n");
-
-  AggregatePlan_Print(&distro);
+  ASSERT(AggregatePlan_Build(&plan, cmd, &err));
+  ASSERT(!AggregatePlan_MakeDistributed(&plan, &err));
+  ASSERT(err != NULL);
+  free(err);
+  ASSERT_EQUAL(AggregateStep_Query, plan.head->next->type);
   AggregatePlan_Free(&plan);
-
   RETURN_TEST_SUCCESS;
 }
-*/
 TEST_MAIN({
   RMUTil_InitAlloc();
 
-  // TESTFUNC(testRevertToBasic);
   TESTFUNC(testGroupSplit);
   TESTFUNC(testGroupBy);
+  TESTFUNC(testGroupDistinct);
+  TESTFUNC(testGroupSpill);
+  TESTFUNC(testSortSpill);
+  TESTFUNC(testGroupMerge);
   TESTFUNC(testAggregatePlan);
   TESTFUNC(testPlanSchema);
-  // TESTFUNC(testDistribute);
+  TESTFUNC(testDistribute);
 })
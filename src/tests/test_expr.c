@@ -206,7 +206,89 @@ int testPropertyFetch() {
   RETURN_TEST_SUCCESS;
   RETURN_TEST_SUCCESS;
 }
+/* Evaluate an expression both interpreted and compiled, and compare the results */
+int testCompiledEval(const char *e, SearchResult *r) {
+  char *err = NULL;
+  RSExpr *root = RSExpr_Parse(e, strlen(e), &err);
+  ASSERT(root != NULL);
+  RSExprProgram *prog = RSExprProgram_Compile(root, NULL);
+  RSFunctionEvalCtx *fctx = RS_NewFunctionEvalCtx();
+  fctx->res = r;
+  RSExprEvalCtx ctx = {.r = r, .fctx = fctx};
+
+  // evaluate twice, to make sure the registers are reset
+  for (int i = 0; i < 2; i++) {
+    RSValue v1 = RSVALUE_STATIC, v2 = RSVALUE_STATIC;
+    int rc1 = RSExpr_Eval(&ctx, root, &v1, &err);
+    int rc2 = RSExprProgram_Eval(prog, &ctx, &v2, &err);
+    if (rc1 != rc2) FAIL("'%s' evaluated to %d, compiled to %d", e, rc1, rc2);
+    if (rc1 == EXPR_EVAL_OK) {
+      if (RSValue_IsNull(&v1) != RSValue_IsNull(&v2) ||
+          (!RSValue_IsNull(&v1) && RSValue_Cmp(&v1, &v2) != 0)) {
+        FAIL("'%s' evaluated and compiled to different values", e);
+      }
+      if (RSValue_Dereference(&v1)->t == RSValue_Number) {
+        ASSERT_EQUAL(RSValue_Number, RSValue_Dereference(&v2)->t);
+      }
+    }
+    RSValue_Free(&v1);
+    RSValue_Free(&v2);
+  }
+
+  RSFunctionEvalCtx_Free(fctx);
+  RSExprProgram_Free(prog);
+  RSExpr_Free(root);
+  return 0;
+}
+
+int testCompiled() {
+  RegisterMathFunctions();
+  SearchResult *rs = NewSearchResult();
+  rs->docId = 1;
+  RSFieldMap_Add(&rs->fields, "foo", RS_NumVal(10));
+  RSFieldMap_Add(&rs->fields, "bar", RS_NumVal(2));
+  RSFieldMap_Add(&rs->fields, "str", RS_ConstStringVal("hello", 5));
+  RSFieldMap_Add(&rs->fields, "num", RS_ConstStringVal("3.5", 3));
+
+  const char *exprs[] = {
+      "1 + 2 * 3",
+      "(((2 + 2) * (3 / 4) + 2 % 3 - 0.43) ^ -3)",
+      "@foo + @bar * 2",
+      "@foo / (1 + 1)",
+      "@num * 2",
+      "@str + 1",
+      "@missing + 1",
+      "@foo",
+      "@str",
+      "'foo'",
+      "NULL",
+      "@foo == 10",
+      "@foo > @bar && @bar > 1",
+      "@foo < @bar || !(@bar == 2)",
+      "(@foo + 1) == 11",
+      "@str == 'hello'",
+      "@str != NULL",
+      "@missing == NULL",
+      "!@missing",
+      "!NULL",
+      "!0",
+      "1 == 1 && 2 == 2",
+      "!(1 == 3) || 2",
+      "sqrt(@foo * 10) + floor(@foo / 3)",
+      "abs(-5 / 20) + log2(2 + 2)",
+      "sqrt('foo')",
+      "(@foo > 5) * 100",
+  };
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(*exprs); i++) {
+    if (testCompiledEval(exprs[i], rs) != 0) return -1;
+  }
+
+  SearchResult_Free(rs);
+  RETURN_TEST_SUCCESS;
+}
+
 TEST_MAIN({
+  TESTFUNC(testCompiled);
   TESTFUNC(testNull);
   TESTFUNC(testPredicate);
   TESTFUNC(testExpr);
@@ -7,6 +7,12 @@
 #include "../spec.h"
 #include "../tokenize.h"
 #include "../varint.h"
+#include "../bitpack.h"
+#include "../doc_bitmap.h"
+#include "../wand_iterator.h"
+#include "../epoch.h"
+#include "../fork_gc.h"
+#include "../util/arr.h"
 #include "test_util.h"
 #include "time_sample.h"
 #include "../rmutil/alloc.h"
@@ -15,6 +21,9 @@
 #include <stdio.h>
 #include <time.h>
 #include <float.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 RSOffsetIterator _offsetVector_iterate(RSOffsetVector *v);
 int testVarint() {
@@ -287,6 +296,7 @@ int testUnion() {
   irs[1] = NewReadIterator(r2);
 
   IndexIterator *ui = NewUnionIterator(irs, 2, NULL, 0, 1);
+  ASSERT_EQUAL(20, ui->NumEstimated(ui->ctx));
   RSIndexResult *h = NULL;
   int expected[] = {2, 3, 4, 6, 8, 9, 10, 12, 14, 15, 16, 18, 20, 21, 24, 27, 30};
   int i = 0;
@@ -308,12 +318,160 @@ int testUnion() {
   }
 
   ui->Free(ui);
+
+  // the children overlap, so the estimate is capped by the size of the index
+  DocTable dt = {.maxDocId = 17};
+  irs = calloc(2, sizeof(IndexIterator *));
+  irs[0] = NewReadIterator(NewTermIndexReader(w, NULL, RS_FIELDMASK_ALL, NULL, 1));
+  irs[1] = NewReadIterator(NewTermIndexReader(w2, NULL, RS_FIELDMASK_ALL, NULL, 1));
+  ui = NewUnionIterator(irs, 2, &dt, 0, 1);
+  ASSERT_EQUAL(17, ui->NumEstimated(ui->ctx));
+  ui->Free(ui);
+
   // IndexResult_Free(&h);
   InvertedIndex_Free(w);
   InvertedIndex_Free(w2);
   return 0;
 }
 
+int testUnionHeap() {
+  // enough children to make the union use a heap. Child n has the multiples of n+2
+  const int num = UNION_HEAP_THRESHOLD + 4;
+  InvertedIndex *idxs[num];
+  for (int quickExit = 0; quickExit < 2; quickExit++) {
+    IndexIterator **irs = calloc(num, sizeof(IndexIterator *));
+    for (int n = 0; n < num; n++) {
+      idxs[n] = createIndex(100, n + 2);
+      irs[n] = NewReadIterator(NewTermIndexReader(idxs[n], NULL, RS_FIELDMASK_ALL, NULL, 1));
+    }
+    IndexIterator *ui = NewUnionIterator(irs, num, NULL, quickExit, 1);
+    ASSERT(((UnionContext *)ui->ctx)->heap != NULL);
+
+    RSIndexResult *h = NULL;
+    t_docId expected = 1;
+    for (int round = 0; round < 2; round++) {
+      expected = 1;
+      while (ui->Read(ui->ctx, &h) != INDEXREAD_EOF) {
+        // find the next id that is a multiple of any child
+        int matches;
+        do {
+          expected++;
+          matches = 0;
+          for (int n = 0; n < num; n++) {
+            if (expected % (n + 2) == 0 && expected / (n + 2) <= 100) matches++;
+          }
+        } while (!matches);
+        ASSERT_EQUAL(expected, h->docId);
+        ASSERT_EQUAL((quickExit ? 1 : matches), h->agg.numChildren);
+      }
+      ASSERT_EQUAL(100 * (num + 1), expected);
+      ui->Rewind(ui->ctx);
+    }
+
+    // 2 * 97 is only in the first child. Around 1000 only children of 11 and up have ids, so the
+    // next ids after 1009 (a prime) are 1012 (11 * 92) and 1014 (13 * 78)
+    ASSERT_EQUAL(INDEXREAD_OK, ui->SkipTo(ui->ctx, 2 * 97, &h));
+    ASSERT_EQUAL(2 * 97, h->docId);
+    ASSERT_EQUAL(INDEXREAD_NOTFOUND, ui->SkipTo(ui->ctx, 1009, &h));
+    ASSERT_EQUAL(1012, h->docId);
+    ASSERT_EQUAL(INDEXREAD_OK, ui->Read(ui->ctx, &h));
+    ASSERT_EQUAL(1014, h->docId);
+    ASSERT_EQUAL(INDEXREAD_EOF, ui->SkipTo(ui->ctx, 100000, &h));
+
+    ui->Free(ui);
+    for (int n = 0; n < num; n++) {
+      InvertedIndex_Free(idxs[n]);
+    }
+  }
+  RETURN_TEST_SUCCESS;
+}
+
+/* A SkipTo that does not move the reader, and reports the last id it read */
+static int stuck_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
+  *hit = IR_Current(ctx);
+  return INDEXREAD_NOTFOUND;
+}
+
+int testUnionHeapStuckChild() {
+  const int num = UNION_HEAP_THRESHOLD;
+  InvertedIndex *idxs[num];
+  IndexIterator **irs = calloc(num, sizeof(IndexIterator *));
+  for (int n = 0; n < num; n++) {
+    idxs[n] = createIndex(100, n + 2);
+    irs[n] = NewReadIterator(NewTermIndexReader(idxs[n], NULL, RS_FIELDMASK_ALL, NULL, 1));
+  }
+  // the first child only moves when it is read
+  irs[0]->SkipTo = stuck_SkipTo;
+
+  IndexIterator *ui = NewUnionIterator(irs, num, NULL, 0, 1);
+  ASSERT(((UnionContext *)ui->ctx)->heap != NULL);
+  RSIndexResult *h = NULL;
+  ASSERT_EQUAL(INDEXREAD_OK, ui->Read(ui->ctx, &h));
+  ASSERT_EQUAL(2, h->docId);
+
+  // the stuck child keeps the id it reported, and comes up first
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, ui->SkipTo(ui->ctx, 101, &h));
+  ASSERT_EQUAL(2, h->docId);
+  ASSERT_EQUAL(2, ui->LastDocId(ui->ctx));
+  // the others were skipped past 101, so the stuck child is read on its own until it gets there
+  ASSERT_EQUAL(INDEXREAD_OK, ui->Read(ui->ctx, &h));
+  ASSERT_EQUAL(4, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, ui->Read(ui->ctx, &h));
+  ASSERT_EQUAL(6, h->docId);
+  ASSERT_EQUAL(1, h->agg.numChildren);
+
+  ui->Free(ui);
+  for (int n = 0; n < num; n++) {
+    InvertedIndex_Free(idxs[n]);
+  }
+  RETURN_TEST_SUCCESS;
+}
+
+int testBitmapUnion() {
+  // the larger steps spread the ids over several bitmap chunks
+  const int steps[] = {3, 7, 1000, 1500};
+  const int num = sizeof(steps) / sizeof(steps[0]);
+  InvertedIndex *idxs[num];
+  IndexIterator **irs = calloc(num, sizeof(IndexIterator *));
+  IndexIterator **bms = calloc(num, sizeof(IndexIterator *));
+  for (int n = 0; n < num; n++) {
+    idxs[n] = createIndex(100, steps[n]);
+    irs[n] = NewReadIterator(NewTermIndexReader(idxs[n], NULL, RS_FIELDMASK_ALL, NULL, 1));
+    bms[n] = NewReadIterator(NewTermIndexReader(idxs[n], NULL, RS_FIELDMASK_ALL, NULL, 1));
+  }
+  IndexIterator *ui = NewUnionIterator(irs, num, NULL, 1, 1);
+  IndexIterator *bi = NewBitmapUnionIterator(bms, num, 1);
+  free(bms);
+
+  // the bitmap union yields exactly the ids of the regular union
+  RSIndexResult *h = NULL, *bh = NULL;
+  size_t count = 0;
+  while (ui->Read(ui->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(INDEXREAD_OK, bi->Read(bi->ctx, &bh));
+    ASSERT_EQUAL(h->docId, bh->docId);
+    count++;
+  }
+  ASSERT_EQUAL(INDEXREAD_EOF, bi->Read(bi->ctx, &bh));
+  ASSERT_EQUAL(count, bi->Len(bi->ctx));
+
+  bi->Rewind(bi->ctx);
+  ASSERT_EQUAL(INDEXREAD_OK, bi->SkipTo(bi->ctx, 21, &bh));
+  ASSERT_EQUAL(21, bh->docId);
+  // past the small steps only multiples of 1000 and 1500 remain, in the second chunk and on
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, bi->SkipTo(bi->ctx, 70001, &bh));
+  ASSERT_EQUAL(70500, bh->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, bi->Read(bi->ctx, &bh));
+  ASSERT_EQUAL(71000, bh->docId);
+  ASSERT_EQUAL(INDEXREAD_EOF, bi->SkipTo(bi->ctx, 150001, &bh));
+
+  ui->Free(ui);
+  bi->Free(bi);
+  for (int n = 0; n < num; n++) {
+    InvertedIndex_Free(idxs[n]);
+  }
+  RETURN_TEST_SUCCESS;
+}
+
 int testWeight() {
   InvertedIndex *w = createIndex(10, 1);
   InvertedIndex *w2 = createIndex(10, 2);
@@ -588,6 +746,102 @@ int testAbort() {
   return 0;
 }
 
+static void writeFreqEntries(InvertedIndex *idx, t_docId first, t_docId last, uint32_t freq) {
+  IndexEncoder enc = InvertedIndex_GetEncoder(idx->flags);
+  for (t_docId id = first; id <= last; id++) {
+    ForwardIndexEntry h = {.docId = id, .fieldMask = 1, .freq = freq, .term = "hello", .len = 5};
+    h.vw = NewVarintVectorWriter(8);
+    InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+    VVW_Free(h.vw);
+  }
+}
+
+// a test bound where a term contributes its frequency
+static double freqTermBound(double weight, double idf, uint32_t maxFreq, const RSIndexStats *st) {
+  return weight * maxFreq;
+}
+
+int testWandIterator() {
+  // a is frequent in its first block only, b is short and frequent
+  InvertedIndex *a = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  writeFreqEntries(a, 1, 100, 10);
+  writeFreqEntries(a, 101, 1000, 1);
+  InvertedIndex *b = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  writeFreqEntries(b, 500, 520, 10);
+  ASSERT_EQUAL(10, a->blocks[0].maxFreq);
+  ASSERT_EQUAL(1, a->blocks[1].maxFreq);
+
+  ScoreBound sb = {.termBound = freqTermBound};
+  for (int prune = 0; prune < 2; prune++) {
+    double threshold = prune ? 5 : 0;
+    IndexIterator **irs = calloc(2, sizeof(IndexIterator *));
+    irs[0] = NewReadIterator(NewTermIndexReader(a, NULL, RS_FIELDMASK_ALL, NULL, 1));
+    irs[1] = NewReadIterator(NewTermIndexReader(b, NULL, RS_FIELDMASK_ALL, NULL, 1));
+    IndexReader *ra = irs[0]->ctx;
+    IndexIterator *wi = NewWandIterator(irs, 2, &sb, &threshold, 1);
+    ASSERT(wi != NULL);
+
+    RSIndexResult *h = NULL;
+    t_docId expected = 0;
+    int count = 0;
+    while (wi->Read(wi->ctx, &h) != INDEXREAD_EOF) {
+      // without a threshold this is a plain union. With it, only the docs in a's first block or in
+      // b may score 5 or more
+      expected++;
+      if (prune && expected == 101) expected = 500;
+      ASSERT_EQUAL(expected, h->docId);
+      ASSERT_EQUAL((expected >= 500 && expected <= 520 ? 2 : 1), h->agg.numChildren);
+      count++;
+    }
+    ASSERT_EQUAL((prune ? 121 : 1000), count);
+    // the blocks of a that can't make it were skipped without being decoded
+    if (prune) {
+      ASSERT(ra->len < 300);
+    }
+    wi->Free(wi);
+  }
+
+  InvertedIndex_Free(a);
+  InvertedIndex_Free(b);
+  RETURN_TEST_SUCCESS;
+}
+
+int testIntersectionOrder() {
+  // a common and a rare term, in that order in the query
+  InvertedIndex *common = createIndex(1000, 1);
+  InvertedIndex *rare = createIndex(20, 50);
+  IndexIterator **irs = calloc(2, sizeof(IndexIterator *));
+  irs[0] = NewReadIterator(NewTermIndexReader(common, NULL, RS_FIELDMASK_ALL, NULL, 1));
+  irs[1] = NewReadIterator(NewTermIndexReader(rare, NULL, RS_FIELDMASK_ALL, NULL, 1));
+  IndexIterator *commonIt = irs[0], *rareIt = irs[1];
+  ASSERT_EQUAL(1000, commonIt->NumEstimated(commonIt->ctx));
+
+  // with a slop check the hits must still have their children in query order
+  IndexIterator *ii = NewIntersecIterator(irs, 2, NULL, RS_FIELDMASK_ALL, 1000, 0, 1);
+  IntersectContext *ic = ii->ctx;
+  ASSERT(ic->its[0] == rareIt);
+  ASSERT_EQUAL(20, ii->NumEstimated(ii->ctx));
+
+  RSIndexResult *h = NULL;
+  int count = 0;
+  while (ii->Read(ii->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(0, (h->docId % 50));
+    ASSERT_EQUAL(2, h->agg.numChildren);
+    ASSERT(h->agg.children[0] == commonIt->Current(commonIt->ctx));
+    ASSERT(h->agg.children[1] == rareIt->Current(rareIt->ctx));
+    count++;
+  }
+  // every 4th rare record has no offsets, so it fails the slop check
+  ASSERT_EQUAL(15, count);
+  // the rare child drove the loop, so the common one was only skipped to the hits
+  ASSERT(((IndexReader *)commonIt->ctx)->len < 1000);
+
+  ii->Free(ii);
+  InvertedIndex_Free(common);
+  InvertedIndex_Free(rare);
+  RETURN_TEST_SUCCESS;
+}
+
 int testIntersection() {
 
   InvertedIndex *w = createIndex(100000, 4);
@@ -1003,7 +1257,7 @@ int testDocTable() {
   ASSERT_EQUAL(N + 1, dt.size);
   ASSERT_EQUAL(N, dt.maxDocId);
 #ifdef __x86_64__
-  ASSERT_EQUAL(10980, (int)dt.memsize);
+  ASSERT_EQUAL(10404, (int)dt.memsize);
 #endif
   for (int i = 0; i < N; i++) {
     sprintf(buf, "doc_%d", i);
@@ -1025,7 +1279,7 @@ int testDocTable() {
     ASSERT_EQUAL((int)dmd->score, i);
     ASSERT_EQUAL((int)dmd->flags, (int)(Document_DefaultFlags | Document_HasPayload));
 
-    t_docId xid = DocIdMap_Get(&dt.dim, MakeDocKey(buf, strlen(buf)));
+    t_docId xid = DocTable_GetId(&dt, MakeDocKey(buf, strlen(buf)));
 
     ASSERT_EQUAL((int)xid, i + 1);
 
@@ -1037,7 +1291,7 @@ int testDocTable() {
     ASSERT(!dmd);
   }
 
-  ASSERT(0 == DocIdMap_Get(&dt.dim, MakeDocKey("foo bar", strlen("foo bar"))));
+  ASSERT(0 == DocTable_GetId(&dt, MakeDocKey("foo bar", strlen("foo bar"))));
 
   ASSERT(NULL == DocTable_Get(&dt, N + 2));
 
@@ -1047,19 +1301,87 @@ int testDocTable() {
   // Test that binary keys also work here
   static const char binBuf[] = {"Hello\x00World"};
   const size_t binBufLen = 11;
-  ASSERT(0 == DocIdMap_Get(&dt.dim, MakeDocKey(binBuf, binBufLen)));
+  ASSERT(0 == DocTable_GetId(&dt, MakeDocKey(binBuf, binBufLen)));
 
   t_docId binDocId = DocTable_Put(&dt, MakeDocKey(binBuf, binBufLen), 1.0, 0, NULL, 0);
   ASSERT(0 != binDocId);
   ASSERT(binDocId != strDocId);
 
-  ASSERT_EQUAL(binDocId, DocIdMap_Get(&dt.dim, MakeDocKey(binBuf, binBufLen)));
-  ASSERT(strDocId == DocIdMap_Get(&dt.dim, MakeDocKey("Hello", 5)));
+  ASSERT_EQUAL(binDocId, DocTable_GetId(&dt, MakeDocKey(binBuf, binBufLen)));
+  ASSERT(strDocId == DocTable_GetId(&dt, MakeDocKey("Hello", 5)));
 
   DocTable_Free(&dt);
   return 0;
 }
 
+int testDocTablePages() {
+  char buf[16];
+  DocTable dt = NewDocTable(10, 10);
+  int N = DOCTABLE_PAGE_SIZE + 1000;
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT_EQUAL(i, DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, 0, NULL, 0));
+  }
+  ASSERT_EQUAL(2, dt.numPages);
+  ASSERT_EQUAL(DOCTABLE_PAGE_SIZE, dt.pages[0].cap);
+  ASSERT(dt.pages[1].cap < DOCTABLE_PAGE_SIZE);
+
+  // emptying the first page frees it
+  for (int i = 1; i < DOCTABLE_PAGE_SIZE; i++) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  ASSERT(dt.pages[0].dmds == NULL);
+  ASSERT(DocTable_Get(&dt, 1) == NULL);
+  ASSERT(!DocTable_Exists(&dt, DOCTABLE_PAGE_SIZE - 1));
+  ASSERT(DocTable_Exists(&dt, DOCTABLE_PAGE_SIZE));
+  ASSERT(DocTable_Get(&dt, N + 1) == NULL);
+
+  size_t n = 0;
+  t_docId last = 0;
+  DocTable_ForEach((&dt), {
+    ASSERT(dmd->id > last);
+    last = dmd->id;
+    n++;
+  });
+  ASSERT_EQUAL(dt.size - 1, n);
+  ASSERT_EQUAL(N, last);
+
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testDocIdMap() {
+  char buf[16];
+  DocTable dt = NewDocTable(10, 10);
+  int N = 10000;
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT_EQUAL(i, DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, 0, NULL, 0));
+  }
+  ASSERT_EQUAL(N, dt.dim.size);
+  ASSERT(dt.dim.size * 4 <= dt.dim.cap * 3);
+
+  // deleting every third key shifts back the slots behind it, which must all stay reachable
+  for (int i = 1; i <= N; i += 3) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    t_docId expected = (i % 3 == 1) ? 0 : i;
+    ASSERT_EQUAL(expected, DocTable_GetId(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+
+  // a deleted key gets a new id when it is put again
+  ASSERT_EQUAL(N + 1, DocTable_Put(&dt, MakeDocKey("doc_1", 5), 1, 0, NULL, 0));
+  ASSERT_EQUAL(N + 1, DocTable_GetId(&dt, MakeDocKey("doc_1", 5)));
+  ASSERT_EQUAL(dt.size - 1, dt.dim.size);
+
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
 int testSortable() {
   RSSortingTable *tbl = NewSortingTable();
   RSSortingTable_Add(tbl, "foo", RSValue_String);
@@ -1187,6 +1509,657 @@ int testDeltaSplits() {
   RETURN_TEST_SUCCESS;
 }
 
+int testSkipToInBlock() {
+  // ids are 3, 6, 9... so every other skip target is missing from the index
+  InvertedIndex *idx = createIndex(1000, 3);
+  ASSERT(idx->blocks[0].numSkips > 0);
+
+  for (int pass = 0; pass < 2; pass++) {
+    IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+    RSIndexResult *h = NULL;
+    for (t_docId id = 1; id <= 3000; id += 7) {
+      int rc = IR_SkipTo(ir, id, &h);
+      t_docId expected = ((id + 2) / 3) * 3;
+      ASSERT_EQUAL((expected == id ? INDEXREAD_OK : INDEXREAD_NOTFOUND), rc);
+      ASSERT_EQUAL(expected, h->docId);
+      ASSERT_EQUAL(expected, IR_LastDocId(ir));
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_SkipTo(ir, 3001, &h));
+    IR_Free(ir);
+
+    // rebuilding the skip tables should yield the same results
+    size_t numSkips = idx->blocks[0].numSkips;
+    InvertedIndex_BuildBlockMeta(idx);
+    ASSERT_EQUAL(numSkips, idx->blocks[0].numSkips);
+  }
+
+  InvertedIndex_Free(idx);
+  RETURN_TEST_SUCCESS;
+}
+
+static int testDocIdsOnlyBufferedFlags(IndexFlags flags) {
+  InvertedIndex *idx = NewInvertedIndex(flags, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(flags);
+
+  // mix long runs of single byte deltas with multi byte ones
+  t_docId ids[1000];
+  t_docId id = 0;
+  for (int i = 0; i < 1000; i++) {
+    id += (i % 37 == 0) ? 1000 + i : 1 + i % 3;
+    ids[i] = id;
+    RSIndexResult rec = {.type = RSResultType_Virtual, .docId = id};
+    InvertedIndex_WriteEntryGeneric(idx, enc, id, &rec);
+  }
+
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  ASSERT(ir->idsBuf != NULL);
+  RSIndexResult *h = NULL;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+    ASSERT_EQUAL(ids[i], h->docId);
+  }
+  ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+
+  // skip to existing and missing ids, both inside and outside the decoded buffer
+  IR_Free(ir);
+  ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  for (int i = 1; i < 1000; i += 5) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, ids[i], &h));
+    ASSERT_EQUAL(ids[i], h->docId);
+    if (ids[i + 1] - ids[i] > 1) {
+      ASSERT_EQUAL(INDEXREAD_NOTFOUND, IR_SkipTo(ir, ids[i] + 1, &h));
+      ASSERT_EQUAL(ids[i + 1], h->docId);
+    }
+  }
+
+  IR_Free(ir);
+  InvertedIndex_Free(idx);
+  RETURN_TEST_SUCCESS;
+}
+
+int testDocIdsOnlyBuffered() {
+  if (testDocIdsOnlyBufferedFlags(Index_DocIdsOnly)) return 1;
+  return testDocIdsOnlyBufferedFlags(Index_DocIdsOnly | Index_PackedDocIds);
+}
+
+int testBitPack() {
+  // deltas of every width, with a few wide ones among narrow ones to make exceptions
+  t_docId ids[1000];
+  t_docId id = 7;
+  for (int i = 0; i < 1000; i++) {
+    uint32_t delta = i % 41 == 0 ? (1u << (i % 32)) : (i % 7 == 0 ? 0 : 1 + i % 5);
+    if (i == 500) delta = UINT32_MAX;
+    id += delta;
+    ids[i] = id;
+  }
+  for (size_t n = 1; n <= 1000; n += 333) {
+    Buffer *b = NewBuffer(16);
+    BufferWriter bw = NewBufferWriter(b);
+    size_t sz = WritePackedDeltas(ids, n, 7, &bw);
+    ASSERT_EQUAL(PackedDeltasSize(ids, n, 7), sz);
+    ASSERT_EQUAL(sz, Buffer_Offset(b));
+
+    const uint8_t *p = (const uint8_t *)b->data;
+    ASSERT_EQUAL(n, PackedDeltasCount(p, p + sz));
+    t_docId out[1000];
+    ASSERT_EQUAL(n, ReadPackedDeltas(p, p + sz, 7, out));
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_EQUAL(ids[i], out[i]);
+    }
+    Buffer_Free(b);
+    free(b);
+  }
+  RETURN_TEST_SUCCESS;
+}
+
+int testPackedBlocks() {
+  char buf[16];
+  int N = 5000;
+  DocTable dt = NewDocTable(100, N);
+  InvertedIndex *plain = NewInvertedIndex(Index_DocIdsOnly, 1);
+  InvertedIndex *idx = NewInvertedIndex(Index_DocIdsOnly | Index_PackedDocIds, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(Index_DocIdsOnly);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+    // a dense tag, with a far apart id now and then
+    if (i % 2 && i % 97) continue;
+    RSIndexResult rec = {.type = RSResultType_Virtual, .docId = i};
+    InvertedIndex_WriteEntryGeneric(plain, enc, i, &rec);
+    InvertedIndex_WriteEntryGeneric(idx, enc, i, &rec);
+  }
+
+  // all of the full blocks are packed, and take less memory than their varints
+  ASSERT(idx->size > 2);
+  ASSERT_EQUAL(plain->size, idx->size);
+  size_t plainBytes = 0, packedBytes = 0;
+  for (uint32_t i = 0; i < idx->size; i++) {
+    ASSERT_EQUAL((i + 1 < idx->size), idx->blocks[i].packed);
+    if (idx->blocks[i].packed) {
+      ASSERT_EQUAL(0, idx->blocks[i].numSkips);
+    }
+    plainBytes += Buffer_Offset(plain->blocks[i].data);
+    packedBytes += Buffer_Offset(idx->blocks[i].data);
+  }
+  ASSERT(packedBytes * 2 < plainBytes);
+
+  // both read the same
+  IndexReader *pr = NewTermIndexReader(plain, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL, *ph = NULL;
+  while (INDEXREAD_EOF != IR_Read(pr, &ph)) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+    ASSERT_EQUAL(ph->docId, h->docId);
+  }
+  ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+  IR_Free(ir);
+  ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, 970, &h));
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, IR_SkipTo(ir, 971, &h));
+  ASSERT_EQUAL(972, h->docId);
+  IR_Free(pr);
+  IR_Free(ir);
+
+  // repairing a packed block packs what is left of it
+  for (int i = 4; i <= N; i += 4) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  // a step of the GC repairs as many blocks of a packed index as of a plain one
+  IndexRepairParams params = {.limit = 2};
+  IndexRepairParams plainParams = {.limit = 2};
+  int blockNum = 0, plainBlockNum = 0, steps = 0;
+  do {
+    size_t docs = params.docsCollected, plainDocs = plainParams.docsCollected;
+    blockNum = InvertedIndex_Repair(idx, &dt, blockNum, &params);
+    plainBlockNum = InvertedIndex_Repair(plain, &dt, plainBlockNum, &plainParams);
+    ASSERT_EQUAL(plainBlockNum, blockNum);
+    ASSERT_EQUAL(plainParams.docsCollected - plainDocs, params.docsCollected - docs);
+    ASSERT(!blockNum || blockNum == 2 * ++steps);
+  } while (blockNum);
+  ASSERT(steps > 1);
+  ASSERT(params.docsCollected > 0);
+  ASSERT(params.bytesCollected > 0);
+  ASSERT(idx->blocks[0].packed);
+
+  ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  t_docId lastId = 0;
+  size_t n = 0;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) {
+    ASSERT(h->docId > lastId);
+    ASSERT(DocTable_Exists(&dt, h->docId));
+    lastId = h->docId;
+    n++;
+  }
+  ASSERT_EQUAL(idx->numDocs - params.docsCollected, n);
+  IR_Free(ir);
+
+  InvertedIndex_Free(plain);
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testBlockGrowth() {
+  InvertedIndex *idx = createIndex(200000, 2);
+  // frequent terms should move on to larger blocks
+  ASSERT(idx->size < 200000 / 100 / 4);
+  ASSERT_EQUAL(100, idx->blocks[0].numDocs);
+  ASSERT(idx->blocks[idx->size - 2].numDocs > 1000);
+
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL;
+  for (t_docId id = 2; id <= 400000; id += 2) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+    ASSERT_EQUAL(id, h->docId);
+  }
+  ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+  IR_Free(ir);
+
+  ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  for (t_docId id = 1; id < 400000; id += 997) {
+    int rc = IR_SkipTo(ir, id, &h);
+    ASSERT_EQUAL((id % 2 ? INDEXREAD_NOTFOUND : INDEXREAD_OK), rc);
+    ASSERT_EQUAL(id + id % 2, h->docId);
+  }
+  IR_Free(ir);
+  InvertedIndex_Free(idx);
+  RETURN_TEST_SUCCESS;
+}
+
+int testRepairRetiresBlocks() {
+  char buf[16];
+  int N = 1000;
+  DocTable dt = NewDocTable(100, 1000);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+  }
+  InvertedIndex *idx = createIndex(N, 1);
+  ASSERT(idx->size > 2);
+
+  // a query pins the epoch and starts reading, then goes to sleep in the middle of the first block
+  EpochPin pin = Epoch_Pin();
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL;
+  for (int i = 1; i <= 10; i++) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+  }
+  Buffer *buf0 = idx->blocks[0].data;
+  t_docId lastId0 = idx->blocks[0].lastId;
+
+  // delete all the even documents and collect them
+  for (int i = 2; i <= N; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  size_t retired = Epoch_NumRetired();
+  IndexRepairParams params = {0};
+  InvertedIndex_Repair(idx, &dt, 0, &params);
+  ASSERT_EQUAL(N / 2, params.docsCollected);
+
+  // the repaired blocks got new buffers, the old ones and the old block array are kept alive for
+  // the reader
+  ASSERT(idx->blocks[0].data != buf0);
+  size_t numSkips = 0;
+  for (uint32_t i = 0; i < idx->size; i++) numSkips += idx->blocks[i].skips != NULL;
+  ASSERT_EQUAL(idx->size + numSkips + 1, Epoch_NumRetired() - retired);
+
+  // the reader finishes its block as it was, and then reads the repaired blocks
+  t_docId lastId = 10;
+  size_t n = 10;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) {
+    ASSERT(h->docId > lastId);
+    if (h->docId > lastId0) {
+      ASSERT_EQUAL(1, (h->docId % 2));
+    }
+    lastId = h->docId;
+    n++;
+  }
+  ASSERT_EQUAL(N - 1, lastId);
+  // all of the first block, and only the odd documents after it
+  ASSERT_EQUAL(lastId0 + (N - lastId0) / 2, n);
+
+  // once the query is done, the old buffers are freed
+  IR_Free(ir);
+  Epoch_Unpin(pin);
+  ASSERT_EQUAL(0, Epoch_NumRetired());
+
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testRepairResumesUnpinned() {
+  char buf[16];
+  int N = 1000;
+  DocTable dt = NewDocTable(100, 1000);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+  }
+  InvertedIndex *idx = createIndex(N, 1);
+
+  // a query reads a few records and goes idle without holding an epoch, like a paused cursor
+  EpochPin pin = Epoch_Pin();
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL;
+  for (int i = 1; i <= 10; i++) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+  }
+  Epoch_Unpin(pin);
+
+  for (int i = 2; i <= N; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  IndexRepairParams params = {0};
+  InvertedIndex_Repair(idx, &dt, 0, &params);
+  ASSERT_EQUAL(N / 2, params.docsCollected);
+
+  // nobody held the old buffers, so they are gone
+  ASSERT_EQUAL(0, Epoch_NumRetired());
+  ASSERT(Epoch_Reclaimed(ir->epoch));
+
+  // when resumed, the reader seeks back to where it was in the repaired block
+  pin = Epoch_Pin();
+  IndexReader_Resume(ir);
+  t_docId lastId = 10;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) {
+    ASSERT(h->docId > lastId);
+    ASSERT_EQUAL(1, (h->docId % 2));
+    lastId = h->docId;
+  }
+  ASSERT_EQUAL(N - 1, lastId);
+
+  IR_Free(ir);
+  Epoch_Unpin(pin);
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+static int testReaderSkipsDeletedFlags(IndexFlags flags) {
+  char buf[16];
+  int N = 1000;
+  DocTable dt = NewDocTable(100, 1000);
+  InvertedIndex *idx = NewInvertedIndex(flags, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(flags);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+    RSIndexResult rec = {.type = RSResultType_Virtual, .docId = i, .freq = 1, .fieldMask = 1};
+    InvertedIndex_WriteEntryGeneric(idx, enc, i, &rec);
+  }
+  // every third document, and a run long enough to empty whole blocks
+  for (int i = 1; i <= N; i++) {
+    if (i % 3 == 0 || (i > 300 && i <= 600)) {
+      sprintf(buf, "doc_%d", i);
+      ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+    }
+  }
+
+  IndexReader *ir = NewTermIndexReader(idx, &dt, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL;
+  size_t n = 0;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) {
+    ASSERT(DocTable_Exists(&dt, h->docId));
+    n++;
+  }
+  ASSERT_EQUAL(dt.size - 1, n);
+  ASSERT_EQUAL(n, IR_NumDocs(ir));
+
+  // skipping to a deleted document lands on the next live one
+  IR_Free(ir);
+  ir = NewTermIndexReader(idx, &dt, RS_FIELDMASK_ALL, NULL, 1);
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, IR_SkipTo(ir, 3, &h));
+  ASSERT_EQUAL(4, h->docId);
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, IR_SkipTo(ir, 301, &h));
+  ASSERT_EQUAL(601, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, 604, &h));
+  ASSERT_EQUAL(604, h->docId);
+  IR_Free(ir);
+
+  // a reader without a doc table sees everything
+  ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  n = 0;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) n++;
+  ASSERT_EQUAL(N, n);
+  IR_Free(ir);
+
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testReaderSkipsDeleted() {
+  if (testReaderSkipsDeletedFlags(Index_DocIdsOnly)) return 1;
+  if (testReaderSkipsDeletedFlags(Index_DocIdsOnly | Index_PackedDocIds)) return 1;
+  return testReaderSkipsDeletedFlags(INDEX_DEFAULT_FLAGS);
+}
+
+int testDocTableCollect() {
+  char buf[16];
+  DocTable dt = NewDocTable(10, 100);
+  for (int i = 1; i <= 100; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+  }
+  for (int i = 1; i <= 10; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf)));
+  }
+
+  // documents deleted during an incomplete cycle are all still there after it
+  DocTable_BeginCollect(&dt);
+  DocTable_Delete(&dt, MakeDocKey("doc_50", 6));
+  DocTable_EndCollect(&dt, 0);
+  ASSERT_EQUAL(11, dt.deleted.card);
+
+  // a complete cycle forgets the documents deleted before it started
+  DocTable_BeginCollect(&dt);
+  DocTable_Delete(&dt, MakeDocKey("doc_60", 6));
+  DocTable_EndCollect(&dt, 1);
+  ASSERT_EQUAL(1, dt.deleted.card);
+  ASSERT(DocIdBitmap_Test(&dt.deleted, 60));
+  ASSERT(!DocIdBitmap_Test(&dt.deleted, 50));
+  ASSERT_EQUAL(0, dt.deletedSinceCollect.card);
+
+  // deletes outside of a cycle are not tracked apart
+  DocTable_Delete(&dt, MakeDocKey("doc_70", 6));
+  ASSERT_EQUAL(2, dt.deleted.card);
+  ASSERT_EQUAL(0, dt.deletedSinceCollect.card);
+
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testRepairSkipsCleanBlocks() {
+  char buf[16];
+  int N = 1000;
+  DocTable dt = NewDocTable(100, 1000);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+  }
+  InvertedIndex *idx = createIndex(N, 1);
+  ASSERT(idx->size > 2);
+
+  // only the last block has a deleted document
+  sprintf(buf, "doc_%d", N);
+  ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  Buffer *buf0 = idx->blocks[0].data;
+  IndexRepairParams params = {0};
+  InvertedIndex_Repair(idx, &dt, 0, &params);
+  ASSERT_EQUAL(1, params.docsCollected);
+  ASSERT(idx->blocks[0].data == buf0);
+  ASSERT_EQUAL(N - 1, idx->blocks[idx->size - 1].lastId);
+
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+int testForkGCRepair() {
+  char buf[16];
+  int N = 950;
+  DocTable dt = NewDocTable(100, 1000);
+  for (int i = 1; i <= N + 1; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+  }
+  InvertedIndex *idx = createIndex(N, 1);
+  ASSERT(idx->size > 2);
+  for (int i = 2; i <= N; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+
+  int fds[2];
+  ASSERT_EQUAL(0, pipe(fds));
+  pid_t pid = fork();
+  ASSERT(pid != -1);
+  if (pid == 0) {
+    // the child repairs its own copy of the index
+    FGCIndexRepair r;
+    FGC_RepairIndex(idx, &dt, &r);
+    _exit(FGC_WriteIndexRepair(fds[1], &r) == REDISMODULE_OK ? 0 : 1);
+  }
+  close(fds[1]);
+
+  // a record is added to the last block while the child is scanning
+  uint32_t lastBlock = idx->size - 1;
+  IndexBlock *lastBlk = &idx->blocks[lastBlock];
+  t_docId lastBlockFirstId = lastBlk->firstId;
+  ForwardIndexEntry h = {.docId = N + 1, .fieldMask = 1, .freq = 1, .term = "hello", .len = 5};
+  h.vw = NewVarintVectorWriter(8);
+  InvertedIndex_WriteForwardIndexEntry(idx, InvertedIndex_GetEncoder(idx->flags), &h);
+  VVW_Free(h.vw);
+  ASSERT_EQUAL(lastBlock + 1, idx->size);
+
+  FGCIndexRepair r;
+  ASSERT_EQUAL(REDISMODULE_OK, FGC_ReadIndexRepair(fds[0], &r));
+  close(fds[0]);
+  int status;
+  ASSERT_EQUAL(pid, waitpid(pid, &status, 0));
+  ASSERT_EQUAL(0, WEXITSTATUS(status));
+  // every block had garbage
+  ASSERT_EQUAL(lastBlock + 1, array_len(r.blocks));
+
+  size_t docs = 0, bytes = 0;
+  // all the blocks but the last were swapped in, the last one changed since the fork
+  ASSERT_EQUAL(1, FGC_ApplyIndexRepair(idx, &r, &docs, &bytes));
+  FGC_FreeIndexRepair(&r);
+  ASSERT(bytes > 0);
+
+  size_t lastBlockDeleted = (N - lastBlockFirstId) / 2 + 1;
+  ASSERT_EQUAL(N / 2 - lastBlockDeleted, docs);
+
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *res = NULL;
+  size_t n = 0;
+  t_docId lastId = 0;
+  while (INDEXREAD_EOF != IR_Read(ir, &res)) {
+    ASSERT(res->docId > lastId);
+    if (res->docId < lastBlockFirstId) {
+      ASSERT_EQUAL(1, (res->docId % 2));
+    }
+    lastId = res->docId;
+    n++;
+  }
+  IR_Free(ir);
+  ASSERT_EQUAL(N + 1, lastId);
+  ASSERT_EQUAL(N + 1 - docs, n);
+
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  RETURN_TEST_SUCCESS;
+}
+
+/* A writer and a reader of the concurrent tests. The writer thread stands in for the GIL holder,
+ * and the readers pin an epoch and read without any lock */
+struct concurrentReadCtx {
+  InvertedIndex *idx;
+  DocTable *dt;
+  DocIdBitmap *bm;
+  int done;
+  int errors;
+  size_t reads;
+};
+
+#define concurrentRead_Error(c) __atomic_add_fetch(&(c)->errors, 1, __ATOMIC_RELAXED)
+
+static void *concurrentIndexReader(void *p) {
+  struct concurrentReadCtx *c = p;
+  while (!__atomic_load_n(&c->done, __ATOMIC_RELAXED)) {
+    EpochPin pin = Epoch_Pin();
+    IndexReader *ir = NewTermIndexReader(c->idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+    RSIndexResult *h = NULL;
+    t_docId lastId = 0;
+    // every record up to the last one published is there, in order
+    while (INDEXREAD_EOF != IR_Read(ir, &h)) {
+      if (h->docId != lastId + 1 || h->freq != 1) concurrentRead_Error(c);
+      lastId = h->docId;
+    }
+    IR_Free(ir);
+    Epoch_Unpin(pin);
+    __atomic_add_fetch(&c->reads, 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+int testConcurrentIndexRead() {
+  struct concurrentReadCtx c = {.idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1)};
+  pthread_t readers[4];
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQUAL(0, pthread_create(&readers[i], NULL, concurrentIndexReader, &c));
+  }
+
+  // appends, grown buffers, skip tables and block arrays, and new blocks
+  IndexEncoder enc = InvertedIndex_GetEncoder(c.idx->flags);
+  int N = 200000;
+  for (t_docId id = 1; id <= N; id++) {
+    ForwardIndexEntry h = {.docId = id, .fieldMask = 1, .freq = 1, .term = "hello", .len = 5};
+    h.vw = NewVarintVectorWriter(8);
+    for (int n = 0; n < id % 4; n++) {
+      VVW_Write(h.vw, n);
+    }
+    InvertedIndex_WriteForwardIndexEntry(c.idx, enc, &h);
+    VVW_Free(h.vw);
+  }
+  __atomic_store_n(&c.done, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < 4; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  ASSERT_EQUAL(0, c.errors);
+  ASSERT(c.reads > 0);
+
+  IndexReader *ir = NewTermIndexReader(c.idx, NULL, RS_FIELDMASK_ALL, NULL, 1);
+  RSIndexResult *h = NULL;
+  size_t n = 0;
+  while (INDEXREAD_EOF != IR_Read(ir, &h)) n++;
+  ASSERT_EQUAL(N, n);
+  IR_Free(ir);
+  InvertedIndex_Free(c.idx);
+  ASSERT_EQUAL(0, Epoch_NumRetired());
+  RETURN_TEST_SUCCESS;
+}
+
+static void *concurrentDocTableReader(void *p) {
+  struct concurrentReadCtx *c = p;
+  char buf[16];
+  while (!__atomic_load_n(&c->done, __ATOMIC_RELAXED)) {
+    EpochPin pin = Epoch_Pin();
+    for (t_docId id = 1;; id++) {
+      RSDocumentMetadata *dmd = DocTable_Get(c->dt, id);
+      if (!dmd) break;
+      sprintf(buf, "doc_%d", (int)id);
+      if (dmd->id != id || strcmp(dmd->keyPtr, buf)) concurrentRead_Error(c);
+      // every document we see is in the bitmap
+      if (!DocIdBitmap_Test(c->bm, id) || DocIdBitmap_Next(c->bm, id) != id) {
+        concurrentRead_Error(c);
+      }
+    }
+    Epoch_Unpin(pin);
+    __atomic_add_fetch(&c->reads, 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+int testConcurrentDocTableRead() {
+  DocTable dt = NewDocTable(10, 1000000);
+  DocIdBitmap bm;
+  DocIdBitmap_Init(&bm);
+  struct concurrentReadCtx c = {.dt = &dt, .bm = &bm};
+  pthread_t readers[4];
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQUAL(0, pthread_create(&readers[i], NULL, concurrentDocTableReader, &c));
+  }
+
+  // page and directory growth of the table, and chunk and table growth of the bitmap
+  char buf[16];
+  int N = 100000;
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    // the bit is set before the document is published, so readers that see the document see it
+    DocIdBitmap_Set(&bm, i);
+    ASSERT_EQUAL(i, DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL,
+                                 0));
+  }
+  __atomic_store_n(&c.done, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < 4; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  ASSERT_EQUAL(0, c.errors);
+  ASSERT(c.reads > 0);
+  ASSERT_EQUAL(N, bm.card);
+
+  DocIdBitmap_Clear(&bm);
+  DocTable_Free(&dt);
+  ASSERT_EQUAL(0, Epoch_NumRetired());
+  RETURN_TEST_SUCCESS;
+}
+
 TEST_MAIN({
   // LOGGING_INIT(L_INFO);
   RMUTil_InitAlloc();
@@ -1210,12 +2183,32 @@ TEST_MAIN({
   TESTFUNC(testIntersection);
   TESTFUNC(testNot);
   TESTFUNC(testUnion);
+  TESTFUNC(testUnionHeap);
+  TESTFUNC(testUnionHeapStuckChild);
+  TESTFUNC(testIntersectionOrder);
+  TESTFUNC(testWandIterator);
+  TESTFUNC(testBitmapUnion);
 
   TESTFUNC(testBuffer);
   // TESTFUNC(testTokenize);
   TESTFUNC(testIndexSpec);
   TESTFUNC(testIndexFlags);
   TESTFUNC(testDocTable);
+  TESTFUNC(testDocTablePages);
+  TESTFUNC(testDocIdMap);
   TESTFUNC(testSortable);
   TESTFUNC(testDeltaSplits);
+  TESTFUNC(testSkipToInBlock);
+  TESTFUNC(testDocIdsOnlyBuffered);
+  TESTFUNC(testBitPack);
+  TESTFUNC(testPackedBlocks);
+  TESTFUNC(testBlockGrowth);
+  TESTFUNC(testRepairRetiresBlocks);
+  TESTFUNC(testRepairResumesUnpinned);
+  TESTFUNC(testForkGCRepair);
+  TESTFUNC(testReaderSkipsDeleted);
+  TESTFUNC(testDocTableCollect);
+  TESTFUNC(testRepairSkipsCleanBlocks);
+  TESTFUNC(testConcurrentIndexRead);
+  TESTFUNC(testConcurrentDocTableRead);
 });
@@ -1,4 +1,5 @@
 #include "../numeric_index.h"
+#include "../geo_index.h"
 #include <stdio.h>
 #include "test_util.h"
 #include "time_sample.h"
@@ -54,6 +55,8 @@ int testNumericRangeTree() {
 
 // declaration for an internal function implemented in numeric_index.c
 IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f);
+IndexIterator *createNumericIteratorEx(NumericRangeTree *t, NumericFilter *f,
+                                       const DocIdBitmap *deleted, int mergeContained);
 
 int testRangeIterator() {
   NumericRangeTree *t = NewNumericRangeTree();
@@ -141,6 +144,149 @@ int testRangeIterator() {
   return 0;
 }
 
+int testRangeIteratorMergeContained() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  int N = 200000;
+  double *lookup = calloc(N + 1, sizeof(double));
+  for (int i = 1; i <= N; i++) {
+    lookup[i] = (double)(prng() % 10000);
+    NumericRangeTree_Add(t, i, lookup[i]);
+  }
+
+  struct {
+    double min;
+    double max;
+    int inclusive;
+  } rngs[] = {{0, 10000, 1}, {100, 9000, 1}, {100, 9000, 0}, {4000, 4100, 1}};
+  for (int r = 0; r < sizeof(rngs) / sizeof(rngs[0]); r++) {
+    NumericFilter *flt =
+        NewNumericFilter(rngs[r].min, rngs[r].max, rngs[r].inclusive, rngs[r].inclusive);
+    int count = 0;
+    for (int i = 1; i <= N; i++) {
+      if (NumericFilter_Match(flt, lookup[i])) count++;
+    }
+
+    // wide filters merge their inner ranges into a bitmap, and must still return every matching
+    // document exactly once, in order
+    IndexIterator *it = createNumericIteratorEx(t, flt, NULL, 1);
+    RSIndexResult *res = NULL;
+    t_docId lastId = 0;
+    int xcount = 0;
+    while (it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+      ASSERT(res->docId > lastId);
+      ASSERT(NumericFilter_Match(flt, lookup[res->docId]));
+      lastId = res->docId;
+      xcount++;
+    }
+    ASSERT_EQUAL(count, xcount);
+
+    // and skipping works across the merged and the edge ranges
+    it->Rewind(it->ctx);
+    lastId = 0;
+    for (t_docId id = 1; id <= N; id += 7) {
+      if (id <= lastId) continue;
+      int rc = it->SkipTo(it->ctx, id, &res);
+      if (rc == INDEXREAD_EOF) break;
+      ASSERT_EQUAL((rc == INDEXREAD_OK), NumericFilter_Match(flt, lookup[id]));
+      ASSERT(res->docId >= id);
+      ASSERT(NumericFilter_Match(flt, lookup[res->docId]));
+      lastId = res->docId;
+    }
+    it->Free(it);
+    NumericFilter_Free(flt);
+  }
+  free(lookup);
+  NumericRangeTree_Free(t);
+  return 0;
+}
+
+/* Check that iterating the tree over random ranges returns exactly the documents in them */
+static int checkRangeQueries(NumericRangeTree *t, double *lookup, int N, double maxVal) {
+  uint8_t *matched = calloc(N + 1, sizeof(uint8_t));
+  for (int q = 0; q < 10; q++) {
+    double min = (double)(prng() % (int)maxVal);
+    double max = (double)(prng() % (int)maxVal);
+    NumericFilter *flt = NewNumericFilter(_min(min, max), _max(min, max), 1, 1);
+    memset(matched, 0, sizeof(uint8_t) * (N + 1));
+    int count = 0;
+    for (int i = 1; i <= N; i++) {
+      if (NumericFilter_Match(flt, lookup[i])) {
+        matched[i] = 1;
+        count++;
+      }
+    }
+
+    IndexIterator *it = createNumericIterator(t, flt);
+    int xcount = 0;
+    RSIndexResult *res = NULL;
+    while (it && it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+      ASSERT_EQUAL(1, matched[res->docId]);
+      matched[res->docId] = 2;
+      xcount++;
+    }
+    ASSERT_EQUAL(count, xcount);
+    if (it) it->Free(it);
+    NumericFilter_Free(flt);
+  }
+  free(matched);
+  return 0;
+}
+
+int testNumericRangeTreeBulkLoad() {
+  int N = 200000;
+  double maxVal = 20000;
+  double *lookup = calloc(N + 1, sizeof(double));
+  NumericRangeEntry *entries = calloc(N + 1000, sizeof(*entries));
+  size_t n = 0;
+  // add the documents in reverse, with the first thousand added twice. Only one entry of a document
+  // should be kept
+  for (int i = N; i > 0; i--) {
+    lookup[i] = (double)(prng() % (int)maxVal);
+    entries[n++] = (NumericRangeEntry){.docId = i, .value = lookup[i]};
+  }
+  for (int i = 1; i <= 1000; i++) {
+    entries[n++] = (NumericRangeEntry){.docId = i, .value = lookup[i]};
+  }
+
+  NumericRangeTree *t = NewNumericRangeTreeFromEntries(entries, n);
+  ASSERT_EQUAL(N, t->numEntries);
+  ASSERT_EQUAL(N, t->lastDocId);
+  ASSERT(t->numRanges > 1);
+  if (checkRangeQueries(t, lookup, N, maxVal)) return -1;
+
+  // every document's value is in the column
+  ASSERT_EQUAL(N, t->column->numValues);
+  for (int i = 1; i <= N; i++) {
+    double d;
+    ASSERT(NumericColumn_Get(t->column, i, &d));
+    ASSERT_EQUAL(lookup[i], d);
+  }
+
+  // the tree keeps growing and splitting as usual
+  int M = N + 50000;
+  lookup = realloc(lookup, (M + 1) * sizeof(double));
+  for (int i = N + 1; i <= M; i++) {
+    lookup[i] = (double)(prng() % (int)maxVal);
+    NumericRangeTree_Add(t, i, lookup[i]);
+  }
+  ASSERT_EQUAL(M, t->numEntries);
+  if (checkRangeQueries(t, lookup, M, maxVal)) return -1;
+  for (int i = 1; i <= M; i++) {
+    double d;
+    ASSERT(NumericColumn_Get(t->column, i, &d));
+    ASSERT_EQUAL(lookup[i], d);
+  }
+  double d;
+  ASSERT(!NumericColumn_Get(t->column, 0, &d));
+  ASSERT(!NumericColumn_Get(t->column, M + 1, &d));
+  ASSERT(!NumericColumn_Get(t->column, 100 * M, &d));
+
+  NumericRangeTree_Free(t);
+  free(entries);
+  free(lookup);
+  return 0;
+}
+
 int benchmarkNumericRangeTree() {
   NumericRangeTree *t = NewNumericRangeTree();
   int count = 1;
@@ -174,10 +320,135 @@ int benchmarkNumericRangeTree() {
   return 0;
 }
 
+int testRangeRecountCard() {
+  char buf[16];
+  int N = 600;
+  DocTable dt = NewDocTable(100, 1000);
+  NumericRangeNode *n = NewLeafNode(2, NF_NEGATIVE_INFINITY, NF_INFINITY, 100);
+  for (int i = 1; i <= N; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, MakeDocKey(buf, strlen(buf)), 1, Document_DefaultFlags, NULL, 0);
+    NumericRange_Add(n->range, i, i % 10, 1);
+  }
+  ASSERT_EQUAL(10, n->range->card);
+  ASSERT_EQUAL(45, n->range->unique_sum);
+
+  // the documents with the values 8 and 9 are deleted and collected
+  for (int i = 1; i <= N; i++) {
+    if (i % 10 < 8) continue;
+    sprintf(buf, "doc_%d", i);
+    ASSERT(DocTable_Delete(&dt, MakeDocKey(buf, strlen(buf))));
+  }
+  IndexRepairParams params = {0};
+  InvertedIndex_Repair(n->range->entries, &dt, 0, &params);
+  ASSERT_EQUAL(N / 5, params.docsCollected);
+
+  NumericRange_RecountCard(n->range);
+  ASSERT_EQUAL(8, n->range->card);
+  ASSERT_EQUAL(28, n->range->unique_sum);
+  for (int i = 0; i < n->range->card; i++) {
+    ASSERT(n->range->values[i] < 8);
+  }
+
+  NumericRangeNode_Free(n);
+  DocTable_Free(&dt);
+  return 0;
+}
+
+int testGeoIndex() {
+  // the same hashes redis' GEOADD gives
+  double hash;
+  ASSERT_EQUAL(REDISMODULE_OK, GeoHash_Encode(13.361389, 38.115556, &hash));
+  ASSERT_EQUAL(3479099956230698ULL, (uint64_t)hash);
+  ASSERT_EQUAL(REDISMODULE_ERR, GeoHash_Encode(0, 86, &hash));
+  ASSERT(fabs(Geo_Distance(13.361389, 38.115556, 15.087269, 37.502669) - 166274.15) < 1);
+
+  // dense clusters around the query centers, over uniform noise
+  struct {
+    double lon, lat, radius;
+  } qs[] = {{13.36, 38.11, 200}, {179.9, 10, 50}, {-0.5, 84.9, 300}, {10, 20, 5000}, {0, 0, 0}};
+  srand(1337);
+  size_t N = 40000;
+  double *hashes = calloc(N + 1, sizeof(*hashes));
+  NumericRangeTree *t = NewNumericRangeTree();
+  for (size_t i = 1; i <= N; i++) {
+    double lon, lat;
+    if (i % 2) {
+      lon = -180 + 360.0 * rand() / RAND_MAX;
+      lat = GEO_LAT_MIN + (GEO_LAT_MAX - GEO_LAT_MIN) * rand() / RAND_MAX;
+    } else {
+      int q = (i / 2) % 4;
+      lon = qs[q].lon + 6.0 * rand() / RAND_MAX - 3;
+      lat = qs[q].lat + 6.0 * rand() / RAND_MAX - 3;
+      if (lon > 180) lon -= 360;
+      if (lat > GEO_LAT_MAX) lat = GEO_LAT_MAX;
+    }
+    ASSERT_EQUAL(REDISMODULE_OK, GeoHash_Encode(lon, lat, &hashes[i]));
+    NumericRangeTree_Add(t, i, hashes[i]);
+  }
+
+  char *found = calloc(N + 1, 1);
+  for (int q = 0; qs[q].radius; q++) {
+    GeoFilter *gf = NewGeoFilter(qs[q].lon, qs[q].lat, qs[q].radius, strdup("km"));
+    ASSERT(GeoFilter_Cover(gf) <= GEO_COVER_MAX_CELLS);
+    // the cells inside the radius are read without checking their points
+    size_t inside = 0;
+    for (size_t c = 0; c < gf->numCells; c++) {
+      inside += !gf->cells[c].geoFilter;
+    }
+    ASSERT(inside > 0);
+    memset(found, 0, N + 1);
+    for (size_t c = 0; c < gf->numCells; c++) {
+      IndexIterator *it = createNumericIteratorEx(t, &gf->cells[c], NULL, 1);
+      if (!it) continue;
+      RSIndexResult *res;
+      while (INDEXREAD_OK == it->Read(it->ctx, &res)) {
+        ASSERT(!found[res->docId]);
+        found[res->docId] = 1;
+      }
+      it->Free(it);
+    }
+    size_t matched = 0;
+    for (size_t i = 1; i <= N; i++) {
+      int match = GeoFilter_MatchHash(gf, hashes[i]);
+      ASSERT_EQUAL(match, found[i]);
+      matched += match;
+    }
+    ASSERT(matched > 0);
+
+    // evaluating the filter again keeps the cells the iterators of the first evaluation read
+    NumericFilter *cells = gf->cells;
+    IndexIterator *first = createNumericIteratorEx(t, &gf->cells[0], NULL, 0);
+    ASSERT(GeoFilter_Cover(gf) <= GEO_COVER_MAX_CELLS);
+    ASSERT(cells == gf->cells);
+    IndexIterator *second = createNumericIteratorEx(t, &gf->cells[0], NULL, 0);
+    RSIndexResult *r1, *r2;
+    while (first && INDEXREAD_OK == first->Read(first->ctx, &r1)) {
+      ASSERT_EQUAL(INDEXREAD_OK, second->Read(second->ctx, &r2));
+      ASSERT_EQUAL(r1->docId, r2->docId);
+    }
+    if (first) {
+      ASSERT_EQUAL(INDEXREAD_EOF, second->Read(second->ctx, &r2));
+      first->Free(first);
+      second->Free(second);
+    }
+    GeoFilter_Free(gf);
+  }
+
+  free(found);
+  free(hashes);
+  NumericRangeTree_Free(t);
+  return 0;
+}
+
 TEST_MAIN({
   RMUTil_InitAlloc();
 
   TESTFUNC(testNumericRangeTree);
   TESTFUNC(testRangeIterator);
+  TESTFUNC(testNumericRangeTreeBulkLoad);
+  TESTFUNC(testRangeIteratorMergeContained);
+  TESTFUNC(testRangeRecountCard);
+  TESTFUNC(testGeoIndex);
   benchmarkNumericRangeTree();
 });
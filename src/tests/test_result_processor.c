@@ -1,9 +1,16 @@
 #include "test_util.h"
 #include <result_processor.h>
 #include <query.h>
+#include <query_plan.h>
+#include <search_request.h>
+#include <spec.h>
+#include <inverted_index.h>
+#include <extension.h>
+#include <ext/default.h>
 
 struct processor1Ctx {
   int counter;
+  int numResults;
 };
 
 #define NUM_RESULTS 5
@@ -11,7 +18,7 @@ struct processor1Ctx {
 int p1_Next(ResultProcessorCtx *ctx, SearchResult *res) {
 
   struct processor1Ctx *p = ctx->privdata;
-  if (p->counter >= NUM_RESULTS) return RS_RESULT_EOF;
+  if (p->counter >= p->numResults) return RS_RESULT_EOF;
 
   res->docId = ++p->counter;
   res->score = (double)res->docId;
@@ -46,6 +53,7 @@ int testProcessorChain() {
 
   struct processor1Ctx *p = malloc(sizeof(*p));
   p->counter = 0;
+  p->numResults = NUM_RESULTS;
   ResultProcessor *p1 = NewResultProcessor(NULL, p);
   p1->ctx.qxc = &pc;
   ASSERT(p1->ctx.privdata == p);
@@ -87,4 +95,294 @@ int testProcessorChain() {
   RETURN_TEST_SUCCESS;
 }
 
-TEST_MAIN({ TESTFUNC(testProcessorChain); })
\ No newline at end of file
+int testProcessorBatch() {
+  QueryProcessingCtx pc = {};
+
+  // processors without NextBatch are read one result at a time into the batch
+  struct processor1Ctx *p = malloc(sizeof(*p));
+  p->counter = 0;
+  p->numResults = NUM_RESULTS;
+  ResultProcessor *p1 = NewResultProcessor(NULL, p);
+  p1->ctx.qxc = &pc;
+  p1->Next = p1_Next;
+  ResultProcessor *p2 = NewResultProcessor(p1, NULL);
+  p2->Next = p2_Next;
+
+  SearchResultBatch *b = NewSearchResultBatch();
+  b->cap = 3;
+  ASSERT_EQUAL(RS_RESULT_OK, ResultProcessor_NextBatch(p2, b, 1));
+  ASSERT_EQUAL(3, b->len);
+  ASSERT_EQUAL(RS_RESULT_OK, ResultProcessor_NextBatch(p2, b, 1));
+  ASSERT_EQUAL(2, b->len);
+  for (size_t i = 0; i < b->len; i++) {
+    ASSERT_EQUAL(4 + i, b->rows[i].docId);
+    ASSERT_EQUAL(1337, RSFieldMap_Get(b->rows[i].fields, "bar")->numval);
+  }
+  ASSERT_EQUAL(RS_RESULT_EOF, ResultProcessor_NextBatch(p2, b, 1));
+  ASSERT_EQUAL(0, b->len);
+  ResultProcessor_Free(p2);
+
+  // the sorter and the pager pass whole batches down
+  const size_t n = 2500;
+  p = malloc(sizeof(*p));
+  p->counter = 0;
+  p->numResults = n;
+  p1 = NewResultProcessor(NULL, p);
+  p1->ctx.qxc = &pc;
+  p1->Next = p1_Next;
+  ResultProcessor *sorter = NewSorterByFields(RS_NewMultiKeyVariadic(1, "foo"), 0, 2100, p1);
+  ResultProcessor *pager = NewPager(sorter, 100, 2000);
+  ASSERT(pager->NextBatch != NULL);
+
+  size_t count = 0, batches = 0;
+  b->cap = RP_BATCH_SIZE;
+  while (RS_RESULT_EOF != ResultProcessor_NextBatch(pager, b, 1)) {
+    ASSERT(b->len > 0 && b->len <= RP_BATCH_SIZE);
+    for (size_t i = 0; i < b->len; i++, count++) {
+      // descending, skipping the top 100
+      ASSERT_EQUAL(n - 100 - count, b->rows[i].docId);
+      ASSERT_EQUAL(n - 100 - count, RSFieldMap_Get(b->rows[i].fields, "foo")->numval);
+    }
+    batches++;
+  }
+  ASSERT_EQUAL(2000, count);
+  ASSERT(batches > 1);
+
+  SearchResultBatch_Free(b);
+  ResultProcessor_Free(pager);
+  RETURN_TEST_SUCCESS;
+}
+
+/* A spec of n documents that all hold the same term. Document scores repeat, so the ranking also
+ * depends on the docId tie break */
+typedef struct {
+  IndexSpec spec;
+  RedisSearchCtx sctx;
+  InvertedIndex *idx;
+} parallelTestIndex;
+
+#define PARALLEL_NUM_DOCS 50000
+#define PARALLEL_NUM_RESULTS 100
+
+static void parallelTestIndex_Init(parallelTestIndex *ti) {
+  memset(ti, 0, sizeof(*ti));
+  ti->spec.docs = NewDocTable(1000, PARALLEL_NUM_DOCS);
+  ti->sctx.spec = &ti->spec;
+  ti->idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(ti->idx->flags);
+  char buf[32];
+  for (int i = 1; i <= PARALLEL_NUM_DOCS; i++) {
+    sprintf(buf, "doc%d", i);
+    t_docId id = DocTable_Put(&ti->spec.docs, MakeDocKey(buf, strlen(buf)), (i * 7919) % 1000,
+                              Document_DefaultFlags, NULL, 0);
+    ForwardIndexEntry h = {.docId = id, .fieldMask = 1, .freq = 1, .term = "hello", .len = 5};
+    h.vw = NewVarintVectorWriter(8);
+    InvertedIndex_WriteForwardIndexEntry(ti->idx, enc, &h);
+    VVW_Free(h.vw);
+    ti->spec.stats.numDocuments++;
+  }
+  // deleted documents are neither ranked nor counted
+  for (int i = 1; i <= PARALLEL_NUM_DOCS; i += 97) {
+    sprintf(buf, "doc%d", i);
+    DocTable_Delete(&ti->spec.docs, MakeDocKey(buf, strlen(buf)));
+  }
+}
+
+static void parallelTestIndex_Free(parallelTestIndex *ti) {
+  InvertedIndex_Free(ti->idx);
+  DocTable_Free(&ti->spec.docs);
+}
+
+typedef struct {
+  t_docId ids[PARALLEL_NUM_RESULTS];
+  double scores[PARALLEL_NUM_RESULTS];
+  size_t num;
+  uint32_t totalResults;
+  QueryProcessingState state;
+} parallelTestResults;
+
+static IndexIterator *parallelTestIndex_Iterator(parallelTestIndex *ti) {
+  return NewReadIterator(NewTermIndexReader(ti->idx, &ti->spec.docs, RS_FIELDMASK_ALL, NULL, 1));
+}
+
+/* Run the query's processor chain over the index, split between numParts ranges of docIds */
+static void runParallelTest(parallelTestIndex *ti, char *scorer, int numParts,
+                            ConcurrentSearchCtx *conc, long long timeoutNS,
+                            parallelTestResults *res) {
+  QueryPlan q = {.ctx = &ti->sctx, .conc = conc, .opts = RS_DEFAULT_SEARCHOPTS};
+  q.opts.scorer = scorer;
+  q.opts.num = PARALLEL_NUM_RESULTS;
+  q.opts.flags |= Search_NoContent;
+  q.rootFilter = parallelTestIndex_Iterator(ti);
+  if (numParts > 1) {
+    q.numPartitions = numParts - 1;
+    q.partitions = calloc(q.numPartitions, sizeof(*q.partitions));
+    for (int i = 0; i < q.numPartitions; i++) {
+      q.partitions[i] = parallelTestIndex_Iterator(ti);
+    }
+  }
+  q.execCtx = (QueryProcessingCtx){.conc = conc,
+                                   .sctx = &ti->sctx,
+                                   .state = QPState_Running,
+                                   .rootFilter = q.rootFilter,
+                                   .timeoutNS = timeoutNS};
+  clock_gettime(CLOCK_MONOTONIC_RAW, &q.execCtx.startTime);
+  RSSearchRequest req = {.opts = q.opts};
+
+  char *err = NULL;
+  ResultProcessor *rp = Query_BuildProcessorChain(&q, &req, &err);
+  SearchResult *r = NewSearchResult();
+  if (conc) ConcurrentSearchCtx_Lock(conc);
+  memset(res, 0, sizeof(*res));
+  while (ResultProcessor_Next(rp, r, 1) != RS_RESULT_EOF) {
+    res->ids[res->num] = r->docId;
+    res->scores[res->num++] = r->score;
+    SearchResult_FreeInternal(r);
+  }
+  if (conc) ConcurrentSearchCtx_Unlock(conc);
+  res->totalResults = q.execCtx.totalResults;
+  res->state = q.execCtx.state;
+
+  SearchResult_Free(r);
+  ResultProcessor_Free(rp);
+  q.rootFilter->Free(q.rootFilter);
+  for (int i = 0; i < q.numPartitions; i++) {
+    q.partitions[i]->Free(q.partitions[i]);
+  }
+  free(q.partitions);
+}
+
+static int assertSameResults(parallelTestResults *expected, parallelTestResults *res) {
+  ASSERT_EQUAL(expected->num, res->num);
+  ASSERT_EQUAL(expected->totalResults, res->totalResults);
+  for (size_t i = 0; i < expected->num; i++) {
+    ASSERT_EQUAL(expected->ids[i], res->ids[i]);
+    ASSERT_EQUAL(expected->scores[i], res->scores[i]);
+  }
+  return 0;
+}
+
+int testParallelScan() {
+  parallelTestIndex ti;
+  parallelTestIndex_Init(&ti);
+
+  parallelTestResults serial, parallel;
+  runParallelTest(&ti, DOCSCORE_SCORER, 1, NULL, 0, &serial);
+  ASSERT_EQUAL(PARALLEL_NUM_RESULTS, serial.num);
+  ASSERT_EQUAL(PARALLEL_NUM_DOCS - (PARALLEL_NUM_DOCS + 96) / 97, serial.totalResults);
+  ASSERT_EQUAL(QPState_Running, serial.state);
+  for (size_t i = 1; i < serial.num; i++) {
+    ASSERT(serial.scores[i - 1] > serial.scores[i] ||
+           (serial.scores[i - 1] == serial.scores[i] && serial.ids[i - 1] > serial.ids[i]));
+  }
+
+  for (int numParts = 2; numParts <= 5; numParts++) {
+    runParallelTest(&ti, DOCSCORE_SCORER, numParts, NULL, 0, &parallel);
+    if (assertSameResults(&serial, &parallel)) return 1;
+    ASSERT_EQUAL(QPState_Running, parallel.state);
+  }
+
+  parallelTestIndex_Free(&ti);
+  RETURN_TEST_SUCCESS;
+}
+
+int testParallelScanTimeout() {
+  parallelTestIndex ti;
+  parallelTestIndex_Init(&ti);
+
+  // the workers check the clock every so many reads, and stop once the query timed out. What they
+  // found until then is still ranked and returned
+  parallelTestResults res;
+  runParallelTest(&ti, DOCSCORE_SCORER, 4, NULL, 1, &res);
+  ASSERT_EQUAL(QPState_TimedOut, res.state);
+  ASSERT(res.totalResults < PARALLEL_NUM_DOCS / 2);
+  ASSERT(res.num > 0);
+  for (size_t i = 1; i < res.num; i++) {
+    ASSERT(res.scores[i - 1] >= res.scores[i]);
+  }
+
+  parallelTestIndex_Free(&ti);
+  RETURN_TEST_SUCCESS;
+}
+
+/* The lock the scan releases now and then, standing in for the GIL */
+static struct {
+  pthread_mutex_t lock;
+  int locked;
+  int switches;
+  int errors;
+} testGIL = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void testGIL_Lock(RedisModuleCtx *ctx) {
+  pthread_mutex_lock(&testGIL.lock);
+  if (testGIL.locked) testGIL.errors++;
+  testGIL.locked = 1;
+  pthread_mutex_unlock(&testGIL.lock);
+}
+
+static void testGIL_Unlock(RedisModuleCtx *ctx) {
+  pthread_mutex_lock(&testGIL.lock);
+  if (!testGIL.locked) testGIL.errors++;
+  testGIL.locked = 0;
+  testGIL.switches++;
+  pthread_mutex_unlock(&testGIL.lock);
+}
+
+static double testScorer(RSScoringFunctionCtx *ctx, RSIndexResult *r, RSDocumentMetadata *dmd,
+                         double minScore) {
+  return dmd->score;
+}
+
+static int testScorerInit(RSExtensionCtx *ctx) {
+  return ctx->RegisterScoringFunction("TEST_DOCSCORE", testScorer, NULL, NULL);
+}
+
+int testParallelScanSwitch() {
+  // an extension scorer is not known to be thread safe, so the scan keeps the lock and switches it
+  RedisModule_ThreadSafeContextLock = testGIL_Lock;
+  RedisModule_ThreadSafeContextUnlock = testGIL_Unlock;
+
+  parallelTestIndex ti;
+  parallelTestIndex_Init(&ti);
+
+  ConcurrentSearchCtx conc;
+  ConcurrentSearchCtx_Init(NULL, &conc);
+  parallelTestResults serial, parallel;
+  runParallelTest(&ti, "TEST_DOCSCORE", 1, &conc, 0, &serial);
+  ASSERT_EQUAL(PARALLEL_NUM_RESULTS, serial.num);
+
+  // the workers pause between reads whenever the scanning thread releases the lock, and their
+  // results are the same as those of a serial scan
+  testGIL.switches = 0;
+  for (int numParts = 2; numParts <= 5; numParts++) {
+    runParallelTest(&ti, "TEST_DOCSCORE", numParts, &conc, 0, &parallel);
+    if (assertSameResults(&serial, &parallel)) return 1;
+  }
+  ASSERT(testGIL.switches > 4);
+  ASSERT_EQUAL(0, testGIL.errors);
+  ASSERT_EQUAL(0, testGIL.locked);
+
+  // the same goes for a thread safe scorer, whose scan runs with the lock released
+  runParallelTest(&ti, DOCSCORE_SCORER, 1, &conc, 0, &serial);
+  runParallelTest(&ti, DOCSCORE_SCORER, 4, &conc, 0, &parallel);
+  if (assertSameResults(&serial, &parallel)) return 1;
+  ASSERT_EQUAL(0, testGIL.errors);
+
+  ConcurrentSearchCtx_Free(&conc);
+  parallelTestIndex_Free(&ti);
+  RETURN_TEST_SUCCESS;
+}
+
+void RMUTil_InitAlloc();
+
+TEST_MAIN({
+  RMUTil_InitAlloc();
+  Extensions_Init();
+  Extension_Load("DEFAULT", DefaultExtensionInit);
+  Extension_Load("TEST", testScorerInit);
+  TESTFUNC(testProcessorChain);
+  TESTFUNC(testProcessorBatch);
+  TESTFUNC(testParallelScan);
+  TESTFUNC(testParallelScanTimeout);
+  TESTFUNC(testParallelScanSwitch);
+})
\ No newline at end of file
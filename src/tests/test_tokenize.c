@@ -1,6 +1,7 @@
 #include "test_util.h"
 #include "../tokenize.h"
 #include "../stemmer.h"
+#include "../stem_cache.h"
 #include "../rmutil/alloc.h"
 
 int testTokenize() {
@@ -30,7 +31,79 @@ int testTokenize() {
   RETURN_TEST_SUCCESS;
 }
 
+int testTokenizeLongTokens() {
+  // long tokens go through the block-at-a-time paths of the tokenizer. Shift the text by up to a
+  // block so that separators, escapes and case changes land at every alignment
+  const char *base =
+      "The QUICK brown FoxJumpsOverTheLazyDogAgainAndAgain, hello\\ World\\,again "
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghij_k Привет\tWORLD";
+  const char *expected[] = {"quick",         "brown",
+                            "foxjumpsoverthelazydogagainandagain",
+                            "hello world,again",
+                            "abcdefghijklmnopqrstuvwxyzabcdefghij_k",
+                            "Привет",        "world"};
+  size_t numExpected = sizeof(expected) / sizeof(expected[0]);
+
+  for (int shift = 0; shift < 16; shift++) {
+    char *txt = malloc(strlen(base) + shift + 1);
+    memset(txt, ' ', shift);
+    strcpy(txt + shift, base);
+
+    RSTokenizer *tk = GetSimpleTokenizer(NULL, DefaultStopWordList());
+    tk->Start(tk, txt, strlen(txt), TOKENIZE_DEFAULT_OPTIONS);
+    Token tok;
+    size_t i = 0;
+    while (tk->Next(tk, &tok)) {
+      ASSERT(i < numExpected);
+      ASSERT_EQUAL(strlen(expected[i]), tok.tokLen);
+      ASSERT(!strncmp(tok.tok, expected[i], tok.tokLen));
+      i++;
+    }
+    ASSERT_EQUAL(numExpected, i);
+    Tokenizer_Release(tk);
+    free(txt);
+  }
+  RETURN_TEST_SUCCESS;
+}
+
+int testTokenizeStemCache() {
+  Stemmer *st = NewStemmer(SnowballStemmer, "english");
+  const char *expectedStems[] = {"+run", "+jump", NULL, "+run"};
+  StemCacheStats before = StemCache_GetStats();
+
+  // the second pass should be served from the cache, with the same results
+  for (int pass = 0; pass < 2; pass++) {
+    char *txt = strdup("running jumping hello running");
+    RSTokenizer *tk = GetSimpleTokenizer(st, DefaultStopWordList());
+    tk->Start(tk, txt, strlen(txt), TOKENIZE_DEFAULT_OPTIONS | TOKENIZE_PHONETICS);
+    Token tok;
+    int i = 0;
+    while (tk->Next(tk, &tok)) {
+      if (!expectedStems[i]) {
+        ASSERT(tok.stem == NULL);
+      } else {
+        ASSERT_EQUAL(strlen(expectedStems[i]), tok.stemLen);
+        ASSERT(!strncmp(tok.stem, expectedStems[i], tok.stemLen));
+      }
+      ASSERT(tok.phoneticsPrimary != NULL);
+      ASSERT_EQUAL('<', tok.phoneticsPrimary[0]);
+      i++;
+    }
+    ASSERT_EQUAL(4, i);
+    Tokenizer_Release(tk);
+    free(txt);
+  }
+
+  StemCacheStats after = StemCache_GetStats();
+  ASSERT_EQUAL(3, after.misses - before.misses);
+  ASSERT_EQUAL(5, after.hits - before.hits);
+  st->Free(st);
+  RETURN_TEST_SUCCESS;
+}
+
 TEST_MAIN({
   RMUTil_InitAlloc();
   TESTFUNC(testTokenize);
+  TESTFUNC(testTokenizeLongTokens);
+  TESTFUNC(testTokenizeStemCache);
 })
\ No newline at end of file
@@ -7,7 +7,7 @@
 #include <stdlib.h>
 #include <strings.h>
 #include <assert.h>
-#include "phonetic_manager.h"
+#include "stem_cache.h"
 
 typedef struct {
   RSTokenizer base;
@@ -30,6 +30,23 @@ static void simpleTokenizer_Start(RSTokenizer *base, char *text, size_t len, uin
 // Normalization buffer
 #define MAX_NORMALIZE_SIZE 128
 
+#if defined(__SSE2__)
+/* Returns a bit for each byte of the block that DefaultNormalize can't just lowercase and copy:
+ * controls, blanks, backslashes and anything that is not ASCII. The signed compare catches both
+ * the bytes below '!' and those above 0x7f */
+static inline int normalize_slowMask(__m128i v) {
+  __m128i m = _mm_cmplt_epi8(v, _mm_set1_epi8('!'));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  return _mm_movemask_epi8(m);
+}
+
+static inline __m128i normalize_lower(__m128i v) {
+  __m128i upper = TOKSEP_RANGE(v, 'A', 'Z');
+  return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+
 /**
  * Normalizes text.
  * - s contains the raw token
@@ -49,7 +66,25 @@ static char *DefaultNormalize(char *s, char *dst, size_t *len) {
   }
   // set to 1 if the previous character was a backslash escape
   int escaped = 0;
-  for (size_t ii = 0; ii < origLen; ++ii) {
+  for (size_t ii = 0; ii < origLen;) {
+#if defined(__SSE2__)
+    // Plain ASCII runs are lowercased a block at a time. dst never gets ahead of s, so the store
+    // can't clobber bytes we have yet to read
+    if (!escaped && origLen - ii >= 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + ii));
+      int slow = normalize_slowMask(v);
+      SWITCH_DEST();
+      if (!slow) {
+        _mm_storeu_si128((__m128i *)(dst + dstLen), normalize_lower(v));
+        ii += 16;
+        dstLen += 16;
+        continue;
+      }
+      for (size_t end = ii + __builtin_ctz(slow); ii < end; ++ii) {
+        dst[dstLen++] = (s[ii] >= 'A' && s[ii] <= 'Z') ? s[ii] + ('a' - 'A') : s[ii];
+      }
+    }
+#endif
     if (isupper(s[ii])) {
       SWITCH_DEST();
       realDest[dstLen++] = tolower(s[ii]);
@@ -58,11 +93,13 @@ static char *DefaultNormalize(char *s, char *dst, size_t *len) {
     } else if (s[ii] == '\\' && !escaped) {
       SWITCH_DEST();
       escaped = 1;
+      ++ii;
       continue;
     } else {
       dst[dstLen++] = s[ii];
     }
     escaped = 0;
+    ++ii;
   }
 
   *len = dstLen;
@@ -112,20 +149,19 @@ uint32_t simpleTokenizer_Next(RSTokenizer *base, Token *t) {
                  .phoneticsPrimary = NULL,
                  .flags = Token_CopyStem};
 
-    // if we support stemming - try to stem the word
-    if (!(ctx->options & TOKENIZE_NOSTEM) && self->stemmer && normLen >= MIN_STEM_CANDIDATE_LEN) {
-      size_t sl;
-      const char *stem = self->stemmer->Stem(self->stemmer->ctx, tok, normLen, &sl);
-      if (stem) {
-        t->stem = stem;
-        t->stemLen = sl;
+    // if we support stemming - try to stem the word. Expansions of frequent words are cached
+    if (normLen >= MIN_STEM_CANDIDATE_LEN) {
+      Stemmer *stemmer = (ctx->options & TOKENIZE_NOSTEM) ? NULL : self->stemmer;
+      int phonetics = !!(ctx->options & TOKENIZE_PHONETICS);
+      if (stemmer || phonetics) {
+        StemCacheEntry exp;
+        StemCache_Expand(stemmer, phonetics, tok, normLen, &exp);
+        t->stem = exp.stem;
+        t->stemLen = exp.stemLen;
+        t->phoneticsPrimary = exp.phonetic;
       }
     }
 
-    if ((ctx->options & TOKENIZE_PHONETICS) && normLen >= MIN_STEM_CANDIDATE_LEN) {
-      PhoneticManager_ExpandPhonerics(NULL, tok, normLen, &t->phoneticsPrimary, NULL);
-    }
-
     return ctx->lastOffset;
   }
 
@@ -26,7 +26,8 @@ typedef struct {
   // Stem. May be NULL
   const char *stem;
 
-  char *phoneticsPrimary;
+  // Primary phonetic code. May be NULL. Like the stem, it only lives until the next token
+  const char *phoneticsPrimary;
 
   // stem length
   uint32_t stemLen;
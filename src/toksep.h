@@ -11,6 +11,47 @@ static const char ToksepMap_g[256] = {
     ['+'] = 1, ['|'] = 1,  ['\''] = 1, ['`'] = 1, ['"'] = 1, ['<'] = 1, ['>'] = 1, ['?'] = 1,
 };
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Mask of the bytes in v that fall within [lo, hi] */
+#define TOKSEP_RANGE(v, lo, hi)                                \
+  _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), \
+                              _mm_set1_epi8((hi) - (lo))),        \
+                 _mm_sub_epi8(v, _mm_set1_epi8(lo)))
+
+/* Returns a bit for each byte of the block that may end a token - the separators of ToksepMap_g, a
+ * backslash escape or the terminating NUL. The separators are all ASCII punctuation, so they can
+ * be matched as a handful of byte ranges */
+static inline int toksep_blockMask(__m128i v) {
+  __m128i m = _mm_or_si128(TOKSEP_RANGE(v, ' ', '/'), TOKSEP_RANGE(v, ':', '@'));
+  m = _mm_or_si128(m, TOKSEP_RANGE(v, '[', '^'));  // [ \ ] ^
+  m = _mm_or_si128(m, TOKSEP_RANGE(v, '{', '~'));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+  return _mm_movemask_epi8(m);
+}
+#endif
+
+/* Skip to the first byte that may end a token: a separator, a backslash or the terminating NUL */
+static inline uint8_t *toksep_skipPlain(uint8_t *pos) {
+#if defined(__SSE2__)
+  // Get to an aligned address byte by byte. Aligned loads never cross into the next page, so we can
+  // read whole blocks without knowing where the string ends
+  for (; ((uintptr_t)pos & 15); ++pos) {
+    if (!*pos || *pos == '\\' || ToksepMap_g[*pos]) return pos;
+  }
+  for (;; pos += 16) {
+    int mask = toksep_blockMask(_mm_load_si128((const __m128i *)pos));
+    if (mask) return pos + __builtin_ctz(mask);
+  }
+#else
+  while (*pos && *pos != '\\' && !ToksepMap_g[*pos]) ++pos;
+  return pos;
+#endif
+}
+
 /**
  * Function reads string pointed to by `s` and indicates the length of the next
  * token in `tokLen`. `s` is set to NULL if this is the last token.
@@ -18,7 +59,7 @@ static const char ToksepMap_g[256] = {
 static inline char *toksep(char **s, size_t *tokLen) {
   uint8_t *pos = (uint8_t *)*s;
   char *orig = *s;
-  for (; *pos; ++pos) {
+  while (*(pos = toksep_skipPlain(pos))) {
     if (ToksepMap_g[*pos] && ((char *)pos == orig || *(pos - 1) != '\\')) {
       *s = (char *)++pos;
       *tokLen = ((char *)pos - orig) - 1;
@@ -27,6 +68,7 @@ static inline char *toksep(char **s, size_t *tokLen) {
       }
       return orig;
     }
+    ++pos;
   }
 
   // Didn't find a terminating token. Use a simpler length calculation
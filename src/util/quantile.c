@@ -316,4 +316,51 @@ void QS_Dump(const QuantStream *stream, FILE *fp) {
 
 size_t QS_GetCount(const QuantStream *stream) {
   return stream->n;
+}
+
+double *QS_GetSamples(QuantStream *stream, size_t *numSamples) {
+  if (stream->bufferLength) {
+    QS_Flush(stream);
+  }
+  double *ret = malloc((stream->samplesLength * 2 + 1) * sizeof(*ret));
+  size_t ii = 0;
+  for (const Sample *cur = stream->firstSample; cur; cur = cur->next, ++ii) {
+    ret[ii * 2] = cur->v;
+    ret[ii * 2 + 1] = cur->g;
+  }
+  *numSamples = ii;
+  return ret;
+}
+
+void QS_Merge(QuantStream *stream, const double *samples, size_t numSamples) {
+  if (stream->bufferLength) {
+    QS_Flush(stream);
+  }
+
+  // Like QS_Flush, only each incoming sample stands for g ranks rather than one
+  Sample *pos = stream->firstSample;
+  double r = 0;
+  for (size_t ii = 0; ii < numSamples; ++ii) {
+    double v = samples[ii * 2], g = samples[ii * 2 + 1];
+    if (g < 1) {
+      continue;
+    }
+    Sample *newSample = QS_NewSample(stream);
+    newSample->v = v;
+    newSample->g = g;
+
+    while (pos && pos->v <= v) {
+      r += pos->g;
+      pos = pos->next;
+    }
+    if (pos) {
+      newSample->d = floor(QS_GetMaxVal(stream, r)) - 1;
+      QS_InsertSampleAt(stream, pos, newSample);
+    } else {
+      newSample->d = 0;
+      QS_AppendSample(stream, newSample);
+    }
+    stream->n += g;
+  }
+  QS_Compress(stream);
 }
\ No newline at end of file
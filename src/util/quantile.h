@@ -13,4 +13,11 @@ void QS_Free(QuantStream *qs);
 void QS_Dump(const QuantStream *stream, FILE *fp);
 size_t QS_GetCount(const QuantStream *stream);
 
+/* Get the stream's samples as pairs of value and number of ranks, sorted by value. Returns an
+ * array of 2 * numSamples doubles, to be freed with free() */
+double *QS_GetSamples(QuantStream *stream, size_t *numSamples);
+
+/* Merge samples returned by QS_GetSamples of another stream into the stream */
+void QS_Merge(QuantStream *stream, const double *samples, size_t numSamples);
+
 #endif
\ No newline at end of file
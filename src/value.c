@@ -369,6 +369,25 @@ RSValue *RS_VStringArray(uint32_t sz, ...) {
   return RS_ArrVal(arr, sz);
 }
 
+RSValue *RS_VNumArray(uint32_t sz, ...) {
+  RSValue **arr = calloc(sz, sizeof(*arr));
+  va_list ap;
+  va_start(ap, sz);
+  for (uint32_t i = 0; i < sz; i++) {
+    arr[i] = RS_NumVal(va_arg(ap, double));
+  }
+  va_end(ap);
+  return RS_ArrVal(arr, sz);
+}
+
+RSValue *RS_NumArray(const double *nums, uint32_t sz) {
+  RSValue **arr = calloc(sz, sizeof(*arr));
+  for (uint32_t i = 0; i < sz; i++) {
+    arr[i] = RS_NumVal(nums[i]);
+  }
+  return RS_ArrVal(arr, sz);
+}
+
 /* Wrap an array of NULL terminated C strings into an RSValue array */
 RSValue *RS_StringArray(char **strs, uint32_t sz) {
   RSValue **arr = calloc(sz, sizeof(RSValue *));
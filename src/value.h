@@ -218,6 +218,12 @@ RSValue *RS_ArrVal(RSValue **vals, uint32_t len);
 
 RSValue *RS_VStringArray(uint32_t sz, ...);
 
+/* Wrap numbers into an RSValue array. The variadic arguments must be doubles */
+RSValue *RS_VNumArray(uint32_t sz, ...);
+
+/* Wrap an array of numbers into an RSValue array */
+RSValue *RS_NumArray(const double *nums, uint32_t sz);
+
 /* Wrap an array of NULL terminated C strings into an RSValue array */
 RSValue *RS_StringArray(char **strs, uint32_t sz);
 
@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // static int msb = (int)(~0ULL << 25);
 
@@ -76,6 +79,39 @@ size_t WriteVarintFieldMask(t_fieldMask value, BufferWriter *w) {
   return Buffer_Write(w, VARINT_BUF(varint, pos), nw);
 }
 
+size_t ReadVarintDeltas(const uint8_t *p, const uint8_t *end, t_docId base, t_docId *out) {
+  size_t n = 0;
+  while (p < end) {
+#ifdef __SSE2__
+    // Dense indexes are mostly made of single byte deltas. If none of the next 16 bytes has the
+    // continuation bit set, each byte is a complete delta and we can skip the per-byte checks
+    while (end - p >= 16) {
+      unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p));
+      // number of leading bytes that are complete single byte deltas
+      unsigned run = mask ? __builtin_ctz(mask) : 16;
+      for (unsigned i = 0; i < run; i++) {
+        base += p[i];
+        out[n++] = base;
+      }
+      p += run;
+      if (run < 16) break;
+    }
+    if (p >= end) break;
+#endif
+    // slow path - same as ReadVarint
+    unsigned char c = *p++;
+    uint32_t val = c & 127;
+    while (c >> 7) {
+      ++val;
+      c = *p++;
+      val = (val << 7) | (c & 127);
+    }
+    base += val;
+    out[n++] = base;
+  }
+  return n;
+}
+
 void VVW_Free(VarintVectorWriter *w) {
   Buffer_Free(&w->buf);
   free(w);
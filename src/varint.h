@@ -38,6 +38,12 @@ static inline t_fieldMask ReadVarintFieldMask(BufferReader *b) {
 
 size_t WriteVarint(uint32_t value, BufferWriter *w);
 
+/* Decode a run of consecutive varint-encoded deltas in [p, end) into absolute values, starting
+ * from base. Each decoded value is the previous one plus the delta. The output array must be able to
+ * hold at least (end - p) values. Returns the number of values decoded.
+ * Runs of single byte deltas are decoded 16 at a time where SSE2 is available */
+size_t ReadVarintDeltas(const uint8_t *p, const uint8_t *end, t_docId base, t_docId *out);
+
 size_t WriteVarintFieldMask(t_fieldMask value, BufferWriter *w);
 
 typedef struct {
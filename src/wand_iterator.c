@@ -0,0 +1,334 @@
+#include <float.h>
+#include <sys/param.h>
+#include "wand_iterator.h"
+#include "index.h"
+#include "inverted_index.h"
+#include "rmalloc.h"
+
+// Bounds are compared with some slack, so rounding can't make us prune a result whose score is
+// computed in a different order of operations and lands just above its bound
+#define WAND_BOUND_SLACK (1 + 1e-9)
+
+typedef struct {
+  IndexIterator *it;
+  // the reader of a plain term child, used for block level bounds. NULL for composite children
+  IndexReader *ir;
+  // the bound on the child's contribution over the whole index
+  double maxScore;
+  t_docId docId;
+  int atEOF;
+} WandChild;
+
+typedef struct {
+  WandChild *children;
+  // the children ordered by their current docId, exhausted ones last
+  WandChild **order;
+  int num;
+  ScoreBound sb;
+  const double *threshold;
+  RSIndexResult *current;
+  t_docId lastDocId;
+  size_t len;
+  int atEnd;
+  int started;
+  double weight;
+} WandContext;
+
+static double wand_TermBound(const ScoreBound *sb, IndexReader *ir, uint32_t maxFreq) {
+  RSIndexResult *rec = ir->record;
+  double idf = rec->term.term ? rec->term.term->idf : 0;
+  // decoders of indexes without frequencies report a frequency of 1
+  return sb->termBound(rec->weight, idf, MAX(maxFreq, 1), &sb->stats);
+}
+
+/* The bound of an iterator's contribution over the whole index. Returns a negative number if the
+ * iterator is of a kind we can't bound */
+static double wand_IteratorBound(const ScoreBound *sb, IndexIterator *it) {
+  if (!it) return 0;
+
+  if (it->Read == IR_Read) {
+    IndexReader *ir = it->ctx;
+    if (ir->record->type != RSResultType_Term) return -1;
+    uint32_t maxFreq = 0;
+    uint32_t size = Epoch_Load(ir->idx->size);
+    const IndexBlock *blocks = Epoch_Load(ir->idx->blocks);
+    for (uint32_t i = 0; i < size; i++) {
+      maxFreq = MAX(maxFreq, __atomic_load_n(&blocks[i].maxFreq, __ATOMIC_RELAXED));
+    }
+    return wand_TermBound(sb, ir, maxFreq);
+  }
+
+  // aggregates score the weighted sum of their children. Intersections may also divide it by the
+  // slop, which only lowers it
+  IndexIterator **its;
+  int num;
+  double weight;
+  if (it->Free == UnionIterator_Free) {
+    UnionContext *ui = it->ctx;
+    its = ui->its, num = ui->num, weight = ui->weight;
+  } else if (it->Free == IntersectIterator_Free) {
+    IntersectContext *ic = it->ctx;
+    its = ic->its, num = ic->num, weight = ic->weight;
+  } else {
+    return -1;
+  }
+
+  double sum = 0;
+  for (int i = 0; i < num; i++) {
+    double b = wand_IteratorBound(sb, its[i]);
+    if (b < 0) return -1;
+    sum += b;
+  }
+  return weight * sum;
+}
+
+/* The bound of a child's contribution to docId, and the last docId for which it holds */
+static double wand_BlockBound(WandContext *wc, WandChild *c, t_docId docId, t_docId *lastId) {
+  if (!c->ir) {
+    *lastId = UINT64_MAX;
+    return c->maxScore;
+  }
+  uint32_t maxFreq = IR_BlockMaxFreq(c->ir, docId, lastId);
+  if (*lastId < docId) {
+    // the index ends before docId, so the child has nothing to contribute from here on
+    *lastId = UINT64_MAX;
+    return 0;
+  }
+  return wand_TermBound(&wc->sb, c->ir, maxFreq);
+}
+
+static void wand_Sort(WandContext *wc) {
+  for (int i = 1; i < wc->num; i++) {
+    WandChild *c = wc->order[i];
+    int j = i;
+    for (; j > 0; j--) {
+      WandChild *p = wc->order[j - 1];
+      if (!p->atEOF && (c->atEOF || p->docId <= c->docId)) break;
+      wc->order[j] = p;
+    }
+    wc->order[j] = c;
+  }
+}
+
+/* Move a child to docId, or to its next record if docId is 0. Children never move backwards */
+static void wand_Advance(WandChild *c, t_docId docId) {
+  if (docId && c->docId >= docId) return;
+  RSIndexResult *r = NULL;
+  int rc = docId ? c->it->SkipTo(c->it->ctx, docId, &r) : c->it->Read(c->it->ctx, &r);
+  if (rc == INDEXREAD_EOF) {
+    c->atEOF = 1;
+  } else {
+    c->docId = r->docId;
+  }
+}
+
+/* Read the first record of every child */
+static void wand_Start(WandContext *wc) {
+  for (int i = 0; i < wc->num; i++) {
+    wand_Advance(&wc->children[i], 0);
+  }
+  wc->started = 1;
+}
+
+static int WD_Read(void *ctx, RSIndexResult **hit) {
+  WandContext *wc = ctx;
+  if (wc->atEnd) return INDEXREAD_EOF;
+
+  if (!wc->started) {
+    wand_Start(wc);
+  } else {
+    // move the children off the last result
+    for (int i = 0; i < wc->num; i++) {
+      WandChild *c = &wc->children[i];
+      if (!c->atEOF && c->docId == wc->lastDocId) {
+        wand_Advance(c, 0);
+      }
+    }
+  }
+
+  while (1) {
+    wand_Sort(wc);
+    double threshold = *wc->threshold;
+
+    // the pivot is the first child at which the bounds of the children up to it may beat the
+    // threshold. No document before the pivot's can make it into the top results
+    double acc = 0;
+    int p = -1;
+    for (int i = 0; i < wc->num && !wc->order[i]->atEOF; i++) {
+      acc += wc->order[i]->maxScore;
+      if (acc * wc->weight * WAND_BOUND_SLACK >= threshold) {
+        p = i;
+        break;
+      }
+    }
+    if (p < 0) goto eof;
+    t_docId pivotId = wc->order[p]->docId;
+    while (p + 1 < wc->num && !wc->order[p + 1]->atEOF && wc->order[p + 1]->docId == pivotId) {
+      p++;
+    }
+
+    // check the tighter bounds of the blocks holding the pivot. If they can't make it, neither can
+    // any document up to the end of the shortest of these blocks or the next child's document
+    if (threshold > 0) {
+      double bacc = 0;
+      t_docId next = UINT64_MAX;
+      for (int i = 0; i <= p; i++) {
+        t_docId lastId;
+        bacc += wand_BlockBound(wc, wc->order[i], pivotId, &lastId);
+        next = MIN(next, lastId);
+      }
+      if (bacc * wc->weight * WAND_BOUND_SLACK < threshold) {
+        if (p + 1 < wc->num && !wc->order[p + 1]->atEOF) {
+          next = MIN(next, wc->order[p + 1]->docId - 1);
+        }
+        if (next == UINT64_MAX) goto eof;
+        for (int i = 0; i <= p; i++) {
+          wand_Advance(wc->order[i], next + 1);
+        }
+        continue;
+      }
+    }
+
+    if (wc->order[0]->docId == pivotId) {
+      // all the children up to the pivot are on it - this is a candidate
+      AggregateResult_Reset(wc->current);
+      for (int i = 0; i <= p; i++) {
+        IndexIterator *it = wc->order[i]->it;
+        AggregateResult_AddChild(wc->current, it->Current(it->ctx));
+      }
+      wc->current->docId = wc->lastDocId = pivotId;
+      wc->len++;
+      if (hit) *hit = wc->current;
+      return INDEXREAD_OK;
+    }
+
+    // bring the children before the pivot up to it
+    for (int i = 0; i < p && wc->order[i]->docId < pivotId; i++) {
+      wand_Advance(wc->order[i], pivotId);
+    }
+  }
+
+eof:
+  wc->atEnd = 1;
+  return INDEXREAD_EOF;
+}
+
+static int WD_SkipTo(void *ctx, t_docId docId, RSIndexResult **hit) {
+  WandContext *wc = ctx;
+  if (wc->atEnd) return INDEXREAD_EOF;
+
+  if (!wc->started) wand_Start(wc);
+  if (docId > wc->lastDocId) {
+    // move every child to docId, and have the read start from there
+    for (int i = 0; i < wc->num; i++) {
+      if (!wc->children[i].atEOF) wand_Advance(&wc->children[i], docId);
+    }
+    wc->lastDocId = docId - 1;
+  }
+
+  int rc = WD_Read(ctx, hit);
+  if (rc == INDEXREAD_EOF) return rc;
+  return wc->lastDocId == docId ? INDEXREAD_OK : INDEXREAD_NOTFOUND;
+}
+
+static RSIndexResult *WD_Current(void *ctx) {
+  return ((WandContext *)ctx)->current;
+}
+
+static t_docId WD_LastDocId(void *ctx) {
+  return ((WandContext *)ctx)->lastDocId;
+}
+
+static int WD_HasNext(void *ctx) {
+  return !((WandContext *)ctx)->atEnd;
+}
+
+static size_t WD_Len(void *ctx) {
+  return ((WandContext *)ctx)->len;
+}
+
+static size_t WD_NumEstimated(void *ctx) {
+  WandContext *wc = ctx;
+  size_t ret = 0;
+  for (int i = 0; i < wc->num; i++) {
+    ret += wc->children[i].it->NumEstimated(wc->children[i].it->ctx);
+  }
+  return ret;
+}
+
+static void WD_Abort(void *ctx) {
+  WandContext *wc = ctx;
+  wc->atEnd = 1;
+  for (int i = 0; i < wc->num; i++) {
+    wc->children[i].it->Abort(wc->children[i].it->ctx);
+  }
+}
+
+static void WD_Rewind(void *ctx) {
+  WandContext *wc = ctx;
+  wc->atEnd = 0;
+  wc->started = 0;
+  wc->lastDocId = 0;
+  wc->current->docId = 0;
+  for (int i = 0; i < wc->num; i++) {
+    wc->children[i].docId = 0;
+    wc->children[i].atEOF = 0;
+    wc->children[i].it->Rewind(wc->children[i].it->ctx);
+  }
+}
+
+static void WD_Free(IndexIterator *self) {
+  WandContext *wc = self->ctx;
+  for (int i = 0; i < wc->num; i++) {
+    wc->children[i].it->Free(wc->children[i].it);
+  }
+  IndexResult_Free(wc->current);
+  rm_free(wc->children);
+  rm_free(wc->order);
+  rm_free(wc);
+  rm_free(self);
+}
+
+IndexIterator *NewWandIterator(IndexIterator **its, int num, const ScoreBound *sb,
+                               const double *threshold, double weight) {
+  double bounds[num];
+  int n = 0;
+  for (int i = 0; i < num; i++) {
+    if (!its[i]) continue;
+    if ((bounds[n++] = wand_IteratorBound(sb, its[i])) < 0) return NULL;
+  }
+  if (n == 0) return NULL;
+
+  WandContext *wc = rm_calloc(1, sizeof(*wc));
+  wc->children = rm_calloc(n, sizeof(*wc->children));
+  wc->order = rm_calloc(n, sizeof(*wc->order));
+  wc->sb = *sb;
+  wc->threshold = threshold;
+  wc->weight = weight;
+  wc->current = NewUnionResult(n, weight);
+
+  for (int i = 0; i < num; i++) {
+    if (!its[i]) continue;
+    WandChild *c = &wc->children[wc->num];
+    c->it = its[i];
+    c->ir = its[i]->Read == IR_Read ? its[i]->ctx : NULL;
+    c->maxScore = bounds[wc->num];
+    wc->order[wc->num++] = c;
+  }
+  // we own the children now, and copied them out of their array
+  free(its);
+
+  IndexIterator *ret = rm_new(IndexIterator);
+  ret->ctx = wc;
+  ret->Free = WD_Free;
+  ret->HasNext = WD_HasNext;
+  ret->LastDocId = WD_LastDocId;
+  ret->Len = WD_Len;
+  ret->NumEstimated = WD_NumEstimated;
+  ret->Read = WD_Read;
+  ret->Current = WD_Current;
+  ret->SkipTo = WD_SkipTo;
+  ret->Abort = WD_Abort;
+  ret->Rewind = WD_Rewind;
+  return ret;
+}
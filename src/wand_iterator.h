@@ -0,0 +1,34 @@
+#ifndef __WAND_ITERATOR_H__
+#define __WAND_ITERATOR_H__
+
+#include "redisearch.h"
+#include "index_iterator.h"
+
+/* Bounds a single term's contribution to the score of a document, given the term record's weight,
+ * the term's idf, and the highest frequency the term may have in the document */
+typedef double (*TermScoreBound)(double weight, double idf, uint32_t maxFreq,
+                                 const RSIndexStats *stats);
+
+/* The scoring function whose scores a top-k union may bound */
+typedef struct {
+  TermScoreBound termBound;
+  RSIndexStats stats;
+} ScoreBound;
+
+/* Create a union iterator for relevance sorted queries, which skips documents that can't score
+ * above *threshold - the lowest score currently in the top-k heap, updated by the sorter as the
+ * query runs.
+ *
+ * This is block-max WAND: every child has an upper bound on its contribution to the score, from its
+ * terms' idf and the max frequency of their index blocks. Documents matched only by children whose
+ * bounds sum below the threshold are never yielded, and whole blocks of them are skipped without
+ * decoding.
+ *
+ * Every child must be a term reader, or a union/intersection of such. If that's not the case NULL
+ * is returned and the children and their array are left untouched, otherwise the iterator takes
+ * ownership of the children, and frees the array. Since pruned documents are never seen
+ * downstream, the total number of results becomes a lower bound */
+IndexIterator *NewWandIterator(IndexIterator **its, int num, const ScoreBound *sb,
+                               const double *threshold, double weight);
+
+#endif